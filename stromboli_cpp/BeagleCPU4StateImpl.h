@@ -83,6 +83,7 @@ public:
                                     const REALTYPE* matrices1,
                                     const REALTYPE* partials2,
                                     const REALTYPE* matrices2,
+                                    const int* patternMask,
                                     int startPattern,
                                     int endPattern);
 
@@ -91,6 +92,7 @@ public:
                                       const REALTYPE* matrices1,
                                       const REALTYPE* partials2,
                                       const REALTYPE* matrices2,
+                                      const int* patternMask,
                                       int startPattern,
                                       int endPattern);
 
@@ -42,6 +42,35 @@
 
 #define OFFSET    (4 + T_PAD)    // For easy conversion between 4/5
 
+// Tips take one of 5 codes (0-3, or 4 for missing/ambiguous, which picks up the 1.0 padding
+// column of the transition matrix), so the tip contribution to a parent partial can be
+// tabulated once per category and looked up per pattern. The tables only pay off when there
+// are more patterns than table entries.
+#define TIP_CODE_COUNT            5
+#define TIP_TABLE_MIN_PATTERNS    32
+
+// table[s*4 + i] = matrices[w + OFFSET*i + s]: the column of the transition matrix for tip
+// code s, stored contiguously
+#define FILL_TIP_TABLE(table,matrices,w) \
+    for (int s = 0; s < TIP_CODE_COUNT; s++) { \
+        table[s*4    ] = matrices[w            + s]; \
+        table[s*4 + 1] = matrices[w + OFFSET*1 + s]; \
+        table[s*4 + 2] = matrices[w + OFFSET*2 + s]; \
+        table[s*4 + 3] = matrices[w + OFFSET*3 + s]; \
+    }
+
+// pairTable[(s1*5 + s2)*4 + i] = product of the tip columns for codes s1 and s2
+#define FILL_TIP_PAIR_TABLE(pairTable,table1,table2) \
+    for (int s1 = 0; s1 < TIP_CODE_COUNT; s1++) { \
+        for (int s2 = 0; s2 < TIP_CODE_COUNT; s2++) { \
+            REALTYPE* t = pairTable + (s1*TIP_CODE_COUNT + s2)*4; \
+            t[0] = table1[s1*4    ] * table2[s2*4    ]; \
+            t[1] = table1[s1*4 + 1] * table2[s2*4 + 1]; \
+            t[2] = table1[s1*4 + 2] * table2[s2*4 + 2]; \
+            t[3] = table1[s1*4 + 3] * table2[s2*4 + 3]; \
+        } \
+    }
+
 #define PREFETCH_MATRIX(num,matrices,w) \
     REALTYPE m##num##00, m##num##01, m##num##02, m##num##03, \
            m##num##10, m##num##11, m##num##12, m##num##13, \
@@ -191,6 +220,32 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
                                                                int startPattern,
                                                                int endPattern) {
 
+    if (endPattern - startPattern >= TIP_TABLE_MIN_PATTERNS) {
+        // The parent partial depends only on the pair of tip codes, so the 25 possible
+        // products are formed once per category and copied out per pattern
+#pragma omp parallel for num_threads(kCategoryCount)
+        for (int l = 0; l < kCategoryCount; l++) {
+            int v = l*4*kPaddedPatternCount + 4*startPattern;
+            int w = l*4*OFFSET;
+
+            REALTYPE table1[TIP_CODE_COUNT*4], table2[TIP_CODE_COUNT*4];
+            REALTYPE pairTable[TIP_CODE_COUNT*TIP_CODE_COUNT*4];
+            FILL_TIP_TABLE(table1, matrices1, w);
+            FILL_TIP_TABLE(table2, matrices2, w);
+            FILL_TIP_PAIR_TABLE(pairTable, table1, table2);
+
+            for (int k = startPattern; k < endPattern; k++) {
+                const REALTYPE* t = pairTable + (states1[k]*TIP_CODE_COUNT + states2[k])*4;
+                destP[v    ] = t[0];
+                destP[v + 1] = t[1];
+                destP[v + 2] = t[2];
+                destP[v + 3] = t[3];
+                v += 4;
+            }
+        }
+        return;
+    }
+
 #pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
         int v = l*4*kPaddedPatternCount;
@@ -228,6 +283,31 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALT
                                                                            int startPattern,
                                                                            int endPattern) {
 
+    if (endPattern - startPattern >= TIP_TABLE_MIN_PATTERNS) {
+#pragma omp parallel for num_threads(kCategoryCount)
+        for (int l = 0; l < kCategoryCount; l++) {
+            int v = l*4*kPaddedPatternCount + 4*startPattern;
+            int w = l*4*OFFSET;
+
+            REALTYPE table1[TIP_CODE_COUNT*4], table2[TIP_CODE_COUNT*4];
+            REALTYPE pairTable[TIP_CODE_COUNT*TIP_CODE_COUNT*4];
+            FILL_TIP_TABLE(table1, matrices1, w);
+            FILL_TIP_TABLE(table2, matrices2, w);
+            FILL_TIP_PAIR_TABLE(pairTable, table1, table2);
+
+            for (int k = startPattern; k < endPattern; k++) {
+                const REALTYPE* t = pairTable + (states1[k]*TIP_CODE_COUNT + states2[k])*4;
+                const REALTYPE scaleFactor = scaleFactors[k];
+                destP[v    ] = t[0] / scaleFactor;
+                destP[v + 1] = t[1] / scaleFactor;
+                destP[v + 2] = t[2] / scaleFactor;
+                destP[v + 3] = t[3] / scaleFactor;
+                v += 4;
+            }
+        }
+        return;
+    }
+
 #pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
         int v = l*4*kPaddedPatternCount;
@@ -265,6 +345,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP
                                                                  const REALTYPE* matrices1,
                                                                  const REALTYPE* partials2,
                                                                  const REALTYPE* matrices2,
+                                                                 const int* patternMask,
                                                                  int startPattern,
                                                                  int endPattern) {
 
@@ -279,18 +360,32 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP
 
         PREFETCH_MATRIX(2,matrices2,w);
 
+        // Tip side looked up from a contiguous copy of the matrix column for each tip code
+        REALTYPE table1[TIP_CODE_COUNT*4];
+        FILL_TIP_TABLE(table1, matrices1, w);
+
         for (int k = startPattern; k < endPattern; k++) {
 
-            const int state1 = states1[k];
+            if (patternMask != NULL && patternMask[k]) {
+                // The tip and every tip below partials2 are missing, so the partial is 1
+                destP[u    ] = 1.0;
+                destP[u + 1] = 1.0;
+                destP[u + 2] = 1.0;
+                destP[u + 3] = 1.0;
+                u += 4;
+                continue;
+            }
+
+            const REALTYPE* t = table1 + 4*states1[k];
 
             PREFETCH_PARTIALS(2,partials2,u);
 
             DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23;
 
-            destP[u    ] = matrices1[w            + state1] * sum20;
-            destP[u + 1] = matrices1[w + OFFSET*1 + state1] * sum21;
-            destP[u + 2] = matrices1[w + OFFSET*2 + state1] * sum22;
-            destP[u + 3] = matrices1[w + OFFSET*3 + state1] * sum23;
+            destP[u    ] = t[0] * sum20;
+            destP[u + 1] = t[1] * sum21;
+            destP[u + 2] = t[2] * sum22;
+            destP[u + 3] = t[3] * sum23;
 
             u += 4;
         }
@@ -318,19 +413,22 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REA
 
         PREFETCH_MATRIX(2,matrices2,w);
 
+        REALTYPE table1[TIP_CODE_COUNT*4];
+        FILL_TIP_TABLE(table1, matrices1, w);
+
         for (int k = startPattern; k < endPattern; k++) {
 
-            const int state1 = states1[k];
+            const REALTYPE* t = table1 + 4*states1[k];
             const REALTYPE scaleFactor = scaleFactors[k];
 
             PREFETCH_PARTIALS(2,partials2,u);
 
             DO_INTEGRATION(2); // defines sum20, sum21, sum22, sum23
 
-            destP[u    ] = matrices1[w            + state1] * sum20 / scaleFactor;
-            destP[u + 1] = matrices1[w + OFFSET*1 + state1] * sum21 / scaleFactor;
-            destP[u + 2] = matrices1[w + OFFSET*2 + state1] * sum22 / scaleFactor;
-            destP[u + 3] = matrices1[w + OFFSET*3 + state1] * sum23 / scaleFactor;
+            destP[u    ] = t[0] * sum20 / scaleFactor;
+            destP[u + 1] = t[1] * sum21 / scaleFactor;
+            destP[u + 2] = t[2] * sum22 / scaleFactor;
+            destP[u + 3] = t[3] * sum23 / scaleFactor;
 
             u += 4;
         }
@@ -343,6 +441,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* des
                                                                    const REALTYPE* matrices1,
                                                                    const REALTYPE* partials2,
                                                                    const REALTYPE* matrices2,
+                                                                   const int* patternMask,
                                                                    int startPattern,
                                                                    int endPattern) {
 
@@ -358,6 +457,16 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* des
         PREFETCH_MATRIX(1,matrices1,w);
         PREFETCH_MATRIX(2,matrices2,w);
         for (int k = startPattern; k < endPattern; k++) {
+            if (patternMask != NULL && patternMask[k]) {
+                // Every tip below both children is missing, so the partial is 1
+                destP[u    ] = 1.0;
+                destP[u + 1] = 1.0;
+                destP[u + 2] = 1.0;
+                destP[u + 3] = 1.0;
+                u += 4;
+                continue;
+            }
+
             PREFETCH_PARTIALS(1,partials1,u);
             PREFETCH_PARTIALS(2,partials2,u);
 
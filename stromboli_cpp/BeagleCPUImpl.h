@@ -106,6 +106,10 @@ protected:
     int** gTipStates;
     REALTYPE** gScaleBuffers;
 
+    // Per partials buffer, NULL or nonzero for the patterns whose partials are all ones
+    // (see setPartialsMask); passed by upPartials to calcStatesPartials and calcPartialsPartials
+    int** gPartialsMasks;
+
     signed short** gAutoScaleBuffers;
 
     int* gActiveScalingFactors;
@@ -208,6 +212,13 @@ public:
 					int scaleBuffer,
                     double* outPartials);
 
+    // marks the patterns for which the partials written to a buffer are all ones
+    //
+    // bufferIndex the index of the partials buffer
+    // inPatternMask nonzero for each such pattern, or NULL to clear the mask
+    int setPartialsMask(int bufferIndex,
+                        const int* inPatternMask);
+
     // sets the Eigen decomposition for a given matrix
     //
     // matrixIndex the matrix index to update
@@ -361,6 +372,9 @@ public:
 	int getScaleFactors(int srcScalingIndex,
                         double* scaleFactors);
 
+    int setScaleFactors(int destScalingIndex,
+                        const double* scaleFactors);
+
     // calculate the site log likelihoods at a particular node
     //
     // rootNodeIndex the index of the root
@@ -552,6 +566,7 @@ protected:
                                     const REALTYPE* matrices1,
                                     const REALTYPE* partials2,
                                     const REALTYPE* matrices2,
+                                    const int* patternMask,
                                     int startPattern,
                                     int endPatternd);
 
@@ -560,6 +575,7 @@ protected:
                                       const REALTYPE* matrices1,
                                       const REALTYPE* partials2,
                                       const REALTYPE* matrices2,
+                                      const int* patternMask,
                                       int startPattern,
                                       int endPattern);
 
@@ -138,9 +138,12 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
             free(gPartials[i]);
         if (gTipStates[i] != NULL)
             free(gTipStates[i]);
+        if (gPartialsMasks[i] != NULL)
+            free(gPartialsMasks[i]);
     }
     free(gPartials);
     free(gTipStates);
+    free(gPartialsMasks);
 
     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
         for(unsigned int i=0; i<kScaleBufferCount; i++) {
@@ -361,9 +364,14 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     if (gTipStates == NULL)
         throw std::bad_alloc();
 
+    gPartialsMasks = (int**) malloc(sizeof(int*) * kBufferCount);
+    if (gPartialsMasks == NULL)
+        throw std::bad_alloc();
+
     for (int i = 0; i < kBufferCount; i++) {
         gPartials[i] = NULL;
         gTipStates[i] = NULL;
+        gPartialsMasks[i] = NULL;
     }
 
     for (int i = kTipCount; i < kBufferCount; i++) {
@@ -708,6 +716,33 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartials(int bufferIndex,
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartialsMask(int bufferIndex,
+                                                       const int* inPatternMask) {
+    if (bufferIndex < 0 || bufferIndex >= kBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    if (inPatternMask == NULL) {
+        if (gPartialsMasks[bufferIndex] != NULL)
+            free(gPartialsMasks[bufferIndex]);
+        gPartialsMasks[bufferIndex] = NULL;
+        return BEAGLE_SUCCESS;
+    }
+
+    if (gPartialsMasks[bufferIndex] == NULL) {
+        gPartialsMasks[bufferIndex] = (int*) malloc(sizeof(int) * kPaddedPatternCount);
+        if (gPartialsMasks[bufferIndex] == 0L)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    int* mask = gPartialsMasks[bufferIndex];
+    for (int k = 0; k < kPatternCount; k++)
+        mask[k] = (inPatternMask[k] != 0);
+    for (int k = kPatternCount; k < kPaddedPatternCount; k++)
+        mask[k] = 0;
+
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getPartials(int bufferIndex,
                                int cumulativeScaleIndex,
@@ -1544,6 +1579,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
         const REALTYPE* matrices2 = gTransitionMatrices[child2TransMatIndex];
 
         REALTYPE* destPartials = gPartials[parIndex];
+        const int* patternMask = gPartialsMasks[parIndex];
 
         int startPattern = 0;
         int endPattern = kPatternCount;
@@ -1604,7 +1640,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
                                                    matrices2, scalingFactors, startPattern, endPattern);
                 } else {
                     calcStatesPartials(destPartials, tipStates1, matrices1, partials2, matrices2,
-                                       startPattern, endPattern);
+                                       patternMask, startPattern, endPattern);
                     if (rescale == 1) { // Recompute scaleFactors
                         if (byPartition) {
                             rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
@@ -1621,7 +1657,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
                                                    scalingFactors, startPattern, endPattern);
                 } else {
                     calcStatesPartials(destPartials, tipStates2, matrices2, partials1, matrices1,
-                                       startPattern, endPattern);
+                                       patternMask, startPattern, endPattern);
                     if (rescale == 1) {// Recompute scaleFactors
                         if (byPartition) {
                             rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
@@ -1643,7 +1679,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
                                                      matrices2,scalingFactors,startPattern,endPattern);
                 } else {
                     calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
-                                         startPattern, endPattern);
+                                         patternMask, startPattern, endPattern);
                     if (rescale == 1) {// Recompute scaleFactors
                         if (byPartition) {
                             rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
@@ -2910,7 +2946,30 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::copyScaleFactors(int destScalingIndex,
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getScaleFactors(int srcScalingIndex,
                                                        double* scaleFactors) {
-    // Do nothing
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    if (srcScalingIndex < 0 || srcScalingIndex >= kScaleBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    const REALTYPE* scaleBuffer = gScaleBuffers[srcScalingIndex];
+    for (int k = 0; k < kPatternCount; k++)
+        scaleFactors[k] = (double) scaleBuffer[k];
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setScaleFactors(int destScalingIndex,
+                                                       const double* scaleFactors) {
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    if (destScalingIndex < 0 || destScalingIndex >= kScaleBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    REALTYPE* scaleBuffer = gScaleBuffers[destScalingIndex];
+    for (int k = 0; k < kPatternCount; k++)
+        scaleBuffer[k] = (REALTYPE) scaleFactors[k];
+
     return BEAGLE_SUCCESS;
 }
 
@@ -4302,6 +4361,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
                                                            const REALTYPE* matrices1,
                                                            const REALTYPE* partials2,
                                                            const REALTYPE* matrices2,
+                                                           const int* patternMask,
                                                            int startPattern,
                                                            int endPattern) {
 
@@ -4320,6 +4380,15 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
         const REALTYPE* partials2Ptr = &partials2[v];
         REALTYPE* destPtr = &destP[v];
         for (int k = startPattern; k < endPattern; k++) {
+            if (patternMask != NULL && patternMask[k]) {
+                // Every tip below is missing, so the partials are ones (see setPartialsMask)
+                for (int i = 0; i < kStateCount; i++)
+                    *(destPtr++) = 1.0;
+                for (int pad = 0; pad < P_PAD; pad++)
+                    *(destPtr++) = 0.0;
+                partials2Ptr += kPartialsPaddedStateCount;
+                continue;
+            }
             int w = l * kMatrixSize;
             int state1 = states1[k];
             for (int i = 0; i < kStateCount; i++) {
@@ -4471,6 +4540,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* destP,
                                                              const REALTYPE* matrices1,
                                                              const REALTYPE* partials2,
                                                              const REALTYPE* matrices2,
+                                                             const int* patternMask,
                                                              int startPattern,
                                                              int endPattern) {
     int matrixIncr = kStateCount;
@@ -4488,6 +4558,15 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsPartials(REALTYPE* destP,
         const REALTYPE* partials2Ptr = &partials2[v];
         REALTYPE* destPtr = &destP[v];
         for (int k = startPattern; k < endPattern; k++) {
+            if (patternMask != NULL && patternMask[k]) {
+                // Every tip below is missing, so the partials are ones (see setPartialsMask)
+                for (int i = 0; i < kStateCount; i++)
+                    *(destPtr++) = 1.0;
+                destPtr += P_PAD;
+                partials1Ptr += kPartialsPaddedStateCount;
+                partials2Ptr += kPartialsPaddedStateCount;
+                continue;
+            }
 
             for (int i = 0; i < kStateCount; i++) {
                 const REALTYPE* matrices1Ptr = matrices1 + matrixOffset + i * matrixIncr;
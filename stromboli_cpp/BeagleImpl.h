@@ -68,6 +68,9 @@ public:
 							int scaleIndex,
                             double* outPartials) = 0;
 
+    virtual int setPartialsMask(int bufferIndex,
+                                const int* inPatternMask) = 0;
+
     virtual int setEigenDecomposition(int eigenIndex,
                                       const double* inEigenVectors,
                                       const double* inInverseEigenVectors,
@@ -186,6 +189,9 @@ public:
     virtual int getScaleFactors(int srcScalingIndex,
                                  double* scaleFactors) = 0;
 
+    virtual int setScaleFactors(int destScalingIndex,
+                                const double* scaleFactors) = 0;
+
     virtual int calculateRootLogLikelihoods(const int* bufferIndices,
                                             const int* categoryWeightsIndices,
                                             const int* stateFrequenciesIndices,
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <cassert>
+#include <memory>
+#include <boost/format.hpp>
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    // Writes records to a file on a background thread. Records pass from the (single) producer
+    // to the writer thread through a fixed-size lock-free ring of strings; the strings keep their
+    // capacity between uses, so a record is normally built without any allocation.
+    class AsyncWriter
+        {
+        public:
+                                        AsyncWriter();
+                                        ~AsyncWriter();
+
+            void                        open(const std::string filename, bool binary = false);
+            void                        close();
+            bool                        isOpen() const;
+
+            std::string &               beginRecord();
+            void                        commitRecord();
+            void                        write(const std::string & s);
+
+        private:
+
+                                        AsyncWriter(const AsyncWriter &) = delete;
+            AsyncWriter &               operator=(const AsyncWriter &) = delete;
+
+            void                        writerLoop();
+
+            static const unsigned       _capacity = 1024;               // number of slots in ring (power of 2)
+            static const std::size_t    _file_buffer_size = 1 << 20;    // bytes buffered by the ofstream
+
+            std::string                 _filename;
+            std::ofstream               _file;
+            std::vector<char>           _file_buffer;
+            std::vector<std::string>    _slots;
+            std::atomic<unsigned>       _head;      // next slot to be filled (written only by producer)
+            std::atomic<unsigned>       _tail;      // next slot to be written (written only by writer thread)
+            std::atomic<bool>           _stopping;
+            std::atomic<bool>           _writer_waiting;
+            std::atomic<bool>           _write_failed;
+            std::mutex                  _mutex;
+            std::condition_variable     _records_available;
+            std::thread                 _writer;
+
+        public:
+
+            typedef std::shared_ptr< AsyncWriter > SharedPtr;
+        };
+
+inline AsyncWriter::AsyncWriter() : _head(0), _tail(0), _stopping(false), _writer_waiting(false), _write_failed(false)
+    {
+    }
+
+inline AsyncWriter::~AsyncWriter()
+    {
+    try
+        {
+        if (isOpen())
+            close();
+        }
+    catch(...)
+        {
+        }
+    }
+
+inline bool AsyncWriter::isOpen() const
+    {
+    return _file.is_open();
+    }
+
+inline void AsyncWriter::open(const std::string filename, bool binary)
+    {
+    assert(!isOpen());
+    _filename = filename;
+
+    // The buffer must be installed before the file is opened to take effect
+    _file_buffer.resize(_file_buffer_size);
+    _file.rdbuf()->pubsetbuf(_file_buffer.data(), _file_buffer.size());
+    _file.open(_filename.c_str(), binary ? std::ios::out | std::ios::binary : std::ios::out);
+    if (!_file.is_open())
+        throw XStrom(boost::str(boost::format("Could not open file \"%s\"") % _filename));
+
+    _slots.assign(_capacity, std::string());
+    _head = 0;
+    _tail = 0;
+    _stopping = false;
+    _write_failed = false;
+    _writer = std::thread(&AsyncWriter::writerLoop, this);
+    }
+
+inline void AsyncWriter::close()
+    {
+    assert(isOpen());
+        {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        }
+    _records_available.notify_one();
+    _writer.join();
+
+    _file.close();
+    bool failed = _write_failed || _file.fail();
+    _slots.clear();
+    _file_buffer.clear();
+    _file.clear();
+    if (failed)
+        throw XStrom(boost::str(boost::format("Error writing to file \"%s\"") % _filename));
+    }
+
+inline std::string & AsyncWriter::beginRecord()
+    {
+    // Wait for the writer thread if the ring is full
+    unsigned head = _head.load(std::memory_order_relaxed);
+    while (head - _tail.load(std::memory_order_acquire) == _capacity)
+        std::this_thread::yield();
+
+    std::string & slot = _slots[head & (_capacity - 1)];
+    slot.clear();
+    return slot;
+    }
+
+inline void AsyncWriter::commitRecord()
+    {
+    // Store to _head then load _writer_waiting, while writerLoop stores _writer_waiting then
+    // loads _head: with both sequentially consistent, at least one side sees the other's store.
+    // Taking _mutex before notifying means the writer is either not yet asleep (and will see
+    // the new head) or already waiting.
+    _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+    if (_writer_waiting.load(std::memory_order_seq_cst))
+        {
+            {
+            std::lock_guard<std::mutex> lock(_mutex);
+            }
+        _records_available.notify_one();
+        }
+    }
+
+inline void AsyncWriter::write(const std::string & s)
+    {
+    beginRecord() += s;
+    commitRecord();
+    }
+
+inline void AsyncWriter::writerLoop()
+    {
+    while (true)
+        {
+        unsigned tail = _tail.load(std::memory_order_relaxed);
+        unsigned head = _head.load(std::memory_order_acquire);
+        if (tail != head)
+            {
+            for (; tail != head; ++tail)
+                {
+                const std::string & slot = _slots[tail & (_capacity - 1)];
+                _file.write(slot.data(), slot.size());
+                _tail.store(tail + 1, std::memory_order_release);
+                }
+            if (_file.fail())
+                _write_failed = true;
+            continue;
+            }
+
+        if (_stopping)
+            {
+            // Producer has finished; drain anything committed before close was called
+            if (_head.load(std::memory_order_acquire) == tail)
+                break;
+            continue;
+            }
+
+        // Nothing to do: sleep until notified (see commitRecord; the timeout is only a safety net)
+        std::unique_lock<std::mutex> lock(_mutex);
+        _writer_waiting.store(true, std::memory_order_seq_cst);
+        if (_head.load(std::memory_order_seq_cst) == tail && !_stopping)
+            _records_available.wait_for(lock, std::chrono::milliseconds(100));
+        _writer_waiting.store(false, std::memory_order_seq_cst);
+        }
+    _file.flush();
+    }
+
+    }
@@ -29,6 +29,7 @@
 #include <cstring>
 #include <exception>    // for exception, bad_exception
 #include <stdexcept>    // for std exception hierarchy
+#include <algorithm>
 #include <list>
 #include <utility>
 #include <vector>
@@ -91,7 +92,7 @@ BeagleImpl* getBeagleInstance(int instanceIndex);
 
 
 BeagleImpl* getBeagleInstance(int instanceIndex) {
-    if (instanceIndex > instances->size())
+    if (instances == NULL || instanceIndex < 0 || instanceIndex >= (int) instances->size())
         return NULL;
     return (*instances)[instanceIndex];
 }
@@ -713,8 +714,12 @@ int beagleCreateInstance(int tipCount,
 
         if (bestBeagle != NULL) {
 
-            int instance = instances->size();
-            instances->push_back(bestBeagle);
+            // reuse the slot of a finalized instance if there is one
+            int instance = std::find(instances->begin(), instances->end(), (beagle::BeagleImpl*) NULL) - instances->begin();
+            if (instance < (int) instances->size())
+                (*instances)[instance] = bestBeagle;
+            else
+                instances->push_back(bestBeagle);
 
             int returnValue = bestBeagle->getInstanceDetails(returnInfo);
             if (returnValue == BEAGLE_SUCCESS) {
@@ -870,6 +875,26 @@ int beagleSetRootPrePartials(const int instance,
     }
 }
 
+int beagleSetPartialsMask(int instance,
+                          int bufferIndex,
+                          const int* inPatternMask) {
+    DEBUG_START_TIME();
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setPartialsMask(bufferIndex, inPatternMask);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
 int beagleGetPartials(int instance, int bufferIndex, int scaleIndex, double* outPartials) {
     DEBUG_START_TIME();
     try {
@@ -1480,6 +1505,18 @@ int beagleGetScaleFactors(int instance,
     //    }
 }
 
+int beagleSetScaleFactors(int instance,
+                          int destScalingIndex,
+                          const double* scaleFactors) {
+    DEBUG_START_TIME();
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setScaleFactors(destScalingIndex, scaleFactors);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
 int beagleCalculateRootLogLikelihoods(int instance,
                                       const int* bufferIndices,
                                       const int* categoryWeightsIndices,
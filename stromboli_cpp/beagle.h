@@ -517,6 +517,28 @@ BEAGLE_DLLEXPORT int beagleGetPartials(int instance,
                       int scaleIndex,
                       double* outPartials);
 
+/**
+ * @brief Set the patterns a partials buffer need not compute
+ *
+ * This function marks the patterns for which every tip below the node whose partials are written
+ * to bufferIndex is missing. For such a pattern the partials are 1 for every state and category,
+ * whatever the transition matrices, so beagleUpdatePartials may write ones instead of computing
+ * them. The mask is kept until it is replaced or cleared. The inPatternMask array should be
+ * patternCount in length; a nonzero entry marks a pattern. Implementations are free to ignore
+ * the mask, since the partials it describes are ones in any case; the CPU implementation uses it
+ * for nodes with at least one internal child, unless the partials are computed with fixed scale
+ * factors.
+ *
+ * @param instance      Instance number (input)
+ * @param bufferIndex   Index of destination partialsBuffer (input)
+ * @param inPatternMask Pointer to the pattern mask, or NULL to clear it (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetPartialsMask(int instance,
+                                           int bufferIndex,
+                                           const int* inPatternMask);
+
 /**
  * @brief Set an eigen-decomposition buffer
  *
@@ -1108,6 +1130,20 @@ BEAGLE_DLLEXPORT int beagleGetScaleFactors(int instance,
                                            int srcScalingIndex,
                                            double* outScaleFactors);
 
+/**
+ * @brief Set scale factors
+ *
+ * This function copies values into a buffer of scale factors (e.g. to restore buffers
+ * previously retrieved with beagleGetScaleFactors).
+ *
+ * @param instance                  Instance number (input)
+ * @param destScalingIndex          Destination scaleBuffer (input)
+ * @param inScaleFactors            Pointer to scaleFactors to set (input)
+ */
+BEAGLE_DLLEXPORT int beagleSetScaleFactors(int instance,
+                                           int destScalingIndex,
+                                           const double* inScaleFactors);
+
 /**
  * @brief Calculate site log likelihoods at a root node
  *
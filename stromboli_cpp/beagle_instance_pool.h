@@ -0,0 +1,236 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <tuple>
+#include <memory>
+#include "beagle.h"
+
+namespace strom
+    {
+
+    // Keeps released BeagleLib instances so that they can be handed to the next Likelihood that
+    // needs buffers of exactly the same dimensions. Creating an instance ranks every resource and
+    // implementation and allocates all partials, matrices and scale buffers; taking one from the
+    // pool costs only a reset of its scale buffers and partials masks. Everything else a
+    // Likelihood relies on (tip states, pattern weights, model parameters, partials and transition
+    // matrices) is written again before it is used, so nothing else needs resetting.
+    //
+    // There is one pool per process (getPool). Up to _max_idle released instances are kept;
+    // beyond that, released instances are finalized.
+    class BeagleInstancePool
+        {
+        public:
+
+            // Arguments of beagleCreateInstance that determine the buffers an instance owns
+            struct Key
+                {
+                int     ntips;
+                int     npartials;
+                int     ncompact;
+                int     nstates;
+                int     npatterns;
+                int     neigen;
+                int     nmatrices;
+                int     ncateg;
+                int     nscalers;
+                long    preference_flags;
+                long    requirement_flags;
+
+                bool operator<(const Key & other) const
+                    {
+                    return std::tie(ntips, npartials, ncompact, nstates, npatterns, neigen, nmatrices, ncateg, nscalers, preference_flags, requirement_flags)
+                         < std::tie(other.ntips, other.npartials, other.ncompact, other.nstates, other.npatterns, other.neigen, other.nmatrices, other.ncateg, other.nscalers, other.preference_flags, other.requirement_flags);
+                    }
+                };
+
+            static BeagleInstancePool &     getPool();
+
+            int                             acquire(const Key & key, BeagleInstanceDetails * details);
+            int                             release(int instance);
+            void                            clear();
+
+            void                            setMaxIdle(unsigned max_idle);
+            unsigned                        getNumIdle() const;
+            unsigned                        getNumInUse() const;
+            unsigned long long              getNumCreated() const;
+            unsigned long long              getNumReused() const;
+
+        private:
+
+                                            BeagleInstancePool();
+                                            ~BeagleInstancePool();
+                                            BeagleInstancePool(const BeagleInstancePool &) = delete;
+            BeagleInstancePool &            operator=(const BeagleInstancePool &) = delete;
+
+            struct Entry
+                {
+                Key                     key;
+                BeagleInstanceDetails   details;
+                bool                    in_use;
+                };
+
+            void                            finalizeIdle();
+
+            mutable std::mutex              _mutex;
+            std::map<int, Entry>            _entries;   // every instance the pool has created and not finalized
+            std::map<Key, std::vector<int> > _idle;     // released instances available for reuse
+            unsigned                        _nidle;
+            unsigned                        _max_idle;
+            unsigned long long              _ncreated;
+            unsigned long long              _nreused;
+        };
+
+inline BeagleInstancePool & BeagleInstancePool::getPool()
+    {
+    static BeagleInstancePool pool;
+    return pool;
+    }
+
+inline BeagleInstancePool::BeagleInstancePool() : _nidle(0), _max_idle(16), _ncreated(0), _nreused(0)
+    {
+    }
+
+inline BeagleInstancePool::~BeagleInstancePool()
+    {
+    finalizeIdle();
+    }
+
+inline int BeagleInstancePool::acquire(const Key & key, BeagleInstanceDetails * details)
+    {
+    // Returns an instance with the given dimensions, or the negative BeagleLib error code
+    // returned by beagleCreateInstance if a new one was needed and could not be created
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _idle.find(key);
+    if (it != _idle.end() && !it->second.empty())
+        {
+        int instance = it->second.back();
+        it->second.pop_back();
+        _nidle--;
+
+        Entry & entry = _entries[instance];
+        for (int s = 0; s < key.nscalers; ++s)
+            {
+            int code = beagleResetScaleFactors(instance, s);
+            if (code != 0)
+                return code;
+            }
+        for (int b = 0; b < key.ntips + key.npartials; ++b)
+            {
+            int code = beagleSetPartialsMask(instance, b, NULL);
+            if (code != 0)
+                return code;
+            }
+        entry.in_use = true;
+        if (details)
+            *details = entry.details;
+        _nreused++;
+        return instance;
+        }
+
+    Entry entry;
+    entry.key = key;
+    entry.in_use = true;
+    int instance = beagleCreateInstance(
+         key.ntips,                 // tips
+         key.npartials,             // partials
+         key.ncompact,              // sequences
+         key.nstates,               // states
+         key.npatterns,             // patterns
+         key.neigen,                // models
+         key.nmatrices,             // transition matrices
+         key.ncateg,                // rate categories
+         key.nscalers,              // scale buffers
+         NULL,                      // resource restrictions
+         0,                         // length of resource list
+         key.preference_flags,      // preferred flags
+         key.requirement_flags,     // required flags
+         &entry.details);           // pointer for details
+    if (instance < 0)
+        return instance;
+
+    _entries[instance] = entry;
+    if (details)
+        *details = entry.details;
+    _ncreated++;
+    return instance;
+    }
+
+inline int BeagleInstancePool::release(int instance)
+    {
+    // Returns instance to the pool, finalizing it if the pool is full. Returns 0 or the
+    // BeagleLib error code from beagleFinalizeInstance.
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _entries.find(instance);
+    if (it == _entries.end() || !it->second.in_use)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+
+    if (_nidle >= _max_idle)
+        {
+        _entries.erase(it);
+        return beagleFinalizeInstance(instance);
+        }
+
+    it->second.in_use = false;
+    _idle[it->second.key].push_back(instance);
+    _nidle++;
+    return 0;
+    }
+
+inline void BeagleInstancePool::clear()
+    {
+    // Finalizes every idle instance; instances still in use are unaffected
+    std::lock_guard<std::mutex> lock(_mutex);
+    finalizeIdle();
+    }
+
+inline void BeagleInstancePool::finalizeIdle()
+    {
+    for (auto & kv : _idle)
+        {
+        for (int instance : kv.second)
+            {
+            beagleFinalizeInstance(instance);
+            _entries.erase(instance);
+            }
+        }
+    _idle.clear();
+    _nidle = 0;
+    }
+
+inline void BeagleInstancePool::setMaxIdle(unsigned max_idle)
+    {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _max_idle = max_idle;
+    if (_nidle > _max_idle)
+        finalizeIdle();
+    }
+
+inline unsigned BeagleInstancePool::getNumIdle() const
+    {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _nidle;
+    }
+
+inline unsigned BeagleInstancePool::getNumInUse() const
+    {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return (unsigned)_entries.size() - _nidle;
+    }
+
+inline unsigned long long BeagleInstancePool::getNumCreated() const
+    {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _ncreated;
+    }
+
+inline unsigned long long BeagleInstancePool::getNumReused() const
+    {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _nreused;
+    }
+
+    }
@@ -1,7 +1,12 @@
 #pragma once
 
 #include <memory>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <map>
 #include <boost/format.hpp>
+#include <boost/algorithm/string.hpp>
 #include "lot.hpp"
 #include "data.hpp"
 #include "tree.hpp"
@@ -12,6 +17,12 @@
 #include "exchangeability_updater.hpp"
 #include "tree_updater.hpp"
 #include "tree_length_updater.hpp"
+#include "mapped_file.h"
+#include "serialization.h"
+#include "instrumentation.h"
+#include "convergence.h"
+#include "subsampled_likelihood.h"
+#include "multiple_try_tree_updater.h"
 
 namespace strom
     {
@@ -38,29 +49,66 @@ namespace strom
             void                                    setTreeFromNewick(std::string & newick);
             void                                    setTreeManip(TreeManip::SharedPtr tm);
             void                                    setLikelihood(typename Likelihood::SharedPtr likelihood);
+            void                                    setSubsampledLikelihood(SubsampledLikelihood::SharedPtr subsampled);
             void                                    setLot(typename Lot::SharedPtr lot);
+            void                                    setTreeUpdaterTries(unsigned ntries, unsigned nthreads = 0);
 
             TreeManip::SharedPtr                    getTreeManip();
             Model::SharedPtr                        getModel();
+            Likelihood::SharedPtr                   getLikelihood();
+            double                                  getLogLikelihood() const;
 
             void                                    setHeatingPower(double p);
             double                                  getHeatingPower() const;
+            void                                    setHeatLikelihoodOnly(bool on);
+            void                                    setAsyncLikelihood(bool on);
+            void                                    setReferenceDistribution(ReferenceDistribution::SharedPtr reference);
 
             void                                    setChainIndex(unsigned idx);
             double                                  getChainIndex() const;
 
+            std::vector<Updater::SharedPtr>         getUpdaters() const;
+            Updater::SharedPtr                      getUpdater(const std::string & name) const;
             std::vector<std::string>                getUpdaterNames() const;
             std::vector<double>                     getAcceptPercentages() const;
             std::vector<double>                     getLambdas() const;
             void                                    setLambdas(std::vector<double> & v);
+            void                                    copyUpdaterSettings(const Chain & other);
+            std::shared_ptr< Chain >                clone(unsigned seed) const;
+
+            InstrumentationReport                   getInstrumentationReport() const;
+            void                                    clearInstrumentation();
+            static std::string                      formatInstrumentationReport(const InstrumentationReport & report);
+
+            void                                    recordConvergenceSample();
+            void                                    clearConvergence();
+            const ConvergenceMonitor &              getConvergenceMonitor() const;
+            std::vector<std::string>                getConvergenceNames() const;
+            std::vector<double>                     getESS() const;
+            std::vector<double>                     getUpdaterSeconds() const;
+            std::vector<double>                     getESSPerSecond() const;
 
             double                                  calcLogLikelihood() const;
             double                                  calcLogJointPrior() const;
 
+            void                                    saveCheckpoint(const std::string filename, unsigned iteration, bool include_beagle_buffers = false) const;
+            unsigned                                loadCheckpoint(const std::string filename);
+
+            void                                    saveCurrentState(std::string & buffer) const;
+            void                                    loadCurrentState(const char * & p, const char * end);
+
             typedef std::shared_ptr< Chain >        SharedPtr;
 
+            static std::vector<double>              calcSplitRhat(const std::vector<SharedPtr> & chains);
+            static double                           calcASDSF(const std::vector<SharedPtr> & chains, double min_freq = 0.1);
+            static bool                             convergenceTargetsMet(const std::vector<SharedPtr> & chains, double min_ess, double max_rhat, double max_asdsf);
+
         private:
 
+            void                                timedUpdate(Updater & updater);
+
+            enum {_checkpoint_magic = 0x504b4353, _checkpoint_version = 2};    // magic is "SCKP" in little-endian byte order
+
             Likelihood::SharedPtr               _likelihood;
             TreeManip::SharedPtr                _tree_manipulator;
 
@@ -70,9 +118,16 @@ namespace strom
             TreeUpdater::SharedPtr              _tree_updater;
             TreeLengthUpdater::SharedPtr        _tree_length_updater;
 
+            Lot::SharedPtr                      _lot;
+
             unsigned                            _chain_index;
             double                              _heating_power;
             double                              _log_likelihood;
+
+            ConvergenceMonitor                  _convergence;
+            std::map<std::string, double>       _updater_seconds;       // time spent in each updater, by updater name
+            std::vector<double>                 _sample_values;
+            Split::treeid_t                     _sample_splits;
         };
 
 inline Chain::Chain()
@@ -96,6 +151,17 @@ inline Model::SharedPtr Chain::getModel()
     return _likelihood->getModel();
     }
 
+inline Likelihood::SharedPtr Chain::getLikelihood()
+    {
+    return _likelihood;
+    }
+
+inline double Chain::getLogLikelihood() const
+    {
+    // Log-likelihood of the current state as last computed by an updater (or start)
+    return _log_likelihood;
+    }
+
 inline void Chain::setHeatingPower(double p)
     {
     _heating_power = p;
@@ -111,6 +177,34 @@ inline double Chain::getHeatingPower() const
     return _heating_power;
     }
 
+inline void Chain::setHeatLikelihoodOnly(bool on)
+    {
+    _shape_updater->setHeatLikelihoodOnly(on);
+    _statefreq_updater->setHeatLikelihoodOnly(on);
+    _exchangeability_updater->setHeatLikelihoodOnly(on);
+    _tree_updater->setHeatLikelihoodOnly(on);
+    _tree_length_updater->setHeatLikelihoodOnly(on);
+    }
+
+inline void Chain::setAsyncLikelihood(bool on)
+    {
+    _shape_updater->setAsyncLikelihood(on);
+    _statefreq_updater->setAsyncLikelihood(on);
+    _exchangeability_updater->setAsyncLikelihood(on);
+    _tree_updater->setAsyncLikelihood(on);
+    _tree_length_updater->setAsyncLikelihood(on);
+    }
+
+inline void Chain::setReferenceDistribution(ReferenceDistribution::SharedPtr reference)
+    {
+    // Pass a null pointer to go back to heating the posterior (or likelihood) alone
+    _shape_updater->setReferenceDistribution(reference);
+    _statefreq_updater->setReferenceDistribution(reference);
+    _exchangeability_updater->setReferenceDistribution(reference);
+    _tree_updater->setReferenceDistribution(reference);
+    _tree_length_updater->setReferenceDistribution(reference);
+    }
+
 inline void Chain::setChainIndex(unsigned idx)
     {
     _chain_index = idx;
@@ -121,6 +215,26 @@ inline double Chain::getChainIndex() const
     return _chain_index;
     }
 
+inline std::vector<Updater::SharedPtr> Chain::getUpdaters() const
+    {
+    // Same order as getUpdaterNames
+    std::vector<Updater::SharedPtr> v;
+    v.push_back(_shape_updater);
+    v.push_back(_statefreq_updater);
+    v.push_back(_exchangeability_updater);
+    v.push_back(_tree_updater);
+    v.push_back(_tree_length_updater);
+    return v;
+    }
+
+inline Updater::SharedPtr Chain::getUpdater(const std::string & name) const
+    {
+    for (auto u : getUpdaters())
+        if (u->getUpdaterName() == name)
+            return u;
+    throw XStrom(boost::str(boost::format("Chain has no updater named \"%s\"") % name));
+    }
+
 inline std::vector<std::string> Chain::getUpdaterNames() const
     {
     std::vector<std::string> v;
@@ -156,12 +270,98 @@ inline std::vector<double> Chain::getLambdas() const
 
 inline void Chain::setLambdas(std::vector<double> & v)
     {
-    assert(v.size() >= 4);
+    assert(v.size() >= 5);
     _shape_updater->setLambda(v[0]);
     _statefreq_updater->setLambda(v[1]);
     _exchangeability_updater->setLambda(v[2]);
     _tree_updater->setLambda(v[3]);
-    _tree_length_updater->setLambda(v[3]);
+    _tree_length_updater->setLambda(v[4]);
+    }
+
+inline void Chain::copyUpdaterSettings(const Chain & other)
+    {
+    // Tuning parameters, target acceptance rates, priors and heating of other's updaters
+    std::vector<Updater::SharedPtr> mine = getUpdaters();
+    std::vector<Updater::SharedPtr> theirs = other.getUpdaters();
+    for (unsigned i = 0; i < mine.size(); ++i)
+        {
+        mine[i]->setLambda(theirs[i]->_lambda);
+        mine[i]->setTargetAcceptanceRate(theirs[i]->_target_acceptance);
+        mine[i]->setPriorParameters(theirs[i]->_prior_parameters);
+        mine[i]->setHeatLikelihoodOnly(theirs[i]->_heat_likelihood_only);
+        mine[i]->setAsyncLikelihood(theirs[i]->_async_likelihood);
+        mine[i]->setReferenceDistribution(theirs[i]->_reference);
+        }
+    setHeatingPower(other._heating_power);
+    }
+
+inline Chain::SharedPtr Chain::clone(unsigned seed) const
+    {
+    // A new chain at the same point as this one, with the same updater settings, that can run
+    // on another thread: it has its own model, Likelihood (sharing this chain's data), tree and
+    // Lot (seeded with seed). The new chain is started, so its BeagleLib instance is created on
+    // the calling thread.
+    assert(_likelihood);
+    assert(_tree_manipulator);
+    std::string model_state;
+    _likelihood->getModel()->saveState(model_state);
+    Model::SharedPtr model(new Model());
+    const char * p = model_state.data();
+    model->loadState(p, p + model_state.size());
+
+    Likelihood::SharedPtr likelihood(new Likelihood());
+    likelihood->setVerbose(false);
+    likelihood->setData(_likelihood->getData());
+    likelihood->setModel(model);
+
+    std::string tree;
+    _tree_manipulator->saveBinary(tree);
+    TreeManip::SharedPtr tm(new TreeManip());
+    p = tree.data();
+    tm->loadBinary(p, p + tree.size());
+
+    Lot::SharedPtr lot(new Lot());
+    lot->setSeed(seed);
+
+    SharedPtr c(new Chain());
+    c->setChainIndex(_chain_index);
+    c->setLikelihood(likelihood);
+    c->setTreeManip(tm);
+    c->setLot(lot);
+    c->copyUpdaterSettings(*this);
+    c->start();
+    return c;
+    }
+
+inline InstrumentationReport Chain::getInstrumentationReport() const
+    {
+    // Updater phases first (in getUpdaterNames order), then the stages of the shared Likelihood.
+    // Counts and times are all zero unless compiled with STROM_INSTRUMENT defined.
+    InstrumentationReport report;
+    for (auto u : getUpdaters())
+        u->appendInstrumentationReport(report);
+    if (_likelihood)
+        _likelihood->appendInstrumentationReport(report);
+    return report;
+    }
+
+inline void Chain::clearInstrumentation()
+    {
+    for (auto u : getUpdaters())
+        u->clearInstrumentation();
+    if (_likelihood)
+        _likelihood->clearInstrumentation();
+    }
+
+inline std::string Chain::formatInstrumentationReport(const InstrumentationReport & report)
+    {
+    std::string s = boost::str(boost::format("%30s %25s %15s %15s %15s\n") % "component" % "name" % "count" % "seconds" % "usec/call");
+    for (auto & r : report)
+        {
+        double usec = (r.count > 0 ? 1.0e6*r.seconds/r.count : 0.0);
+        s += boost::str(boost::format("%30s %25s %15d %15.6f %15.3f\n") % r.component % r.name % r.count % r.seconds % usec);
+        }
+    return s;
     }
 
 inline void Chain::startTuning()
@@ -187,7 +387,12 @@ inline void Chain::setTreeFromNewick(std::string & newick)
     if (!_tree_manipulator)
         _tree_manipulator.reset(new TreeManip);
     _tree_manipulator->buildFromNewick(newick, false, false);
+    setTreeManip(_tree_manipulator);
+    }
 
+inline void Chain::setTreeManip(TreeManip::SharedPtr tm)
+    {
+    _tree_manipulator = tm;
     _shape_updater->setTreeManip(_tree_manipulator);
     _statefreq_updater->setTreeManip(_tree_manipulator);
     _exchangeability_updater->setTreeManip(_tree_manipulator);
@@ -205,8 +410,19 @@ inline void Chain::setLikelihood(typename Likelihood::SharedPtr likelihood)
     _tree_length_updater->setLikelihood(likelihood);
     }
 
+inline void Chain::setSubsampledLikelihood(SubsampledLikelihood::SharedPtr subsampled)
+    {
+    // Pass a null pointer to go back to evaluating the full likelihood for every proposal
+    _shape_updater->setSubsampledLikelihood(subsampled);
+    _statefreq_updater->setSubsampledLikelihood(subsampled);
+    _exchangeability_updater->setSubsampledLikelihood(subsampled);
+    _tree_updater->setSubsampledLikelihood(subsampled);
+    _tree_length_updater->setSubsampledLikelihood(subsampled);
+    }
+
 inline void Chain::setLot(typename Lot::SharedPtr lot)
     {
+    _lot = lot;
     _shape_updater->setLot(lot);
     _statefreq_updater->setLot(lot);
     _exchangeability_updater->setLot(lot);
@@ -214,6 +430,35 @@ inline void Chain::setLot(typename Lot::SharedPtr lot)
     _tree_length_updater->setLot(lot);
     }
 
+inline void Chain::setTreeUpdaterTries(unsigned ntries, unsigned nthreads)
+    {
+    // Replaces the tree updater with a multiple-try version drawing ntries candidates per update
+    // (or, if ntries is 1, with an ordinary TreeUpdater), keeping its settings and tuning state
+    TreeUpdater::SharedPtr old = _tree_updater;
+    if (ntries > 1)
+        {
+        MultipleTryTreeUpdater::SharedPtr mtm(new MultipleTryTreeUpdater);
+        mtm->setNumTries(ntries);
+        mtm->setNumThreads(nthreads);
+        _tree_updater = mtm;
+        }
+    else
+        _tree_updater.reset(new TreeUpdater);
+
+    _tree_updater->setLambda(old->_lambda);
+    _tree_updater->setTargetAcceptanceRate(old->_target_acceptance);
+    _tree_updater->setPriorParameters(old->_prior_parameters);
+    _tree_updater->setHeatingPower(old->_heating_power);
+    _tree_updater->setHeatLikelihoodOnly(old->_heat_likelihood_only);
+    _tree_updater->setAsyncLikelihood(old->_async_likelihood);
+    _tree_updater->setReferenceDistribution(old->_reference);
+    _tree_updater->setTuning(old->_tuning);
+    _tree_updater->setTreeManip(old->_tree_manipulator);
+    _tree_updater->setLikelihood(old->_likelihood);
+    _tree_updater->setSubsampledLikelihood(old->_subsampled_likelihood);
+    _tree_updater->setLot(old->_lot);
+    }
+
 inline void Chain::clear()
     {
     _log_likelihood = 0.0;
@@ -250,6 +495,7 @@ inline void Chain::clear()
     _chain_index = 0;
     setHeatingPower(1.0);
     startTuning();
+    clearConvergence();
     }
 
 inline void Chain::start()
@@ -273,8 +519,10 @@ inline double Chain::calcLogLikelihood() const
 
 inline double Chain::calcLogJointPrior() const
     {
+    // The gamma shape only counts if there is rate heterogeneity (nextStep skips it otherwise)
     double lnP = 0.0;
-    lnP += _shape_updater->calcLogPrior();
+    if (_likelihood->getModel()->getGammaNCateg() > 1)
+        lnP += _shape_updater->calcLogPrior();
     lnP += _statefreq_updater->calcLogPrior();
     lnP += _exchangeability_updater->calcLogPrior();
     lnP += _tree_updater->calcLogPrior();
@@ -282,15 +530,311 @@ inline double Chain::calcLogJointPrior() const
     return lnP;
     }
 
+inline void Chain::timedUpdate(Updater & updater)
+    {
+    typedef std::chrono::steady_clock clock_t;
+    clock_t::time_point start = clock_t::now();
+    _log_likelihood = updater.update(_log_likelihood);
+    _updater_seconds[updater.getUpdaterName()] += std::chrono::duration<double>(clock_t::now() - start).count();
+    }
+
 inline void Chain::nextStep(int iteration)
     {
     Model::SharedPtr model = getModel();
     if (model->getGammaNCateg() > 1)
-        _log_likelihood = _shape_updater->update(_log_likelihood);
-    _log_likelihood = _statefreq_updater->update(_log_likelihood);
-    _log_likelihood = _exchangeability_updater->update(_log_likelihood);
-    _log_likelihood = _tree_updater->update(_log_likelihood);
-    _log_likelihood = _tree_length_updater->update(_log_likelihood);
+        timedUpdate(*_shape_updater);
+    timedUpdate(*_statefreq_updater);
+    timedUpdate(*_exchangeability_updater);
+    timedUpdate(*_tree_updater);
+    timedUpdate(*_tree_length_updater);
+    }
+
+inline void Chain::clearConvergence()
+    {
+    _convergence.clear();
+    _updater_seconds.clear();
+    }
+
+inline std::vector<std::string> Chain::getConvergenceNames() const
+    {
+    // lnL and tree length followed by the model parameters in paramNamesAsString order
+    std::vector<std::string> names = {"lnL", "TL"};
+    std::vector<std::string> param_names;
+    std::string s = _likelihood->getModel()->paramNamesAsString("\t");
+    boost::split(param_names, s, boost::is_any_of("\t"), boost::token_compress_on);
+    for (auto & name : param_names)
+        {
+        boost::trim(name);
+        if (!name.empty())
+            names.push_back(name);
+        }
+    return names;
+    }
+
+inline void Chain::recordConvergenceSample()
+    {
+    // Call at the sampling frequency, typically alongside OutputManager::outputTree
+    if (_convergence.getNames().empty())
+        _convergence.setNames(getConvergenceNames());
+
+    _sample_values.clear();
+    _sample_values.push_back(_log_likelihood);
+    _sample_values.push_back(_tree_manipulator->calcTreeLength());
+    std::vector<double> params;
+    getModel()->getParamValues(params);
+    _sample_values.insert(_sample_values.end(), params.begin(), params.end());
+
+    _sample_splits.clear();
+    _tree_manipulator->storeSplits(_sample_splits);
+    _convergence.addSample(_sample_values, _sample_splits);
+    }
+
+inline const ConvergenceMonitor & Chain::getConvergenceMonitor() const
+    {
+    return _convergence;
+    }
+
+inline std::vector<double> Chain::getESS() const
+    {
+    // Same order as getConvergenceNames
+    return _convergence.calcESS();
+    }
+
+inline std::vector<double> Chain::getUpdaterSeconds() const
+    {
+    // Same order as getUpdaterNames
+    std::vector<double> v;
+    for (auto & name : getUpdaterNames())
+        {
+        auto it = _updater_seconds.find(name);
+        v.push_back(it == _updater_seconds.end() ? 0.0 : it->second);
+        }
+    return v;
+    }
+
+inline std::vector<double> Chain::getESSPerSecond() const
+    {
+    // For each updater (getUpdaterNames order), the smallest ESS among the quantities it
+    // changes divided by the wall-clock time spent in that updater; 0 if it has not run.
+    // Quantities are looked up by updater and series name, and an updater not listed here
+    // is judged by the ESS of lnL, which every updater changes.
+    static const std::map<std::string, std::vector<std::string> > targets = {
+        {"Gamma Shape",             {"alpha"}},
+        {"State Frequencies",       {"pi(A)", "pi(C)", "pi(G)", "pi(T)"}},
+        {"Exchangeabilities",       {"r(A<->C)", "r(A<->G)", "r(A<->T)", "r(C<->G)", "r(C<->T)", "r(G<->T)"}},
+        {"Tree and Edge Lengths",   {"lnL", "TL"}},
+        {"Tree Length",             {"TL"}}
+        };
+
+    std::vector<std::string> updater_names = getUpdaterNames();
+    std::vector<double> seconds = getUpdaterSeconds();
+    std::vector<double> ess = getESS();
+    if (ess.empty())
+        return std::vector<double>(updater_names.size(), 0.0);
+
+    std::vector<std::string> series_names = getConvergenceNames();
+    std::map<std::string, double> series_ess;
+    for (unsigned k = 0; k < series_names.size() && k < ess.size(); ++k)
+        series_ess[series_names[k]] = ess[k];
+
+    std::vector<double> v;
+    for (unsigned i = 0; i < updater_names.size(); ++i)
+        {
+        auto t = targets.find(updater_names[i]);
+        const std::vector<std::string> & names = (t == targets.end() ? std::vector<std::string>(1, "lnL") : t->second);
+        double min_ess = std::numeric_limits<double>::max();
+        for (auto & name : names)
+            {
+            auto e = series_ess.find(name);
+            if (e == series_ess.end())
+                throw XStrom(boost::str(boost::format("No convergence series named \"%s\" for updater \"%s\"") % name % updater_names[i]));
+            min_ess = std::min(min_ess, e->second);
+            }
+        v.push_back(seconds[i] > 0.0 ? min_ess/seconds[i] : 0.0);
+        }
+    return v;
+    }
+
+inline std::vector<double> Chain::calcSplitRhat(const std::vector<SharedPtr> & chains)
+    {
+    std::vector<const ConvergenceMonitor *> monitors;
+    for (auto c : chains)
+        monitors.push_back(&c->_convergence);
+    return ConvergenceMonitor::calcSplitRhat(monitors);
+    }
+
+inline double Chain::calcASDSF(const std::vector<SharedPtr> & chains, double min_freq)
+    {
+    std::vector<const ConvergenceMonitor *> monitors;
+    for (auto c : chains)
+        monitors.push_back(&c->_convergence);
+    return ConvergenceMonitor::calcASDSF(monitors, min_freq);
+    }
+
+inline bool Chain::convergenceTargetsMet(const std::vector<SharedPtr> & chains, double min_ess, double max_rhat, double max_asdsf)
+    {
+    // True once every chain has reached min_ess for every monitored quantity and, when more
+    // than one chain is running, split R-hat and ASDSF are below their thresholds
+    if (chains.empty())
+        return false;
+    for (auto c : chains)
+        {
+        std::vector<double> ess = c->getESS();
+        if (ess.empty() || *std::min_element(ess.begin(), ess.end()) < min_ess)
+            return false;
+        }
+    if (chains.size() > 1)
+        {
+        for (auto r : calcSplitRhat(chains))
+            if (!(r <= max_rhat))
+                return false;
+        if (calcASDSF(chains) > max_asdsf)
+            return false;
+        }
+    return true;
+    }
+
+inline void Chain::saveCheckpoint(const std::string filename, unsigned iteration, bool include_beagle_buffers) const
+    {
+    // Everything needed to carry on from iteration as if the run had never stopped: the tuning
+    // state of each updater, the model, the tree, the random number generator and the current
+    // log-likelihood (so that no likelihood calculation is needed on restart). The BeagleLib
+    // partials, scalers and transition matrices may optionally be included as well, with the
+    // record of what they were computed from, so that the first likelihood calculation after a
+    // restart only recomputes buffers that differ from the saved ones.
+    std::string buffer;
+    appendBinary(buffer, (std::uint32_t)_checkpoint_magic);
+    appendBinary(buffer, (std::uint32_t)_checkpoint_version);
+    appendBinary(buffer, (std::uint32_t)iteration);
+    appendBinary(buffer, (std::uint32_t)_chain_index);
+    appendBinary(buffer, _heating_power);
+    appendBinary(buffer, _log_likelihood);
+
+    _likelihood->getModel()->saveState(buffer);
+
+    _shape_updater->saveState(buffer);
+    _statefreq_updater->saveState(buffer);
+    _exchangeability_updater->saveState(buffer);
+    _tree_updater->saveState(buffer);
+    _tree_length_updater->saveState(buffer);
+
+    appendBinary(buffer, (std::uint8_t)(_lot ? 1 : 0));
+    if (_lot)
+        appendBinaryString(buffer, _lot->getState());
+
+    assert(_tree_manipulator);
+    _tree_manipulator->saveBinary(buffer);
+
+    appendBinary(buffer, (std::uint8_t)(include_beagle_buffers ? 1 : 0));
+    if (include_beagle_buffers)
+        _likelihood->saveBeagleBuffers(buffer);
+
+    // Write to a temporary file and rename it so that an interrupted write never
+    // replaces a good checkpoint with a truncated one
+    std::string tmpname = filename + ".tmp";
+    std::ofstream outf(tmpname.c_str(), std::ios::out | std::ios::binary);
+    if (!outf.is_open())
+        throw XStrom(boost::str(boost::format("Could not open checkpoint file \"%s\"") % tmpname));
+    outf.write(buffer.data(), buffer.size());
+    outf.close();
+    if (outf.fail())
+        throw XStrom(boost::str(boost::format("Error writing checkpoint file \"%s\"") % tmpname));
+    if (std::rename(tmpname.c_str(), filename.c_str()) != 0)
+        throw XStrom(boost::str(boost::format("Could not rename \"%s\" to \"%s\"") % tmpname % filename));
+    }
+
+inline unsigned Chain::loadCheckpoint(const std::string filename)
+    {
+    // Restores the state written by saveCheckpoint and returns the iteration at which it was
+    // saved. The likelihood and lot must already have been set; start should not be called
+    // afterwards because that would recompute the log-likelihood.
+    assert(_likelihood);
+    MappedFile checkpoint(filename);
+    const char * p = checkpoint.begin();
+    const char * end = checkpoint.end();
+
+    std::uint32_t magic = 0;
+    std::uint32_t version = 0;
+    if (checkpoint.size() >= sizeof(magic))
+        readBinary(p, end, magic);
+    if (magic != _checkpoint_magic)
+        throw XStrom(boost::str(boost::format("File \"%s\" is not a checkpoint file") % filename));
+    readBinary(p, end, version);
+    if (version != _checkpoint_version)
+        throw XStrom(boost::str(boost::format("Checkpoint file \"%s\" has unsupported version %d") % filename % version));
+
+    std::uint32_t iteration = 0;
+    std::uint32_t chain_index = 0;
+    double heating_power = 1.0;
+    readBinary(p, end, iteration);
+    readBinary(p, end, chain_index);
+    readBinary(p, end, heating_power);
+    readBinary(p, end, _log_likelihood);
+    _chain_index = chain_index;
+    _heating_power = heating_power;
+
+    _likelihood->getModel()->loadState(p, end);
+
+    _shape_updater->loadState(p, end);
+    _statefreq_updater->loadState(p, end);
+    _exchangeability_updater->loadState(p, end);
+    _tree_updater->loadState(p, end);
+    _tree_length_updater->loadState(p, end);
+
+    std::uint8_t has_lot = 0;
+    readBinary(p, end, has_lot);
+    if (has_lot)
+        {
+        std::string lot_state;
+        readBinaryString(p, end, lot_state);
+        if (_lot)
+            _lot->setState(lot_state);
+        }
+
+    if (!_tree_manipulator)
+        setTreeManip(TreeManip::SharedPtr(new TreeManip));
+    _tree_manipulator->loadBinary(p, end);
+
+    std::uint8_t has_beagle_buffers = 0;
+    readBinary(p, end, has_beagle_buffers);
+    if (has_beagle_buffers)
+        _likelihood->loadBeagleBuffers(p, end);
+
+    _shape_updater->pullCurrentStateFromModel();
+    _statefreq_updater->pullCurrentStateFromModel();
+    _exchangeability_updater->pullCurrentStateFromModel();
+    _tree_updater->pullCurrentStateFromModel();
+    _tree_length_updater->pullCurrentStateFromModel();
+
+    return iteration;
+    }
+
+inline void Chain::saveCurrentState(std::string & buffer) const
+    {
+    // Appends the point the chain is at (model, tree and its cached log-likelihood) but none of
+    // the tuning or random number state kept by saveCheckpoint. Used to move states between
+    // chains, e.g. particles of an SMC sampler, without recomputing their likelihoods.
+    assert(_likelihood);
+    assert(_tree_manipulator);
+    appendBinary(buffer, _log_likelihood);
+    _likelihood->getModel()->saveState(buffer);
+    _tree_manipulator->saveBinary(buffer);
+    }
+
+inline void Chain::loadCurrentState(const char * & p, const char * end)
+    {
+    assert(_likelihood);
+    readBinary(p, end, _log_likelihood);
+    _likelihood->getModel()->loadState(p, end);
+    if (!_tree_manipulator)
+        setTreeManip(TreeManip::SharedPtr(new TreeManip));
+    _tree_manipulator->loadBinary(p, end);
+
+    _shape_updater->pullCurrentStateFromModel();
+    _statefreq_updater->pullCurrentStateFromModel();
+    _exchangeability_updater->pullCurrentStateFromModel();
+    _tree_updater->pullCurrentStateFromModel();
+    _tree_length_updater->pullCurrentStateFromModel();
     }
 
 }
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <memory>
+#include <cassert>
+#include <cstdint>
+#include <boost/format.hpp>
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    // Internal node times kept in sorted order so that a single time can be changed in O(log n).
+    // Implemented as a treap over slots 0..n-1 (one slot per internal node) whose subtrees carry
+    // the number of times, their sum and their rank-weighted sum (sum of rank*time, ranks
+    // starting at 1 within the subtree). These are enough to get any prefix of the sorted times
+    // in a single walk from the root.
+    class NodeTimeIndex
+        {
+        public:
+                                        NodeTimeIndex();
+
+            void                        clear();
+            void                        setTimes(const std::vector<double> & times);
+            void                        setTime(unsigned slot, double t);
+
+            unsigned                    getNumTimes() const;
+            double                      getTime(unsigned slot) const;
+            double                      getTotalSum() const;
+            double                      getTotalWeightedSum() const;
+
+            void                        calcPrefix(double x, unsigned & count, double & sum, double & weighted_sum) const;
+
+        private:
+
+            enum {_nil = -1};
+
+            bool                        less(int i, double t, int slot) const;
+            void                        update(int i);
+            void                        split(int i, double t, int slot, int & lo, int & hi);
+            int                         merge(int lo, int hi);
+            void                        insert(int i);
+            void                        erase(int i);
+
+            std::vector<double>         _time;
+            std::vector<std::uint64_t>  _priority;
+            std::vector<int>            _left;
+            std::vector<int>            _right;
+            std::vector<unsigned>       _count;
+            std::vector<double>         _sum;
+            std::vector<double>         _weighted_sum;
+            int                         _root;
+
+        public:
+
+            typedef std::shared_ptr< NodeTimeIndex > SharedPtr;
+        };
+
+    // Kingman coalescent prior on the internal node times of a rooted tree whose leaves are all
+    // at time 0. Each pair of lineages coalesces at rate 1/N(t), where the population size N(t),
+    // measured in the same units as the tree, is piecewise constant: sizes[0] applies before
+    // breakpoints[0], sizes[1] between breakpoints[0] and breakpoints[1], and so on (a single
+    // size and no breakpoints gives the constant-size coalescent). With t_1 < ... < t_{n-1} the
+    // sorted node times and k lineages present, the log density is
+    //
+    //      -sum_j log N(t_j) - integral of C(k(t),2)/N(t) dt
+    //
+    // and the integral up to x (with m node times at or below x) reduces to
+    //
+    //      F(x) = sum_{j<=m} (n - j) t_j + C(n - m, 2) x
+    //
+    // which NodeTimeIndex provides in O(log n) for any x.
+    class CoalescentPrior
+        {
+        public:
+                                        CoalescentPrior();
+
+            void                        clear();
+            void                        setPopulationSize(double N);
+            void                        setSkyline(const std::vector<double> & breakpoints, const std::vector<double> & sizes);
+            const std::vector<double> & getPopulationSizes() const;
+            const std::vector<double> & getBreakpoints() const;
+
+            void                        setNodeTimes(const std::vector<double> & times);
+            void                        setNodeTime(unsigned slot, double t);
+            double                      getNodeTime(unsigned slot) const;
+            unsigned                    getNumLeaves() const;
+
+            double                      calcLogPrior() const;
+
+        private:
+
+            double                      calcIntegral(double x, unsigned & m) const;
+
+            NodeTimeIndex               _index;
+            std::vector<double>         _breakpoints;
+            std::vector<double>         _sizes;
+
+        public:
+
+            typedef std::shared_ptr< CoalescentPrior > SharedPtr;
+        };
+
+inline NodeTimeIndex::NodeTimeIndex()
+    {
+    clear();
+    }
+
+inline void NodeTimeIndex::clear()
+    {
+    _time.clear();
+    _priority.clear();
+    _left.clear();
+    _right.clear();
+    _count.clear();
+    _sum.clear();
+    _weighted_sum.clear();
+    _root = _nil;
+    }
+
+inline void NodeTimeIndex::setTimes(const std::vector<double> & times)
+    {
+    clear();
+    unsigned n = (unsigned)times.size();
+    _time = times;
+    _priority.resize(n);
+    _left.assign(n, _nil);
+    _right.assign(n, _nil);
+    _count.assign(n, 1);
+    _sum.resize(n);
+    _weighted_sum.resize(n);
+    for (unsigned i = 0; i < n; ++i)
+        {
+        // Priorities only need to be independent of the times, so a hash of the slot will do
+        std::uint64_t z = (std::uint64_t)(i + 1)*0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+        _priority[i] = z ^ (z >> 31);
+        insert((int)i);
+        }
+    }
+
+inline void NodeTimeIndex::setTime(unsigned slot, double t)
+    {
+    assert(slot < _time.size());
+    erase((int)slot);
+    _time[slot] = t;
+    insert((int)slot);
+    }
+
+inline unsigned NodeTimeIndex::getNumTimes() const
+    {
+    return (unsigned)_time.size();
+    }
+
+inline double NodeTimeIndex::getTime(unsigned slot) const
+    {
+    assert(slot < _time.size());
+    return _time[slot];
+    }
+
+inline double NodeTimeIndex::getTotalSum() const
+    {
+    return (_root == _nil ? 0.0 : _sum[_root]);
+    }
+
+inline double NodeTimeIndex::getTotalWeightedSum() const
+    {
+    return (_root == _nil ? 0.0 : _weighted_sum[_root]);
+    }
+
+inline void NodeTimeIndex::calcPrefix(double x, unsigned & count, double & sum, double & weighted_sum) const
+    {
+    // Number, sum and rank-weighted sum of the times that are less than or equal to x
+    count = 0;
+    sum = 0.0;
+    weighted_sum = 0.0;
+    int i = _root;
+    while (i != _nil)
+        {
+        if (_time[i] <= x)
+            {
+            int l = _left[i];
+            if (l != _nil)
+                {
+                weighted_sum += _weighted_sum[l] + count*_sum[l];
+                sum += _sum[l];
+                count += _count[l];
+                }
+            count++;
+            weighted_sum += count*_time[i];
+            sum += _time[i];
+            i = _right[i];
+            }
+        else
+            i = _left[i];
+        }
+    }
+
+inline bool NodeTimeIndex::less(int i, double t, int slot) const
+    {
+    // Ties in time are broken by slot so that every key is unique
+    return (_time[i] < t || (_time[i] == t && i < slot));
+    }
+
+inline void NodeTimeIndex::update(int i)
+    {
+    int l = _left[i];
+    int r = _right[i];
+    unsigned nl = (l == _nil ? 0 : _count[l]);
+    _count[i] = nl + 1 + (r == _nil ? 0 : _count[r]);
+    _sum[i] = (l == _nil ? 0.0 : _sum[l]) + _time[i] + (r == _nil ? 0.0 : _sum[r]);
+    _weighted_sum[i] = (l == _nil ? 0.0 : _weighted_sum[l]) + (nl + 1)*_time[i];
+    if (r != _nil)
+        _weighted_sum[i] += _weighted_sum[r] + (nl + 1)*_sum[r];
+    }
+
+inline void NodeTimeIndex::split(int i, double t, int slot, int & lo, int & hi)
+    {
+    // lo receives the keys that sort before (t, slot), hi the rest
+    if (i == _nil)
+        {
+        lo = hi = _nil;
+        return;
+        }
+    if (less(i, t, slot))
+        {
+        split(_right[i], t, slot, _right[i], hi);
+        lo = i;
+        }
+    else
+        {
+        split(_left[i], t, slot, lo, _left[i]);
+        hi = i;
+        }
+    update(i);
+    }
+
+inline int NodeTimeIndex::merge(int lo, int hi)
+    {
+    if (lo == _nil)
+        return hi;
+    if (hi == _nil)
+        return lo;
+    if (_priority[lo] > _priority[hi])
+        {
+        _right[lo] = merge(_right[lo], hi);
+        update(lo);
+        return lo;
+        }
+    _left[hi] = merge(lo, _left[hi]);
+    update(hi);
+    return hi;
+    }
+
+inline void NodeTimeIndex::insert(int i)
+    {
+    _left[i] = _right[i] = _nil;
+    update(i);
+    int lo, hi;
+    split(_root, _time[i], i, lo, hi);
+    _root = merge(merge(lo, i), hi);
+    }
+
+inline void NodeTimeIndex::erase(int i)
+    {
+    int lo, mid, hi;
+    split(_root, _time[i], i, lo, mid);
+    split(mid, _time[i], i + 1, mid, hi);
+    assert(mid == i);
+    _root = merge(lo, hi);
+    }
+
+inline CoalescentPrior::CoalescentPrior()
+    {
+    clear();
+    }
+
+inline void CoalescentPrior::clear()
+    {
+    _index.clear();
+    _breakpoints.clear();
+    _sizes.assign(1, 1.0);
+    }
+
+inline void CoalescentPrior::setPopulationSize(double N)
+    {
+    setSkyline(std::vector<double>(), std::vector<double>(1, N));
+    }
+
+inline void CoalescentPrior::setSkyline(const std::vector<double> & breakpoints, const std::vector<double> & sizes)
+    {
+    if (sizes.size() != breakpoints.size() + 1)
+        throw XStrom(boost::str(boost::format("Expecting %d population sizes for %d breakpoints but got %d") % (breakpoints.size() + 1) % breakpoints.size() % sizes.size()));
+    for (auto N : sizes)
+        if (!(N > 0.0))
+            throw XStrom(boost::str(boost::format("Population sizes must be positive (found %g)") % N));
+    for (unsigned i = 0; i < breakpoints.size(); ++i)
+        if (!(breakpoints[i] > (i == 0 ? 0.0 : breakpoints[i - 1])))
+            throw XStrom("Skyline breakpoints must be positive and strictly increasing");
+    _breakpoints = breakpoints;
+    _sizes = sizes;
+    }
+
+inline const std::vector<double> & CoalescentPrior::getPopulationSizes() const
+    {
+    return _sizes;
+    }
+
+inline const std::vector<double> & CoalescentPrior::getBreakpoints() const
+    {
+    return _breakpoints;
+    }
+
+inline void CoalescentPrior::setNodeTimes(const std::vector<double> & times)
+    {
+    // One time per internal node (n - 1 of them for n leaves); slots are positions in times
+    if (times.empty())
+        throw XStrom("The coalescent prior needs a tree with at least two leaves");
+    _index.setTimes(times);
+    }
+
+inline void CoalescentPrior::setNodeTime(unsigned slot, double t)
+    {
+    _index.setTime(slot, t);
+    }
+
+inline double CoalescentPrior::getNodeTime(unsigned slot) const
+    {
+    return _index.getTime(slot);
+    }
+
+inline unsigned CoalescentPrior::getNumLeaves() const
+    {
+    return _index.getNumTimes() + 1;
+    }
+
+inline double CoalescentPrior::calcIntegral(double x, unsigned & m) const
+    {
+    // F(x) = n*(sum of the m times <= x) - (their rank-weighted sum) + C(n - m, 2) x
+    double n = (double)getNumLeaves();
+    double sum = 0.0;
+    double weighted_sum = 0.0;
+    _index.calcPrefix(x, m, sum, weighted_sum);
+    double k = n - m;
+    return n*sum - weighted_sum + 0.5*k*(k - 1.0)*x;
+    }
+
+inline double CoalescentPrior::calcLogPrior() const
+    {
+    assert(_index.getNumTimes() > 0);
+    double n = (double)getNumLeaves();
+    double total = n*_index.getTotalSum() - _index.getTotalWeightedSum();
+    if (_breakpoints.empty())
+        return -(n - 1.0)*std::log(_sizes[0]) - total/_sizes[0];
+
+    double log_prior = 0.0;
+    double F_prev = 0.0;
+    unsigned m_prev = 0;
+    for (unsigned e = 0; e < _sizes.size(); ++e)
+        {
+        double F = total;
+        unsigned m = _index.getNumTimes();
+        if (e < _breakpoints.size())
+            F = calcIntegral(_breakpoints[e], m);
+        log_prior -= (m - m_prev)*std::log(_sizes[e]) + (F - F_prev)/_sizes[e];
+        F_prev = F;
+        m_prev = m;
+        if (m == _index.getNumTimes())
+            break;
+        }
+    return log_prior;
+    }
+
+    }
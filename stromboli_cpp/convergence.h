@@ -0,0 +1,380 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <cmath>
+#include <memory>
+#include <cassert>
+#include <limits>
+#include <algorithm>
+#include <boost/format.hpp>
+#include "split.h"
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    // Online batch-means estimator for a single scalar series. Samples are grouped into at most
+    // _max_batches batches; when that number is reached, adjacent batches are merged and the
+    // batch size doubles, so memory use is constant however long the chain runs. Each batch
+    // keeps its count, mean and sum of squared deviations, which avoids the cancellation that
+    // running sums of squares suffer for quantities such as lnL.
+    class BatchMeans
+        {
+        public:
+                                        BatchMeans(unsigned max_batches = 64);
+
+            void                        clear();
+            void                        add(double x);
+
+            unsigned long long          getNumSamples() const;
+            double                      getMean() const;
+            double                      getVariance() const;
+            double                      calcESS() const;
+            void                        calcHalfStats(double & n, double & mean0, double & var0, double & mean1, double & var1) const;
+
+        private:
+
+            struct Batch
+                {
+                double n;
+                double mean;
+                double m2;
+                };
+
+            static void                 merge(Batch & a, const Batch & b);
+
+            unsigned                    _max_batches;
+            unsigned long long          _batch_size;
+            std::vector<Batch>          _batches;       // completed batches
+            Batch                       _current;       // batch being filled
+            Batch                       _total;         // all samples
+
+        public:
+
+            typedef std::shared_ptr< BatchMeans > SharedPtr;
+        };
+
+    // Convergence statistics for one chain: a BatchMeans estimator for each named series plus
+    // counts of how often the frequent splits have been sampled. Split counts are kept in a
+    // table of at most _max_splits entries (Misra-Gries): when a new split arrives at a full
+    // table every count is decremented and zero counts are dropped. Each count is then low by
+    // at most (number of splits added)/(_max_splits + 1), so a split's frequency is low by at
+    // most (splits per tree)/(_max_splits + 1), and every split more frequent than that stays.
+    class ConvergenceMonitor
+        {
+        public:
+                                        ConvergenceMonitor();
+
+            void                        clear();
+            void                        setNames(const std::vector<std::string> & names);
+            void                        setMaxSplits(unsigned max_splits);
+            const std::vector<std::string> & getNames() const;
+
+            void                        addSample(const std::vector<double> & values, const Split::treeid_t & splits);
+
+            unsigned long long          getNumSamples() const;
+            unsigned                    getNumTrackedSplits() const;
+            std::vector<double>         calcESS() const;
+
+            static std::vector<double>  calcSplitRhat(const std::vector<const ConvergenceMonitor *> & monitors);
+            static double               calcASDSF(const std::vector<const ConvergenceMonitor *> & monitors, double min_freq = 0.1);
+
+        private:
+
+            std::vector<std::string>            _names;
+            std::vector<BatchMeans>             _series;
+            std::map<Split, unsigned long long> _split_counts;
+            unsigned                            _max_splits;
+            unsigned long long                  _ntrees;
+
+        public:
+
+            typedef std::shared_ptr< ConvergenceMonitor > SharedPtr;
+        };
+
+inline BatchMeans::BatchMeans(unsigned max_batches) : _max_batches(max_batches)
+    {
+    assert(_max_batches >= 4 && _max_batches % 2 == 0);
+    clear();
+    }
+
+inline void BatchMeans::clear()
+    {
+    _batch_size = 1;
+    _batches.clear();
+    _batches.reserve(_max_batches);
+    _current = {0.0, 0.0, 0.0};
+    _total = {0.0, 0.0, 0.0};
+    }
+
+inline void BatchMeans::merge(Batch & a, const Batch & b)
+    {
+    // Chan et al. pairwise update of count, mean and sum of squared deviations
+    double n = a.n + b.n;
+    if (n == 0.0)
+        return;
+    double delta = b.mean - a.mean;
+    a.mean += delta*b.n/n;
+    a.m2 += b.m2 + delta*delta*a.n*b.n/n;
+    a.n = n;
+    }
+
+inline void BatchMeans::add(double x)
+    {
+    Batch single = {1.0, x, 0.0};
+    merge(_total, single);
+    merge(_current, single);
+    if (_current.n < (double)_batch_size)
+        return;
+
+    _batches.push_back(_current);
+    _current = {0.0, 0.0, 0.0};
+    if (_batches.size() == _max_batches)
+        {
+        for (unsigned i = 0; i < _max_batches/2; ++i)
+            {
+            _batches[i] = _batches[2*i];
+            merge(_batches[i], _batches[2*i + 1]);
+            }
+        _batches.resize(_max_batches/2);
+        _batch_size *= 2;
+        }
+    }
+
+inline unsigned long long BatchMeans::getNumSamples() const
+    {
+    return (unsigned long long)_total.n;
+    }
+
+inline double BatchMeans::getMean() const
+    {
+    return _total.mean;
+    }
+
+inline double BatchMeans::getVariance() const
+    {
+    return (_total.n > 1.0 ? _total.m2/(_total.n - 1.0) : 0.0);
+    }
+
+inline double BatchMeans::calcESS() const
+    {
+    // ESS = n*s^2/sigma^2, where the asymptotic variance sigma^2 is estimated by the
+    // batch size times the variance among batch means
+    unsigned nbatches = (unsigned)_batches.size();
+    if (nbatches < 2)
+        return 0.0;
+
+    double n = (double)nbatches*_batch_size;
+    double grand_mean = 0.0;
+    for (auto & b : _batches)
+        grand_mean += b.mean;
+    grand_mean /= nbatches;
+
+    double ss = 0.0;
+    for (auto & b : _batches)
+        ss += (b.mean - grand_mean)*(b.mean - grand_mean);
+    double sigma2 = _batch_size*ss/(nbatches - 1);
+
+    double s2 = getVariance();
+    if (sigma2 <= 0.0 || s2 <= 0.0)
+        return n;
+    return std::min(n, n*s2/sigma2);
+    }
+
+inline void BatchMeans::calcHalfStats(double & n, double & mean0, double & var0, double & mean1, double & var1) const
+    {
+    // Statistics for the first and second halves of the completed batches (the middle
+    // batch is left out if the number of batches is odd)
+    unsigned nhalf = (unsigned)_batches.size()/2;
+    Batch first = {0.0, 0.0, 0.0};
+    Batch second = {0.0, 0.0, 0.0};
+    for (unsigned i = 0; i < nhalf; ++i)
+        {
+        merge(first, _batches[i]);
+        merge(second, _batches[_batches.size() - nhalf + i]);
+        }
+    n = first.n;
+    mean0 = first.mean;
+    mean1 = second.mean;
+    var0 = (first.n > 1.0 ? first.m2/(first.n - 1.0) : 0.0);
+    var1 = (second.n > 1.0 ? second.m2/(second.n - 1.0) : 0.0);
+    }
+
+inline ConvergenceMonitor::ConvergenceMonitor() : _max_splits(10000)
+    {
+    clear();
+    }
+
+inline void ConvergenceMonitor::clear()
+    {
+    for (auto & s : _series)
+        s.clear();
+    _split_counts.clear();
+    _ntrees = 0;
+    }
+
+inline void ConvergenceMonitor::setNames(const std::vector<std::string> & names)
+    {
+    _names = names;
+    _series.assign(names.size(), BatchMeans());
+    clear();
+    }
+
+inline void ConvergenceMonitor::setMaxSplits(unsigned max_splits)
+    {
+    if (max_splits == 0)
+        throw XStrom("Maximum number of splits tracked must be positive");
+    _max_splits = max_splits;
+    clear();
+    }
+
+inline const std::vector<std::string> & ConvergenceMonitor::getNames() const
+    {
+    return _names;
+    }
+
+inline void ConvergenceMonitor::addSample(const std::vector<double> & values, const Split::treeid_t & splits)
+    {
+    if (values.size() != _series.size())
+        throw XStrom(boost::str(boost::format("Expecting %d values in convergence sample but got %d") % _series.size() % values.size()));
+    for (unsigned i = 0; i < values.size(); ++i)
+        _series[i].add(values[i]);
+    for (auto & s : splits)
+        {
+        auto it = _split_counts.find(s);
+        if (it != _split_counts.end())
+            it->second++;
+        else if (_split_counts.size() < _max_splits)
+            _split_counts.insert(std::make_pair(s, 1ULL));
+        else
+            {
+            for (auto jt = _split_counts.begin(); jt != _split_counts.end();)
+                {
+                if (--jt->second == 0)
+                    jt = _split_counts.erase(jt);
+                else
+                    ++jt;
+                }
+            }
+        }
+    _ntrees++;
+    }
+
+inline unsigned long long ConvergenceMonitor::getNumSamples() const
+    {
+    return _ntrees;
+    }
+
+inline unsigned ConvergenceMonitor::getNumTrackedSplits() const
+    {
+    return (unsigned)_split_counts.size();
+    }
+
+inline std::vector<double> ConvergenceMonitor::calcESS() const
+    {
+    std::vector<double> v;
+    for (auto & s : _series)
+        v.push_back(s.calcESS());
+    return v;
+    }
+
+inline std::vector<double> ConvergenceMonitor::calcSplitRhat(const std::vector<const ConvergenceMonitor *> & monitors)
+    {
+    // Gelman-Rubin potential scale reduction computed over 2m sequences obtained by splitting
+    // each of the m chains in half. Series that are constant in every chain get 1.0.
+    if (monitors.empty())
+        return std::vector<double>();
+    unsigned nseries = (unsigned)monitors[0]->_series.size();
+    for (auto m : monitors)
+        if (m->_series.size() != nseries)
+            throw XStrom("All chains must monitor the same series to compute split R-hat");
+
+    std::vector<double> rhat(nseries, 0.0);
+    for (unsigned k = 0; k < nseries; ++k)
+        {
+        std::vector<double> means;
+        std::vector<double> vars;
+        double nsum = 0.0;
+        for (auto m : monitors)
+            {
+            double n, mean0, var0, mean1, var1;
+            m->_series[k].calcHalfStats(n, mean0, var0, mean1, var1);
+            if (n < 2.0)
+                return std::vector<double>(nseries, std::numeric_limits<double>::infinity());
+            means.push_back(mean0);
+            means.push_back(mean1);
+            vars.push_back(var0);
+            vars.push_back(var1);
+            nsum += 2.0*n;
+            }
+        double nseq = (double)means.size();
+        double n = nsum/nseq;
+
+        double grand_mean = 0.0;
+        double W = 0.0;
+        for (unsigned i = 0; i < means.size(); ++i)
+            {
+            grand_mean += means[i];
+            W += vars[i];
+            }
+        grand_mean /= nseq;
+        W /= nseq;
+
+        double B_over_n = 0.0;
+        for (auto mean : means)
+            B_over_n += (mean - grand_mean)*(mean - grand_mean);
+        B_over_n /= (nseq - 1.0);
+
+        if (W <= 0.0)
+            rhat[k] = (B_over_n > 0.0 ? std::numeric_limits<double>::infinity() : 1.0);
+        else
+            rhat[k] = std::sqrt(((n - 1.0)/n*W + B_over_n)/W);
+        }
+    return rhat;
+    }
+
+inline double ConvergenceMonitor::calcASDSF(const std::vector<const ConvergenceMonitor *> & monitors, double min_freq)
+    {
+    // Average, over splits whose frequency reaches min_freq in at least one chain, of the
+    // standard deviation of that split's frequency across chains
+    if (monitors.size() < 2)
+        throw XStrom("Need at least two chains to compute the average standard deviation of split frequencies");
+    for (auto m : monitors)
+        if (m->_ntrees == 0)
+            throw XStrom("Cannot compute the average standard deviation of split frequencies before any trees have been sampled");
+
+    std::map<Split, std::vector<double> > freqs;
+    for (unsigned c = 0; c < monitors.size(); ++c)
+        {
+        for (auto & sc : monitors[c]->_split_counts)
+            {
+            std::vector<double> & f = freqs[sc.first];
+            f.resize(monitors.size(), 0.0);
+            f[c] = (double)sc.second/monitors[c]->_ntrees;
+            }
+        }
+
+    double nchains = (double)monitors.size();
+    double sum_sd = 0.0;
+    unsigned nsplits = 0;
+    for (auto & sf : freqs)
+        {
+        const std::vector<double> & f = sf.second;
+        if (*std::max_element(f.begin(), f.end()) < min_freq)
+            continue;
+        double mean = 0.0;
+        for (auto x : f)
+            mean += x;
+        mean /= nchains;
+        double ss = 0.0;
+        for (auto x : f)
+            ss += (x - mean)*(x - mean);
+        sum_sd += std::sqrt(ss/(nchains - 1.0));
+        nsplits++;
+        }
+    return (nsplits > 0 ? sum_sd/nsplits : 0.0);
+    }
+
+    }
@@ -5,9 +5,16 @@
 #include <vector>
 #include <numeric>
 #include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <set>
+#include <cctype>
 #include <regex>
+#include <cstring>
 #include <boost/format.hpp>
 #include "xstrom.h"
+#include "mapped_file.h"
+#include "packed_matrix.h"
 
 #include "nxsmultiformat.h"
 
@@ -19,40 +26,66 @@ class Data
         typedef std::vector<double>             pattern_counts_t;
         typedef std::vector<std::string>        taxon_names_t;
         typedef std::vector<int>                pattern_t;
-        typedef std::map< pattern_t, unsigned > pattern_map_t;
         typedef std::vector< pattern_t >        data_matrix_t;
+        typedef std::vector<PackedMatrix::word_t>                                   packed_pattern_t;
+        typedef std::unordered_map< packed_pattern_t, unsigned, PackedWordsHash >  pattern_map_t;
         typedef std::shared_ptr< Data >         SharedPtr;
 
                                                 Data();
                                                 ~Data();
 
         void                                    getDataFromFile(const std::string filename);
+        void                                    getDataFromFastaFile(const std::string filename);
+        void                                    getDataFromPhylipFile(const std::string filename);
+        void                                    setData(const taxon_names_t & taxon_names, const data_matrix_t & data_matrix);
+        void                                    setPatternSubset(const Data & source, const std::vector<unsigned> & patterns, const pattern_counts_t & counts);
+        void                                    setPatterns(const taxon_names_t & taxon_names, const std::vector<pattern_map_t> & pattern_maps);
+        void                                    reorderPatterns(const std::vector<unsigned> & taxon_order);
 
         const pattern_counts_t &                getPatternCounts() const;
         const taxon_names_t &                   getTaxonNames() const;
-        const data_matrix_t &                   getDataMatrix() const;
+        const PackedMatrix &                    getPackedMatrix() const;
+        const std::vector<unsigned> &           getPatternOrigins() const;
+        void                                    restorePatternOrder(std::vector<double> & values) const;
+        void                                    getTipStates(unsigned taxon, std::vector<int> & states) const;
+        void                                    getMissingMask(unsigned taxon, std::vector<PackedMatrix::word_t> & mask) const;
+        data_matrix_t                           getDataMatrix() const;
 
         void                                    clear();
         unsigned                                getNumPatterns() const;
         unsigned                                getSeqLen() const;
         unsigned                                getNumTaxa() const;
+        unsigned                                getNumAllMissingSites() const;
 
         std::string                             createTaxaBlock() const;
         std::string                             createTranslateStatement() const;
 
     private:
 
-        void                                    updatePatternMap(Data::pattern_t & pattern);
-        void                                    compressPatterns();
+        typedef std::pair<const char *, const char *>   segment_t;
+        typedef std::vector< std::vector<segment_t> >   segment_list_t;
+
+        void                                    updatePatternMap(const packed_pattern_t & pattern);
+        void                                    compressPatterns(const PackedMatrix & raw);
+        void                                    unpackPatternMap(unsigned ntaxa, unsigned seqlen);
+
+        static const signed char *              nucleotideCodes();
+        void                                    scanFasta(const char * begin, const char * end, taxon_names_t & names, segment_list_t & segments);
+        bool                                    scanPhylipSequential(const char * p, const char * end, unsigned ntax, unsigned nchar, taxon_names_t & names, segment_list_t & segments);
+        void                                    scanPhylipInterleaved(const char * p, const char * end, unsigned ntax, taxon_names_t & names, segment_list_t & segments);
+        void                                    compressSegments(const taxon_names_t & names, const segment_list_t & segments, unsigned nchar);
 
         pattern_map_t                           _pattern_map;       // used as workspace
         pattern_counts_t                        _pattern_counts;
         taxon_names_t                           _taxon_names;
-        data_matrix_t                           _data_matrix;
+        PackedMatrix                            _packed_matrix;     // one row per taxon, one column per pattern
+        unsigned                                _num_all_missing;   // sites dropped because every taxon was missing
+        std::vector<unsigned>                   _pattern_origins;   // index of each pattern before any reorderPatterns
     };
 
 inline Data::Data()
     {
+    _num_all_missing = 0;
     //std::cout << "Creating Data object" << std::endl;
     }
 
@@ -71,17 +104,66 @@ inline const Data::taxon_names_t & Data::getTaxonNames() const
 	return _taxon_names;
 	}
 
-inline const Data::data_matrix_t & Data::getDataMatrix() const
-	{
-	return _data_matrix;
-	}
+inline const PackedMatrix & Data::getPackedMatrix() const
+    {
+    return _packed_matrix;
+    }
+
+inline const std::vector<unsigned> & Data::getPatternOrigins() const
+    {
+    return _pattern_origins;
+    }
+
+inline void Data::restorePatternOrder(std::vector<double> & values) const
+    {
+    // Permutes per-pattern values (e.g. site log-likelihoods) back to the order the patterns had
+    // when the data were compressed, before any calls to reorderPatterns
+    if (values.size() != _pattern_origins.size())
+        throw XStrom(boost::str(boost::format("Expecting %d per-pattern values but found %d") % _pattern_origins.size() % values.size()));
+    std::vector<double> restored(values.size());
+    for (unsigned j = 0; j < values.size(); ++j)
+        restored[_pattern_origins[j]] = values[j];
+    values.swap(restored);
+    }
+
+inline void Data::getTipStates(unsigned taxon, std::vector<int> & states) const
+    {
+    // State codes for BeagleLib (0-3, or 4 for ambiguous or missing), one per pattern
+    states.resize(_packed_matrix.getNumCols());
+    if (!states.empty())
+        _packed_matrix.unpackRow(taxon, &states[0]);
+    }
+
+inline void Data::getMissingMask(unsigned taxon, std::vector<PackedMatrix::word_t> & mask) const
+    {
+    // Bit j (bit j % 64 of word j/64) is set if taxon is missing (gap or N) for pattern j
+    typedef PackedMatrix::word_t word_t;
+    const unsigned cpw = PackedMatrix::codes_per_word;
+    unsigned npatterns = _packed_matrix.getNumCols();
+    mask.assign((npatterns + 63)/64, 0);
+    const word_t * w = _packed_matrix.getRow(taxon);
+    for (unsigned j = 0; j < npatterns; ++j)
+        if (((w[j/cpw] >> (PackedMatrix::bits_per_code*(j % cpw))) & 0xF) == PackedMatrix::missing_code)
+            mask[j/64] |= (word_t)1 << (j % 64);
+    }
+
+inline Data::data_matrix_t Data::getDataMatrix() const
+    {
+    // Expanded copy of the compressed matrix; use getPackedMatrix or getTipStates where speed matters
+    data_matrix_t m(getNumTaxa());
+    for (unsigned t = 0; t < m.size(); ++t)
+        getTipStates(t, m[t]);
+    return m;
+    }
 
 inline void Data::clear()
     {
     _pattern_map.clear();
     _pattern_counts.clear();
     _taxon_names.clear();
-    _data_matrix.clear();
+    _packed_matrix.clear();
+    _num_all_missing = 0;
+    _pattern_origins.clear();
     }
 
 inline unsigned Data::getNumPatterns() const
@@ -94,92 +176,519 @@ inline unsigned Data::getNumTaxa() const
     return (unsigned)_taxon_names.size();
     }
 
+inline unsigned Data::getNumAllMissingSites() const
+    {
+    return _num_all_missing;
+    }
+
 inline unsigned Data::getSeqLen() const
     {
     return (unsigned)std::accumulate(_pattern_counts.begin(), _pattern_counts.end(), 0);
     }
 
-inline void Data::compressPatterns()
+inline void Data::compressPatterns(const PackedMatrix & raw)
     {
     // sanity checks
-    if (_data_matrix.empty())
+    if (raw.getNumRows() == 0 || raw.getNumCols() == 0)
         throw XStrom("Attempted to compress an empty data matrix");
-    if (_data_matrix[0].size() < getSeqLen())
-        throw XStrom("Attempted to compress an already compressed data matrix");
 
     // create map with keys equal to patterns and values equal to site counts
     _pattern_map.clear();
 
-    std::vector<int> pattern;
-    unsigned ntaxa = (unsigned)_data_matrix.size();
-    unsigned seqlen = (unsigned)_data_matrix[0].size();
-    for (unsigned i = 0; i < seqlen; ++i)
+    // Sites are taken 16 at a time, so each word of each row is read only once
+    typedef PackedMatrix::word_t word_t;
+    const unsigned cpw = PackedMatrix::codes_per_word;
+    unsigned ntaxa = raw.getNumRows();
+    unsigned seqlen = raw.getNumCols();
+    unsigned nwords = (ntaxa + cpw - 1)/cpw;
+    std::vector<packed_pattern_t> patterns(cpw, packed_pattern_t(nwords));
+    for (unsigned first = 0; first < seqlen; first += cpw)
         {
-        // Create vector representing pattern at site i
-        pattern.clear();
-        for (unsigned j = 0; j < ntaxa; ++j)
+        unsigned nsites = std::min(cpw, seqlen - first);
+        for (auto & pattern : patterns)
+            std::fill(pattern.begin(), pattern.end(), 0);
+        for (unsigned t = 0; t < ntaxa; ++t)
             {
-            pattern.push_back(_data_matrix[j][i]);
+            word_t w = raw.getRow(t)[first/cpw];
+            unsigned shift = PackedMatrix::bits_per_code*(t % cpw);
+            for (unsigned k = 0; k < nsites; ++k)
+                patterns[k][t/cpw] |= ((w >> (PackedMatrix::bits_per_code*k)) & 0xF) << shift;
             }
+        for (unsigned k = 0; k < nsites; ++k)
+            updatePatternMap(patterns[k]);
+        }
 
-        // Add this pattern to pattern_counts
-        updatePatternMap(pattern);
+    unpackPatternMap(ntaxa, seqlen);
+    }
+
+inline void Data::unpackPatternMap(unsigned ntaxa, unsigned seqlen)
+    {
+    // Patterns are stored in sorted order so that the layout does not depend on hashing. A
+    // pattern in which every taxon is missing contributes a factor of 1 to the likelihood
+    // whatever the tree and model, so it is dropped (and counted in _num_all_missing).
+    const unsigned cpw = PackedMatrix::codes_per_word;
+    packed_pattern_t all_missing((ntaxa + cpw - 1)/cpw, 0);
+    for (unsigned i = 0; i < ntaxa; ++i)
+        all_missing[i/cpw] |= (PackedMatrix::word_t)PackedMatrix::missing_code << (PackedMatrix::bits_per_code*(i % cpw));
+
+    _num_all_missing = 0;
+    std::vector<pattern_map_t::const_iterator> entries;
+    entries.reserve(_pattern_map.size());
+    for (auto it = _pattern_map.cbegin(); it != _pattern_map.cend(); ++it)
+        {
+        if (it->first == all_missing)
+            _num_all_missing += it->second;
+        else
+            entries.push_back(it);
         }
+    if (entries.empty())
+        throw XStrom("Every site in the data matrix is missing for all taxa");
+    std::sort(entries.begin(), entries.end(), [](pattern_map_t::const_iterator a, pattern_map_t::const_iterator b) {return a->first < b->first;});
 
-    // resize _pattern_counts
-    unsigned npatterns = (unsigned)_pattern_map.size();
+    unsigned npatterns = (unsigned)entries.size();
     _pattern_counts.resize(npatterns);
+    _packed_matrix.resize(ntaxa, npatterns);
+    _pattern_origins.resize(npatterns);
+    std::iota(_pattern_origins.begin(), _pattern_origins.end(), 0);
+    for (unsigned j = 0; j < npatterns; ++j)
+        {
+        const packed_pattern_t & pattern = entries[j]->first;
+        _pattern_counts[j] = entries[j]->second;
+        for (unsigned i = 0; i < ntaxa; ++i)
+            _packed_matrix.set(i, j, (unsigned)(pattern[i/cpw] >> (PackedMatrix::bits_per_code*(i % cpw))) & 0xF);
+        }
 
-    // resize _data_matrix so that we can use operator[] to assign values
-    _data_matrix.resize(ntaxa);
-    for (auto & row : _data_matrix)
+    // Everything has been transferred to _packed_matrix and _pattern_counts, so can now free this memory
+    entries.clear();
+    _pattern_map.clear();
+
+    unsigned total_num_sites = std::accumulate(_pattern_counts.begin(), _pattern_counts.end(), 0);
+    if (seqlen != total_num_sites + _num_all_missing)
+        throw XStrom(boost::str(boost::format("Total number of sites before compaction (%d) not equal to toal number of sites after (%d)") % seqlen % total_num_sites));
+    }
+
+inline void Data::updatePatternMap(const packed_pattern_t & pattern)
+    {
+    // Inserts pattern with a count of 1 if it has not been seen, otherwise increments its count
+    ++_pattern_map[pattern];
+    }
+
+inline void Data::setData(const taxon_names_t & taxon_names, const data_matrix_t & data_matrix)
+    {
+    // Uncompressed matrix (one row per taxon, states 0-3 or 4 for missing) supplied directly,
+    // e.g. by a simulation, rather than read from a file
+    if (taxon_names.size() != data_matrix.size())
+        throw XStrom(boost::str(boost::format("Number of taxon names (%d) not equal to number of rows in data matrix (%d)") % taxon_names.size() % data_matrix.size()));
+
+    for (auto & row : data_matrix)
         {
-        row.resize(npatterns);
+        if (row.size() != data_matrix[0].size())
+            throw XStrom("All rows of the data matrix must have the same length");
         }
 
-    unsigned j = 0;
-    for (auto & pc : _pattern_map)
+    PackedMatrix raw;
+    raw.resize((unsigned)data_matrix.size(), data_matrix.empty() ? 0 : (unsigned)data_matrix[0].size());
+    for (unsigned t = 0; t < data_matrix.size(); ++t)
+        for (unsigned s = 0; s < data_matrix[t].size(); ++s)
+            raw.set(t, s, PackedMatrix::stateToCode(data_matrix[t][s]));
+
+    clear();
+    _taxon_names = taxon_names;
+    compressPatterns(raw);
+    }
+
+inline void Data::setPatternSubset(const Data & source, const std::vector<unsigned> & patterns, const pattern_counts_t & counts)
+    {
+    // Keeps only the listed patterns of source, in the order given and with the given counts
+    if (patterns.size() != counts.size())
+        throw XStrom(boost::str(boost::format("Number of patterns (%d) not equal to number of pattern counts (%d)") % patterns.size() % counts.size()));
+
+    unsigned ntaxa = source.getNumTaxa();
+    unsigned npatterns = (unsigned)patterns.size();
+    clear();
+    _taxon_names = source._taxon_names;
+    _pattern_counts = counts;
+    _packed_matrix.resize(ntaxa, npatterns);
+    _pattern_origins.resize(npatterns);
+    std::iota(_pattern_origins.begin(), _pattern_origins.end(), 0);
+    for (unsigned j = 0; j < npatterns; ++j)
         {
-        _pattern_counts[j] = pc.second;
+        if (patterns[j] >= source.getNumPatterns())
+            throw XStrom(boost::str(boost::format("Pattern index %d out of range (data have %d patterns)") % patterns[j] % source.getNumPatterns()));
+        for (unsigned i = 0; i < ntaxa; ++i)
+            _packed_matrix.set(i, j, source._packed_matrix.get(i, patterns[j]));
+        }
+    }
 
-        unsigned i = 0;
-        for (auto sc : pc.first)
+inline void Data::setPatterns(const taxon_names_t & taxon_names, const std::vector<pattern_map_t> & pattern_maps)
+    {
+    // Compressed patterns built elsewhere (e.g. by a Simulator, one map per thread), each a packed
+    // column laid out as in compressPatterns, with its site count; the maps are merged
+    clear();
+    _taxon_names = taxon_names;
+    unsigned seqlen = 0;
+    for (auto & m : pattern_maps)
+        {
+        for (auto & entry : m)
             {
-            _data_matrix[i][j] = sc;
-            ++i;
+            _pattern_map[entry.first] += entry.second;
+            seqlen += entry.second;
             }
+        }
+    if (seqlen == 0)
+        throw XStrom("Attempted to set an empty set of patterns");
+    unpackPatternMap((unsigned)_taxon_names.size(), seqlen);
+    }
 
-        ++j;
+inline void Data::reorderPatterns(const std::vector<unsigned> & taxon_order)
+    {
+    // Sorts patterns lexicographically with taxa compared in the order given. If taxon_order
+    // lists the leaves of a tree in preorder (TreeManip::getLeafNumbersInPreorder), patterns
+    // that agree on the first clade are grouped, within those the ones that agree on the next,
+    // and so on, so neighbouring patterns tend to have equal partials in the largest subtrees.
+    // The permutation is composed into _pattern_origins, so per-pattern output can be mapped
+    // back with restorePatternOrder.
+    typedef PackedMatrix::word_t word_t;
+    const unsigned cpw = PackedMatrix::codes_per_word;
+    unsigned ntaxa = getNumTaxa();
+    unsigned npatterns = getNumPatterns();
+    if (taxon_order.size() != ntaxa)
+        throw XStrom(boost::str(boost::format("Taxon order lists %d taxa but data have %d") % taxon_order.size() % ntaxa));
+    std::vector<bool> seen(ntaxa, false);
+    for (auto t : taxon_order)
+        {
+        if (t >= ntaxa || seen[t])
+            throw XStrom("Taxon order must list each taxon exactly once");
+        seen[t] = true;
         }
 
-    // Everything has been transferred to _data_matrix and _pattern_counts, so can now free this memory
+    // Sort keys: the first taxon in taxon_order goes in the most significant bits of word 0
+    unsigned nwords = (ntaxa + cpw - 1)/cpw;
+    std::vector<word_t> keys((std::size_t)npatterns*nwords, 0);
+    for (unsigned k = 0; k < ntaxa; ++k)
+        {
+        unsigned shift = PackedMatrix::bits_per_code*(cpw - 1 - k % cpw);
+        for (unsigned j = 0; j < npatterns; ++j)
+            keys[(std::size_t)j*nwords + k/cpw] |= (word_t)_packed_matrix.get(taxon_order[k], j) << shift;
+        }
+    std::vector<unsigned> order(npatterns);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b)
+        {
+        return std::lexicographical_compare(&keys[(std::size_t)a*nwords], &keys[(std::size_t)(a + 1)*nwords], &keys[(std::size_t)b*nwords], &keys[(std::size_t)(b + 1)*nwords]);
+        });
+
+    PackedMatrix sorted;
+    sorted.resize(ntaxa, npatterns);
+    pattern_counts_t counts(npatterns);
+    std::vector<unsigned> origins(npatterns);
+    for (unsigned j = 0; j < npatterns; ++j)
+        {
+        counts[j] = _pattern_counts[order[j]];
+        origins[j] = _pattern_origins[order[j]];
+        for (unsigned i = 0; i < ntaxa; ++i)
+            sorted.set(i, j, _packed_matrix.get(i, order[j]));
+        }
+    _packed_matrix = sorted;
+    _pattern_counts.swap(counts);
+    _pattern_origins.swap(origins);
+    }
+
+inline const signed char * Data::nucleotideCodes()
+    {
+    // Maps each byte to its PackedMatrix code (the IUPAC bit mask, with gaps and missing data
+    // as 15), -1 for whitespace and -2 for characters that may not appear in a DNA sequence
+    static signed char codes[256];
+    static bool initialized = false;
+    if (!initialized)
+        {
+        std::memset(codes, -2, sizeof(codes));
+        for (const char * c = " \t\r\n\v\f"; *c; ++c)
+            codes[(unsigned char)*c] = -1;
+        const char * symbols = "ACGTURYMKSWBDHVNX?-.";
+        const signed char masks[] = {1, 2, 4, 8, 8, 5, 10, 3, 12, 6, 9, 14, 13, 11, 7, 15, 15, 15, 15, 15};
+        for (unsigned i = 0; symbols[i]; ++i)
+            {
+            codes[(unsigned char)symbols[i]] = masks[i];
+            codes[(unsigned char)std::tolower(symbols[i])] = masks[i];
+            }
+        initialized = true;
+        }
+    return codes;
+    }
+
+inline void Data::compressSegments(const taxon_names_t & names, const segment_list_t & segments, unsigned nchar)
+    {
+    // Walks all sequences in step, one cursor per taxon, so that each site pattern is encoded
+    // and added to the pattern map straight from the file; the uncompressed matrix is never built
+    const signed char * codes = nucleotideCodes();
+    unsigned ntaxa = (unsigned)names.size();
+    if (ntaxa == 0)
+        throw XStrom("No sequences found");
+    if (nchar == 0)
+        throw XStrom("Sequences are empty");
+
+    std::vector<unsigned> which(ntaxa, 0);
+    std::vector<const char *> cursor(ntaxa);
+    for (unsigned t = 0; t < ntaxa; ++t)
+        cursor[t] = segments[t].empty() ? 0 : segments[t][0].first;
+
     _pattern_map.clear();
+    const unsigned cpw = PackedMatrix::codes_per_word;
+    packed_pattern_t pattern((ntaxa + cpw - 1)/cpw);
+    for (unsigned site = 0; site < nchar; ++site)
+        {
+        std::fill(pattern.begin(), pattern.end(), 0);
+        for (unsigned t = 0; t < ntaxa; ++t)
+            {
+            signed char code = -1;
+            const char * & p = cursor[t];
+            while (code == -1)
+                {
+                if (which[t] == segments[t].size())
+                    throw XStrom(boost::str(boost::format("Sequence for taxon \"%s\" has fewer than %d characters") % names[t] % nchar));
+                if (p == segments[t][which[t]].second)
+                    {
+                    if (++which[t] < segments[t].size())
+                        p = segments[t][which[t]].first;
+                    continue;
+                    }
+                code = codes[(unsigned char)*p++];
+                }
+            if (code < 0)
+                throw XStrom(boost::str(boost::format("Invalid character '%c' in sequence for taxon \"%s\"") % *(p - 1) % names[t]));
+            pattern[t/cpw] |= (PackedMatrix::word_t)code << (PackedMatrix::bits_per_code*(t % cpw));
+            }
+        updatePatternMap(pattern);
+        }
 
-    unsigned total_num_sites = std::accumulate(_pattern_counts.begin(), _pattern_counts.end(), 0);
-    if (seqlen != total_num_sites)
-        throw XStrom(boost::str(boost::format("Total number of sites before compaction (%d) not equal to toal number of sites after (%d)") % seqlen % total_num_sites));
+    // Anything other than whitespace left over means a sequence is too long
+    for (unsigned t = 0; t < ntaxa; ++t)
+        {
+        for (unsigned k = which[t]; k < segments[t].size(); ++k)
+            {
+            const char * p = (k == which[t] ? cursor[t] : segments[t][k].first);
+            for (; p != segments[t][k].second; ++p)
+                if (codes[(unsigned char)*p] != -1)
+                    throw XStrom(boost::str(boost::format("Sequence for taxon \"%s\" has more than %d characters") % names[t] % nchar));
+            }
+        }
+
+    // Commit to storing new data (the pattern map is consumed by unpackPatternMap)
+    _pattern_counts.clear();
+    _taxon_names = names;
+    unpackPatternMap(ntaxa, nchar);
+    }
+
+inline void Data::scanFasta(const char * begin, const char * end, taxon_names_t & names, segment_list_t & segments)
+    {
+    // Each record is a '>' header line, whose first word is the taxon name, followed by the
+    // sequence on any number of lines up to the next line starting with '>'
+    const char * p = begin;
+    while (p != end && std::isspace((unsigned char)*p))
+        ++p;
+    if (p == end || *p != '>')
+        throw XStrom("FASTA file must begin with a '>' header line");
+
+    std::set<std::string> seen;
+    while (p != end)
+        {
+        assert(*p == '>');
+        const char * eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (!eol)
+            eol = end;
+
+        const char * name_begin = p + 1;
+        while (name_begin != eol && std::isspace((unsigned char)*name_begin))
+            ++name_begin;
+        const char * name_end = name_begin;
+        while (name_end != eol && !std::isspace((unsigned char)*name_end))
+            ++name_end;
+        std::string name(name_begin, name_end);
+        if (name.empty())
+            throw XStrom(boost::str(boost::format("FASTA record %d has no name") % (names.size() + 1)));
+        if (!seen.insert(name).second)
+            throw XStrom(boost::str(boost::format("Taxon name \"%s\" appears more than once") % name));
+
+        const char * seq_begin = (eol == end ? end : eol + 1);
+        const char * seq_end = seq_begin;
+        while (true)
+            {
+            seq_end = static_cast<const char *>(std::memchr(seq_end, '>', end - seq_end));
+            if (!seq_end)
+                {
+                seq_end = end;
+                break;
+                }
+            if (seq_end[-1] == '\n')
+                break;
+            ++seq_end;
+            }
+
+        names.push_back(name);
+        segments.push_back(std::vector<segment_t>(1, segment_t(seq_begin, seq_end)));
+        p = seq_end;
+        }
     }
 
-inline void Data::updatePatternMap(Data::pattern_t & pattern)
+inline bool Data::scanPhylipSequential(const char * p, const char * end, unsigned ntax, unsigned nchar, taxon_names_t & names, segment_list_t & segments)
     {
-    // If pattern is not already in pattern_map, insert it and set value to 1.
-    // If it does exist, increment its current value.
-    // (see item 24, p. 110, in Meyers' Efficient STL for more info on the technique used here)
-    pattern_map_t::iterator lowb = _pattern_map.lower_bound(pattern);
-    if (lowb != _pattern_map.end() && !(_pattern_map.key_comp()(pattern, lowb->first)))
+    // Name followed by exactly nchar characters, possibly spread over several lines, for each
+    // taxon in turn. Returns false (rather than throwing) if the file does not have this layout
+    // so that the caller can try the interleaved layout instead.
+    const signed char * codes = nucleotideCodes();
+    names.clear();
+    segments.clear();
+    for (unsigned t = 0; t < ntax; ++t)
         {
-        // this pattern has already been seen
-        lowb->second += 1;
+        while (p != end && std::isspace((unsigned char)*p))
+            ++p;
+        const char * name_begin = p;
+        while (p != end && !std::isspace((unsigned char)*p))
+            ++p;
+        if (p == name_begin)
+            return false;
+        names.push_back(std::string(name_begin, p));
+
+        const char * seq_begin = p;
+        unsigned n = 0;
+        for (; p != end && n < nchar; ++p)
+            {
+            signed char code = codes[(unsigned char)*p];
+            if (code == -2)
+                return false;
+            if (code >= 0)
+                ++n;
+            }
+        if (n < nchar)
+            return false;
+        segments.push_back(std::vector<segment_t>(1, segment_t(seq_begin, p)));
+
+        // The sequence must end at the end of a line
+        while (p != end && *p != '\n')
+            if (!std::isspace((unsigned char)*p++))
+                return false;
         }
-    else
+
+    while (p != end)
+        if (!std::isspace((unsigned char)*p++))
+            return false;
+    return true;
+    }
+
+inline void Data::scanPhylipInterleaved(const char * p, const char * end, unsigned ntax, taxon_names_t & names, segment_list_t & segments)
+    {
+    // The first ntax non-blank lines hold a name and the start of each sequence; every later
+    // non-blank line continues the sequences in the same taxon order
+    names.clear();
+    segments.assign(ntax, std::vector<segment_t>());
+    unsigned nlines = 0;
+    while (true)
         {
-        // this pattern has not yet been seen
-        _pattern_map.insert(lowb, pattern_map_t::value_type(pattern, 1));
+        while (p != end && std::isspace((unsigned char)*p))
+            ++p;
+        if (p == end)
+            break;
+        const char * eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        if (!eol)
+            eol = end;
+
+        unsigned t = nlines % ntax;
+        if (nlines < ntax)
+            {
+            const char * name_begin = p;
+            while (p != eol && !std::isspace((unsigned char)*p))
+                ++p;
+            names.push_back(std::string(name_begin, p));
+            }
+        segments[t].push_back(segment_t(p, eol));
+        ++nlines;
+        p = eol;
         }
+
+    if (nlines < ntax || nlines % ntax != 0)
+        throw XStrom(boost::str(boost::format("Interleaved PHYLIP file has %d sequence lines, which is not a multiple of the number of taxa (%d)") % nlines % ntax));
+    }
+
+inline void Data::getDataFromFastaFile(const std::string filename)
+    {
+    MappedFile file(filename);
+    taxon_names_t names;
+    segment_list_t segments;
+    scanFasta(file.begin(), file.end(), names, segments);
+
+    // Every sequence must have as many characters as the first
+    const signed char * codes = nucleotideCodes();
+    unsigned nchar = 0;
+    for (const char * p = segments[0][0].first; p != segments[0][0].second; ++p)
+        if (codes[(unsigned char)*p] != -1)
+            ++nchar;
+
+    compressSegments(names, segments, nchar);
+    }
+
+inline void Data::getDataFromPhylipFile(const std::string filename)
+    {
+    // Relaxed PHYLIP: a header line giving the numbers of taxa and sites, then names separated
+    // from sequences by whitespace, in either sequential or interleaved layout
+    MappedFile file(filename);
+    const char * p = file.begin();
+    const char * end = file.end();
+
+    unsigned dims[2] = {0, 0};
+    for (unsigned i = 0; i < 2; ++i)
+        {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            ++p;
+        if (p == end || !std::isdigit((unsigned char)*p))
+            throw XStrom(boost::str(boost::format("Expecting the numbers of taxa and sites at the start of PHYLIP file \"%s\"") % filename));
+        for (; p != end && std::isdigit((unsigned char)*p); ++p)
+            dims[i] = 10*dims[i] + (unsigned)(*p - '0');
+        }
+    unsigned ntax = dims[0];
+    unsigned nchar = dims[1];
+    if (ntax == 0)
+        throw XStrom(boost::str(boost::format("PHYLIP file \"%s\" declares no taxa") % filename));
+
+    // Skip the rest of the header line
+    const char * eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+    p = (eol ? eol + 1 : end);
+
+    taxon_names_t names;
+    segment_list_t segments;
+    if (!scanPhylipSequential(p, end, ntax, nchar, names, segments))
+        scanPhylipInterleaved(p, end, ntax, names, segments);
+
+    std::set<std::string> seen;
+    for (auto & name : names)
+        if (!seen.insert(name).second)
+            throw XStrom(boost::str(boost::format("Taxon name \"%s\" appears more than once") % name));
+
+    compressSegments(names, segments, nchar);
     }
 
 inline void Data::getDataFromFile(const std::string filename)
     {
+    // FASTA and PHYLIP files are read directly from a memory mapping; anything else is NEXUS
+        {
+        MappedFile file(filename);
+        const char * p = file.begin();
+        while (p != file.end() && std::isspace((unsigned char)*p))
+            ++p;
+        if (p != file.end() && *p == '>')
+            {
+            file.close();
+            getDataFromFastaFile(filename);
+            return;
+            }
+        if (p != file.end() && std::isdigit((unsigned char)*p))
+            {
+            file.close();
+            getDataFromPhylipFile(filename);
+            return;
+            }
+        }
+
     // See http://phylo.bio.ku.edu/ncldocs/v2.1/funcdocs/index.html for documentation
     //
     // -1 means "process all blocks found" (this is a bit field and -1 fills the bit field with 1s)
@@ -208,6 +717,7 @@ inline void Data::getDataFromFile(const std::string filename)
     // Commit to storing new data
     clear();
 
+    PackedMatrix raw;
     int numTaxaBlocks = nexusReader.GetNumTaxaBlocks();
     for (int i = 0; i < numTaxaBlocks; ++i)
         {
@@ -224,18 +734,27 @@ inline void Data::getDataFromFile(const std::string filename)
             const NxsCharactersBlock * charBlock = nexusReader.GetCharactersBlock(taxaBlock, j);
             std::string charBlockTitle = taxaBlock->GetTitle();
 
-            _data_matrix.resize(ntax);
+            unsigned nchar = (unsigned)charBlock->GetNCharTotal();
+            const NxsDiscreteDatatypeMapper * mapper = (nchar > 0 ? charBlock->GetDatatypeMapperForChar(0) : 0);
+            raw.resize(ntax, nchar);
             for (unsigned t = 0; t < ntax; ++t)
                 {
                 const NxsDiscreteStateRow & row = charBlock->GetDiscreteMatrixRow(t);
-                unsigned seqlen = (unsigned)row.size();
-                _data_matrix[t].resize(seqlen);
                 unsigned k = 0;
                 for (auto state_code : row) {
-                    if (state_code < 0)
-                        _data_matrix[t][k++] = 4;
-                    else
-                        _data_matrix[t][k++] = state_code;
+                    // NCL gives ambiguous cells codes of 4 or more; their state sets give the IUPAC mask
+                    unsigned code = PackedMatrix::missing_code;
+                    if (state_code >= 0 && state_code < 4)
+                        code = 1u << state_code;
+                    else if (state_code >= 4 && mapper)
+                        {
+                        code = 0;
+                        for (auto s : mapper->GetStateSetForCode(state_code))
+                            code |= (s >= 0 && s < 4 ? 1u << s : (unsigned)PackedMatrix::missing_code);
+                        if (code == 0)
+                            code = PackedMatrix::missing_code;
+                        }
+                    raw.set(t, k++, code);
                     }
                 }
 
@@ -245,8 +764,8 @@ inline void Data::getDataFromFile(const std::string filename)
     // No longer any need to store raw data from nexus file
     nexusReader.DeleteBlocksFromFactories();
 
-    // Compress _data_matrix so that it holds only unique patterns (counts stored in _pattern_counts)
-    compressPatterns();
+    // Compress the raw matrix so that it holds only unique patterns (counts stored in _pattern_counts)
+    compressPatterns(raw);
     }
 
 inline std::string Data::createTaxaBlock() const
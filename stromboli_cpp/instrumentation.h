@@ -0,0 +1,125 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <cassert>
+
+#define STROM_CONCAT_IMPL(a, b)     a##b
+#define STROM_CONCAT(a, b)          STROM_CONCAT_IMPL(a, b)
+
+// Hot-path counters and timers are compiled in only when STROM_INSTRUMENT is defined
+// (e.g. -DSTROM_INSTRUMENT); otherwise the STROM_TIME and STROM_COUNT macros expand to nothing
+#if defined(STROM_INSTRUMENT)
+#   define STROM_TIME(instrumentation, phase)       strom::Instrumentation::ScopedTimer STROM_CONCAT(strom_scoped_timer_, __LINE__)(instrumentation, phase)
+#   define STROM_COUNT(instrumentation, counter, n) (instrumentation).increment(counter, n)
+#else
+#   define STROM_TIME(instrumentation, phase)
+#   define STROM_COUNT(instrumentation, counter, n)
+#endif
+
+namespace strom
+    {
+
+    struct InstrumentationRecord
+        {
+        std::string         component;      // e.g. updater name or "Likelihood"
+        std::string         name;           // phase or counter name
+        unsigned long long  count;          // number of times phase was entered, or counter total
+        double              seconds;        // total wall time spent in phase (0 for pure counters)
+        };
+
+    typedef std::vector<InstrumentationRecord> InstrumentationReport;
+
+    // Accumulates call counts and elapsed time for a fixed set of phases identified by index.
+    // Owners define an enum of phase indices and pass the matching names to the constructor.
+    class Instrumentation
+        {
+        public:
+                                        Instrumentation(const std::vector<std::string> & names);
+
+            void                        clear();
+            void                        record(unsigned phase, double seconds);
+            void                        increment(unsigned counter, unsigned long long n = 1);
+            void                        appendReport(InstrumentationReport & report, const std::string & component) const;
+
+            static bool                 isEnabled();
+
+            class ScopedTimer
+                {
+                public:
+                                                ScopedTimer(Instrumentation & instrumentation, unsigned phase);
+                                                ~ScopedTimer();
+
+                private:
+                    typedef std::chrono::steady_clock clock_t;
+
+                    Instrumentation &           _instrumentation;
+                    unsigned                    _phase;
+                    clock_t::time_point         _start;
+                };
+
+        private:
+
+            std::vector<std::string>            _names;
+            std::vector<unsigned long long>     _counts;
+            std::vector<double>                 _seconds;
+
+        public:
+
+            typedef std::shared_ptr< Instrumentation > SharedPtr;
+        };
+
+inline Instrumentation::Instrumentation(const std::vector<std::string> & names) : _names(names)
+    {
+    clear();
+    }
+
+inline bool Instrumentation::isEnabled()
+    {
+#if defined(STROM_INSTRUMENT)
+    return true;
+#else
+    return false;
+#endif
+    }
+
+inline void Instrumentation::clear()
+    {
+    _counts.assign(_names.size(), 0);
+    _seconds.assign(_names.size(), 0.0);
+    }
+
+inline void Instrumentation::record(unsigned phase, double seconds)
+    {
+    assert(phase < _names.size());
+    _counts[phase]++;
+    _seconds[phase] += seconds;
+    }
+
+inline void Instrumentation::increment(unsigned counter, unsigned long long n)
+    {
+    assert(counter < _names.size());
+    _counts[counter] += n;
+    }
+
+inline void Instrumentation::appendReport(InstrumentationReport & report, const std::string & component) const
+    {
+    for (unsigned i = 0; i < _names.size(); ++i)
+        {
+        InstrumentationRecord r = {component, _names[i], _counts[i], _seconds[i]};
+        report.push_back(r);
+        }
+    }
+
+inline Instrumentation::ScopedTimer::ScopedTimer(Instrumentation & instrumentation, unsigned phase) : _instrumentation(instrumentation), _phase(phase), _start(clock_t::now())
+    {
+    }
+
+inline Instrumentation::ScopedTimer::~ScopedTimer()
+    {
+    _instrumentation.record(_phase, std::chrono::duration<double>(clock_t::now() - _start).count());
+    }
+
+    }
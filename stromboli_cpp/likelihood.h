@@ -1,15 +1,21 @@
 #pragma once
 
 #include <map>
+#include <future>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/range/adaptor/reversed.hpp>
 #include "beagle.h"
+#include "beagle_instance_pool.h"
 #include "data.h"
 #include "model.h"
 #include "xstrom.h"
 #include "tree.h"
+#include "missing_data_mask.h"
+#include "serialization.h"
+#include "instrumentation.h"
+#include "thread_pool.h"
 
 namespace strom {
 
@@ -20,10 +26,13 @@ class Likelihood
                                     ~Likelihood();
 
         void                        useStoredData(bool using_data);
+        void                        useMissingDataMasks(bool using_masks);
+        void                        setVerbose(bool verbose);
 
         std::string                 availableResources();
 
         double                      calcLogLikelihood(typename Tree::SharedPtr t);
+        std::future<double>         calcLogLikelihoodAsync(typename Tree::SharedPtr t);
 
         void                        setData(Data::SharedPtr d);
         Data::SharedPtr             getData();
@@ -31,6 +40,13 @@ class Likelihood
         void                        setModel(Model::SharedPtr model);
         Model::SharedPtr            getModel();
 
+        void                        saveBeagleBuffers(std::string & buffer);
+        void                        loadBeagleBuffers(const char * & p, const char * end);
+
+        void                        clearInstrumentation();
+        void                        appendInstrumentationReport(InstrumentationReport & report) const;
+
+        void                        invalidateCache();
 
     private:
 
@@ -40,6 +56,7 @@ class Likelihood
         void                        setDiscreteGammaShape();
         void                        setModelRateMatrix();
         void                        defineOperations(typename Tree::SharedPtr t);
+        void                        setPartialsMask(unsigned node_number);
         void                        updateTransitionMatrices();
         void                        calculatePartials();
 
@@ -48,6 +65,26 @@ class Likelihood
         std::vector<int>            _operations;
         std::vector<int>            _pmatrix_index;
         std::vector<double>         _edge_lengths;
+        std::vector<int>            _scale_indices;
+
+        // What each BeagleLib buffer was last computed from, so that calcLogLikelihood can skip
+        // transition matrices whose edge length is unchanged and partials with nothing changed
+        // below them. Matrices are indexed by the number of the node at the child end of the
+        // edge and partials by node number.
+        bool                        _cache_valid;
+        std::string                 _cached_model_state;
+        std::vector<double>         _cached_edge_lengths;
+        std::vector<int>            _cached_children;
+        std::vector<bool>           _matrix_updated;
+        std::vector<bool>           _partials_updated;
+
+        // Patterns for which every leaf below a node is missing, whose partials BeagleLib then
+        // fills with ones instead of computing them, and the mask it was last given for each
+        // partials buffer (none when the instance is acquired)
+        MissingDataMask             _missing_data_mask;
+        std::vector<MissingDataMask::mask_t> _beagle_masks;
+        std::vector<int>            _pattern_mask;
+        bool                        _using_masks;
 
         Data::SharedPtr             _data;
         Model::SharedPtr            _model;
@@ -58,12 +95,18 @@ class Likelihood
         bool                        _prefer_gpu;
 
         bool                        _using_data;
+        bool                        _verbose;
+
+        enum {_stage_total, _stage_rate_matrix, _stage_gamma, _stage_operations, _stage_transition_matrices, _stage_partials, _stage_edge_likelihood, _counter_partials_operations, _counter_transition_matrices};
+        Instrumentation             _instrumentation;
+
+        TaskRunner::SharedPtr       _runner;            // created by the first calcLogLikelihoodAsync
 
     public:
         typedef std::shared_ptr< Likelihood > SharedPtr;
     };
 
-inline Likelihood::Likelihood()
+inline Likelihood::Likelihood() : _instrumentation({"calcLogLikelihood", "setModelRateMatrix", "setDiscreteGammaShape", "defineOperations", "updateTransitionMatrices", "calculatePartials", "edgeLogLikelihood", "partialsOperations", "transitionMatrices"})
     {
     _instance   = -1;
     _ntaxa      = 0;
@@ -72,7 +115,10 @@ inline Likelihood::Likelihood()
     _rooted     = false;
     _prefer_gpu = false;
     _using_data = true;
+    _using_masks = true;
+    _verbose    = true;
     _model      = Model::SharedPtr(new Model());
+    invalidateCache();
 
 
     // store BeagleLib error codes so that useful
@@ -92,11 +138,13 @@ inline Likelihood::Likelihood()
 
 inline Likelihood::~Likelihood()
     {
+    // Finish any pending asynchronous evaluation before the instance is released
+    _runner.reset();
     if (_instance >= 0)
         {
-        int code = beagleFinalizeInstance(_instance);
+        int code = BeagleInstancePool::getPool().release(_instance);
         if (code != 0)
-            std::cerr << boost::str(boost::format("Likelihood destructor failed to finalize BeagleLib instance. BeagleLib error code was %d (%s).") % code % _beagle_error[code]) << std::endl;
+            std::cerr << boost::str(boost::format("Likelihood destructor failed to release BeagleLib instance. BeagleLib error code was %d (%s).") % code % _beagle_error[code]) << std::endl;
         }
     //std::cout << "Destroying a Likelihood" << std::endl;
     }
@@ -127,11 +175,11 @@ inline void Likelihood::setData(Data::SharedPtr data)
     _data = data;
     if (_instance >= 0)
         {
-        // initBeagleLib function was previously called, so
-        // finalize existing instance and create new one
-        int code = beagleFinalizeInstance(_instance);
+        // initBeagleLib function was previously called, so return the
+        // existing instance to the pool and acquire one sized for the new data
+        int code = BeagleInstancePool::getPool().release(_instance);
         if (code != 0)
-            throw XStrom(boost::str(boost::format("Likelihood setData function failed to finalize BeagleLib instance. BeagleLib error code was %d (%s).") % code % _beagle_error[code]));
+            throw XStrom(boost::str(boost::format("Likelihood setData function failed to release BeagleLib instance. BeagleLib error code was %d (%s).") % code % _beagle_error[code]));
         _instance = -1;
         assert(_ntaxa > 0 && _nstates > 0 && _npatterns > 0);
         initBeagleLib();
@@ -143,10 +191,11 @@ inline void Likelihood::setModel(Model::SharedPtr model)
     _model = model;
     if (_instance >= 0)
         {
-        // init function was previously called, so set the model and create new BeagleLib instance
-        int code = beagleFinalizeInstance(_instance);
+        // init function was previously called, so set the model and acquire a BeagleLib instance
+        // (the same one comes back from the pool if the number of rate categories is unchanged)
+        int code = BeagleInstancePool::getPool().release(_instance);
         if (code != 0)
-            throw XStrom(boost::str(boost::format("Likelihood setModel function failed to finalize BeagleLib instance. BeagleLib error code was %d (%s).") % code % _beagle_error[code]));
+            throw XStrom(boost::str(boost::format("Likelihood setModel function failed to release BeagleLib instance. BeagleLib error code was %d (%s).") % code % _beagle_error[code]));
         _instance = -1;
         assert(_ntaxa > 0 && _nstates > 0 && _npatterns > 0);
         initBeagleLib();
@@ -158,11 +207,48 @@ inline Model::SharedPtr Likelihood::getModel()
     return _model;
     }
 
+inline void Likelihood::clearInstrumentation()
+    {
+    _instrumentation.clear();
+    }
+
+inline void Likelihood::appendInstrumentationReport(InstrumentationReport & report) const
+    {
+    _instrumentation.appendReport(report, "Likelihood");
+    }
+
 inline void Likelihood::useStoredData(bool using_data)
     {
     _using_data = using_data;
     }
 
+inline void Likelihood::useMissingDataMasks(bool using_masks)
+    {
+    // Masks change no likelihood (beyond rounding) and can be switched off to check just that.
+    // Masks already passed to BeagleLib are cleared, since they would go out of date as soon as
+    // the topology changed.
+    _using_masks = using_masks;
+    if (_using_masks || _instance < 0)
+        return;
+    for (unsigned i = 0; i < _beagle_masks.size(); ++i)
+        {
+        bool any_missing = false;
+        for (auto w : _beagle_masks[i])
+            any_missing = any_missing || (w != 0);
+        if (!any_missing)
+            continue;
+        int code = beagleSetPartialsMask(_instance, i, NULL);
+        if (code != 0)
+            throw XStrom(boost::str(boost::format("failed to clear partials mask for node %d. BeagleLib error code was %d (%s)") % i % code % _beagle_error[code]));
+        _beagle_masks[i].assign(_beagle_masks[i].size(), 0);
+        }
+    }
+
+inline void Likelihood::setVerbose(bool verbose)
+    {
+    _verbose = verbose;
+    }
+
 inline void Likelihood::initBeagleLib()
     {
     // a non-operation ("no-op") if a valid instance has already been created
@@ -174,15 +260,21 @@ inline void Likelihood::initBeagleLib()
     _ntaxa      = _data->getNumTaxa();
     _npatterns  = _data->getNumPatterns();
     _nstates    = 4;
-    _rooted     = false;
     _prefer_gpu = false;
 
-    std::cout << "Sequence length:    " << _data->getSeqLen() << std::endl;
-    std::cout << "Number of taxa:     " << _ntaxa << std::endl;
-    std::cout << "Number of patterns: " << _npatterns << std::endl;
+    if (_verbose)
+        {
+        std::cout << "Sequence length:    " << _data->getSeqLen() << std::endl;
+        std::cout << "Number of taxa:     " << _ntaxa << std::endl;
+        std::cout << "Number of patterns: " << _npatterns << std::endl;
+        if (_data->getNumAllMissingSites() > 0)
+            std::cout << "All-missing sites:  " << _data->getNumAllMissingSites() << " (dropped)" << std::endl;
+        }
 
-    unsigned num_internals        = (_rooted ? (_ntaxa - 1) : (_ntaxa - 2));
-    unsigned num_transition_probs = (_rooted ? (2*_ntaxa - 2) : (2*_ntaxa - 3));
+    // Buffers are allocated for a rooted tree, which has one more internal node and one more
+    // edge than an unrooted tree, so the same instance serves both
+    unsigned num_internals        = _ntaxa - 1;
+    unsigned num_transition_probs = 2*_ntaxa - 2;
 
     long requirementFlags = 0;
     requirementFlags |= BEAGLE_FLAG_PRECISION_DOUBLE;
@@ -195,55 +287,63 @@ inline void Likelihood::initBeagleLib()
 
     requirementFlags |= BEAGLE_FLAG_SCALING_MANUAL;
 
+    BeagleInstancePool::Key key;
+    key.ntips               = _ntaxa;
+    key.npartials           = num_internals;
+    key.ncompact            = _ntaxa;
+    key.nstates             = _nstates;
+    key.npatterns           = _npatterns;
+    key.neigen              = 1;
+    key.nmatrices           = num_transition_probs;
+    key.ncateg              = _model->_num_categ;
+    key.nscalers            = num_internals + 1;
+    key.preference_flags    = preferenceFlags;
+    key.requirement_flags   = requirementFlags;
+
     BeagleInstanceDetails instance_details;
-    _instance = beagleCreateInstance(
-         _ntaxa,                    // tips
-         num_internals,             // partials
-         _ntaxa,                    // sequences
-         _nstates,                  // states
-         _npatterns,                // patterns
-         1,                         // models
-         num_transition_probs,      // transition matrices
-         _model->_num_categ,        // rate categories
-         num_internals + 1,         // scale buffers
-         NULL,                      // resource restrictions
-         0,                         // length of resource list
-         preferenceFlags,           // preferred flags
-         requirementFlags,          // required flags
-         &instance_details);        // pointer for details
+    _instance = BeagleInstancePool::getPool().acquire(key, &instance_details);
 
     if (_instance < 0)
         {
-        // beagleCreateInstance returns one of the following:
+        // acquire returns one of the following:
         //   valid instance (0, 1, 2, ...)
         //   error code (negative integer)
-        throw XStrom(boost::str(boost::format("Likelihood init function failed to create Likelihood instance (BeagleLib error code was %d)") % _beagle_error[_instance]));
+        throw XStrom(boost::str(boost::format("Likelihood init function failed to create Likelihood instance (BeagleLib error code was %d: %s)") % _instance % _beagle_error[_instance]));
         }
 
     setTipStates();
     setPatternWeights();
+    invalidateCache();
+
+    _missing_data_mask.setData(_data);
+    _beagle_masks.assign(2*_ntaxa, MissingDataMask::mask_t((_npatterns + 63)/64, 0));
 
     //std::cout << boost::str(boost::format("BeagleLib instance (%d) created.") % _instance) << std::endl;
     }
 
+inline void Likelihood::invalidateCache()
+    {
+    _cache_valid = false;
+    _cached_model_state.clear();
+    }
+
 inline void Likelihood::setTipStates()
     {
     assert(_data);
 
-    const Data::data_matrix_t & data_matrix = _data->getDataMatrix();
-    unsigned i = 0;
-
-    typedef const std::vector<int> & ref_int_vect_t;
-    for (ref_int_vect_t v : data_matrix)
+    // Patterns are stored packed in Data and expanded to int state codes one taxon at a time
+    std::vector<int> states;
+    unsigned ntaxa = _data->getNumTaxa();
+    for (unsigned i = 0; i < ntaxa; ++i)
         {
+        _data->getTipStates(i, states);
         int code = beagleSetTipStates(
             _instance,      // Instance number
             i,              // Index of destination compactBuffer
-            &v[0]);         // Pointer to compact states vector
+            &states[0]);    // Pointer to compact states vector
 
         if (code != 0)
             throw XStrom(boost::str(boost::format("failed to set tip state for taxon %d (\"%s\"; BeagleLib error code was %d)") % (i+1) % _data->getTaxonNames()[i] % code % _beagle_error[code]));
-        ++i;
         }
     }
 
@@ -296,67 +396,127 @@ inline void Likelihood::setModelRateMatrix()
 
 inline void Likelihood::defineOperations(typename Tree::SharedPtr t)
     {
+    // Node numbers do not change unless the topology does, so buffers stay attached to the same
+    // nodes across moves that only change edge lengths or node heights. A transition matrix is
+    // recomputed only if its edge length differs from the one last used, and a partial only if
+    // one of its children, the child partials or the child transition matrices have changed.
     _operations.clear();
     _pmatrix_index.clear();
     _edge_lengths.clear();
+    _scale_indices.clear();
+
+    unsigned nnodes = 2*_ntaxa;
+    if (!_cache_valid)
+        {
+        _cached_edge_lengths.assign(nnodes, -1.0);
+        _cached_children.assign(2*nnodes, -1);
+        }
+    _matrix_updated.assign(nnodes, false);
+    _partials_updated.assign(nnodes, false);
 
+    Node * first = t->_preorder[0];
     for (auto nd : boost::adaptors::reverse(t->_levelorder))
         {
         assert(nd->_number >= 0);
-        if (!nd->_left_child)
+
+        // The first preorder node of a rooted tree is the root of the ingroup and has no edge
+        // below it; in an unrooted tree its edge leads to the leaf serving as the root, and the
+        // transition matrix for that edge belongs to that leaf
+        if (nd != first || !t->_is_rooted)
             {
-            // This is a leaf
-            _pmatrix_index.push_back(nd->_number);
-            _edge_lengths.push_back(nd->_edge_length);
+            int tmatrix = (nd == first ? t->_root->_number : nd->_number);
+            if (!_cache_valid || _cached_edge_lengths[tmatrix] != nd->_edge_length)
+                {
+                _pmatrix_index.push_back(tmatrix);
+                _edge_lengths.push_back(nd->_edge_length);
+                _cached_edge_lengths[tmatrix] = nd->_edge_length;
+                _matrix_updated[tmatrix] = true;
+                }
             }
-        else
+
+        if (nd->_left_child)
             {
             // This is an internal node
-            _pmatrix_index.push_back(nd->_number);
-            _edge_lengths.push_back(nd->_edge_length);
+            assert(nd->_left_child->_right_sib);
+            assert(!nd->_left_child->_right_sib->_right_sib);  // assumes binary tree
+            int left = nd->_left_child->_number;
+            int right = nd->_left_child->_right_sib->_number;
+            int partial = nd->_number;
+            int scaler = nd->_number - _ntaxa + 1;
+            _scale_indices.push_back(scaler);
 
-            // Internal nodes have partials to be calculated, so define
-            // an operation to compute the partials for this node
+            bool recompute = !_cache_valid;
+            recompute = recompute || _cached_children[2*partial] != left || _cached_children[2*partial + 1] != right;
+            recompute = recompute || _matrix_updated[left] || _matrix_updated[right];
+            recompute = recompute || _partials_updated[left] || _partials_updated[right];
+            if (!recompute)
+                continue;
+
+            _cached_children[2*partial] = left;
+            _cached_children[2*partial + 1] = right;
+            _partials_updated[partial] = true;
+            if (_using_masks && _missing_data_mask.hasAnyMissing())
+                setPartialsMask(partial);
 
             // 1. destination partial to be calculated
-            int partial = nd->_number;
             _operations.push_back(partial);
 
             // 2. destination scaling buffer index to write to
-            int scaler = nd->_number - _ntaxa + 1;
             _operations.push_back(scaler);
 
             // 3. destination scaling buffer index to read from
             _operations.push_back(BEAGLE_OP_NONE);
 
             // 4. left child partial index
-            partial = nd->_left_child->_number;
-            _operations.push_back(partial);
+            _operations.push_back(left);
 
             // 5. left child transition matrix index
-            int tmatrix = nd->_left_child->_number;
-            _operations.push_back(tmatrix);
+            _operations.push_back(left);
 
             // 6. right child partial index
-            assert(nd->_left_child);
-            assert(nd->_left_child->_right_sib);
-            partial = nd->_left_child->_right_sib->_number;
-            _operations.push_back(partial); // assumes binary tree
+            _operations.push_back(right);
 
             // 7. right child transition matrix index
-            tmatrix = nd->_left_child->_right_sib->_number;
-            _operations.push_back(tmatrix);
+            _operations.push_back(right);
+            }
         }
+    _cache_valid = true;
     }
 
-    // if tree is unrooted and thus "rooted" at a leaf, need to
-    // use the transition matrix associated with the leaf
-    if (!t->_is_rooted)
-        _pmatrix_index[_pmatrix_index.size()-1] = t->_root->_number;
+inline void Likelihood::setPartialsMask(unsigned node_number)
+    {
+    // Called for each partial about to be recomputed. A node's mask changes only if the leaves
+    // below it do, and then the partial is recomputed, so masks are only passed on here and only
+    // when they differ from the one BeagleLib already has for the buffer.
+    const MissingDataMask::mask_t & mask = _missing_data_mask.getMask(node_number);
+    MissingDataMask::mask_t & beagle_mask = _beagle_masks[node_number];
+    if (mask == beagle_mask)
+        return;
+
+    bool any_missing = false;
+    for (auto w : mask)
+        any_missing = any_missing || (w != 0);
+
+    int code = 0;
+    if (any_missing)
+        {
+        _pattern_mask.resize(_npatterns);
+        for (unsigned j = 0; j < _npatterns; ++j)
+            _pattern_mask[j] = (int)((mask[j/64] >> (j % 64)) & 1);
+        code = beagleSetPartialsMask(_instance, node_number, &_pattern_mask[0]);
+        }
+    else
+        code = beagleSetPartialsMask(_instance, node_number, NULL);
+    if (code != 0)
+        throw XStrom(boost::str(boost::format("failed to set partials mask for node %d. BeagleLib error code was %d (%s)") % node_number % code % _beagle_error[code]));
+    beagle_mask = mask;
     }
 
 inline void Likelihood::updateTransitionMatrices()
     {
+    STROM_COUNT(_instrumentation, _counter_transition_matrices, _pmatrix_index.size());
+    if (_pmatrix_index.empty())
+        return;
     int code = beagleUpdateTransitionMatrices(
         _instance,                      // Instance number
         0,                              // Index of eigen-decomposition buffer
@@ -372,20 +532,185 @@ inline void Likelihood::updateTransitionMatrices()
 
 inline void Likelihood::calculatePartials()
     {
-    int code = beagleResetScaleFactors(_instance, 0);
-    if (code != 0)
-        throw XStrom(boost::str(boost::format("failed to reset scale factors in calculatePartials. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
-
     // Calculate or queue for calculation partials using a list of operations
     int totalOperations = (int)(_operations.size()/7);
-    code = beagleUpdatePartials(
-        _instance,                              // Instance number
-        (BeagleOperation *) &_operations[0],    // BeagleOperation list specifying operations
-        totalOperations,                        // Number of operations
-        0);                                     // Index number of scaleBuffer to store accumulated factors
+    STROM_COUNT(_instrumentation, _counter_partials_operations, totalOperations);
+    int code = 0;
+    if (totalOperations > 0)
+        {
+        code = beagleUpdatePartials(
+            _instance,                              // Instance number
+            (BeagleOperation *) &_operations[0],    // BeagleOperation list specifying operations
+            totalOperations,                        // Number of operations
+            BEAGLE_OP_NONE);                        // Index number of scaleBuffer to store accumulated factors
 
+        if (code != 0)
+            throw XStrom(boost::str(boost::format("failed to update partials. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+        }
+
+    // Only some partials may have been recomputed, so the cumulative scale factors are rebuilt
+    // from the scale buffers of all internal nodes
+    code = beagleResetScaleFactors(_instance, 0);
+    if (code != 0)
+        throw XStrom(boost::str(boost::format("failed to reset scale factors in calculatePartials. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+
+    code = beagleAccumulateScaleFactors(_instance, &_scale_indices[0], (int)_scale_indices.size(), 0);
     if (code != 0)
-        throw XStrom(boost::str(boost::format("failed to update partials. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+        throw XStrom(boost::str(boost::format("failed to accumulate scale factors in calculatePartials. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+    }
+
+inline void Likelihood::saveBeagleBuffers(std::string & buffer)
+    {
+    // Copies every internal partial, scale buffer and transition matrix out of the BeagleLib
+    // instance, preceded by the dimensions needed to check that they fit when loaded again and
+    // followed by the record of what they were computed from (see defineOperations), so that
+    // loadBeagleBuffers can restore a cache that calcLogLikelihood will reuse
+    initBeagleLib();
+
+    // All buffers allocated by initBeagleLib, which sizes them for a rooted tree
+    unsigned num_internals        = _ntaxa - 1;
+    unsigned num_transition_probs = 2*_ntaxa - 2;
+    unsigned ncateg               = _model->_num_categ;
+    appendBinary(buffer, (std::uint32_t)_ntaxa);
+    appendBinary(buffer, (std::uint32_t)_npatterns);
+    appendBinary(buffer, (std::uint32_t)_nstates);
+    appendBinary(buffer, (std::uint32_t)ncateg);
+    appendBinary(buffer, (std::uint8_t)(_rooted ? 1 : 0));
+
+    std::vector<double> v(_nstates*_npatterns*ncateg);
+    for (unsigned i = 0; i < num_internals; ++i)
+        {
+        int code = beagleGetPartials(_instance, _ntaxa + i, BEAGLE_OP_NONE, &v[0]);
+        if (code != 0)
+            throw XStrom(boost::str(boost::format("failed to get partials. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+        buffer.append(reinterpret_cast<const char *>(&v[0]), v.size()*sizeof(double));
+        }
+
+    v.resize(_npatterns);
+    for (unsigned i = 0; i < num_internals + 1; ++i)
+        {
+        int code = beagleGetScaleFactors(_instance, i, &v[0]);
+        if (code != 0)
+            throw XStrom(boost::str(boost::format("failed to get scale factors. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+        buffer.append(reinterpret_cast<const char *>(&v[0]), v.size()*sizeof(double));
+        }
+
+    v.resize(_nstates*_nstates*ncateg);
+    for (unsigned i = 0; i < num_transition_probs; ++i)
+        {
+        int code = beagleGetTransitionMatrix(_instance, i, &v[0]);
+        if (code != 0)
+            throw XStrom(boost::str(boost::format("failed to get transition matrix. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+        buffer.append(reinterpret_cast<const char *>(&v[0]), v.size()*sizeof(double));
+        }
+
+    appendBinary(buffer, (std::uint8_t)(_cache_valid ? 1 : 0));
+    appendBinaryString(buffer, _cached_model_state);
+    appendBinary(buffer, (std::uint32_t)_cached_edge_lengths.size());
+    for (auto x : _cached_edge_lengths)
+        appendBinary(buffer, x);
+    appendBinary(buffer, (std::uint32_t)_cached_children.size());
+    for (auto x : _cached_children)
+        appendBinary(buffer, (std::int32_t)x);
+    }
+
+inline void Likelihood::loadBeagleBuffers(const char * & p, const char * end)
+    {
+    // Call after the model has been restored: the cache is kept only if the buffers were
+    // computed under the model's current parameters, which are then passed to BeagleLib
+    // (the instance may be fresh), so the next calcLogLikelihood recomputes only what differs
+    // between the saved tree and the one it is given
+    initBeagleLib();
+
+    std::uint32_t ntaxa = 0;
+    std::uint32_t npatterns = 0;
+    std::uint32_t nstates = 0;
+    std::uint32_t ncateg = 0;
+    std::uint8_t rooted = 0;
+    readBinary(p, end, ntaxa);
+    readBinary(p, end, npatterns);
+    readBinary(p, end, nstates);
+    readBinary(p, end, ncateg);
+    readBinary(p, end, rooted);
+    if (ntaxa != _ntaxa || npatterns != _npatterns || nstates != _nstates || ncateg != _model->_num_categ)
+        throw XStrom("Saved BeagleLib buffers do not match the dimensions of the current likelihood");
+    _rooted = (rooted != 0);
+
+    unsigned num_internals        = _ntaxa - 1;
+    unsigned num_transition_probs = 2*_ntaxa - 2;
+
+    std::vector<double> v(_nstates*_npatterns*ncateg);
+    for (unsigned i = 0; i < num_internals; ++i)
+        {
+        for (auto & x : v)
+            readBinary(p, end, x);
+        int code = beagleSetPartials(_instance, _ntaxa + i, &v[0]);
+        if (code != 0)
+            throw XStrom(boost::str(boost::format("failed to set partials. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+        }
+
+    v.resize(_npatterns);
+    for (unsigned i = 0; i < num_internals + 1; ++i)
+        {
+        for (auto & x : v)
+            readBinary(p, end, x);
+        int code = beagleSetScaleFactors(_instance, i, &v[0]);
+        if (code != 0)
+            throw XStrom(boost::str(boost::format("failed to set scale factors. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+        }
+
+    v.resize(_nstates*_nstates*ncateg);
+    for (unsigned i = 0; i < num_transition_probs; ++i)
+        {
+        for (auto & x : v)
+            readBinary(p, end, x);
+        int code = beagleSetTransitionMatrix(_instance, i, &v[0], 1.0);
+        if (code != 0)
+            throw XStrom(boost::str(boost::format("failed to set transition matrix. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+        }
+
+    std::uint8_t cache_valid = 0;
+    std::string cached_model_state;
+    std::uint32_t n = 0;
+    readBinary(p, end, cache_valid);
+    readBinaryString(p, end, cached_model_state);
+    readBinary(p, end, n);
+    if (n != 2*_ntaxa)
+        throw XStrom("Saved BeagleLib cache does not match the number of taxa");
+    _cached_edge_lengths.resize(n);
+    for (auto & x : _cached_edge_lengths)
+        readBinary(p, end, x);
+    readBinary(p, end, n);
+    if (n != 4*_ntaxa)
+        throw XStrom("Saved BeagleLib cache does not match the number of taxa");
+    _cached_children.resize(n);
+    for (auto & x : _cached_children)
+        {
+        std::int32_t child = 0;
+        readBinary(p, end, child);
+        x = child;
+        }
+
+    std::string model_state;
+    _model->saveState(model_state);
+    if (!cache_valid || model_state != cached_model_state)
+        {
+        invalidateCache();
+        return;
+        }
+    setModelRateMatrix();
+    setDiscreteGammaShape();
+    _cached_model_state.swap(cached_model_state);
+    _cache_valid = true;
+    }
+
+inline std::future<double> Likelihood::calcLogLikelihoodAsync(typename Tree::SharedPtr t)
+    {
+    // Runs calcLogLikelihood(t) on this likelihood's background thread. Until the future is
+    // ready, the caller may read t and the model but must not change them or use this object.
+    if (!_runner)
+        _runner.reset(new TaskRunner());
+    return _runner->submit([this, t]{return calcLogLikelihood(t);});
     }
 
 inline double Likelihood::calcLogLikelihood(typename Tree::SharedPtr t)
@@ -393,41 +718,90 @@ inline double Likelihood::calcLogLikelihood(typename Tree::SharedPtr t)
     if (!_using_data)
         return 0.0;
 
-    if (t->_is_rooted)
-        throw XStrom("can only compute likelihoods for unrooted trees currently");
-
     if (!_data)
         throw XStrom("must call setData before calcLogLikelihood");
 
     initBeagleLib(); // this is a no-op if a valid instance already exists
 
-    // Assuming "root" is leaf 0
-    assert(t->_root->_number == 0 && t->_root->_left_child == t->_preorder[0] && !t->_preorder[0]->_right_sib);
+    // Unrooted trees are "rooted" at leaf 0; rooted trees have a root node above the ingroup root
+    assert(t->_root->_left_child == t->_preorder[0] && !t->_preorder[0]->_right_sib);
+    assert(t->_is_rooted || t->_root->_number == 0);
+    if (t->_is_rooted != _rooted)
+        {
+        _rooted = t->_is_rooted;
+        invalidateCache();
+        }
 
-    // Assuming there are as many transition matrices as there are edge lengths
-    assert(_pmatrix_index.size() == _edge_lengths.size());
+    STROM_TIME(_instrumentation, _stage_total);
 
-    setModelRateMatrix();
-    setDiscreteGammaShape();
-    defineOperations(t);
-    updateTransitionMatrices();
-    calculatePartials();
+    // The rate matrix and gamma rates are only passed to BeagleLib again (invalidating every
+    // transition matrix) when some model parameter has changed
+    std::string model_state;
+    _model->saveState(model_state);
+    if (model_state != _cached_model_state)
+        {
+        invalidateCache();
+            {
+            STROM_TIME(_instrumentation, _stage_rate_matrix);
+            setModelRateMatrix();
+            }
+            {
+            STROM_TIME(_instrumentation, _stage_gamma);
+            setDiscreteGammaShape();
+            }
+        _cached_model_state.swap(model_state);
+        }
+        {
+        STROM_TIME(_instrumentation, _stage_operations);
+        if (_using_masks && _missing_data_mask.hasAnyMissing())
+            _missing_data_mask.update(t);
+        defineOperations(t);
+        }
+        {
+        STROM_TIME(_instrumentation, _stage_transition_matrices);
+        updateTransitionMatrices();
+        }
+        {
+        STROM_TIME(_instrumentation, _stage_partials);
+        calculatePartials();
+        }
 
-    // The beagleCalculateEdgeLogLikelihoods function integrates a list of partials
-    // at a parent and child node with respect to a set of partials-weights and
-    // state frequencies to return the log likelihood and first and second derivative sums
     int stateFrequencyIndex  = 0;
     int categoryWeightsIndex = 0;
     int cumulativeScalingIndex = 0;
     double log_likelihood = 0.0;
 
+    STROM_TIME(_instrumentation, _stage_edge_likelihood);
+    int code = 0;
+    if (t->_is_rooted)
+        {
+        // Integrate the partials at the root of the ingroup over the state frequencies
+        int index_root = t->_preorder[0]->_number;
+        code = beagleCalculateRootLogLikelihoods(
+            _instance,                  // instance number
+            &index_root,                // indices of root partialsBuffers
+            &categoryWeightsIndex,      // weights to apply to each partialsBuffer
+            &stateFrequencyIndex,       // state frequencies for each partialsBuffer
+            &cumulativeScalingIndex,    // scaleBuffers containing accumulated factors
+            1,                          // Number of partialsBuffer
+            &log_likelihood);           // destination for log likelihood
+
+        if (code != 0)
+            throw XStrom(boost::str(boost::format("failed to calculate root logLikelihoods in CalcLogLikelihood. BeagleLib error code was %d (%s)") % code % _beagle_error[code]));
+        return log_likelihood;
+        }
+
+    // The beagleCalculateEdgeLogLikelihoods function integrates a list of partials
+    // at a parent and child node with respect to a set of partials-weights and
+    // state frequencies to return the log likelihood and first and second derivative sums
+
     // index_focal_child is the root node
     int index_focal_child  = t->_root->_number;
 
     // index_focal_parent is the only child of root node
     int index_focal_parent = t->_preorder[0]->_number;
 
-    int code = beagleCalculateEdgeLogLikelihoods(
+    code = beagleCalculateEdgeLogLikelihoods(
         _instance,                  // instance number
         &index_focal_parent,        // indices of parent partialsBuffers
         &index_focal_child,         // indices of child partialsBuffers
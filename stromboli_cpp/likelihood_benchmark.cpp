@@ -0,0 +1,290 @@
+//
+//  likelihood_benchmark.cpp
+//
+//  Stand-alone end-to-end throughput benchmark (no R dependency). For every combination of
+//  number of taxa, number of site patterns and number of rate categories in the grid, a random
+//  tree and an alignment (random, or simulated on the tree) are generated, the patterns are put
+//  in each requested order (as compressed, or grouped by Data::reorderPatterns using the tree's
+//  leaves in preorder) and the following are timed:
+//
+//      Likelihood::calcLogLikelihood
+//      Updater::update for each updater of a Chain
+//      Chain::nextStep
+//
+//  Results are written as JSON (one object per line) or CSV so that runs from different
+//  commits can be compared. Not part of the main target; build it on its own, e.g.
+//
+//      c++ -std=gnu++14 -O2 -I. likelihood_benchmark.cpp <ncl and beagle sources> -ldl -o likelihood_benchmark
+//
+//  Usage:
+//
+//      likelihood_benchmark [--taxa 8,16,32,64] [--patterns 100,1000,10000] [--categ 1,4]
+//                           [--data random|simulated] [--order none,tree]
+//                           [--reps 20] [--seed 1] [--format json|csv] [--output file]
+//
+//  Uniform random data have no pattern similarity to exploit, so use --data simulated (where
+//  --patterns gives the number of sites) to measure the effect of --order.
+//
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <boost/format.hpp>
+#include "node.h"
+#include "lot.h"
+#include "data.h"
+#include "model.h"
+#include "likelihood.h"
+#include "tree_manip.h"
+#include "chain.h"
+#include "simulator.h"
+#include "xstrom.h"
+
+using namespace strom;
+
+const double strom::Node::_smallest_edge_length = 1.0e-12;
+const double strom::Updater::_log_minus_infinity = -std::numeric_limits<double>::max();
+
+struct BenchmarkResult
+    {
+    unsigned    ntaxa;
+    unsigned    npatterns;
+    unsigned    ncateg;
+    std::string order;
+    std::string operation;
+    unsigned    reps;
+    double      mean_secs;
+    double      min_secs;
+    };
+
+std::vector<unsigned> parseList(const std::string & s)
+    {
+    std::vector<unsigned> v;
+    std::istringstream iss(s);
+    std::string item;
+    while (std::getline(iss, item, ','))
+        v.push_back((unsigned)std::stoul(item));
+    return v;
+    }
+
+std::vector<std::string> parseNames(const std::string & s)
+    {
+    std::vector<std::string> v;
+    std::istringstream iss(s);
+    std::string item;
+    while (std::getline(iss, item, ','))
+        v.push_back(item);
+    return v;
+    }
+
+// Times f() reps times after one untimed warm-up call
+template <class F>
+BenchmarkResult timeIt(unsigned ntaxa, unsigned npatterns, unsigned ncateg, const std::string & order, const std::string & operation, unsigned reps, F f)
+    {
+    typedef std::chrono::steady_clock clock_t;
+    f();
+    double total = 0.0;
+    double fastest = std::numeric_limits<double>::max();
+    for (unsigned r = 0; r < reps; ++r)
+        {
+        clock_t::time_point start = clock_t::now();
+        f();
+        double secs = std::chrono::duration<double>(clock_t::now() - start).count();
+        total += secs;
+        fastest = std::min(fastest, secs);
+        }
+    BenchmarkResult result = {ntaxa, npatterns, ncateg, order, operation, reps, total/reps, fastest};
+    return result;
+    }
+
+Data::SharedPtr randomData(unsigned ntaxa, unsigned nsites, Lot::SharedPtr lot)
+    {
+    // Independent uniform states; with 8 or more taxa nearly every site is a distinct pattern
+    Data::taxon_names_t names(ntaxa);
+    Data::data_matrix_t matrix(ntaxa, Data::pattern_t(nsites));
+    for (unsigned t = 0; t < ntaxa; ++t)
+        {
+        names[t] = boost::str(boost::format("taxon_%d") % (t + 1));
+        for (unsigned s = 0; s < nsites; ++s)
+            matrix[t][s] = lot->randint(0, 3);
+        }
+    Data::SharedPtr data(new Data());
+    data->setData(names, matrix);
+    return data;
+    }
+
+Data::SharedPtr simulatedData(unsigned nsites, TreeManip::SharedPtr tm, unsigned seed)
+    {
+    // GTR+G sites simulated on the benchmark tree, so that patterns share clade states
+    Model::SharedPtr model(new Model());
+    model->setExchangeabilitiesAndStateFreqs({1.0, 4.0, 1.0, 1.0, 4.0, 1.0}, {0.3, 0.2, 0.2, 0.3});
+    model->setGammaNCateg(4);
+    model->setGammaShape(0.5);
+
+    Tree::SharedPtr tree = tm->getTree();
+    Data::taxon_names_t names(tree->numLeaves());
+    for (unsigned t = 0; t < names.size(); ++t)
+        names[t] = boost::str(boost::format("taxon_%d") % (t + 1));
+
+    Simulator simulator;
+    simulator.setModel(model);
+    simulator.setSeed(seed);
+    Data::SharedPtr data(new Data());
+    simulator.simulate(tree, names, nsites, *data);
+    return data;
+    }
+
+void writeResults(std::ostream & out, const std::vector<BenchmarkResult> & results, const std::string & format)
+    {
+    if (format == "csv")
+        out << "ntaxa,npatterns,ncateg,order,operation,reps,mean_secs,min_secs\n";
+    for (auto & r : results)
+        {
+        if (format == "csv")
+            out << boost::str(boost::format("%d,%d,%d,%s,\"%s\",%d,%.9g,%.9g\n") % r.ntaxa % r.npatterns % r.ncateg % r.order % r.operation % r.reps % r.mean_secs % r.min_secs);
+        else
+            out << boost::str(boost::format("{\"ntaxa\": %d, \"npatterns\": %d, \"ncateg\": %d, \"order\": \"%s\", \"operation\": \"%s\", \"reps\": %d, \"mean_secs\": %.9g, \"min_secs\": %.9g}\n") % r.ntaxa % r.npatterns % r.ncateg % r.order % r.operation % r.reps % r.mean_secs % r.min_secs);
+        }
+    }
+
+int main(int argc, const char * argv[])
+    {
+    std::vector<unsigned> taxa_grid     = {8, 16, 32, 64};
+    std::vector<unsigned> patterns_grid = {100, 1000, 10000};
+    std::vector<unsigned> categ_grid    = {1, 4};
+    std::vector<std::string> order_grid = {"none", "tree"};
+    std::string data_source = "random";
+    unsigned nreps = 20;
+    unsigned seed = 1;
+    std::string format = "json";
+    std::string output_filename = "likelihood_benchmark.json";
+
+    try
+        {
+        for (int i = 1; i < argc; ++i)
+            {
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+                throw XStrom(boost::str(boost::format("Missing value for option %s") % arg));
+            std::string value = argv[++i];
+            if (arg == "--taxa")
+                taxa_grid = parseList(value);
+            else if (arg == "--patterns")
+                patterns_grid = parseList(value);
+            else if (arg == "--categ")
+                categ_grid = parseList(value);
+            else if (arg == "--data")
+                data_source = value;
+            else if (arg == "--order")
+                order_grid = parseNames(value);
+            else if (arg == "--reps")
+                nreps = (unsigned)std::stoul(value);
+            else if (arg == "--seed")
+                seed = (unsigned)std::stoul(value);
+            else if (arg == "--format")
+                format = value;
+            else if (arg == "--output")
+                output_filename = value;
+            else
+                throw XStrom(boost::str(boost::format("Unknown option %s") % arg));
+            }
+        if (format != "json" && format != "csv")
+            throw XStrom("--format must be json or csv");
+        if (nreps == 0)
+            throw XStrom("--reps must be greater than zero");
+        if (data_source != "random" && data_source != "simulated")
+            throw XStrom("--data must be random or simulated");
+        for (auto & order : order_grid)
+            if (order != "none" && order != "tree")
+                throw XStrom("--order must list none and/or tree");
+
+        std::vector<BenchmarkResult> results;
+        for (unsigned ntaxa : taxa_grid)
+            {
+            for (unsigned npatterns : patterns_grid)
+                {
+                for (unsigned ncateg : categ_grid)
+                    {
+                    for (auto & order : order_grid)
+                        {
+                        std::cerr << boost::str(boost::format("taxa = %d, patterns = %d, categories = %d, order = %s") % ntaxa % npatterns % ncateg % order) << std::endl;
+
+                        Lot::SharedPtr lot(new Lot());
+                        lot->setSeed(seed);
+
+                        Data::SharedPtr data = (data_source == "random" ? randomData(ntaxa, npatterns, lot) : Data::SharedPtr());
+
+                        TreeManip::SharedPtr tm(new TreeManip());
+                        tm->buildRandomTree(ntaxa, lot, 0.1);
+
+                        if (data_source == "simulated")
+                            data = simulatedData(npatterns, tm, seed);
+                        unsigned nactual = data->getNumPatterns();
+
+                        if (order == "tree")
+                            {
+                            std::vector<unsigned> taxon_order;
+                            tm->getLeafNumbersInPreorder(taxon_order);
+                            data->reorderPatterns(taxon_order);
+                            }
+
+                        Likelihood::SharedPtr likelihood(new Likelihood());
+                        likelihood->setData(data);
+                        Model::SharedPtr model = likelihood->getModel();
+                        model->setGammaNCateg(ncateg);
+                        model->setExchangeabilities(std::vector<double>(6, 1.0/6.0));
+
+                        results.push_back(timeIt(ntaxa, nactual, ncateg, order, "calcLogLikelihood", nreps, [&]()
+                            {
+                            likelihood->invalidateCache();
+                            likelihood->calcLogLikelihood(tm->getTree());
+                            }));
+
+                        Chain chain;
+                        chain.setLikelihood(likelihood);
+                        chain.setLot(lot);
+                        chain.setTreeManip(tm);
+                        chain.start();
+                        chain.stopTuning();
+
+                        for (auto updater : chain.getUpdaters())
+                            {
+                            if (updater->getUpdaterName() == "Gamma Shape" && ncateg == 1)
+                                continue;
+                            double lnL = chain.calcLogLikelihood();
+                            results.push_back(timeIt(ntaxa, nactual, ncateg, order, "update:" + updater->getUpdaterName(), nreps, [&]()
+                                {
+                                lnL = updater->update(lnL);
+                                }));
+                            }
+
+                        chain.start();
+                        int iteration = 0;
+                        results.push_back(timeIt(ntaxa, nactual, ncateg, order, "nextStep", nreps, [&]()
+                            {
+                            chain.nextStep(++iteration);
+                            }));
+                        }
+                    }
+                }
+            }
+
+        std::ofstream outf(output_filename.c_str());
+        if (!outf.is_open())
+            throw XStrom(boost::str(boost::format("Could not open output file \"%s\"") % output_filename));
+        writeResults(outf, results, format);
+        std::cerr << boost::str(boost::format("%d results written to %s") % results.size() % output_filename) << std::endl;
+        }
+    catch (XStrom & x)
+        {
+        std::cerr << "Error: " << x.what() << std::endl;
+        return 1;
+        }
+
+    return 0;
+    }
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace strom
+    {
+
+    // log(sum_i exp(v[i])), scaled by the largest element so that it neither overflows nor
+    // underflows; -infinity if v is empty or every element is -infinity
+    inline double logSumExp(const std::vector<double> & v)
+        {
+        if (v.empty())
+            return -std::numeric_limits<double>::infinity();
+        double m = *std::max_element(v.begin(), v.end());
+        if (m == -std::numeric_limits<double>::infinity())
+            return m;
+        double s = 0.0;
+        for (auto x : v)
+            s += std::exp(x - m);
+        return m + std::log(s);
+        }
+
+    }
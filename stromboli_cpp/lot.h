@@ -1,11 +1,14 @@
 #pragma once
 
 #include <ctime>
+#include <string>
+#include <sstream>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/uniform_real.hpp>
 #include <boost/random/normal_distribution.hpp>
 #include <boost/random/gamma_distribution.hpp>
 #include <boost/random/variate_generator.hpp>
+#include "xstrom.h"
 
 namespace strom
     {
@@ -23,10 +26,16 @@ namespace strom
             double                  gamma(double shape, double scale);
             double                  logUniform();
 
+            std::string             getState() const;
+            void                    setState(const std::string & state);
+
             typedef boost::shared_ptr<Lot> SharedPtr;
 
         private:
 
+                                    Lot(const Lot &) = delete;
+            Lot &                   operator=(const Lot &) = delete;
+
             typedef boost::variate_generator<boost::mt19937 &, boost::uniform_real<> > uniform_variate_generator_t;
             typedef boost::variate_generator<boost::mt19937 &, boost::normal_distribution<> > normal_variate_generator_t;
             typedef boost::variate_generator<boost::mt19937 &, boost::gamma_distribution<> > gamma_variate_generator_t;
@@ -46,6 +55,8 @@ namespace strom
 
     inline Lot::~Lot()
         {
+        delete _uniform_variate_generator;
+        delete _normal_variate_generator;
         }
 
     inline void Lot::setSeed(unsigned seed)
@@ -54,6 +65,24 @@ namespace strom
         _generator.seed(_seed > 0 ? _seed : static_cast<unsigned int>(std::time(0)));
         }
 
+    inline std::string Lot::getState() const
+        {
+        // Textual form of the generator state as defined by boost::random
+        std::ostringstream oss;
+        oss << _seed << ' ' << _generator;
+        return oss.str();
+        }
+
+    inline void Lot::setState(const std::string & state)
+        {
+        // Reading the generator can leave failbit set even when successful, so the
+        // result is checked by writing it out again instead
+        std::istringstream iss(state);
+        iss >> _seed >> _generator;
+        if (getState() != state)
+            throw XStrom("Could not restore random number generator state");
+        }
+
     inline double Lot::uniform()
         {
         return (*_uniform_variate_generator)();
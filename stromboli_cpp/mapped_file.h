@@ -0,0 +1,128 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/format.hpp>
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    class MappedFile
+        {
+        public:
+                                        MappedFile();
+                                        MappedFile(const std::string filename);
+                                        ~MappedFile();
+
+            void                        open(const std::string filename);
+            void                        close();
+
+            bool                        isOpen() const;
+            const char *                begin() const;
+            const char *                end() const;
+            std::size_t                 size() const;
+            std::string                 getFileName() const;
+
+        private:
+
+                                        MappedFile(const MappedFile &) = delete;
+            MappedFile &                operator=(const MappedFile &) = delete;
+
+            std::string                 _filename;
+            const char *                _data;
+            std::size_t                 _size;
+            int                         _fd;
+
+        public:
+
+            typedef std::shared_ptr< MappedFile > SharedPtr;
+        };
+
+inline MappedFile::MappedFile() : _data(0), _size(0), _fd(-1)
+    {
+    }
+
+inline MappedFile::MappedFile(const std::string filename) : _data(0), _size(0), _fd(-1)
+    {
+    open(filename);
+    }
+
+inline MappedFile::~MappedFile()
+    {
+    close();
+    }
+
+inline void MappedFile::open(const std::string filename)
+    {
+    close();
+    _filename = filename;
+
+    _fd = ::open(filename.c_str(), O_RDONLY);
+    if (_fd < 0)
+        throw XStrom(boost::str(boost::format("Could not open file \"%s\"") % filename));
+
+    struct stat sb;
+    if (::fstat(_fd, &sb) != 0)
+        {
+        close();
+        throw XStrom(boost::str(boost::format("Could not determine the size of file \"%s\"") % filename));
+        }
+    _size = (std::size_t)sb.st_size;
+
+    // mmap refuses zero-length mappings, so an empty file is simply left unmapped
+    if (_size > 0)
+        {
+        void * p = ::mmap(0, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+        if (p == MAP_FAILED)
+            {
+            close();
+            throw XStrom(boost::str(boost::format("Could not memory-map file \"%s\"") % filename));
+            }
+        ::madvise(p, _size, MADV_SEQUENTIAL);
+        _data = static_cast<const char *>(p);
+        }
+    }
+
+inline void MappedFile::close()
+    {
+    if (_data)
+        ::munmap(const_cast<char *>(_data), _size);
+    if (_fd >= 0)
+        ::close(_fd);
+    _data = 0;
+    _size = 0;
+    _fd = -1;
+    }
+
+inline bool MappedFile::isOpen() const
+    {
+    return _fd >= 0;
+    }
+
+inline const char * MappedFile::begin() const
+    {
+    return _data;
+    }
+
+inline const char * MappedFile::end() const
+    {
+    return _data + _size;
+    }
+
+inline std::size_t MappedFile::size() const
+    {
+    return _size;
+    }
+
+inline std::string MappedFile::getFileName() const
+    {
+    return _filename;
+    }
+
+    }
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vector>
+#include <boost/format.hpp>
+#include "data.h"
+#include "tree.h"
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    // For each node of a tree, the set of patterns for which every leaf in the subtree below the
+    // node is missing (gap or N), stored as a bitset with one bit per pattern. For such a pattern
+    // the node's conditional likelihood vector is all ones, whatever the edge lengths below it,
+    // so a kernel can skip the pattern at that node (and the transition matrix on the node's
+    // edge leaves the ones unchanged). The leaf sets come from Data::getMissingMask; an internal
+    // node's set is the intersection of its children's sets. Masks are indexed by node number;
+    // in an unrooted tree the root is the leaf numbered 0.
+    class MissingDataMask
+        {
+        public:
+            typedef PackedMatrix::word_t            word_t;
+            typedef std::vector<word_t>             mask_t;
+
+                                                    MissingDataMask();
+
+            void                                    clear();
+            void                                    setData(Data::SharedPtr data);
+            void                                    update(Tree::SharedPtr tree);
+
+            const mask_t &                          getMask(unsigned node_number) const;
+            bool                                    isAllMissing(unsigned node_number, unsigned pattern) const;
+            unsigned                                countAllMissing(unsigned node_number) const;
+            bool                                    hasAnyMissing() const;
+
+        private:
+
+            Data::SharedPtr                         _data;
+            unsigned                                _npatterns;
+            std::vector<mask_t>                     _taxon_masks;
+            std::vector<mask_t>                     _node_masks;
+            bool                                    _any_missing;
+
+        public:
+
+            typedef std::shared_ptr< MissingDataMask > SharedPtr;
+        };
+
+inline MissingDataMask::MissingDataMask()
+    {
+    clear();
+    }
+
+inline void MissingDataMask::clear()
+    {
+    _data.reset();
+    _npatterns = 0;
+    _taxon_masks.clear();
+    _node_masks.clear();
+    _any_missing = false;
+    }
+
+inline void MissingDataMask::setData(Data::SharedPtr data)
+    {
+    clear();
+    _data = data;
+    _npatterns = data->getNumPatterns();
+    _taxon_masks.resize(data->getNumTaxa());
+    for (unsigned t = 0; t < _taxon_masks.size(); ++t)
+        {
+        data->getMissingMask(t, _taxon_masks[t]);
+        for (auto w : _taxon_masks[t])
+            if (w)
+                _any_missing = true;
+        }
+    }
+
+inline void MissingDataMask::update(Tree::SharedPtr tree)
+    {
+    // Call whenever the topology changes; edge lengths do not matter
+    if (!_data)
+        throw XStrom("MissingDataMask needs data before it can be updated");
+    if (tree->_nleaves != _taxon_masks.size())
+        throw XStrom(boost::str(boost::format("Tree has %d leaves but data have %d taxa") % tree->_nleaves % _taxon_masks.size()));
+
+    unsigned nwords = (_npatterns + 63)/64;
+    _node_masks.resize(tree->_nodes.size());
+
+    // Children are visited before their parents in reverse preorder
+    for (auto it = tree->_preorder.rbegin(); it != tree->_preorder.rend(); ++it)
+        {
+        Node * nd = *it;
+        mask_t & mask = _node_masks[nd->getNumber()];
+        if (!nd->getLeftChild())
+            {
+            mask = _taxon_masks[nd->getNumber()];
+            continue;
+            }
+        mask.assign(nwords, ~(word_t)0);
+        for (Node * child = nd->getLeftChild(); child; child = child->getRightSib())
+            {
+            const mask_t & child_mask = _node_masks[child->getNumber()];
+            for (unsigned k = 0; k < nwords; ++k)
+                mask[k] &= child_mask[k];
+            }
+        }
+
+    Node * root = tree->_root;
+    if (tree->_is_rooted)
+        _node_masks[root->getNumber()] = _node_masks[tree->_preorder[0]->getNumber()];
+    else
+        _node_masks[root->getNumber()] = _taxon_masks[root->getNumber()];
+    }
+
+inline const MissingDataMask::mask_t & MissingDataMask::getMask(unsigned node_number) const
+    {
+    assert(node_number < _node_masks.size());
+    return _node_masks[node_number];
+    }
+
+inline bool MissingDataMask::isAllMissing(unsigned node_number, unsigned pattern) const
+    {
+    assert(pattern < _npatterns);
+    return (getMask(node_number)[pattern/64] >> (pattern % 64)) & 1;
+    }
+
+inline unsigned MissingDataMask::countAllMissing(unsigned node_number) const
+    {
+    unsigned n = 0;
+    for (auto w : getMask(node_number))
+        n += (unsigned)__builtin_popcountll(w);
+    return n;
+    }
+
+inline bool MissingDataMask::hasAnyMissing() const
+    {
+    // False if no taxon is missing for any pattern, in which case every node's mask is empty
+    return _any_missing;
+    }
+
+    }
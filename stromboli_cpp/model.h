@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <vector>
 #include "beagle.h"
+#include "serialization.h"
 #include <boost/math/distributions/gamma.hpp>
 #include <Eigen/Dense>
 
@@ -40,6 +41,12 @@ namespace strom
 
             std::string                 paramNamesAsString(std::string sep) const;
             std::string                 paramValuesAsString(std::string sep) const;
+            void                        getParamValues(std::vector<double> & values) const;
+
+            void                        saveState(std::string & buffer) const;
+            void                        loadState(const char * & p, const char * end);
+
+            void                        calcTransitionProbs(double edge_length, double relative_rate, EigenMatrix4d & P) const;
 
             int                         setBeagleEigenDecomposition(int beagle_instance);
             int                         setBeagleStateFrequencies(int beagle_instance);
@@ -264,6 +271,25 @@ inline void Model::recalcRateMatrix()
         }
     }
 
+inline void Model::calcTransitionProbs(double edge_length, double relative_rate, EigenMatrix4d & P) const
+    {
+    // P(t) = V exp(Lambda r t) V^{-1}, using the eigen decomposition also given to BeagleLib;
+    // roundoff can make tiny entries negative, so these are zeroed and rows renormalized
+    EigenVector4d d = (_eigenvalues*edge_length*relative_rate).array().exp();
+    P = _eigenvectors*d.asDiagonal()*_inverse_eigenvectors;
+    for (unsigned i = 0; i < 4; ++i)
+        {
+        double row_sum = 0.0;
+        for (unsigned j = 0; j < 4; ++j)
+            {
+            if (P(i,j) < 0.0)
+                P(i,j) = 0.0;
+            row_sum += P(i,j);
+            }
+        P.row(i) /= row_sum;
+        }
+    }
+
 inline void Model::recalcGammaRates()
     {
     assert(_num_categ > 0);
@@ -362,6 +388,42 @@ inline std::string Model::paramNamesAsString(std::string sep) const
     return s;
     }
 
+inline void Model::getParamValues(std::vector<double> & values) const
+    {
+    // Same order as paramNamesAsString
+    values.assign(_exchangeabilities.begin(), _exchangeabilities.end());
+    values.insert(values.end(), _state_freqs.begin(), _state_freqs.end());
+    values.push_back(_gamma_shape);
+    }
+
+inline void Model::saveState(std::string & buffer) const
+    {
+    appendBinary(buffer, (std::uint32_t)_num_categ);
+    appendBinary(buffer, _gamma_shape);
+    for (auto x : _exchangeabilities)
+        appendBinary(buffer, x);
+    for (auto x : _state_freqs)
+        appendBinary(buffer, x);
+    }
+
+inline void Model::loadState(const char * & p, const char * end)
+    {
+    std::uint32_t ncateg = 0;
+    double shape = 0.0;
+    std::vector<double> exchangeabilities(6);
+    std::vector<double> state_freqs(4);
+    readBinary(p, end, ncateg);
+    readBinary(p, end, shape);
+    for (auto & x : exchangeabilities)
+        readBinary(p, end, x);
+    for (auto & x : state_freqs)
+        readBinary(p, end, x);
+
+    _gamma_shape = shape;
+    setGammaNCateg(ncateg);
+    setExchangeabilitiesAndStateFreqs(exchangeabilities, state_freqs);
+    }
+
 inline std::string Model::paramValuesAsString(std::string sep) const
     {
     return boost::str(boost::format("%.5f%s%.5f%s%.5f%s%.5f%s%.5f%s%.5f%s%.5f%s%.5f%s%.5f%s%.5f%s%.5f") % _exchangeabilities[0] % sep % _exchangeabilities[1] % sep % _exchangeabilities[2] % sep % _exchangeabilities[3] % sep % _exchangeabilities[4] % sep % _exchangeabilities[5] % sep % _state_freqs[0] % sep % _state_freqs[1] % sep % _state_freqs[2] % sep % _state_freqs[3] % sep % _gamma_shape);
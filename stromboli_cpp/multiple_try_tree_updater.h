@@ -0,0 +1,277 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "tree_updater.h"
+#include "thread_pool.h"
+#include "log_sum_exp.h"
+
+namespace strom
+    {
+
+    class Chain;
+
+    // Multiple-try Metropolis (Liu, Liang and Wong 2000) version of TreeUpdater. Each update draws
+    // K Larget-Simon candidates from the current tree, evaluates them concurrently, picks one with
+    // probability proportional to its weight, then draws K - 1 reference moves back from the
+    // chosen tree (the current tree being the Kth) and accepts with probability
+    //
+    //      min(1, sum_j w(y_j, x) / sum_j w(x*_j, y))
+    //
+    // The weight of a candidate z proposed from c is w(z, c) = pi(z) sqrt(T(z, c)/T(c, z)), which
+    // corresponds to the symmetric choice lambda(c, z) = 1/sqrt(T(c, z) T(z, c)) and needs only
+    // the Hastings ratio of the Larget-Simon move, not its proposal density.
+    //
+    // Candidates are copied (exactly, via saveBinary/loadBinary) into K worker trees, each with its
+    // own Likelihood and hence its own BeagleLib instance, so that their likelihoods can be computed
+    // on separate threads. Worker likelihoods share the model and data of the chain's likelihood.
+    // A subsampled likelihood set with setSubsampledLikelihood is not used by this updater.
+    class MultipleTryTreeUpdater : public TreeUpdater
+        {
+        friend class Chain;
+
+        public:
+
+                                                MultipleTryTreeUpdater();
+                                                ~MultipleTryTreeUpdater();
+
+            void                                setNumTries(unsigned ntries);
+            void                                setNumThreads(unsigned nthreads);
+            unsigned                            getNumTries() const;
+
+            virtual double                      update(double prev_lnL);
+
+        private:
+
+            struct Worker
+                {
+                TreeManip::SharedPtr            tree_manipulator;
+                Likelihood::SharedPtr           likelihood;
+                };
+
+            void                                prepareWorkers();
+            void                                drawCandidates(unsigned n, std::vector<std::string> & trees, std::vector<double> & log_hastings, std::vector<double> & log_priors, std::vector<double> & log_references);
+            void                                evaluateCandidates(const std::vector<std::string> & trees, const std::vector<double> & log_priors, std::vector<double> & log_likelihoods);
+
+            unsigned                            _ntries;
+            unsigned                            _nthreads;
+            std::vector<Worker>                 _workers;
+            ThreadPool::SharedPtr               _pool;
+            TreeManip::SharedPtr                _scratch;           // holds the chosen candidate while reference moves are drawn
+
+        public:
+            typedef std::shared_ptr< MultipleTryTreeUpdater > SharedPtr;
+        };
+
+inline MultipleTryTreeUpdater::MultipleTryTreeUpdater()
+    {
+    // std::cout << "Creating a MultipleTryTreeUpdater" << std::endl;
+    _ntries = 4;
+    _nthreads = 0;
+    }
+
+inline MultipleTryTreeUpdater::~MultipleTryTreeUpdater()
+    {
+    // std::cout << "Destroying a MultipleTryTreeUpdater" << std::endl;
+    }
+
+inline void MultipleTryTreeUpdater::setNumTries(unsigned ntries)
+    {
+    if (ntries < 1)
+        throw XStrom("Number of tries must be at least 1");
+    _ntries = ntries;
+    _pool.reset();
+    }
+
+inline void MultipleTryTreeUpdater::setNumThreads(unsigned nthreads)
+    {
+    // 0 means one thread per try, up to the number of hardware threads
+    _nthreads = nthreads;
+    _pool.reset();
+    }
+
+inline unsigned MultipleTryTreeUpdater::getNumTries() const
+    {
+    return _ntries;
+    }
+
+inline void MultipleTryTreeUpdater::prepareWorkers()
+    {
+    // Worker likelihoods are (re)created whenever the chain's model or data change and are
+    // initialized here, on the calling thread, so that BeagleLib instances are never created
+    // concurrently
+    Model::SharedPtr model = _likelihood->getModel();
+    Data::SharedPtr data = _likelihood->getData();
+    bool stale = (_workers.size() != _ntries);
+    for (auto & w : _workers)
+        if (w.likelihood->getModel() != model || w.likelihood->getData() != data)
+            stale = true;
+
+    if (stale)
+        {
+        _workers.resize(_ntries);
+        std::string current;
+        _tree_manipulator->saveBinary(current);
+        for (auto & w : _workers)
+            {
+            w.tree_manipulator.reset(new TreeManip());
+            w.likelihood.reset(new Likelihood());
+            w.likelihood->setVerbose(false);
+            w.likelihood->setModel(model);
+            w.likelihood->setData(data);
+
+            const char * p = current.data();
+            w.tree_manipulator->loadBinary(p, p + current.size());
+            w.likelihood->calcLogLikelihood(w.tree_manipulator->getTree());
+            }
+        }
+
+    if (!_pool)
+        {
+        unsigned nthreads = (_nthreads > 0 ? _nthreads : std::min(_ntries, ThreadPool::defaultNumThreads()));
+        _pool.reset(new ThreadPool(nthreads));
+        }
+    if (!_scratch)
+        _scratch.reset(new TreeManip());
+    }
+
+inline void MultipleTryTreeUpdater::drawCandidates(unsigned n, std::vector<std::string> & trees, std::vector<double> & log_hastings, std::vector<double> & log_priors, std::vector<double> & log_references)
+    {
+    // Draws n Larget-Simon moves from the tree currently held by _tree_manipulator, recording
+    // each resulting tree and undoing the move before drawing the next
+    trees.assign(n, std::string());
+    log_hastings.assign(n, 0.0);
+    log_priors.assign(n, 0.0);
+    log_references.assign(n, 0.0);
+    for (unsigned j = 0; j < n; ++j)
+        {
+            {
+            STROM_TIME(_instrumentation, _phase_propose);
+            proposeNewState();
+            }
+        log_hastings[j] = _log_hastings_ratio;
+            {
+            STROM_TIME(_instrumentation, _phase_prior);
+            log_priors[j] = calcLogPrior();
+            log_references[j] = calcLogReferenceDensity();
+            }
+        _tree_manipulator->saveBinary(trees[j]);
+            {
+            STROM_TIME(_instrumentation, _phase_revert);
+            revert();
+            }
+        reset();
+        }
+    }
+
+inline void MultipleTryTreeUpdater::evaluateCandidates(const std::vector<std::string> & trees, const std::vector<double> & log_priors, std::vector<double> & log_likelihoods)
+    {
+    STROM_TIME(_instrumentation, _phase_likelihood);
+    unsigned n = (unsigned)trees.size();
+    assert(n <= _workers.size());
+    log_likelihoods.assign(n, 0.0);
+    _pool->parallelFor(n, [&](unsigned j)
+        {
+        if (log_priors[j] <= _log_minus_infinity)
+            return;
+        Worker & w = _workers[j];
+        const char * p = trees[j].data();
+        w.tree_manipulator->loadBinary(p, p + trees[j].size());
+        log_likelihoods[j] = w.likelihood->calcLogLikelihood(w.tree_manipulator->getTree());
+        });
+    }
+
+inline double MultipleTryTreeUpdater::update(double prev_lnL)
+    {
+        {
+        STROM_TIME(_instrumentation, _phase_pull);
+        pullCurrentStateFromModel();
+        }
+    prepareWorkers();
+
+    const double minus_infinity = -std::numeric_limits<double>::infinity();
+    double prev_log_prior = 0.0;
+    double prev_log_reference = 0.0;
+        {
+        STROM_TIME(_instrumentation, _phase_prior);
+        prev_log_prior = calcLogPrior();
+        prev_log_reference = calcLogReferenceDensity();
+        }
+
+    // Forward candidates y_1, ..., y_K from the current tree x
+    std::vector<std::string> candidates;
+    std::vector<double> log_hastings;
+    std::vector<double> log_priors;
+    std::vector<double> log_references;
+    std::vector<double> log_likelihoods;
+    drawCandidates(_ntries, candidates, log_hastings, log_priors, log_references);
+    evaluateCandidates(candidates, log_priors, log_likelihoods);
+
+    std::vector<double> log_weights(_ntries, minus_infinity);
+    for (unsigned j = 0; j < _ntries; ++j)
+        if (log_priors[j] > _log_minus_infinity)
+            log_weights[j] = calcLogHeatedDensity(log_likelihoods[j], log_priors[j], log_references[j]) + 0.5*log_hastings[j];
+    double log_forward_sum = logSumExp(log_weights);
+
+    bool accept = (log_forward_sum > minus_infinity);
+    unsigned chosen = 0;
+    if (accept)
+        {
+        // Choose y = y_J with probability proportional to its weight
+        double u = _lot->uniform();
+        double cum = 0.0;
+        chosen = _ntries - 1;
+        for (unsigned j = 0; j < _ntries; ++j)
+            {
+            cum += std::exp(log_weights[j] - log_forward_sum);
+            if (u < cum && log_weights[j] > minus_infinity)
+                {
+                chosen = j;
+                break;
+                }
+            }
+
+        // Reference moves x*_1, ..., x*_{K-1} drawn from y, with x*_K = x
+        std::vector<std::string> references;
+        std::vector<double> ref_log_hastings;
+        std::vector<double> ref_log_priors;
+        std::vector<double> ref_log_references;
+        std::vector<double> ref_log_likelihoods;
+        const char * p = candidates[chosen].data();
+        _scratch->loadBinary(p, p + candidates[chosen].size());
+        TreeManip::SharedPtr live = _tree_manipulator;
+        _tree_manipulator = _scratch;
+        drawCandidates(_ntries - 1, references, ref_log_hastings, ref_log_priors, ref_log_references);
+        _tree_manipulator = live;
+        evaluateCandidates(references, ref_log_priors, ref_log_likelihoods);
+
+        std::vector<double> ref_log_weights(_ntries, minus_infinity);
+        for (unsigned j = 0; j + 1 < _ntries; ++j)
+            if (ref_log_priors[j] > _log_minus_infinity)
+                ref_log_weights[j] = calcLogHeatedDensity(ref_log_likelihoods[j], ref_log_priors[j], ref_log_references[j]) + 0.5*ref_log_hastings[j];
+        ref_log_weights[_ntries - 1] = calcLogHeatedDensity(prev_lnL, prev_log_prior, prev_log_reference) - 0.5*log_hastings[chosen];
+
+        double log_diff = log_forward_sum - logSumExp(ref_log_weights);
+        if (_lot->logUniform() > log_diff)
+            accept = false;
+        }
+
+    double log_likelihood = prev_lnL;
+    if (accept)
+        {
+        _naccepts++;
+        const char * p = candidates[chosen].data();
+        _tree_manipulator->loadBinary(p, p + candidates[chosen].size());
+        log_likelihood = log_likelihoods[chosen];
+        }
+
+    tune(accept);
+    reset();
+
+    return log_likelihood;
+    }
+
+    }
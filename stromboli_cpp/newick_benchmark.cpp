@@ -0,0 +1,436 @@
+//
+//  newick_benchmark.cpp
+//
+//  Stand-alone timing comparison of TreeManip::buildFromNewick against the original
+//  regex-based parser, which is kept here (LegacyNewickParser) rather than in TreeManip.
+//  Not part of the main target; build it on its own, e.g.
+//
+//      c++ -std=gnu++14 -O2 -I. newick_benchmark.cpp <ncl sources> -o newick_benchmark
+//
+//  and run it as
+//
+//      newick_benchmark <treefile> [repetitions]
+//
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <set>
+#include <algorithm>
+#include <regex>
+#include <cstdlib>
+#include <cmath>
+#include <cctype>
+#include <boost/format.hpp>
+#include "tree_summary.h"
+#include "tree_manip.h"
+#include "xstrom.h"
+
+using namespace strom;
+
+const double strom::Node::_smallest_edge_length = 1.0e-12;
+
+// The regex-based parser that TreeManip::buildFromNewick replaced, building a plain array of
+// nodes instead of a Tree. Node 0 is the root and every node comes after its parent. Unlike
+// the original, it neither reroots unrooted trees at leaf 0 nor refreshes the preorder, so its
+// timings slightly flatter it.
+class LegacyNewickParser
+    {
+    public:
+
+        struct LegacyNode
+            {
+            int             parent;
+            int             left_child;
+            int             right_sib;
+            int             number;
+            std::string     name;
+            double          edge_length;
+            };
+
+        void                        parse(const std::string newick, bool rooted, bool allow_polytomies);
+
+        std::vector<LegacyNode>     _nodes;
+        unsigned                    _nleaves;
+
+    private:
+
+        void                        extractNodeNumberFromName(LegacyNode & nd, std::set<unsigned> & used);
+        void                        extractEdgeLen(LegacyNode & nd, std::string edge_length_string);
+        unsigned                    countNewickLeaves(const std::string newick);
+        void                        stripOutNexusComments(std::string & newick);
+        bool                        canHaveSibling(int nd, bool rooted, bool allow_polytomies);
+    };
+
+void LegacyNewickParser::extractNodeNumberFromName(LegacyNode & nd, std::set<unsigned> & used)
+    {
+    unsigned x = 0;
+    try
+        {
+        x = std::stoi(nd.name);
+        }
+    catch(std::invalid_argument &)
+        {
+        throw XStrom(boost::str(boost::format("node name (%s) not interpretable as a positive integer") % nd.name));
+        }
+    if (!used.insert(x).second)
+        throw XStrom(boost::str(boost::format("leaf number %d used more than once") % x));
+    nd.number = x - 1;
+    }
+
+void LegacyNewickParser::extractEdgeLen(LegacyNode & nd, std::string edge_length_string)
+    {
+    double d = 0.0;
+    try
+        {
+        d = std::stof(edge_length_string);
+        }
+    catch(std::invalid_argument &)
+        {
+        throw XStrom(boost::str(boost::format("%s is not interpretable as an edge length") % edge_length_string));
+        }
+    nd.edge_length = (d < 0.0 ? 0.0 : d);
+    }
+
+unsigned LegacyNewickParser::countNewickLeaves(const std::string newick)
+    {
+    std::regex taxonexpr("[(,]\\s*(\\d+|\\S+?|['].+?['])\\s*(?=[,):])");
+    std::sregex_iterator m1(newick.begin(), newick.end(), taxonexpr);
+    std::sregex_iterator m2;
+    return (unsigned)std::distance(m1, m2);
+    }
+
+void LegacyNewickParser::stripOutNexusComments(std::string & newick)
+    {
+    std::regex commentexpr("\\[.*?\\]");
+    newick = std::regex_replace(newick, commentexpr, std::string(""));
+    }
+
+bool LegacyNewickParser::canHaveSibling(int nd, bool rooted, bool allow_polytomies)
+    {
+    int parent = _nodes[nd].parent;
+    if (parent < 0)
+        return false;
+    if (allow_polytomies || nd == _nodes[parent].left_child)
+        return true;
+    if (_nodes[parent].parent >= 0 || rooted)
+        return false;
+    return (nd == _nodes[_nodes[parent].left_child].right_sib);
+    }
+
+void LegacyNewickParser::parse(const std::string newick, bool rooted, bool allow_polytomies)
+    {
+    std::set<unsigned> used;
+    unsigned curr_leaf = 0;
+
+    std::string commentless_newick = newick;
+    stripOutNexusComments(commentless_newick);
+
+    _nleaves = countNewickLeaves(commentless_newick);
+    if (_nleaves == 0)
+        throw XStrom("Expecting newick tree description to have at least 4 leaves");
+    unsigned max_nodes = 2*_nleaves - (rooted ? 0 : 2);
+    LegacyNode blank = {-1, -1, -1, -1, "", 0.0};
+    _nodes.assign(max_nodes, blank);
+
+    unsigned curr_node_index = 0;
+    int nd = 0;
+    if (rooted)
+        {
+        nd = ++curr_node_index;
+        _nodes[nd].parent = 0;
+        _nodes[0].left_child = nd;
+        }
+
+    enum {
+        Prev_Tok_LParen     = 0x01,
+        Prev_Tok_RParen     = 0x02,
+        Prev_Tok_Colon      = 0x04,
+        Prev_Tok_Comma      = 0x08,
+        Prev_Tok_Name       = 0x10,
+        Prev_Tok_EdgeLen    = 0x20
+        };
+    unsigned previous = Prev_Tok_LParen;
+    unsigned LParen_Valid = (Prev_Tok_LParen | Prev_Tok_Comma);
+    unsigned RParen_Valid = (Prev_Tok_RParen | Prev_Tok_Name | Prev_Tok_EdgeLen);
+    unsigned Comma_Valid  = (Prev_Tok_RParen | Prev_Tok_Name | Prev_Tok_EdgeLen);
+    unsigned Colon_Valid  = (Prev_Tok_RParen | Prev_Tok_Name);
+    unsigned Name_Valid   = (Prev_Tok_RParen | Prev_Tok_LParen | Prev_Tok_Comma);
+
+    bool inside_edge_length = false;
+    std::string edge_length_str;
+    bool inside_quoted_name = false;
+    bool inside_unquoted_name = false;
+
+    unsigned position_in_string = 0;
+    for (auto ch : commentless_newick)
+        {
+        position_in_string++;
+
+        if (inside_quoted_name)
+            {
+            if (ch == '\'')
+                {
+                inside_quoted_name = false;
+                if (_nodes[nd].left_child < 0)
+                    {
+                    extractNodeNumberFromName(_nodes[nd], used);
+                    curr_leaf++;
+                    }
+                previous = Prev_Tok_Name;
+                }
+            else if (iswspace(ch))
+                _nodes[nd].name += ' ';
+            else
+                _nodes[nd].name += ch;
+            continue;
+            }
+        else if (inside_unquoted_name)
+            {
+            if (ch == '(')
+                throw XStrom(boost::str(boost::format("Unexpected left parenthesis inside node name at position %d in tree description") % position_in_string));
+            if (iswspace(ch) || ch == ':' || ch == ',' || ch == ')')
+                {
+                inside_unquoted_name = false;
+                if (!(previous & Name_Valid))
+                    throw XStrom(boost::str(boost::format("Unexpected node name (%s) at position %d in tree description") % _nodes[nd].name % position_in_string));
+                if (_nodes[nd].left_child < 0)
+                    {
+                    extractNodeNumberFromName(_nodes[nd], used);
+                    curr_leaf++;
+                    }
+                previous = Prev_Tok_Name;
+                }
+            else
+                {
+                _nodes[nd].name += ch;
+                continue;
+                }
+            }
+        else if (inside_edge_length)
+            {
+            if (ch == ',' || ch == ')' || iswspace(ch))
+                {
+                inside_edge_length = false;
+                extractEdgeLen(_nodes[nd], edge_length_str);
+                previous = Prev_Tok_EdgeLen;
+                }
+            else
+                {
+                bool valid = (ch =='e' || ch == 'E' || ch =='.' || ch == '-' || ch == '+' || isdigit(ch));
+                if (!valid)
+                    throw XStrom(boost::str(boost::format("Invalid branch length character (%c) at position %d in tree description") % ch % position_in_string));
+                edge_length_str += ch;
+                continue;
+                }
+            }
+
+        if (iswspace(ch))
+            continue;
+
+        switch(ch)
+            {
+            case ';':
+                break;
+
+            case ')':
+                if (_nodes[nd].parent < 0 || !(previous & RParen_Valid))
+                    throw XStrom(boost::str(boost::format("Unexpected right parenthesis at position %d in tree description") % position_in_string));
+                nd = _nodes[nd].parent;
+                if (_nodes[_nodes[nd].left_child].right_sib < 0)
+                    throw XStrom(boost::str(boost::format("Internal node has only one child at position %d in tree description") % position_in_string));
+                previous = Prev_Tok_RParen;
+                break;
+
+            case ':':
+                if (!(previous & Colon_Valid))
+                    throw XStrom(boost::str(boost::format("Unexpected colon at position %d in tree description") % position_in_string));
+                previous = Prev_Tok_Colon;
+                break;
+
+            case ',':
+                if (_nodes[nd].parent < 0 || !(previous & Comma_Valid))
+                    throw XStrom(boost::str(boost::format("Unexpected comma at position %d in tree description") % position_in_string));
+                if (!canHaveSibling(nd, rooted, allow_polytomies))
+                    throw XStrom(boost::str(boost::format("Polytomy found in the following tree description but polytomies prohibited:\n%s") % newick));
+                curr_node_index++;
+                if (curr_node_index == _nodes.size())
+                    throw XStrom(boost::str(boost::format("Too many nodes specified by tree description (%d nodes allocated for %d leaves)") % _nodes.size() % _nleaves));
+                _nodes[nd].right_sib = curr_node_index;
+                _nodes[curr_node_index].parent = _nodes[nd].parent;
+                nd = curr_node_index;
+                previous = Prev_Tok_Comma;
+                break;
+
+            case '(':
+                if (!(previous & LParen_Valid))
+                    throw XStrom(boost::str(boost::format("Not expecting left parenthesis at position %d in tree description") % position_in_string));
+                curr_node_index++;
+                if (curr_node_index == _nodes.size())
+                    throw XStrom(boost::str(boost::format("malformed tree description (more than %d nodes specified)") % _nodes.size()));
+                _nodes[nd].left_child = curr_node_index;
+                _nodes[curr_node_index].parent = nd;
+                nd = curr_node_index;
+                previous = Prev_Tok_LParen;
+                break;
+
+            case '\'':
+                if (!(previous & Name_Valid))
+                    throw XStrom(boost::str(boost::format("Not expecting node name at position %d in tree description") % position_in_string));
+                _nodes[nd].name.clear();
+                inside_quoted_name = true;
+                break;
+
+            default:
+                if (previous == Prev_Tok_Colon)
+                    {
+                    inside_edge_length = true;
+                    edge_length_str = ch;
+                    }
+                else
+                    {
+                    _nodes[nd].name = ch;
+                    inside_unquoted_name = true;
+                    }
+            }
+        }
+
+    if (inside_unquoted_name || inside_edge_length || inside_quoted_name)
+        throw XStrom("Tree description ended inside a node name or edge length");
+    if (curr_leaf != _nleaves)
+        throw XStrom(boost::str(boost::format("Expecting %d named leaves in tree description but found %d") % _nleaves % curr_leaf));
+    }
+
+// Nontrivial bipartitions, each given by the side that does not contain leaf 0 (so that they
+// do not depend on where the tree is rooted), and the total edge length
+typedef std::set< std::vector<bool> > bipartition_set_t;
+
+void addBipartition(std::vector<bool> below, bipartition_set_t & bipartitions)
+    {
+    if (below[0])
+        below.flip();
+    unsigned n = (unsigned)std::count(below.begin(), below.end(), true);
+    if (n > 1 && n + 2 < below.size())
+        bipartitions.insert(below);
+    }
+
+double legacyBipartitions(const LegacyNewickParser & parser, bipartition_set_t & bipartitions)
+    {
+    // Children follow their parents in the node array, so a backward pass visits them first
+    std::vector< std::vector<bool> > below(parser._nodes.size(), std::vector<bool>(parser._nleaves, false));
+    double tree_length = 0.0;
+    bipartitions.clear();
+    for (int i = (int)parser._nodes.size() - 1; i >= 0; --i)
+        {
+        const LegacyNewickParser::LegacyNode & nd = parser._nodes[i];
+        if (nd.left_child < 0 && nd.number >= 0)
+            below[i][nd.number] = true;
+        if (nd.parent >= 0)
+            {
+            tree_length += nd.edge_length;
+            addBipartition(below[i], bipartitions);
+            for (unsigned k = 0; k < parser._nleaves; ++k)
+                if (below[i][k])
+                    below[nd.parent][k] = true;
+            }
+        }
+    return tree_length;
+    }
+
+void collectBipartitions(Node * nd, unsigned nleaves, std::vector<bool> & below, bipartition_set_t & bipartitions)
+    {
+    below.assign(nleaves, false);
+    if (!nd->getLeftChild())
+        below[nd->getNumber()] = true;
+    std::vector<bool> child_below;
+    for (Node * child = nd->getLeftChild(); child; child = child->getRightSib())
+        {
+        collectBipartitions(child, nleaves, child_below, bipartitions);
+        for (unsigned k = 0; k < nleaves; ++k)
+            if (child_below[k])
+                below[k] = true;
+        }
+    if (nd->getParent())
+        addBipartition(below, bipartitions);
+    }
+
+double treeBipartitions(TreeManip & tm, bipartition_set_t & bipartitions)
+    {
+    Node::PtrVector nodes;
+    tm.getNodesByNumber(nodes);
+    unsigned nleaves = tm.getTree()->numLeaves();
+    std::vector<bool> below;
+    bipartitions.clear();
+    for (auto nd : nodes)
+        if (nd && !nd->getParent())
+            collectBipartitions(nd, nleaves, below, bipartitions);
+    return tm.calcTreeLength();
+    }
+
+int main(int argc, const char * argv[])
+    {
+    if (argc < 2)
+        {
+        std::cerr << "usage: newick_benchmark <treefile> [repetitions]" << std::endl;
+        return 1;
+        }
+    std::string treefile = argv[1];
+    unsigned nreps = (argc > 2 ? (unsigned)std::atoi(argv[2]) : 10);
+
+    try
+        {
+        TreeSummary summary;
+        summary.readTreefileStreaming(treefile, 0);
+        unsigned ntrees = summary.getNumStoredTrees();
+        std::vector<std::string> newicks(ntrees);
+        for (unsigned i = 0; i < ntrees; ++i)
+            newicks[i] = summary.getNewick(i);
+        summary.clear();
+
+        // Both parsers must produce the same tree (the legacy parser reads edge lengths
+        // in single precision, so tree lengths are only compared to float accuracy)
+        TreeManip tm_new;
+        LegacyNewickParser legacy;
+        bipartition_set_t bipartitions_new;
+        bipartition_set_t bipartitions_old;
+        for (unsigned i = 0; i < ntrees; ++i)
+            {
+            tm_new.buildFromNewick(newicks[i], false, false);
+            legacy.parse(newicks[i], false, false);
+            double tl_new = treeBipartitions(tm_new, bipartitions_new);
+            double tl_old = legacyBipartitions(legacy, bipartitions_old);
+            if (bipartitions_new != bipartitions_old || std::fabs(tl_new - tl_old) > 1.0e-6*(1.0 + tl_old))
+                throw XStrom(boost::str(boost::format("Parsers disagree on tree %d") % (i + 1)));
+            }
+
+        typedef std::chrono::steady_clock clock_t;
+        TreeManip tm;
+
+        clock_t::time_point start = clock_t::now();
+        for (unsigned r = 0; r < nreps; ++r)
+            for (auto & newick : newicks)
+                legacy.parse(newick, false, false);
+        double legacy_secs = std::chrono::duration<double>(clock_t::now() - start).count();
+
+        start = clock_t::now();
+        for (unsigned r = 0; r < nreps; ++r)
+            for (auto & newick : newicks)
+                tm.buildFromNewick(newick, false, false);
+        double new_secs = std::chrono::duration<double>(clock_t::now() - start).count();
+
+        double nparsed = (double)ntrees*nreps;
+        std::cout << boost::str(boost::format("%d trees x %d repetitions") % ntrees % nreps) << std::endl;
+        std::cout << boost::str(boost::format("%12s %15s %15s") % "parser" % "seconds" % "usec/tree") << std::endl;
+        std::cout << boost::str(boost::format("%12s %15.3f %15.3f") % "legacy" % legacy_secs % (1.0e6*legacy_secs/nparsed)) << std::endl;
+        std::cout << boost::str(boost::format("%12s %15.3f %15.3f") % "single-pass" % new_secs % (1.0e6*new_secs/nparsed)) << std::endl;
+        std::cout << boost::str(boost::format("speedup: %.1fx") % (legacy_secs/new_secs)) << std::endl;
+        }
+    catch (XStrom & x)
+        {
+        std::cerr << "Error: " << x.what() << std::endl;
+        return 1;
+        }
+
+    return 0;
+    }
@@ -0,0 +1,133 @@
+//
+//  nexus_benchmark.cpp
+//
+//  Stand-alone timing comparison of the three ways NxsToken can read a NEXUS file:
+//
+//      stream      characters pulled one at a time from an ifstream (NxsReader::ReadFilestream)
+//      buffered    ifstream read in 1 MB blocks (NxsReader::ReadFilepath)
+//      mmap        memory-mapped file scanned in place (NxsReader::ReadBuffer)
+//
+//  The taxa, character matrices and tree descriptions obtained by each mode are checked to be
+//  identical before timing. Not part of the main target; build it on its own, e.g.
+//
+//      c++ -std=gnu++14 -O2 -I. nexus_benchmark.cpp <ncl sources> -o nexus_benchmark
+//
+//  and run it as
+//
+//      nexus_benchmark <nexusfile> [repetitions]
+//
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <boost/format.hpp>
+#include "ncl.h"
+#include "mapped_file.h"
+#include "xstrom.h"
+
+using namespace strom;
+
+enum ReadMode {stream_mode, buffered_mode, mmap_mode};
+
+// Parses filename using the given mode and returns a digest of everything read
+std::string parseNexus(const std::string & filename, ReadMode mode)
+    {
+    MultiFormatReader reader(-1, NxsReader::IGNORE_WARNINGS);
+    try
+        {
+        if (mode == stream_mode)
+            {
+            std::ifstream inf(filename.c_str(), std::ios::binary);
+            if (!inf.good())
+                throw XStrom(boost::str(boost::format("Could not open file \"%s\"") % filename));
+            reader.ReadFilestream(inf);
+            }
+        else if (mode == buffered_mode)
+            reader.ReadFilepath(filename.c_str(), MultiFormatReader::NEXUS_FORMAT);
+        else
+            {
+            MappedFile file(filename);
+            reader.ReadBuffer(file.begin(), file.end());
+            }
+        }
+    catch(NxsException & x)
+        {
+        reader.DeleteBlocksFromFactories();
+        throw XStrom(boost::str(boost::format("%s (line %d, column %d)") % x.msg % x.line % x.col));
+        }
+
+    std::string digest;
+    for (unsigned i = 0; i < reader.GetNumTaxaBlocks(); ++i)
+        {
+        NxsTaxaBlock * taxa = reader.GetTaxaBlock(i);
+        for (auto & label : taxa->GetAllLabels())
+            digest += label + "\n";
+
+        for (unsigned j = 0; j < reader.GetNumCharactersBlocks(taxa); ++j)
+            {
+            const NxsCharactersBlock * chars = reader.GetCharactersBlock(taxa, j);
+            for (unsigned t = 0; t < taxa->GetNTax(); ++t)
+                {
+                for (auto code : chars->GetDiscreteMatrixRow(t))
+                    digest += boost::str(boost::format("%d,") % code);
+                digest += "\n";
+                }
+            }
+
+        for (unsigned j = 0; j < reader.GetNumTreesBlocks(taxa); ++j)
+            {
+            const NxsTreesBlock * trees = reader.GetTreesBlock(taxa, j);
+            for (unsigned t = 0; t < trees->GetNumTrees(); ++t)
+                digest += trees->GetFullTreeDescription(t).GetNewick() + "\n";
+            }
+        }
+    reader.DeleteBlocksFromFactories();
+    return digest;
+    }
+
+int main(int argc, const char * argv[])
+    {
+    if (argc < 2)
+        {
+        std::cerr << "usage: nexus_benchmark <nexusfile> [repetitions]" << std::endl;
+        return 1;
+        }
+    std::string filename = argv[1];
+    unsigned nreps = (argc > 2 ? (unsigned)std::atoi(argv[2]) : 5);
+
+    try
+        {
+        std::vector<std::string> names = {"stream", "buffered", "mmap"};
+        std::vector<ReadMode> modes = {stream_mode, buffered_mode, mmap_mode};
+
+        std::string reference = parseNexus(filename, stream_mode);
+        for (unsigned m = 1; m < modes.size(); ++m)
+            if (parseNexus(filename, modes[m]) != reference)
+                throw XStrom(boost::str(boost::format("%s mode does not read the same content as stream mode") % names[m]));
+
+        typedef std::chrono::steady_clock clock_t;
+        std::vector<double> secs(modes.size());
+        for (unsigned m = 0; m < modes.size(); ++m)
+            {
+            clock_t::time_point start = clock_t::now();
+            for (unsigned r = 0; r < nreps; ++r)
+                parseNexus(filename, modes[m]);
+            secs[m] = std::chrono::duration<double>(clock_t::now() - start).count()/nreps;
+            }
+
+        std::cout << boost::str(boost::format("%s: %d repetitions") % filename % nreps) << std::endl;
+        std::cout << boost::str(boost::format("%12s %15s %15s") % "mode" % "seconds/parse" % "speedup") << std::endl;
+        for (unsigned m = 0; m < modes.size(); ++m)
+            std::cout << boost::str(boost::format("%12s %15.4f %14.2fx") % names[m] % secs[m] % (secs[0]/secs[m])) << std::endl;
+        }
+    catch (XStrom & x)
+        {
+        std::cerr << "Error: " << x.what() << std::endl;
+        return 1;
+        }
+
+    return 0;
+    }
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+#include "updater.h"
+#include "coalescent.h"
+
+namespace strom
+    {
+
+    class Chain;
+
+    // Changes the height of one internal node of a rooted, ultrametric tree at a time, keeping
+    // the topology and all other heights fixed, under a Kingman coalescent prior. A non-root node
+    // gets a new height drawn uniformly between its highest child and its parent; the root's
+    // height above its highest child is multiplied by a random factor. Only the node's sorted
+    // position in the coalescent prior's time index changes, so the prior is updated in O(log n).
+    //
+    // Node heights are derived from edge lengths when the updater first sees a tree. If anything
+    // else changes edge lengths, call refreshNodeHeights before the next update.
+    class NodeHeightUpdater : public Updater
+        {
+        friend class Chain;
+
+        public:
+
+                                                NodeHeightUpdater();
+                                                ~NodeHeightUpdater();
+
+            virtual void                        clear();
+
+            void                                setCoalescentPrior(CoalescentPrior::SharedPtr prior);
+            CoalescentPrior::SharedPtr          getCoalescentPrior() const;
+            void                                refreshNodeHeights();
+
+            virtual double                      calcLogPrior() const;
+
+        private:
+
+            virtual void                        revert();
+            virtual void                        proposeNewState();
+            virtual void                        pullCurrentStateFromModel();
+            virtual void                        pushCurrentStateToModel() const;
+
+            virtual void                        reset();
+
+            void                                setHeight(Node * nd, double height);
+
+            CoalescentPrior::SharedPtr          _coalescent_prior;
+            const Tree *                        _indexed_tree;
+            std::vector<double>                 _heights;       // indexed by node number
+            Node::PtrVector                     _nodes;         // indexed by node number
+            unsigned                            _nleaves;
+
+            Node *                              _x;
+            double                              _prev_height;
+
+        public:
+            typedef std::shared_ptr< NodeHeightUpdater > SharedPtr;
+        };
+
+inline NodeHeightUpdater::NodeHeightUpdater()
+    {
+    // std::cout << "Creating a NodeHeightUpdater" << std::endl;
+    clear();
+    }
+
+inline NodeHeightUpdater::~NodeHeightUpdater()
+    {
+    // std::cout << "Destroying a NodeHeightUpdater" << std::endl;
+    }
+
+inline void NodeHeightUpdater::clear()
+    {
+    Updater::clear();
+    _name = "Node Heights";
+    _coalescent_prior.reset(new CoalescentPrior());
+    _indexed_tree = 0;
+    _heights.clear();
+    _nodes.clear();
+    _nleaves = 0;
+    reset();
+    }
+
+inline void NodeHeightUpdater::reset()
+    {
+    _log_hastings_ratio = 0.0;
+    _x                  = 0;
+    _prev_height        = 0.0;
+    }
+
+inline void NodeHeightUpdater::setCoalescentPrior(CoalescentPrior::SharedPtr prior)
+    {
+    _coalescent_prior = prior;
+    _indexed_tree = 0;
+    }
+
+inline CoalescentPrior::SharedPtr NodeHeightUpdater::getCoalescentPrior() const
+    {
+    return _coalescent_prior;
+    }
+
+inline void NodeHeightUpdater::refreshNodeHeights()
+    {
+    Tree::SharedPtr tree = _tree_manipulator->getTree();
+    assert(tree);
+    _tree_manipulator->calcNodeHeights(_heights);
+    _tree_manipulator->getNodesByNumber(_nodes);
+    _nleaves = tree->numLeaves();
+
+    // Internal nodes are numbered _nleaves, _nleaves + 1, ..., 2*_nleaves - 2, so
+    // node number minus _nleaves is the node's slot in the time index
+    std::vector<double> times(_heights.begin() + _nleaves, _heights.begin() + 2*_nleaves - 1);
+    _coalescent_prior->setNodeTimes(times);
+    _indexed_tree = tree.get();
+
+    // Make edge lengths agree exactly with the heights, so that reverting a move restores the
+    // tree the likelihood was last computed for even if it was not quite ultrametric
+    for (unsigned i = _nleaves; i < 2*_nleaves - 1; ++i)
+        {
+        for (Node * child = _nodes[i]->getLeftChild(); child; child = child->getRightSib())
+            child->setEdgeLength(_heights[i] - _heights[child->getNumber()]);
+        }
+    }
+
+inline double NodeHeightUpdater::calcLogPrior() const
+    {
+    return _coalescent_prior->calcLogPrior();
+    }
+
+inline void NodeHeightUpdater::pullCurrentStateFromModel()
+    {
+    if (_indexed_tree != _tree_manipulator->getTree().get())
+        refreshNodeHeights();
+    }
+
+inline void NodeHeightUpdater::pushCurrentStateToModel() const
+    {
+    }
+
+inline void NodeHeightUpdater::setHeight(Node * nd, double height)
+    {
+    // Moves nd to the given height, adjusting the edges to its children and (unless it is the
+    // root) its parent, and its entry in the coalescent time index
+    _heights[nd->getNumber()] = height;
+    for (Node * child = nd->getLeftChild(); child; child = child->getRightSib())
+        child->setEdgeLength(height - _heights[child->getNumber()]);
+    Node * parent = nd->getParent();
+    if (parent->getParent())
+        nd->setEdgeLength(_heights[parent->getNumber()] - height);
+    _coalescent_prior->setNodeTime(nd->getNumber() - _nleaves, height);
+    }
+
+inline void NodeHeightUpdater::proposeNewState()
+    {
+    assert(_indexed_tree);
+    unsigned slot = (unsigned)std::floor(_lot->uniform()*(_nleaves - 1));
+    _x = _nodes[_nleaves + slot];
+    _prev_height = _heights[_x->getNumber()];
+
+    double lower = 0.0;
+    for (Node * child = _x->getLeftChild(); child; child = child->getRightSib())
+        lower = std::max(lower, _heights[child->getNumber()]);
+    lower += Node::_smallest_edge_length;
+
+    double new_height = 0.0;
+    Node * parent = _x->getParent();
+    if (parent->getParent())
+        {
+        // Uniform between the highest child and the parent: the proposal is symmetric
+        double upper = _heights[parent->getNumber()] - Node::_smallest_edge_length;
+        new_height = lower + _lot->uniform()*(upper - lower);
+        _log_hastings_ratio = 0.0;
+        }
+    else
+        {
+        // Root: scale the distance above the highest child
+        double m = exp(_lambda*(_lot->uniform() - 0.5));
+        new_height = lower + m*(_prev_height - lower);
+        _log_hastings_ratio = log(m);
+        }
+
+    setHeight(_x, new_height);
+    }
+
+inline void NodeHeightUpdater::revert()
+    {
+    assert(_x);
+    setHeight(_x, _prev_height);
+    }
+
+    }
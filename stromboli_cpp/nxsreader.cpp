@@ -116,15 +116,14 @@ void NxsReader::ReadFilepath(const char *filename)
 		err << '\"' << filename <<"\" does not refer to a valid file." ;
 		this->NexusError(err, 0, -1, -1);
 		}
-	this->ReadFilestream(inf);
+	this->ReadFilestreamBuffered(inf);
 	}
 
 
 /*! Reads the content of string `s` as if it were NEXUS. */
 void NxsReader::ReadStringAsNexusContent(const std::string & s)
 	{
-	std::istringstream inf(s);
-	this->ReadFilestream(inf);
+	this->ReadBuffer(s.data(), s.data() + s.length());
 	}
 
 /*! Reads the istream `inf` by creating a NxsToken object and then calling NxsReader::Execute() */
@@ -134,6 +133,21 @@ void NxsReader::ReadFilestream(std::istream & inf)
 	this->Execute(token);
 	}
 
+/*! Like ReadFilestream, but the tokenizer reads `inf` in blocks of `blockSize` characters (so `inf` is read ahead
+	of the parser and should not be used for anything else until this returns) */
+void NxsReader::ReadFilestreamBuffered(std::istream & inf, std::size_t blockSize)
+	{
+	NxsToken token(inf, blockSize);
+	this->Execute(token);
+	}
+
+/*! Reads the characters from `begin` up to `end` (e.g. a memory-mapped file) as NEXUS content */
+void NxsReader::ReadBuffer(const char * begin, const char * end)
+	{
+	NxsToken token(begin, end);
+	this->Execute(token);
+	}
+
 /*! Returns the set of blocks that have been created from factories, and
 	removes reference to from the NxsReader's collections.
 */
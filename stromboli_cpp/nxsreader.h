@@ -179,6 +179,8 @@ class NxsReader
 		// shortcuts for calling execute...
 		void			ReadFilepath(const char *filename);
 		void			ReadFilestream(std::istream & inf);
+		void			ReadFilestreamBuffered(std::istream & inf, std::size_t blockSize = 1 << 20);
+		void			ReadBuffer(const char * begin, const char * end);
 		void			ReadStringAsNexusContent(const std::string & s);
 
 		virtual void	DebugReportBlock(NxsBlock &nexusBlock);
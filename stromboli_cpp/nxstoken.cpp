@@ -221,15 +221,49 @@ inline void NxsToken::AdvanceToNextCharInStream()
 	{
 	if (nextCharInStream == EOF)
 		return;
-	nextCharInStream  = (signed char) (inputStream.rdbuf())->sbumpc();
+	if (buffered)
+		{
+		// Pointer scan of the buffer; the stream (if any) is only touched once per block
+		for (;;)
+			{
+			if (bufCurr == bufEnd && !RefillBuffer())
+				{
+				nextCharPos = bufOffset + (bufEnd - bufBegin);
+				nextCharInStream = EOF;
+				return;
+				}
+			if (skipLeadingLF)
+				{
+				skipLeadingLF = false;
+				if (*bufCurr == 10)
+					{
+					++bufCurr;
+					continue;
+					}
+				}
+			break;
+			}
+		nextCharPos = bufOffset + (bufCurr - bufBegin);
+		nextCharInStream = (signed char) *bufCurr++;
+		if (nextCharInStream == 13)
+			{
+			if (bufCurr == bufEnd)
+				skipLeadingLF = true;
+			else if (*bufCurr == 10)
+				++bufCurr;
+			nextCharInStream = '\n';
+			}
+		return;
+		}
+	nextCharInStream  = (signed char) (inputStream->rdbuf())->sbumpc();
 	posOffBy = -1;
 	if (nextCharInStream == 13 || nextCharInStream == 10)
 		{
 		if(nextCharInStream == 13)
 			{
-			if ((inputStream.rdbuf())->sgetc() == 10)	//peeks at the next char
+			if ((inputStream->rdbuf())->sgetc() == 10)	//peeks at the next char
 				{
-				(inputStream.rdbuf())->sbumpc();
+				(inputStream->rdbuf())->sbumpc();
 				posOffBy = -2;
 				}
 			}
@@ -237,6 +271,59 @@ inline void NxsToken::AdvanceToNextCharInStream()
 		}
 	}
 
+/*!
+	Block-buffered stream mode: replaces the current block with the next one read from the stream. Line and column
+	bookkeeping is brought up to the end of the old block first, since its characters are about to be discarded.
+	Returns false at the end of the input (always, in memory mode).
+*/
+bool NxsToken::RefillBuffer()
+	{
+	if (!inputStream)
+		return false;
+	long long endPos = bufOffset + (bufEnd - bufBegin);
+	AdvanceLineCache(endPos);
+	std::streamsize n = inputStream->rdbuf()->sgetn(&blockBuffer[0], (std::streamsize)blockBuffer.size());
+	if (n <= 0)
+		return false;
+	bufOffset = endPos;
+	bufBegin = bufCurr = &blockBuffer[0];
+	bufEnd = bufBegin + n;
+	return true;
+	}
+
+/*!
+	Buffered modes: brings the cached line and column up to date for file position `targetPos', counting line
+	endings and tabs exactly as GetNextChar does when reading from a stream. Called only when a position is asked
+	for (e.g. for an error message), so the common path of scanning characters does no bookkeeping at all.
+*/
+void NxsToken::AdvanceLineCache(long long targetPos) const
+	{
+	if (targetPos <= lineCachePos)
+		return;
+	const char *p = bufBegin + (lineCachePos - bufOffset);
+	const char *e = bufBegin + (targetPos - bufOffset);
+	for (; p != e; ++p)
+		{
+		const char ch = *p;
+		if (ch == 10 && lineCacheAfterCR)
+			{
+			lineCacheAfterCR = false;
+			continue;
+			}
+		lineCacheAfterCR = (ch == 13);
+		if (ch == 10 || ch == 13)
+			{
+			lineCacheLine++;
+			lineCacheColumn = 1L;
+			}
+		else if (ch == '\t')
+			lineCacheColumn += 4 - ((lineCacheColumn - 1)%4);
+		else
+			lineCacheColumn++;
+		}
+	lineCachePos = targetPos;
+	}
+
 
 #if defined(NEW_NXS_TOKEN_READ_CHAR)
 /*!
@@ -264,11 +351,17 @@ inline char NxsToken::GetNextChar()
 		}
 	if(ch == '\n')
 		{
-		fileLine++;
-		fileColumn = 1L;
+		if (!buffered)
+			{
+			fileLine++;
+			fileColumn = 1L;
+			}
 		atEOL = true;
 		return '\n';
 		}
+	atEOL = false;
+	if (buffered)
+		return ch;
 	if (ch == '\t')
 		fileColumn += 4 - ((fileColumn - 1)%4);	//@assumes that tab will be 4 in the editor we use
 	else
@@ -294,8 +387,8 @@ inline char NxsToken::GetNextChar()
 */
 inline char NxsToken::GetNextChar()
 	{
-	int ch = inputStream.get();
-	int failed = inputStream.bad();
+	int ch = inputStream->get();
+	int failed = inputStream->bad();
 	if (failed)
 		{
 		errormsg = "Unknown error reading data file (check to make sure file exists)";
@@ -307,8 +400,8 @@ inline char NxsToken::GetNextChar()
 		fileLine++;
 		fileColumn = 1L;
 
-		if (ch == 13 && (int)inputStream.peek() == 10)
-			ch = inputStream.get();
+		if (ch == 13 && (int)inputStream->peek() == 10)
+			ch = inputStream->get();
 
 		atEOL = 1;
 		}
@@ -323,7 +416,7 @@ inline char NxsToken::GetNextChar()
 #	if defined(__DECCXX)
 		filepos = 0L;
 #	else
-		file_pos filepos = inputStream.tellg();
+		file_pos filepos = inputStream->tellg();
 #	endif
 
 	if (atEOF)
@@ -509,8 +602,50 @@ bool NxsToken::NeedsQuotes(const std::string &s)
 */
 NxsToken::NxsToken(
   istream &i)	/* the istream object to which the token is to be associated */
-  : inputStream(i),
+  : inputStream(&i),
+	buffered(false),
+	eofAllowed(true)
+	{
+	InitTokenizer();
+	}
+
+/*!
+	Reads from `i' in blocks of `blockSize' characters and scans each block with pointer arithmetic, rather than
+	pulling characters from the stream one at a time. Line and column numbers are computed only when asked for. The
+	stream is read ahead of the tokenizer, so it should not be used by anything else while the token is alive.
+*/
+NxsToken::NxsToken(
+  istream &i,			/* the istream object to which the token is to be associated */
+  std::size_t blockSize)	/* number of characters to read from the stream at a time */
+  : inputStream(&i),
+	buffered(true),
+	blockBuffer(blockSize > 0 ? blockSize : 1),
 	eofAllowed(true)
+	{
+	InitTokenizer();
+	}
+
+/*!
+	Scans the characters from `begin' up to (not including) `end', which must remain valid while the token is alive
+	(e.g. a memory-mapped file). Line and column numbers are computed only when asked for.
+*/
+NxsToken::NxsToken(
+  const char *begin,	/* first character of the input */
+  const char *end)		/* one past the last character of the input */
+  : inputStream(NULL),
+	buffered(true),
+	eofAllowed(true)
+	{
+	InitTokenizer();
+	bufBegin = bufCurr = begin;
+	bufEnd = end;
+#	if defined(NEW_NXS_TOKEN_READ_CHAR)
+		nextCharInStream = 'a';
+		AdvanceToNextCharInStream();
+#	endif
+	}
+
+void NxsToken::InitTokenizer()
 	{
 	posOffBy = 0;
 	atEOF		= false;
@@ -522,13 +657,23 @@ NxsToken::NxsToken(
 	saved		= '\0';
 	special		= '\0';
 
+	bufBegin = bufCurr = bufEnd = NULL;
+	bufOffset = 0;
+	nextCharPos = 0;
+	skipLeadingLF = false;
+	lineCachePos = 0;
+	lineCacheLine = 1L;
+	lineCacheColumn = 1L;
+	lineCacheAfterCR = false;
+
 	whitespace[0]  = ' ';
 	whitespace[1]  = '\t';
 	whitespace[2]  = '\n';
 	whitespace[3]  = '\0';
 #	if defined(NEW_NXS_TOKEN_READ_CHAR)
 		nextCharInStream = 'a';	//anything other than EOF will work
-		AdvanceToNextCharInStream();
+		if (inputStream)
+			AdvanceToNextCharInStream();
 #	endif
     this->isPunctuationFn = &(NxsString::IsNexusPunctuation);
 	}
@@ -685,8 +830,8 @@ void NxsToken::GetQuoted()
 	{
 	bool formerEOFAllowed = eofAllowed;
 	eofAllowed = false;
-	long fl = fileLine;
-	long fc = fileColumn;
+	long fl = GetFileLine();
+	long fc = GetFileColumn();
 
 	try
 		{
@@ -20,6 +20,8 @@
 #ifndef NCL_NXSTOKEN_H
 #define NCL_NXSTOKEN_H
 
+#include <vector>
+#include <cstddef>
 #include "nxsexception.h"
 class NxsToken;
 
@@ -380,6 +382,8 @@ class NxsToken
 		NxsString		errormsg;
 
 						NxsToken(std::istream &i);
+						NxsToken(std::istream &i, std::size_t blockSize);
+						NxsToken(const char *begin, const char *end);
 		virtual			~NxsToken();
 
 		bool			AtEOF();
@@ -459,8 +463,23 @@ class NxsToken
 		void AdvanceToNextCharInStream();
 		char			GetNextChar();
 		//char ReadNextChar();
-
-		std::istream	&inputStream;		/* reference to input stream from which tokens will be read */
+		void			InitTokenizer();
+		bool			RefillBuffer();
+		void			AdvanceLineCache(long long targetPos) const;
+
+		std::istream	*inputStream;		/* input stream from which tokens will be read (NULL when reading from memory) */
+		bool			buffered;			/* true if characters are scanned from bufBegin..bufEnd rather than pulled one at a time from the stream */
+		const char		*bufBegin;			/* start of the characters currently available (whole input in memory mode, current block otherwise) */
+		const char		*bufCurr;			/* next unread character */
+		const char		*bufEnd;			/* end of the characters currently available */
+		long long		bufOffset;			/* file position of bufBegin */
+		long long		nextCharPos;		/* file position of nextCharInStream */
+		bool			skipLeadingLF;		/* a CR ended the previous block, so a LF starting the next one belongs to it */
+		std::vector<char> blockBuffer;		/* storage for the block-buffered stream mode */
+		mutable long long lineCachePos;		/* buffered modes compute line and column lazily; these hold the values at lineCachePos */
+		mutable long	lineCacheLine;
+		mutable long	lineCacheColumn;
+		mutable bool	lineCacheAfterCR;
 		signed char		nextCharInStream;
 		file_pos		posOffBy;			/* offset of the file pos (according to the stream) and the tokenizer (which is usually a character or two behind, due to saved chars */
 		file_pos		usualPosOffBy;		/* default of posOffBy.  Usually this is -1, but it can be positive if a tokenizer is created from a substring of the file */
@@ -617,6 +636,11 @@ inline void NxsToken::BlanksToUnderscores()
 */
 inline long  NxsToken::GetFileColumn() const
 	{
+	if (buffered)
+		{
+		AdvanceLineCache(nextCharPos);
+		return lineCacheColumn;
+		}
 	return fileColumn;
 	}
 
@@ -627,7 +651,9 @@ inline long  NxsToken::GetFileColumn() const
 */
 inline file_pos  NxsToken::GetFilePosition() const
 	{
-	return inputStream.rdbuf()->pubseekoff(0,std::ios::cur, std::ios::in) + posOffBy;
+	if (buffered)
+		return file_pos(nextCharPos);
+	return inputStream->rdbuf()->pubseekoff(0,std::ios::cur, std::ios::in) + posOffBy;
 	}
 
 /*!
@@ -636,6 +662,11 @@ inline file_pos  NxsToken::GetFilePosition() const
 */
 inline long  NxsToken::GetFileLine() const
 	{
+	if (buffered)
+		{
+		AdvanceLineCache(nextCharPos);
+		return lineCacheLine;
+		}
 	return fileLine;
 	}
 
@@ -4,7 +4,11 @@
 #include "tree_manip.hpp"
 #include "model.hpp"
 #include "xstrom.hpp"
+#include "async_writer.h"
+#include "mapped_file.h"
+#include "serialization.h"
 #include <fstream>
+#include <cstdint>
 
 namespace strom
     {
@@ -20,34 +24,54 @@ namespace strom
 
             void                                                openTreeFile(std::string filename, Data::SharedPtr data);
             void                                                openParameterFile(std::string filename, Model::SharedPtr model);
+            void                                                openTraceFile(std::string filename, Data::SharedPtr data, Model::SharedPtr model);
 
             void                                                closeTreeFile();
             void                                                closeParameterFile();
+            void                                                closeTraceFile();
 
             void                                                outputConsole(std::string s);
             void                                                outputTree(unsigned iter, TreeManip::SharedPtr tm);
             void                                                outputParameters(unsigned iter, double lnL, double lnP, double TL, Model::SharedPtr model);
+            void                                                outputTrace(unsigned iter, double lnL, double lnP, double TL, Model::SharedPtr model, TreeManip::SharedPtr tm);
 
+            static void                                         convertTraceToNexus(std::string trace_filename, std::string tree_filename, std::string param_filename);
 
         private:
 
+            static std::string                                  treeFileHeader(Data::SharedPtr data);
+            static std::string                                  parameterFileHeader(Model::SharedPtr model);
+            static void                                         appendTreeLine(std::string & s, unsigned iter, const TreeManip & tm);
+            static void                                         appendParameterLine(std::string & s, unsigned iter, double lnL, double lnP, double TL, const std::vector<double> & values);
+
+            enum {_trace_magic = 0x43525453, _trace_version = 1};      // magic is "STRC" in little-endian byte order
+
             TreeManip::SharedPtr                                _tree_manip;
             Model::SharedPtr                                    _model;
-            std::ofstream                                       _treefile;
-            std::ofstream                                       _parameterfile;
+            AsyncWriter                                         _treefile;
+            AsyncWriter                                         _parameterfile;
+            AsyncWriter                                         _tracefile;
             std::string                                         _tree_file_name;
             std::string                                         _param_file_name;
+            std::string                                         _trace_file_name;
+            std::vector<double>                                 _param_values;
 
         public:
 
             typedef std::shared_ptr< OutputManager >            SharedPtr;
     };
 
+// Trees and parameters are formatted directly into the writers' record buffers and handed to
+// background threads that own the files, so sampling costs the chain little more than the
+// formatting itself. The optional trace file holds the same information in binary form and can
+// be turned back into the usual tree and parameter files with convertTraceToNexus.
+
 inline OutputManager::OutputManager()
     {
     //std::cout << "Constructing an OutputManager" << std::endl;
     _tree_file_name = "trees.t";
     _param_file_name = "params.p";
+    _trace_file_name = "trace.bin";
     }
 
 inline OutputManager::~OutputManager()
@@ -55,45 +79,122 @@ inline OutputManager::~OutputManager()
     //std::cout << "Destroying an OutputManager" << std::endl;
     }
 
+inline std::string OutputManager::treeFileHeader(Data::SharedPtr data)
+    {
+    std::string s = "#nexus\n\n";
+    s += data->createTaxaBlock() + "\n";
+    s += "begin trees;\n";
+    s += data->createTranslateStatement() + "\n";
+    return s;
+    }
+
+inline std::string OutputManager::parameterFileHeader(Model::SharedPtr model)
+    {
+    return boost::str(boost::format("%s\t%s\t%s\t%s\t%s\n") % "iter" % "lnL" % "lnPr" % "TL" % model->paramNamesAsString("\t"));
+    }
+
+inline void OutputManager::appendTreeLine(std::string & s, unsigned iter, const TreeManip & tm)
+    {
+    s += "  tree iter_";
+    appendUnsigned(s, iter);
+    s += " = ";
+    tm.appendNewick(s, 5);
+    s += ";\n";
+    }
+
+inline void OutputManager::appendParameterLine(std::string & s, unsigned iter, double lnL, double lnP, double TL, const std::vector<double> & values)
+    {
+    appendUnsigned(s, iter);
+    s += '\t';
+    appendFixed(s, lnL, 5);
+    s += '\t';
+    appendFixed(s, lnP, 5);
+    s += '\t';
+    appendFixed(s, TL, 5);
+    for (unsigned i = 0; i < values.size(); ++i)
+        {
+        s += '\t';
+        appendFixed(s, values[i], 5);
+        }
+    s += '\n';
+    }
+
 inline void OutputManager::openTreeFile(std::string filename, Data::SharedPtr data)
     {
-    assert(!_treefile.is_open());
+    assert(!_treefile.isOpen());
     _tree_file_name = filename;
-    _treefile.open(_tree_file_name.c_str());
-    if (!_treefile.is_open())
+    try
+        {
+        _treefile.open(_tree_file_name);
+        }
+    catch(XStrom &)
+        {
         throw XStrom(boost::str(boost::format("Could not open tree file \"%s\"") % _tree_file_name));
-
-    _treefile << "#nexus\n\n";
-    _treefile << data->createTaxaBlock() << std::endl;
-
-    _treefile << "begin trees;\n";
-    _treefile << data->createTranslateStatement() << std::endl;
+        }
+    _treefile.write(treeFileHeader(data));
     }
 
 inline void OutputManager::closeTreeFile()
     {
-    assert(_treefile.is_open());
-    _treefile << "end;\n";
+    assert(_treefile.isOpen());
+    _treefile.write("end;\n");
     _treefile.close();
     }
 
 inline void OutputManager::openParameterFile(std::string filename, Model::SharedPtr model)
     {
     assert(model);
-    assert(!_parameterfile.is_open());
+    assert(!_parameterfile.isOpen());
     _param_file_name = filename;
-    _parameterfile.open(_param_file_name.c_str());
-    if (!_parameterfile.is_open())
+    try
+        {
+        _parameterfile.open(_param_file_name);
+        }
+    catch(XStrom &)
+        {
         throw XStrom(boost::str(boost::format("Could not open parameter file \"%s\"") % _param_file_name));
-    _parameterfile << boost::str(boost::format("%s\t%s\t%s\t%s\t%s") % "iter" % "lnL" % "lnPr" % "TL" % model->paramNamesAsString("\t")) << std::endl;
+        }
+    _parameterfile.write(parameterFileHeader(model));
     }
 
 inline void OutputManager::closeParameterFile()
     {
-    assert(_parameterfile.is_open());
+    assert(_parameterfile.isOpen());
     _parameterfile.close();
     }
 
+inline void OutputManager::openTraceFile(std::string filename, Data::SharedPtr data, Model::SharedPtr model)
+    {
+    assert(model);
+    assert(!_tracefile.isOpen());
+    _trace_file_name = filename;
+    try
+        {
+        _tracefile.open(_trace_file_name, true);
+        }
+    catch(XStrom &)
+        {
+        throw XStrom(boost::str(boost::format("Could not open trace file \"%s\"") % _trace_file_name));
+        }
+
+    // Header: magic, version, the text that begins the tree and parameter files, and the number
+    // of model parameters stored in each record
+    model->getParamValues(_param_values);
+    std::string & s = _tracefile.beginRecord();
+    appendBinary(s, (std::uint32_t)_trace_magic);
+    appendBinary(s, (std::uint32_t)_trace_version);
+    appendBinaryString(s, treeFileHeader(data));
+    appendBinaryString(s, parameterFileHeader(model));
+    appendBinary(s, (std::uint32_t)_param_values.size());
+    _tracefile.commitRecord();
+    }
+
+inline void OutputManager::closeTraceFile()
+    {
+    assert(_tracefile.isOpen());
+    _tracefile.close();
+    }
+
 inline void OutputManager::outputConsole(std::string s)
     {
     std::cout << s << std::endl;
@@ -101,17 +202,93 @@ inline void OutputManager::outputConsole(std::string s)
 
 inline void OutputManager::outputTree(unsigned iter, TreeManip::SharedPtr tm)
     {
-    assert(_treefile.is_open());
+    assert(_treefile.isOpen());
     assert(tm);
-    _treefile << boost::str(boost::format("  tree iter_%d = %s;") % iter % tm->makeNewick(5)) << std::endl;
+    appendTreeLine(_treefile.beginRecord(), iter, *tm);
+    _treefile.commitRecord();
     }
 
 inline void OutputManager::outputParameters(unsigned iter, double lnL, double lnP, double TL, Model::SharedPtr model)
     {
     assert(model);
-    assert(_parameterfile.is_open());
-    _parameterfile << boost::str(boost::format("%d\t%.5f\t%.5f\t%.5f\t%s") % iter % lnL % lnP % TL % model->paramValuesAsString("\t")) << std::endl;
+    assert(_parameterfile.isOpen());
+    model->getParamValues(_param_values);
+    appendParameterLine(_parameterfile.beginRecord(), iter, lnL, lnP, TL, _param_values);
+    _parameterfile.commitRecord();
     }
 
+inline void OutputManager::outputTrace(unsigned iter, double lnL, double lnP, double TL, Model::SharedPtr model, TreeManip::SharedPtr tm)
+    {
+    assert(model);
+    assert(tm);
+    assert(_tracefile.isOpen());
+    model->getParamValues(_param_values);
+    std::string & s = _tracefile.beginRecord();
+    appendBinary(s, (std::uint32_t)iter);
+    appendBinary(s, lnL);
+    appendBinary(s, lnP);
+    appendBinary(s, TL);
+    for (auto v : _param_values)
+        appendBinary(s, v);
+    tm->saveBinary(s);
+    _tracefile.commitRecord();
+    }
+
+inline void OutputManager::convertTraceToNexus(std::string trace_filename, std::string tree_filename, std::string param_filename)
+    {
+    MappedFile trace(trace_filename);
+    const char * p = trace.begin();
+    const char * end = trace.end();
+
+    std::uint32_t magic = 0;
+    std::uint32_t version = 0;
+    if (trace.size() >= sizeof(magic))
+        readBinary(p, end, magic);
+    if (magic != _trace_magic)
+        throw XStrom(boost::str(boost::format("File \"%s\" is not a trace file") % trace_filename));
+    readBinary(p, end, version);
+    if (version != _trace_version)
+        throw XStrom(boost::str(boost::format("Trace file \"%s\" has unsupported version %d") % trace_filename % version));
+
+    std::string tree_header;
+    std::string param_header;
+    std::uint32_t nparams = 0;
+    readBinaryString(p, end, tree_header);
+    readBinaryString(p, end, param_header);
+    readBinary(p, end, nparams);
+
+    AsyncWriter treefile;
+    AsyncWriter paramfile;
+    treefile.open(tree_filename);
+    paramfile.open(param_filename);
+    treefile.write(tree_header);
+    paramfile.write(param_header);
+
+    TreeManip tm;
+    std::vector<double> values(nparams);
+    while (p < end)
+        {
+        std::uint32_t iter = 0;
+        double lnL = 0.0;
+        double lnP = 0.0;
+        double TL = 0.0;
+        readBinary(p, end, iter);
+        readBinary(p, end, lnL);
+        readBinary(p, end, lnP);
+        readBinary(p, end, TL);
+        for (auto & v : values)
+            readBinary(p, end, v);
+        tm.loadBinary(p, end);
+
+        appendTreeLine(treefile.beginRecord(), iter, tm);
+        treefile.commitRecord();
+        appendParameterLine(paramfile.beginRecord(), iter, lnL, lnP, TL, values);
+        paramfile.commitRecord();
+        }
+
+    treefile.write("end;\n");
+    treefile.close();
+    paramfile.close();
+    }
 
 }
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <cassert>
+
+namespace strom
+    {
+
+    // Matrix of 4-bit nucleotide codes, 16 to a 64-bit word, each row starting on a word
+    // boundary. A code is the IUPAC set of possible bases as a bit mask (A = 1, C = 2, G = 4,
+    // T = 8), so ambiguity codes are kept exactly and 15 stands for a gap or missing data.
+    class PackedMatrix
+        {
+        public:
+            typedef std::uint64_t       word_t;
+
+            enum {bits_per_code = 4, codes_per_word = 16, missing_code = 15};
+
+                                        PackedMatrix();
+
+            void                        clear();
+            void                        resize(unsigned nrows, unsigned ncols);
+
+            unsigned                    getNumRows() const;
+            unsigned                    getNumCols() const;
+            unsigned                    getWordsPerRow() const;
+            std::size_t                 getNumBytes() const;
+
+            unsigned                    get(unsigned row, unsigned col) const;
+            void                        set(unsigned row, unsigned col, unsigned code);
+
+            const word_t *              getRow(unsigned row) const;
+            word_t *                    getRow(unsigned row);
+
+            void                        unpackRow(unsigned row, int * states) const;
+
+            static unsigned             stateToCode(int state);
+            static int                  codeToState(unsigned code);
+
+        private:
+
+            unsigned                    _nrows;
+            unsigned                    _ncols;
+            unsigned                    _words_per_row;
+            std::vector<word_t>         _words;
+
+        public:
+
+            typedef std::shared_ptr< PackedMatrix > SharedPtr;
+        };
+
+    // Hash for a packed column (such as a site pattern) stored as a vector of words
+    struct PackedWordsHash
+        {
+        std::size_t operator()(const std::vector<PackedMatrix::word_t> & v) const
+            {
+            std::uint64_t h = 0x9e3779b97f4a7c15ULL;
+            for (auto w : v)
+                {
+                h ^= w + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+                h *= 0xff51afd7ed558ccdULL;
+                }
+            return (std::size_t)(h ^ (h >> 33));
+            }
+        };
+
+inline PackedMatrix::PackedMatrix()
+    {
+    clear();
+    }
+
+inline void PackedMatrix::clear()
+    {
+    _nrows = 0;
+    _ncols = 0;
+    _words_per_row = 0;
+    _words.clear();
+    }
+
+inline void PackedMatrix::resize(unsigned nrows, unsigned ncols)
+    {
+    // All codes are zero afterwards
+    _nrows = nrows;
+    _ncols = ncols;
+    _words_per_row = (ncols + codes_per_word - 1)/codes_per_word;
+    _words.assign((std::size_t)_nrows*_words_per_row, 0);
+    }
+
+inline unsigned PackedMatrix::getNumRows() const
+    {
+    return _nrows;
+    }
+
+inline unsigned PackedMatrix::getNumCols() const
+    {
+    return _ncols;
+    }
+
+inline unsigned PackedMatrix::getWordsPerRow() const
+    {
+    return _words_per_row;
+    }
+
+inline std::size_t PackedMatrix::getNumBytes() const
+    {
+    return _words.size()*sizeof(word_t);
+    }
+
+inline unsigned PackedMatrix::get(unsigned row, unsigned col) const
+    {
+    assert(row < _nrows && col < _ncols);
+    word_t w = _words[(std::size_t)row*_words_per_row + col/codes_per_word];
+    return (unsigned)(w >> (bits_per_code*(col % codes_per_word))) & 0xF;
+    }
+
+inline void PackedMatrix::set(unsigned row, unsigned col, unsigned code)
+    {
+    assert(row < _nrows && col < _ncols && code < 16);
+    word_t & w = _words[(std::size_t)row*_words_per_row + col/codes_per_word];
+    unsigned shift = bits_per_code*(col % codes_per_word);
+    w = (w & ~((word_t)0xF << shift)) | ((word_t)code << shift);
+    }
+
+inline const PackedMatrix::word_t * PackedMatrix::getRow(unsigned row) const
+    {
+    assert(row < _nrows);
+    return &_words[(std::size_t)row*_words_per_row];
+    }
+
+inline PackedMatrix::word_t * PackedMatrix::getRow(unsigned row)
+    {
+    assert(row < _nrows);
+    return &_words[(std::size_t)row*_words_per_row];
+    }
+
+inline void PackedMatrix::unpackRow(unsigned row, int * states) const
+    {
+    // Expands a row to the state codes BeagleLib expects (0-3, or 4 for anything ambiguous)
+    const word_t * w = getRow(row);
+    for (unsigned col = 0; col < _ncols; ++col)
+        states[col] = codeToState((unsigned)(w[col/codes_per_word] >> (bits_per_code*(col % codes_per_word))) & 0xF);
+    }
+
+inline unsigned PackedMatrix::stateToCode(int state)
+    {
+    return (state >= 0 && state < 4 ? 1u << state : (unsigned)missing_code);
+    }
+
+inline int PackedMatrix::codeToState(unsigned code)
+    {
+    static const int states[16] = {4, 0, 1, 4, 2, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4};
+    return states[code & 0xF];
+    }
+
+    }
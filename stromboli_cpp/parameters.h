@@ -20,6 +20,32 @@
 
 class Parameters;
 
+// Typed reference to an object-valued (boost::any) entry, resolved once with
+// Parameters::get_any_handle. Dereferencing does no hashing, any_cast or
+// reference counting. The handle keeps the entry alive, but is invalidated if
+// the entry is later assigned a new value.
+template<class T>
+class AnyHandle
+{
+  
+public:
+  
+  AnyHandle();
+  AnyHandle(const std::shared_ptr<boost::any> &entry_in);
+  
+  const T& operator*() const;
+  const T* operator->() const;
+  const T* get() const;
+  
+  bool is_resolved() const;
+  
+protected:
+  
+  std::shared_ptr<boost::any> entry;
+  const T* value;
+  
+};
+
 typedef boost::unordered_map< std::string, std::pair<std::shared_ptr<arma::mat>,bool>>::iterator vector_parameter_iterator;
 typedef boost::unordered_map< std::string, std::pair<std::shared_ptr<arma::mat>,bool>>::const_iterator vector_parameter_const_iterator;
 typedef boost::unordered_map< std::string, std::pair<std::shared_ptr<boost::any>,bool>>::iterator any_parameter_iterator;
@@ -41,13 +67,19 @@ public:
   virtual ~Parameters();
   
   arma::mat& operator[](const std::string &variable);
-  arma::mat operator[](const std::string &variable) const;
+  const arma::mat& operator[](const std::string &variable) const;
   arma::colvec operator[](const std::vector<std::string> &variables) const;
   
   //std::shared_ptr<arma::mat> get_vector_pointer(const std::string &variable);
   
   boost::any& operator()(const std::string &variable);
-  boost::any operator()(const std::string &variable) const;
+  const boost::any& operator()(const std::string &variable) const;
+  
+  template<class T>
+  const T& get_any(const std::string &variable) const;
+  
+  template<class T>
+  AnyHandle<T> get_any_handle(const std::string &variable) const;
   
   //std::shared_ptr<boost::any> get_any_pointer(const std::string &variable);
   
@@ -70,6 +102,8 @@ public:
   arma::rowvec get_rowvec(const std::string &variable) const;
   arma::rowvec get_rowvec(const std::vector<std::string> &variables) const;
   
+  double get_double(const std::string &variable) const;
+  
   std::vector<arma::mat> get_matrices(const std::vector<std::string> &variables) const;
   
   Parameters merge(const Parameters &another) const;
@@ -77,6 +111,7 @@ public:
   //void add_parameters_overwrite(const Parameters &another);
   
   void merge_with_fixed(const Parameters &conditioned_on_parameters);
+  void merge_fixed_variables(const Parameters &another);
   
   Parameters deep_copy_nonfixed() const;
   void self_deep_copy_nonfixed();
@@ -126,6 +161,45 @@ typedef Parameters Data;
 
 #include <RcppArmadillo.h>
 
+template<class T>
+inline AnyHandle<T>::AnyHandle()
+{
+  this->value = NULL;
+}
+
+template<class T>
+inline AnyHandle<T>::AnyHandle(const std::shared_ptr<boost::any> &entry_in)
+{
+  this->entry = entry_in;
+  this->value = boost::any_cast<T>(this->entry.get());
+  if (this->value==NULL)
+    Rcpp::stop("AnyHandle: variable does not have the requested type.");
+}
+
+template<class T>
+inline const T& AnyHandle<T>::operator*() const
+{
+  return *this->value;
+}
+
+template<class T>
+inline const T* AnyHandle<T>::operator->() const
+{
+  return this->value;
+}
+
+template<class T>
+inline const T* AnyHandle<T>::get() const
+{
+  return this->value;
+}
+
+template<class T>
+inline bool AnyHandle<T>::is_resolved() const
+{
+  return this->value!=NULL;
+}
+
 inline Parameters::Parameters()
 {
   this->vector_parameters.clear();
@@ -282,6 +356,14 @@ inline arma::rowvec Parameters::get_rowvec(const std::vector<std::string> &varia
   return concatenated_vector;
 }
 
+inline double Parameters::get_double(const std::string &variable) const
+{
+  const arma::mat &value = (*this)[variable];
+  if (value.n_elem==0)
+    Rcpp::stop("Parameters::get_double: variable is empty.");
+  return value[0];
+}
+
 inline std::vector<arma::mat> Parameters::get_matrices(const std::vector<std::string> &variables) const
 {
   std::vector<arma::mat> output;
@@ -459,7 +541,7 @@ inline arma::mat& Parameters::operator[](const std::string &variable)
     
 }
 
-inline arma::mat Parameters::operator[](const std::string &variable) const
+inline const arma::mat& Parameters::operator[](const std::string &variable) const
 {
   auto found = this->vector_parameters.find(variable);
   if (found != this->vector_parameters.end())
@@ -553,7 +635,7 @@ inline boost::any& Parameters::operator()(const std::string &variable)
   }
 }
 
-inline boost::any Parameters::operator()(const std::string &variable) const
+inline const boost::any& Parameters::operator()(const std::string &variable) const
 {
   auto found = this->any_parameters.find(variable);
   
@@ -563,6 +645,24 @@ inline boost::any Parameters::operator()(const std::string &variable) const
     Rcpp::stop("Parameters::operator(): variable not found in Parameters.");
 }
 
+template<class T>
+inline const T& Parameters::get_any(const std::string &variable) const
+{
+  const T* value = boost::any_cast<T>(&(*this)(variable));
+  if (value==NULL)
+    Rcpp::stop("Parameters::get_any: variable does not have the requested type.");
+  return *value;
+}
+
+template<class T>
+inline AnyHandle<T> Parameters::get_any_handle(const std::string &variable) const
+{
+  auto found = this->any_parameters.find(variable);
+  if (found == this->any_parameters.end())
+    Rcpp::stop("Parameters::get_any_handle: variable not found in Parameters.");
+  return AnyHandle<T>(found->second.first);
+}
+
 /*
 inline std::shared_ptr<boost::any> Parameters::get_any_pointer(const std::string &variable)
 {
@@ -620,6 +720,22 @@ inline void Parameters::merge_with_fixed(const Parameters &conditioned_on_parame
   }
 }
 
+// Shallow copies only the variables that are fixed in another.
+inline void Parameters::merge_fixed_variables(const Parameters &another)
+{
+  for (auto i=another.vector_begin(); i!=another.vector_end(); ++i)
+  {
+    if (i->second.second==true)
+      this->vector_parameters[i->first] = i->second;
+  }
+  
+  for (auto i=another.any_begin(); i!=another.any_end(); ++i)
+  {
+    if (i->second.second==true)
+      this->any_parameters[i->first] = i->second;
+  }
+}
+
 inline Parameters Parameters::deep_copy_nonfixed() const
 {
   Parameters output;
@@ -1,40 +1,102 @@
 #pragma once
 
+#include <set>
+#include <vector>
+#include <string>
+#include <numeric>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
 #include "likelihood.hpp"
 #include "model.hpp"
 #include "lot.hpp"
 #include "tree_summary.hpp"
+#include "chain.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "log_sum_exp.h"
+#include <Eigen/Dense>
 
 namespace strom
 {
 
+// Partition-weighted kernel (PWK) estimate of the log marginal likelihood from a posterior
+// sample (Wang et al. 2018), computed after the run from its tree and parameter files.
+//
+// Each sampled tree and parameter vector is mapped to unconstrained coordinates (log edge
+// lengths in split order, additive log-ratios of the exchangeabilities and state frequencies
+// and the log of the gamma shape), where the posterior kernel q (likelihood x prior x Jacobian)
+// is evaluated. For every topology sampled at least _minimum_sample_size times, the samples are
+// standardized using their mean and Cholesky factor, and the space is divided into _num_shells
+// concentric shells (the "matryoshka"), whose radii are quantiles of the standardized sample
+// radii, enclosing the innermost _coverage of the samples. Within shell k the kernel is
+// approximated by a constant q_k (the geometric mean of q over the samples in the shell). With f
+// the resulting step function, summed over topologies,
+//
+//      c = sum_k q_k V_k / E[f(x)/q(x)]
+//
+// where V_k is the volume of shell k and the expectation is over the whole posterior sample, so
+// samples of topologies that were left out only add zeros to the denominator.
+//
+// Likelihoods and priors are evaluated concurrently by one clone of the template chain per
+// thread (so their BeagleLib instances come from the pool), and topologies are processed
+// concurrently as well. Parameter blocks that do not vary in the sample (e.g. exchangeabilities
+// that were fixed) are not part of the integral and are left out of both q and the coordinates.
 class PWK
 	{
 	public:
                                             PWK(Lot::SharedPtr lot, TreeSummary::SharedPtr sumt);
                                             ~PWK();
 
+        void                                setChain(Chain::SharedPtr chain);
+        void                                readParamfile(const std::string filename, unsigned skip);
+        void                                setMinimumSampleSize(unsigned n);
+        void                                setNumShells(unsigned n);
+        void                                setCoverage(double fraction);
+        void                                setNumThreads(unsigned nthreads);
+
         double                              logMarginalLikelihood();
 
     private:
 
+        enum {_block_edges, _block_exchangeabilities, _block_state_freqs, _block_shape, _nblocks};
+
+        struct Sample
+            {
+            double                          log_likelihood;
+            double                          log_density[_nblocks];  // log prior plus log Jacobian of each parameter block
+            std::vector<double>             coords[_nblocks];       // unconstrained coordinates of each parameter block
+            };
+
+        struct TopologyResult
+            {
+            bool                            used;
+            double                          log_numerator;          // log sum_k q_k V_k
+            double                          log_denominator;        // log sum over this topology's samples of f/q
+            };
+
         double                              sortTrees();
+        void                                evaluateSamples();
+        void                                evaluateSample(Chain & chain, unsigned index, Sample & s);
+        void                                findVaryingBlocks();
+        double                              calcLogKernel(const Sample & s) const;
+        TopologyResult                      matryoshka(const std::vector<unsigned> & tree_indices) const;
+
+        static void                         appendLogRatios(const std::vector<double> & x, std::vector<double> & coords, double & log_jacobian);
 
         TreeSummary::sorted_vect_t          _sorted_trees;
 
         Lot::SharedPtr                      _lot;                             // pseudorandom number generator
-        //Likelihood::SharedPtr               _likelihood;                      // the likelihood calculator
-        //Model::SharedPtr                    _model;                           // the substitution model
+        Chain::SharedPtr                    _chain;                           // template: data, model settings and priors
         TreeSummary::SharedPtr              _tree_summary;                    // contains treeID map and newick vector stored from tree sample file
-        //ParamSummary::SharedPtr             _param_summary;                 // contains vector of parameter vectors stored from parameter sample file
-        //Tree::SharedPtr                     _tree;                          // used to store current tree topology
-        //double                              _log_num_topol;                 // log(number of possible tree topologies) used in computing discrete uniform topology prior
-        //double                              _edgelen_prior_lambda;          // rate parameter of Exponential distribution used for edge length
-        //double                              _shape_prior_lambda;            // rate parameter of Exponential distribution used for gamma shape
-        //double                              _exchangeability_prior_param;   // Dirichlet parameter for exchangeabilities (1 for flat prior)
-        //double                              _frequency_prior_param;         // Dirichlet parameter for frequencies (1 for flat prior)
-        //unsigned                            _minimum_sample_size;           // smallest sample size for which tree topology will be included
-        //unsigned                            _num_shells;                    // number of concentric shells used in the pwk estimator
+        std::vector< std::vector<double> >  _param_samples;                   // model parameters (Model::getParamValues order) of each sampled tree
+        std::vector<Sample>                 _samples;
+        bool                                _varying[_nblocks];               // whether each parameter block is part of the integral
+        unsigned                            _minimum_sample_size;             // smallest sample size for which tree topology will be included
+        unsigned                            _num_shells;                      // number of concentric shells used in the pwk estimator
+        double                              _coverage;                        // fraction of a topology's samples inside the outermost shell
+        unsigned                            _nthreads;
         double                              _log_total_sampled_trees;
 
 	public:
@@ -46,12 +108,96 @@ class PWK
 inline PWK::PWK(Lot::SharedPtr lot, TreeSummary::SharedPtr sumt)
   : _lot(lot), _tree_summary(sumt)
     {
+    _minimum_sample_size = 100;
+    _num_shells = 10;
+    _coverage = 0.9;
+    _nthreads = 0;
+    _log_total_sampled_trees = 0.0;
+    for (unsigned b = 0; b < _nblocks; ++b)
+        _varying[b] = true;
     }
 
 inline PWK::~PWK()
     {
     }
 
+inline void PWK::setChain(Chain::SharedPtr chain)
+    {
+    // The chain's likelihood supplies the data and model settings (e.g. number of rate
+    // categories), its updaters the priors; it should be set up as it was for the MCMC run
+    _chain = chain;
+    }
+
+inline void PWK::setMinimumSampleSize(unsigned n)
+    {
+    _minimum_sample_size = n;
+    }
+
+inline void PWK::setNumShells(unsigned n)
+    {
+    if (n == 0)
+        throw XStrom("Number of PWK shells must be positive");
+    _num_shells = n;
+    }
+
+inline void PWK::setCoverage(double fraction)
+    {
+    if (!(fraction > 0.0 && fraction <= 1.0))
+        throw XStrom(boost::str(boost::format("PWK coverage must be between 0 and 1 (found %g)") % fraction));
+    _coverage = fraction;
+    }
+
+inline void PWK::setNumThreads(unsigned nthreads)
+    {
+    // 0 means one thread per hardware thread
+    _nthreads = nthreads;
+    }
+
+inline void PWK::readParamfile(const std::string filename, unsigned skip)
+    {
+    // Reads a parameter file written by OutputManager (iter, lnL, lnPr, TL and then the model
+    // parameters), skipping the first skip samples just as TreeSummary::readTreefile does so
+    // that the i-th parameter sample belongs to the i-th stored tree
+    MappedFile paramfile(filename);
+    const char * p = paramfile.begin();
+    const char * end = paramfile.end();
+
+    _param_samples.clear();
+    unsigned line_number = 0;
+    unsigned nsamples = 0;
+    std::vector<std::string> fields;
+    while (p < end)
+        {
+        const char * eol = std::find(p, end, '\n');
+        std::string line(p, eol);
+        p = (eol < end ? eol + 1 : end);
+        ++line_number;
+        boost::trim(line);
+        if (line.empty() || line_number == 1)
+            continue;   // header
+
+        if (nsamples++ < skip)
+            continue;
+
+        boost::split(fields, line, boost::is_any_of("\t "), boost::token_compress_on);
+        if (fields.size() != 15)
+            throw XStrom(boost::str(boost::format("Expecting 15 values on line %d of parameter file \"%s\" but found %d") % line_number % filename % fields.size()));
+        std::vector<double> values;
+        for (unsigned i = 4; i < fields.size(); ++i)
+            {
+            try
+                {
+                values.push_back(std::stod(fields[i]));
+                }
+            catch (std::exception &)
+                {
+                throw XStrom(boost::str(boost::format("Could not read \"%s\" on line %d of parameter file \"%s\" as a number") % fields[i] % line_number % filename));
+                }
+            }
+        _param_samples.push_back(values);
+        }
+    }
+
 inline double PWK::sortTrees()
     {
     unsigned ntrees = _tree_summary->getNumStoredTrees();
@@ -60,94 +206,293 @@ inline double PWK::sortTrees()
     std::cout << boost::str(boost::format("Read %d trees from file") % ntrees) << std::endl;
 
     // Let TreeSummary do the work
+    _sorted_trees.clear();
     _tree_summary->sortTrees(_sorted_trees);
 
     return log(ntrees);
     }
 
+inline void PWK::appendLogRatios(const std::vector<double> & x, std::vector<double> & coords, double & log_jacobian)
+    {
+    // Additive log-ratios relative to the last component; the density of the log-ratios is the
+    // density on the simplex times the product of the (normalized) components
+    double sum = 0.0;
+    for (auto v : x)
+        sum += v;
+    unsigned k = (unsigned)x.size();
+    for (unsigned i = 0; i + 1 < k; ++i)
+        coords.push_back(std::log(x[i]/x[k - 1]));
+    for (auto v : x)
+        log_jacobian += std::log(v/sum);
+    }
+
+inline void PWK::evaluateSample(Chain & chain, unsigned index, Sample & s)
+    {
+    const std::vector<double> & values = _param_samples[index];
+    std::vector<double> exchangeabilities(values.begin(), values.begin() + 6);
+    std::vector<double> state_freqs(values.begin() + 6, values.begin() + 10);
+    double shape = values[10];
+    double exchangeability_sum = std::accumulate(exchangeabilities.begin(), exchangeabilities.end(), 0.0);
+    double state_freq_sum = std::accumulate(state_freqs.begin(), state_freqs.end(), 0.0);
+    for (auto & x : exchangeabilities)
+        x /= exchangeability_sum;
+    for (auto & x : state_freqs)
+        x /= state_freq_sum;
+
+    std::string newick = _tree_summary->getNewick(index);
+    chain.setTreeFromNewick(newick);
+    Model::SharedPtr model = chain.getModel();
+    model->setExchangeabilitiesAndStateFreqs(exchangeabilities, state_freqs);
+    model->setGammaShape(shape);
+    chain.start();
+    s.log_likelihood = chain.getLogLikelihood();
+
+    for (unsigned b = 0; b < _nblocks; ++b)
+        s.coords[b].clear();
+
+    // Edge lengths, ordered by split so that coordinates match across samples of a topology.
+    // The tree prior is a density for (TL, edge length proportions); for the edge lengths it
+    // must be divided by TL^(nedges - 1), and for their logs multiplied by their product.
+    TreeManip::SharedPtr tm = chain.getTreeManip();
+    std::set<Split> splits;
+    tm->storeSplits(splits);
+    Node::PtrVector nodes;
+    tm->getNodesByNumber(nodes);
+    std::vector< std::pair<Split, double> > edges;
+    for (auto nd : nodes)
+        if (nd && nd->getParent())
+            edges.push_back(std::make_pair(nd->getSplit(), nd->getEdgeLength()));
+    std::sort(edges.begin(), edges.end(), [](const std::pair<Split, double> & a, const std::pair<Split, double> & b) {return a.first < b.first;});
+    double TL = tm->calcTreeLength();
+    s.log_density[_block_edges] = chain.getUpdater("Tree and Edge Lengths")->calcLogPrior() - (edges.size() - 1.0)*std::log(TL);
+    for (auto & e : edges)
+        {
+        s.coords[_block_edges].push_back(std::log(e.second));
+        s.log_density[_block_edges] += std::log(e.second);
+        }
+
+    s.log_density[_block_exchangeabilities] = chain.getUpdater("Exchangeabilities")->calcLogPrior();
+    appendLogRatios(exchangeabilities, s.coords[_block_exchangeabilities], s.log_density[_block_exchangeabilities]);
+
+    s.log_density[_block_state_freqs] = chain.getUpdater("State Frequencies")->calcLogPrior();
+    appendLogRatios(state_freqs, s.coords[_block_state_freqs], s.log_density[_block_state_freqs]);
+
+    s.log_density[_block_shape] = chain.getUpdater("Gamma Shape")->calcLogPrior() + std::log(shape);
+    s.coords[_block_shape].push_back(std::log(shape));
+    }
+
+inline void PWK::evaluateSamples()
+    {
+    // One clone of the template chain per thread, created on this thread so that BeagleLib
+    // instances are never created concurrently; each evaluates a contiguous block of samples
+    unsigned nsamples = (unsigned)_param_samples.size();
+    ThreadPool pool(_nthreads);
+    unsigned nworkers = std::max(1U, std::min(pool.getNumThreads(), nsamples));
+    std::vector<Chain::SharedPtr> workers;
+    for (unsigned w = 0; w < nworkers; ++w)
+        workers.push_back(_chain->clone(w + 1));
+
+    _samples.assign(nsamples, Sample());
+    pool.parallelFor(nworkers, [&](unsigned w)
+        {
+        unsigned first = w*nsamples/nworkers;
+        unsigned last = (w + 1)*nsamples/nworkers;
+        for (unsigned i = first; i < last; ++i)
+            evaluateSample(*workers[w], i, _samples[i]);
+        });
+    }
+
+inline void PWK::findVaryingBlocks()
+    {
+    _varying[_block_edges] = true;
+    _varying[_block_shape] = (_chain->getModel()->getGammaNCateg() > 1);
+    for (unsigned b : {_block_exchangeabilities, _block_state_freqs, _block_shape})
+        {
+        if (b == _block_shape && !_varying[b])
+            continue;
+        bool varies = false;
+        for (auto & s : _samples)
+            if (s.coords[b] != _samples[0].coords[b])
+                varies = true;
+        _varying[b] = varies;
+        }
+    }
+
+inline double PWK::calcLogKernel(const Sample & s) const
+    {
+    double log_q = s.log_likelihood;
+    for (unsigned b = 0; b < _nblocks; ++b)
+        if (_varying[b])
+            log_q += s.log_density[b];
+    return log_q;
+    }
+
+inline PWK::TopologyResult PWK::matryoshka(const std::vector<unsigned> & tree_indices) const
+    {
+    TopologyResult result;
+    result.used = false;
+    result.log_numerator = 0.0;
+    result.log_denominator = 0.0;
+
+    // Coordinates of this topology's samples as the columns of X
+    unsigned n = (unsigned)tree_indices.size();
+    unsigned d = 0;
+    for (unsigned b = 0; b < _nblocks; ++b)
+        if (_varying[b])
+            d += (unsigned)_samples[tree_indices[0]].coords[b].size();
+    if (n <= d + 1)
+        return result;
+
+    Eigen::MatrixXd X(d, n);
+    Eigen::VectorXd log_q(n);
+    for (unsigned j = 0; j < n; ++j)
+        {
+        const Sample & s = _samples[tree_indices[j]];
+        unsigned i = 0;
+        for (unsigned b = 0; b < _nblocks; ++b)
+            if (_varying[b])
+                for (auto x : s.coords[b])
+                    X(i++, j) = x;
+        log_q(j) = calcLogKernel(s);
+        }
+
+    // Standardize: z = L^{-1} (x - mean), where L L' is the sample covariance. All radii come
+    // from a single triangular solve and a column-wise norm.
+    Eigen::VectorXd mean = X.rowwise().mean();
+    X.colwise() -= mean;
+    Eigen::MatrixXd cov = (X*X.transpose())/(n - 1.0);
+    Eigen::LLT<Eigen::MatrixXd> llt(cov);
+    if (llt.info() != Eigen::Success)
+        return result;
+    Eigen::MatrixXd L = llt.matrixL();
+    Eigen::MatrixXd Z = L.triangularView<Eigen::Lower>().solve(X);
+    Eigen::VectorXd radii = Z.colwise().norm().transpose();
+    double log_det = L.diagonal().array().log().sum();
+
+    // Shell boundaries: quantiles of the radii, the outermost enclosing _coverage of the samples
+    std::vector<double> sorted_radii(radii.data(), radii.data() + n);
+    std::sort(sorted_radii.begin(), sorted_radii.end());
+    std::vector<double> boundaries(_num_shells + 1, 0.0);
+    for (unsigned k = 1; k <= _num_shells; ++k)
+        {
+        unsigned m = (unsigned)std::ceil(_coverage*n*k/_num_shells);
+        boundaries[k] = sorted_radii[std::min(std::max(m, 1U), n) - 1];
+        }
+
+    // Representative (log) kernel value of each shell: mean of log q over its samples
+    std::vector<unsigned> shell(n, _num_shells);
+    std::vector<double> sum_log_q(_num_shells, 0.0);
+    std::vector<unsigned> count(_num_shells, 0);
+    for (unsigned j = 0; j < n; ++j)
+        {
+        auto it = std::lower_bound(boundaries.begin() + 1, boundaries.end(), radii(j));
+        if (it == boundaries.end())
+            continue;
+        unsigned k = (unsigned)(it - boundaries.begin()) - 1;
+        shell[j] = k;
+        sum_log_q[k] += log_q(j);
+        count[k]++;
+        }
+
+    // log V_k = log(unit d-ball volume) + log(r_k^d - r_{k-1}^d) + log|L|
+    double log_unit_ball = 0.5*d*std::log(M_PI) - std::lgamma(0.5*d + 1.0);
+    std::vector<double> log_shell_q(_num_shells, 0.0);
+    std::vector<double> numerator_terms;
+    for (unsigned k = 0; k < _num_shells; ++k)
+        {
+        if (count[k] == 0 || !(boundaries[k + 1] > boundaries[k]))
+            continue;
+        log_shell_q[k] = sum_log_q[k]/count[k];
+        double log_outer = d*std::log(boundaries[k + 1]);
+        double log_inner = (boundaries[k] > 0.0 ? d*std::log(boundaries[k]) : -std::numeric_limits<double>::infinity());
+        double log_volume = log_unit_ball + log_outer + std::log1p(-std::exp(log_inner - log_outer)) + log_det;
+        numerator_terms.push_back(log_shell_q[k] + log_volume);
+        }
+
+    std::vector<double> denominator_terms;
+    for (unsigned j = 0; j < n; ++j)
+        {
+        unsigned k = shell[j];
+        if (k < _num_shells && count[k] > 0 && boundaries[k + 1] > boundaries[k])
+            denominator_terms.push_back(log_shell_q[k] - log_q(j));
+        }
+    if (numerator_terms.empty() || denominator_terms.empty())
+        return result;
+
+    result.used = true;
+    result.log_numerator = logSumExp(numerator_terms);
+    result.log_denominator = logSumExp(denominator_terms);
+    return result;
+    }
+
 inline double PWK::logMarginalLikelihood()
     {
+    if (!_chain)
+        throw XStrom("PWK needs a chain (for the data, model and priors); call setChain first");
     _log_total_sampled_trees = sortTrees();
+    unsigned ntrees = _tree_summary->getNumStoredTrees();
+    if (_param_samples.size() != ntrees)
+        throw XStrom(boost::str(boost::format("PWK needs one parameter sample per tree but there are %d trees and %d parameter samples") % ntrees % _param_samples.size()));
+
     std::cout << boost::str(boost::format("\nTotal sampled trees: %d (log scale: %.5f)\n") % exp(_log_total_sampled_trees) % _log_total_sampled_trees);
 
     std::cout << "\nTopologies sorted by sample frequency:" << std::endl;
     std::cout << boost::str(boost::format("%20s %20s") % "topology" % "frequency") << std::endl;
+    unsigned t = 0;
     for (auto & ntrees_topol_pair : boost::adaptors::reverse(_sorted_trees))
         {
         unsigned n = ntrees_topol_pair.first;
-        unsigned t = ntrees_topol_pair.second;
-        std::cout << boost::str(boost::format("%20d %20d") % t % n) << std::endl;
+        std::cout << boost::str(boost::format("%20d %20d") % ++t % n) << std::endl;
         }
 
-    return 0.0;
+    evaluateSamples();
+    findVaryingBlocks();
 
-#if 0
-    _posterior_proportion = 0.0;
-    unsigned which_tree = 0;
-    unsigned cum_trees_sampled = 0;
-    std::vector<double> log_numerators;
-    unsigned num_topol_considered = 0;
-    BOOST_REVERSE_FOREACH(sorted_pair_t & p, _sortedTrees)
+    // Topologies sampled often enough, most frequent first, processed concurrently
+    Split::treemap_t & tree_map = _tree_summary->getTreeIDMap();
+    std::vector<const std::vector<unsigned> *> topologies;
+    for (auto & ntrees_topol_pair : boost::adaptors::reverse(_sorted_trees))
         {
-        if (p.first < _minimum_sample_size)
+        if (ntrees_topol_pair.first < _minimum_sample_size)
             break;
-
-        ++which_tree;
-        unsigned num_trees_sampled = p.first;
-        cum_trees_sampled += num_trees_sampled;
-
-        // Get vector of indices of the p.first sampled trees having topology specified by tree ID p.second
-        Split::treeid_t & tree_id = p.second;
-        Split::treemap_t & tree_map = _tree_summary->getTreeIDMap();
-        std::vector<unsigned> & tree_indices = tree_map[tree_id];
-
-        storePosteriorSamples(which_tree, tree_indices);
-        unsigned num_params = standardizeSamples();
-        double this_numerator = matryoshka(which_tree, num_params, _num_shells);
-
-        // debugging
-        double log_c_this_topology = log(_posterior_samples.size()) - this_numerator + _log_num_topol;
-        double post_prob_this_topology = (double)_posterior_samples.size()/exp(_log_total_sampled_trees);
-        double info_contribution = post_prob_this_topology*log_c_this_topology;
-        std::cerr << std::endl;
-        std::cerr << "This tree topology only:" << std::endl;
-        std::cerr << "  log(total num. topologies)    = " << _log_num_topol << std::endl;
-        std::cerr << "  newick description            = " << _tree_summary->getNewick(tree_indices[0]) << std::endl;
-        std::cerr << "  log(numerator)                = " << this_numerator << std::endl;
-        std::cerr << "  number of samples             = " << _posterior_samples.size() << std::endl;
-        std::cerr << "  log(number of samples)        = " << log(_posterior_samples.size()) << std::endl;
-        std::cerr << "  log(c)                        = " << log_c_this_topology << std::endl;
-        std::cerr << "  posterior probability pr(tau) = " << post_prob_this_topology << std::endl;
-        std::cerr << "  pr(tau) * log(c)              = " << info_contribution << std::endl;
-
-        log_numerators.push_back(this_numerator);
-        num_topol_considered++;
+        topologies.push_back(&tree_map[ntrees_topol_pair.second]);
         }
+    if (topologies.empty())
+        throw XStrom(boost::str(boost::format("No topology was sampled at least %d times") % _minimum_sample_size));
 
-    double max_numerator_term = *std::max_element(log_numerators.begin(), log_numerators.end());
-    double numerator_sum = 0.0;
-    BOOST_FOREACH(double d, log_numerators)
+    std::vector<TopologyResult> results(topologies.size());
+    ThreadPool pool(_nthreads);
+    pool.parallelFor((unsigned)topologies.size(), [&](unsigned i)
         {
-        numerator_sum += exp(d - max_numerator_term);
+        results[i] = matryoshka(*topologies[i]);
+        });
+
+    std::vector<double> log_numerators;
+    std::vector<double> log_denominators;
+    unsigned num_topol_considered = 0;
+    unsigned cum_trees_sampled = 0;
+    for (unsigned i = 0; i < results.size(); ++i)
+        {
+        if (!results[i].used)
+            continue;
+        log_numerators.push_back(results[i].log_numerator);
+        log_denominators.push_back(results[i].log_denominator);
+        num_topol_considered++;
+        cum_trees_sampled += (unsigned)topologies[i]->size();
         }
-    double log_numerator = max_numerator_term + log(numerator_sum);
+    if (log_numerators.empty())
+        throw XStrom("PWK could not use any topology (too few samples for the number of parameters?)");
+
+    double log_c = logSumExp(log_numerators) - (logSumExp(log_denominators) - _log_total_sampled_trees);
 
     std::cout << std::endl;
     std::cout << "Number of topologies considered: " << num_topol_considered << std::endl;
     std::cout << "log(T) = log(number of samples): " << _log_total_sampled_trees << std::endl;
-    std::cerr << "proportion posterior included  = " << _posterior_proportion << std::endl;
+    std::cout << "proportion posterior included  = " << (double)cum_trees_sampled/ntrees << std::endl;
+    std::cout << "log(marginal likelihood)       = " << log_c << std::endl;
     std::cout << std::endl;
 
-    //temporary!
-    //std::cout << "log(num_topol_considered) = " << log(num_topol_considered) << std::endl;
-    //std::cout << "_log_num_topol            = " << _log_num_topol << std::endl;
-    //std::cout << "log_numerator             = " << log_numerator << std::endl;
-    //std::cout << "_log_total_sampled_trees                     = " << _log_total_sampled_trees << std::endl;
-
-    //double log_c = (log(num_topol_considered) - _log_num_topol) - (log_numerator - _log_total_sampled_trees);
-    double log_c =  log(_posterior_proportion) - (log_numerator - _log_total_sampled_trees);  //temporary
-    //double log_c =  _log_total_sampled_trees - log_numerator;  //temporary
-#endif
+    return log_c;
     }
 
 } // namespace strom
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <boost/format.hpp>
+#include "model.h"
+#include "tree_manip.h"
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    // Reference distribution for generalized stepping-stone sampling (Fan et al. 2011): a
+    // product of independent densities, each fitted by the method of moments to a sample from
+    // the posterior, that is proper and cheap to evaluate:
+    //
+    //      tree length                         Gamma
+    //      edge length proportions             symmetric Dirichlet (same for every topology)
+    //      exchangeabilities, state freqs      Dirichlet
+    //      gamma shape                         Gamma (only if there is more than one category)
+    //      topology                            uniform, as in TreeUpdater's prior
+    class ReferenceDistribution
+        {
+        public:
+                                        ReferenceDistribution();
+
+            void                        clear();
+            void                        addSample(const Model & model, const TreeManip & tm);
+            void                        fit();
+
+            unsigned                    getNumSamples() const;
+            bool                        isFitted() const;
+            double                      calcLogDensity(const Model & model, const TreeManip & tm) const;
+
+        private:
+
+            static void                 fitGamma(const std::vector<double> & x, double & shape, double & scale);
+            static void                 fitDirichlet(const std::vector< std::vector<double> > & x, std::vector<double> & params);
+            static double               calcLogGamma(double x, double shape, double scale);
+            static double               calcLogDirichlet(const std::vector<double> & x, const std::vector<double> & params);
+            static void                 getEdgeProportions(const TreeManip & tm, double & TL, std::vector<double> & proportions);
+            static double               calcLogNumTopologies(unsigned nedges);
+
+            std::vector<double>                 _shapes;
+            std::vector<double>                 _tree_lengths;
+            std::vector< std::vector<double> >  _exchangeabilities;
+            std::vector< std::vector<double> >  _state_freqs;
+            double                              _proportion_sum_sq;     // sum over samples and edges of (p - 1/n)^2
+            double                              _nproportions;
+            unsigned                            _nedges;
+            bool                                _has_shape;
+
+            bool                                _fitted;
+            double                              _shape_shape;
+            double                              _shape_scale;
+            double                              _tree_length_shape;
+            double                              _tree_length_scale;
+            double                              _edge_proportion_param;
+            std::vector<double>                 _exchangeability_params;
+            std::vector<double>                 _state_freq_params;
+
+        public:
+
+            typedef std::shared_ptr< ReferenceDistribution > SharedPtr;
+        };
+
+inline ReferenceDistribution::ReferenceDistribution()
+    {
+    clear();
+    }
+
+inline void ReferenceDistribution::clear()
+    {
+    _shapes.clear();
+    _tree_lengths.clear();
+    _exchangeabilities.clear();
+    _state_freqs.clear();
+    _proportion_sum_sq      = 0.0;
+    _nproportions           = 0.0;
+    _nedges                 = 0;
+    _has_shape              = false;
+    _fitted                 = false;
+    _shape_shape            = 1.0;
+    _shape_scale            = 1.0;
+    _tree_length_shape      = 1.0;
+    _tree_length_scale      = 1.0;
+    _edge_proportion_param  = 1.0;
+    _exchangeability_params.clear();
+    _state_freq_params.clear();
+    }
+
+inline unsigned ReferenceDistribution::getNumSamples() const
+    {
+    return (unsigned)_tree_lengths.size();
+    }
+
+inline bool ReferenceDistribution::isFitted() const
+    {
+    return _fitted;
+    }
+
+inline void ReferenceDistribution::getEdgeProportions(const TreeManip & tm, double & TL, std::vector<double> & proportions)
+    {
+    Node::PtrVector nodes;
+    tm.getNodesByNumber(nodes);
+    TL = tm.calcTreeLength();
+    proportions.clear();
+    for (auto nd : nodes)
+        if (nd && nd->getParent())
+            proportions.push_back(nd->getEdgeLength()/TL);
+    }
+
+inline void ReferenceDistribution::addSample(const Model & model, const TreeManip & tm)
+    {
+    double TL = 0.0;
+    std::vector<double> proportions;
+    getEdgeProportions(tm, TL, proportions);
+    if (_nedges > 0 && proportions.size() != _nedges)
+        throw XStrom(boost::str(boost::format("Reference distribution sample has %d edges but earlier samples had %d") % proportions.size() % _nedges));
+    _nedges = (unsigned)proportions.size();
+
+    _has_shape = (model.getGammaNCateg() > 1);
+    _shapes.push_back(model.getGammaShape());
+    _tree_lengths.push_back(TL);
+    _exchangeabilities.push_back(model.getExchangeabilities());
+    _state_freqs.push_back(model.getStateFreqs());
+    for (auto p : proportions)
+        _proportion_sum_sq += (p - 1.0/_nedges)*(p - 1.0/_nedges);
+    _nproportions += proportions.size();
+    _fitted = false;
+    }
+
+inline void ReferenceDistribution::fitGamma(const std::vector<double> & x, double & shape, double & scale)
+    {
+    double n = (double)x.size();
+    double mean = std::accumulate(x.begin(), x.end(), 0.0)/n;
+    double var = 0.0;
+    for (auto v : x)
+        var += (v - mean)*(v - mean);
+    var /= (n - 1.0);
+    if (!(var > 0.0) || !(mean > 0.0))
+        throw XStrom("Cannot fit a Gamma reference density to a sample with no variation");
+    shape = mean*mean/var;
+    scale = var/mean;
+    }
+
+inline void ReferenceDistribution::fitDirichlet(const std::vector< std::vector<double> > & x, std::vector<double> & params)
+    {
+    // Precision from the variance of each component, averaged over components:
+    // var_i = mean_i (1 - mean_i)/(s + 1)
+    double n = (double)x.size();
+    unsigned k = (unsigned)x[0].size();
+    std::vector<double> mean(k, 0.0);
+    std::vector<double> var(k, 0.0);
+    for (auto & v : x)
+        for (unsigned i = 0; i < k; ++i)
+            mean[i] += v[i]/n;
+    for (auto & v : x)
+        for (unsigned i = 0; i < k; ++i)
+            var[i] += (v[i] - mean[i])*(v[i] - mean[i])/(n - 1.0);
+
+    double s = 0.0;
+    unsigned ns = 0;
+    for (unsigned i = 0; i < k; ++i)
+        {
+        if (var[i] > 0.0)
+            {
+            s += mean[i]*(1.0 - mean[i])/var[i] - 1.0;
+            ns++;
+            }
+        }
+    if (ns == 0 || !(s > 0.0))
+        throw XStrom("Cannot fit a Dirichlet reference density to a sample with no variation");
+    s /= ns;
+    params.resize(k);
+    for (unsigned i = 0; i < k; ++i)
+        params[i] = s*mean[i];
+    }
+
+inline void ReferenceDistribution::fit()
+    {
+    if (getNumSamples() < 2)
+        throw XStrom("Fitting a reference distribution needs at least 2 samples");
+
+    if (_has_shape)
+        fitGamma(_shapes, _shape_shape, _shape_scale);
+    fitGamma(_tree_lengths, _tree_length_shape, _tree_length_scale);
+    fitDirichlet(_exchangeabilities, _exchangeability_params);
+    fitDirichlet(_state_freqs, _state_freq_params);
+
+    // For a symmetric Dirichlet(c) on n proportions, var = (n - 1)/(n^2 (n c + 1))
+    double n = (double)_nedges;
+    double var = _proportion_sum_sq/(_nproportions - 1.0);
+    if (!(var > 0.0))
+        throw XStrom("Cannot fit an edge length proportion reference density to a sample with no variation");
+    _edge_proportion_param = std::max(((n - 1.0)/(n*n*var) - 1.0)/n, 1.0e-3);
+    _fitted = true;
+    }
+
+inline double ReferenceDistribution::calcLogGamma(double x, double shape, double scale)
+    {
+    return (shape - 1.0)*std::log(x) - x/scale - shape*std::log(scale) - std::lgamma(shape);
+    }
+
+inline double ReferenceDistribution::calcLogDirichlet(const std::vector<double> & x, const std::vector<double> & params)
+    {
+    double param_sum = 0.0;
+    double log_density = 0.0;
+    for (unsigned i = 0; i < x.size(); ++i)
+        {
+        param_sum += params[i];
+        log_density += (params[i] - 1.0)*std::log(x[i]) - std::lgamma(params[i]);
+        }
+    return log_density + std::lgamma(param_sum);
+    }
+
+inline double ReferenceDistribution::calcLogNumTopologies(unsigned nedges)
+    {
+    // An unrooted tree with n leaves has 2n - 3 edges (odd), a rooted one 2n - 2 (even); a
+    // rooted tree with n leaves has as many topologies as an unrooted one with n + 1
+    double n = (nedges % 2 == 1 ? (nedges + 3.0)/2.0 : (nedges + 2.0)/2.0 + 1.0);
+    return std::lgamma(2.0*n - 5.0 + 1.0) - (n - 3.0)*std::log(2.0) - std::lgamma(n - 3.0 + 1.0);
+    }
+
+inline double ReferenceDistribution::calcLogDensity(const Model & model, const TreeManip & tm) const
+    {
+    if (!_fitted)
+        throw XStrom("Reference distribution used before being fitted");
+
+    double TL = 0.0;
+    std::vector<double> proportions;
+    getEdgeProportions(tm, TL, proportions);
+
+    double log_density = -calcLogNumTopologies((unsigned)proportions.size());
+    log_density += calcLogGamma(TL, _tree_length_shape, _tree_length_scale);
+    log_density += calcLogDirichlet(proportions, std::vector<double>(proportions.size(), _edge_proportion_param));
+    log_density += calcLogDirichlet(model.getExchangeabilities(), _exchangeability_params);
+    log_density += calcLogDirichlet(model.getStateFreqs(), _state_freq_params);
+    if (_has_shape)
+        log_density += calcLogGamma(model.getGammaShape(), _shape_shape, _shape_scale);
+    return log_density;
+    }
+
+    }
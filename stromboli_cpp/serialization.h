@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    // Appends v to s formatted exactly as printf("%.*f", precision, v) would, but without
+    // going through printf for the common case
+    inline void appendFixed(std::string & s, double v, unsigned precision)
+        {
+        static const double powers_of_ten[] = {1.0, 1.0e1, 1.0e2, 1.0e3, 1.0e4, 1.0e5, 1.0e6, 1.0e7, 1.0e8, 1.0e9};
+        static const std::uint64_t int_powers_of_ten[] = {1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL};
+
+        if (precision <= 9 && std::isfinite(v))
+            {
+            double scaled = std::fabs(v)*powers_of_ten[precision];
+
+            // The product is accurate to well within 1e-4 below 1e11, so rounding agrees with printf
+            // unless the scaled value lies very close to half-way between two outputs; those rare
+            // cases fall through to snprintf, which rounds using the exact binary value
+            if (scaled < 1.0e11 && std::fabs(scaled - std::floor(scaled) - 0.5) > 1.0e-4)
+                {
+                std::uint64_t n = (std::uint64_t)std::floor(scaled + 0.5);
+                std::uint64_t whole = n/int_powers_of_ten[precision];
+                std::uint64_t frac = n - whole*int_powers_of_ten[precision];
+
+                char buffer[32];
+                char * p = buffer + sizeof(buffer);
+                for (unsigned i = 0; i < precision; ++i)
+                    {
+                    *--p = (char)('0' + frac%10);
+                    frac /= 10;
+                    }
+                if (precision > 0)
+                    *--p = '.';
+                do
+                    {
+                    *--p = (char)('0' + whole%10);
+                    whole /= 10;
+                    }
+                while (whole > 0);
+                if (std::signbit(v))
+                    *--p = '-';
+                s.append(p, buffer + sizeof(buffer));
+                return;
+                }
+            }
+
+        char buffer[512];
+        std::snprintf(buffer, sizeof(buffer), "%.*f", (int)precision, v);
+        s += buffer;
+        }
+
+    inline void appendUnsigned(std::string & s, unsigned long long v)
+        {
+        char buffer[24];
+        char * p = buffer + sizeof(buffer);
+        do
+            {
+            *--p = (char)('0' + v%10);
+            v /= 10;
+            }
+        while (v > 0);
+        s.append(p, buffer + sizeof(buffer));
+        }
+
+    // Binary records are written in native byte order; they are intended for trace and
+    // checkpoint files read back on the same kind of machine that wrote them
+    template <class T>
+    inline void appendBinary(std::string & s, const T & v)
+        {
+        static_assert(std::is_trivially_copyable<T>::value, "appendBinary requires a trivially copyable type");
+        s.append(reinterpret_cast<const char *>(&v), sizeof(T));
+        }
+
+    inline void appendBinaryString(std::string & s, const std::string & v)
+        {
+        appendBinary(s, (std::uint32_t)v.size());
+        s.append(v);
+        }
+
+    template <class T>
+    inline void readBinary(const char * & p, const char * end, T & v)
+        {
+        static_assert(std::is_trivially_copyable<T>::value, "readBinary requires a trivially copyable type");
+        if ((std::size_t)(end - p) < sizeof(T))
+            throw XStrom("Unexpected end of binary data");
+        std::memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        }
+
+    inline void readBinaryString(const char * & p, const char * end, std::string & v)
+        {
+        std::uint32_t n = 0;
+        readBinary(p, end, n);
+        if ((std::size_t)(end - p) < n)
+            throw XStrom("Unexpected end of binary data");
+        v.assign(p, n);
+        p += n;
+        }
+
+    }
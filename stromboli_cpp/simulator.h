@@ -0,0 +1,302 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <boost/format.hpp>
+#include "data.h"
+#include "model.h"
+#include "tree.h"
+#include "lot.h"
+#include "thread_pool.h"
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    // Simulates alignments on a Tree under a Model. Each site is assigned a rate category, a
+    // state is drawn for the root from the state frequencies, and states are then drawn down
+    // _preorder from the rows of the per-edge transition matrices, which are built from the
+    // model's eigen decomposition. Every row (and the category and root distributions) is
+    // turned into an alias table, so drawing a state costs one uniform deviate.
+    //
+    // Sites are split into fixed-size blocks that are simulated concurrently on a ThreadPool,
+    // each with its own Lot seeded from the simulator's Lot, so the result does not depend on
+    // the number of threads. Within a block, sites are simulated 16 at a time and leaf states
+    // are packed straight into site patterns (as in Data::compressPatterns) and counted in a
+    // per-block map; the maps are merged by Data::setPatterns. No uncompressed matrix is made.
+    class Simulator
+        {
+        public:
+                                                Simulator();
+                                                ~Simulator();
+
+            void                                clear();
+            void                                setModel(Model::SharedPtr model);
+            void                                setSeed(unsigned seed);
+            void                                setNumThreads(unsigned nthreads);
+            void                                setBlockSize(unsigned nsites);
+
+            void                                simulate(Tree::SharedPtr tree, const Data::taxon_names_t & taxon_names, unsigned nsites, Data & data);
+
+        private:
+
+            struct AliasTable
+                {
+                double                          prob[4];
+                unsigned                        alias[4];
+                };
+
+            static void                         buildAliasTable(const double * p, unsigned n, double * prob, unsigned * alias);
+            static unsigned                     sampleAlias(const double * prob, const unsigned * alias, unsigned n, double u);
+
+            void                                buildTables(Tree::SharedPtr tree);
+            void                                simulateBlock(Tree::SharedPtr tree, unsigned nsites, unsigned seed, Data::pattern_map_t & patterns) const;
+
+            Model::SharedPtr                    _model;
+            Lot::SharedPtr                      _lot;
+            ThreadPool::SharedPtr               _pool;
+            unsigned                            _nthreads;
+            unsigned                            _block_size;
+
+            // rebuilt by buildTables for each tree
+            unsigned                            _ncateg;
+            std::vector<double>                 _categ_prob;
+            std::vector<unsigned>               _categ_alias;
+            AliasTable                          _root_table;
+            std::vector<AliasTable>             _tables;            // (node index*_ncateg + category)*4 + parent state
+            std::vector<unsigned>               _leaf_index;        // node index of each taxon
+
+        public:
+
+            typedef std::shared_ptr< Simulator > SharedPtr;
+        };
+
+inline Simulator::Simulator()
+    {
+    clear();
+    }
+
+inline Simulator::~Simulator()
+    {
+    }
+
+inline void Simulator::clear()
+    {
+    _model.reset();
+    _lot.reset(new Lot());
+    _lot->setSeed(1);
+    _pool.reset();
+    _nthreads = 0;
+    _block_size = 4096;
+    _ncateg = 0;
+    _categ_prob.clear();
+    _categ_alias.clear();
+    _tables.clear();
+    _leaf_index.clear();
+    }
+
+inline void Simulator::setModel(Model::SharedPtr model)
+    {
+    _model = model;
+    }
+
+inline void Simulator::setSeed(unsigned seed)
+    {
+    _lot->setSeed(seed);
+    }
+
+inline void Simulator::setNumThreads(unsigned nthreads)
+    {
+    // 0 means one thread per block, up to the number of hardware threads
+    _nthreads = nthreads;
+    _pool.reset();
+    }
+
+inline void Simulator::setBlockSize(unsigned nsites)
+    {
+    // Rounded up to a multiple of 16 so that blocks start on a packed word boundary
+    if (nsites == 0)
+        throw XStrom("Simulation block size must be positive");
+    const unsigned cpw = PackedMatrix::codes_per_word;
+    _block_size = ((nsites + cpw - 1)/cpw)*cpw;
+    }
+
+inline void Simulator::buildAliasTable(const double * p, unsigned n, double * prob, unsigned * alias)
+    {
+    // Vose's method: prob[i] is the chance of keeping i once bucket i has been chosen uniformly
+    std::vector<double> scaled(n);
+    std::vector<unsigned> small;
+    std::vector<unsigned> large;
+    double total = 0.0;
+    for (unsigned i = 0; i < n; ++i)
+        total += p[i];
+    for (unsigned i = 0; i < n; ++i)
+        {
+        scaled[i] = p[i]*n/total;
+        alias[i] = i;
+        if (scaled[i] < 1.0)
+            small.push_back(i);
+        else
+            large.push_back(i);
+        }
+    while (!small.empty() && !large.empty())
+        {
+        unsigned s = small.back();
+        unsigned l = large.back();
+        small.pop_back();
+        prob[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0)
+            {
+            large.pop_back();
+            small.push_back(l);
+            }
+        }
+    for (auto i : small)
+        prob[i] = 1.0;
+    for (auto i : large)
+        prob[i] = 1.0;
+    }
+
+inline unsigned Simulator::sampleAlias(const double * prob, const unsigned * alias, unsigned n, double u)
+    {
+    double x = u*n;
+    unsigned i = std::min((unsigned)x, n - 1);
+    return (x - i < prob[i] ? i : alias[i]);
+    }
+
+inline void Simulator::buildTables(Tree::SharedPtr tree)
+    {
+    std::vector<double> relative_rates = _model->getDiscreteGammaRelRates();
+    std::vector<double> rate_probs = _model->getDiscreteGammaRateProbs();
+    std::vector<double> state_freqs = _model->getStateFreqs();
+
+    _ncateg = (unsigned)relative_rates.size();
+    _categ_prob.resize(_ncateg);
+    _categ_alias.resize(_ncateg);
+    buildAliasTable(&rate_probs[0], _ncateg, &_categ_prob[0], &_categ_alias[0]);
+    buildAliasTable(&state_freqs[0], 4, _root_table.prob, _root_table.alias);
+
+    const Node * first = &tree->_nodes[0];
+    _tables.resize(tree->_nodes.size()*_ncateg*4);
+    Model::EigenMatrix4d P;
+    for (auto nd : tree->_preorder)
+        {
+        unsigned i = (unsigned)(nd - first);
+        for (unsigned c = 0; c < _ncateg; ++c)
+            {
+            _model->calcTransitionProbs(nd->getEdgeLength(), relative_rates[c], P);
+            for (unsigned from = 0; from < 4; ++from)
+                {
+                AliasTable & t = _tables[(i*_ncateg + c)*4 + from];
+                buildAliasTable(P.row(from).data(), 4, t.prob, t.alias);
+                }
+            }
+        }
+
+    // In an unrooted tree the root is the leaf numbered 0
+    _leaf_index.assign(tree->_nleaves, 0);
+    for (auto & nd : tree->_nodes)
+        {
+        bool is_leaf = (!nd.getLeftChild() || (&nd == tree->_root && !tree->_is_rooted));
+        if (is_leaf && nd.getNumber() >= 0 && (unsigned)nd.getNumber() < tree->_nleaves)
+            _leaf_index[nd.getNumber()] = (unsigned)(&nd - first);
+        }
+    }
+
+inline void Simulator::simulateBlock(Tree::SharedPtr tree, unsigned nsites, unsigned seed, Data::pattern_map_t & patterns) const
+    {
+    typedef PackedMatrix::word_t word_t;
+    const unsigned cpw = PackedMatrix::codes_per_word;
+    const Node * first_node = &tree->_nodes[0];
+    unsigned nnodes = (unsigned)tree->_nodes.size();
+    unsigned ntaxa = (unsigned)_leaf_index.size();
+    unsigned nwords = (ntaxa + cpw - 1)/cpw;
+    unsigned root = (unsigned)(tree->_root - first_node);
+
+    // Parent and table offsets in preorder, looked up once per block
+    std::vector<unsigned> node_index;
+    std::vector<unsigned> parent_index;
+    for (auto nd : tree->_preorder)
+        {
+        node_index.push_back((unsigned)(nd - first_node));
+        parent_index.push_back((unsigned)(nd->getParent() - first_node));
+        }
+
+    Lot lot;
+    lot.setSeed(seed);
+    std::vector<unsigned> categ(cpw);
+    std::vector<unsigned char> states((std::size_t)nnodes*cpw);
+    std::vector<Data::packed_pattern_t> batch(cpw, Data::packed_pattern_t(nwords));
+    patterns.clear();
+    for (unsigned s = 0; s < nsites; s += cpw)
+        {
+        unsigned nbatch = std::min(cpw, nsites - s);
+        for (unsigned k = 0; k < nbatch; ++k)
+            {
+            categ[k] = (_ncateg == 1 ? 0 : sampleAlias(&_categ_prob[0], &_categ_alias[0], _ncateg, lot.uniform()));
+            states[root*cpw + k] = (unsigned char)sampleAlias(_root_table.prob, _root_table.alias, 4, lot.uniform());
+            }
+        for (unsigned j = 0; j < node_index.size(); ++j)
+            {
+            unsigned char * child = &states[node_index[j]*cpw];
+            const unsigned char * parent = &states[parent_index[j]*cpw];
+            const AliasTable * tables = &_tables[node_index[j]*_ncateg*4];
+            for (unsigned k = 0; k < nbatch; ++k)
+                {
+                const AliasTable & t = tables[categ[k]*4 + parent[k]];
+                child[k] = (unsigned char)sampleAlias(t.prob, t.alias, 4, lot.uniform());
+                }
+            }
+        for (unsigned k = 0; k < nbatch; ++k)
+            std::fill(batch[k].begin(), batch[k].end(), 0);
+        for (unsigned t = 0; t < ntaxa; ++t)
+            {
+            const unsigned char * leaf = &states[_leaf_index[t]*cpw];
+            unsigned shift = PackedMatrix::bits_per_code*(t % cpw);
+            for (unsigned k = 0; k < nbatch; ++k)
+                batch[k][t/cpw] |= (word_t)PackedMatrix::stateToCode(leaf[k]) << shift;
+            }
+        for (unsigned k = 0; k < nbatch; ++k)
+            ++patterns[batch[k]];
+        }
+    }
+
+inline void Simulator::simulate(Tree::SharedPtr tree, const Data::taxon_names_t & taxon_names, unsigned nsites, Data & data)
+    {
+    // Replaces the contents of data with nsites simulated sites; taxon i is the leaf numbered i
+    if (!_model)
+        throw XStrom("Simulator needs a model");
+    if (!tree || tree->_preorder.empty())
+        throw XStrom("Simulator needs a tree");
+    if (taxon_names.size() != tree->_nleaves)
+        throw XStrom(boost::str(boost::format("Number of taxon names (%d) not equal to number of leaves in the tree (%d)") % taxon_names.size() % tree->_nleaves));
+    if (nsites == 0)
+        throw XStrom("Number of sites to simulate must be positive");
+
+    buildTables(tree);
+
+    unsigned nblocks = (nsites + _block_size - 1)/_block_size;
+    std::vector<unsigned> seeds(nblocks);
+    for (auto & seed : seeds)
+        seed = 1 + (unsigned)(_lot->uniform()*4294967294.0);
+
+    if (!_pool)
+        {
+        unsigned nthreads = (_nthreads > 0 ? _nthreads : ThreadPool::defaultNumThreads());
+        _pool.reset(new ThreadPool(nthreads));
+        }
+
+    std::vector<Data::pattern_map_t> patterns(nblocks);
+    _pool->parallelFor(nblocks, [&](unsigned b)
+        {
+        unsigned first = b*_block_size;
+        simulateBlock(tree, std::min(_block_size, nsites - first), seeds[b], patterns[b]);
+        });
+
+    data.setPatterns(taxon_names, patterns);
+    }
+
+    }
@@ -0,0 +1,487 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <boost/format.hpp>
+#include "chain.h"
+#include "lot.h"
+#include "thread_pool.h"
+#include "log_sum_exp.h"
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    // Sequential Monte Carlo sampler that tempers the likelihood from prior to posterior,
+    // targeting p(x) L(x)^phi for an increasing sequence of powers 0 = phi_0 < ... < phi_T = 1.
+    // Each iteration
+    //
+    //  1. chooses phi_t by bisection so that the conditional ESS of the incremental weights
+    //     L(x)^(phi_t - phi_{t-1}) is _target_cess times the number of particles,
+    //  2. reweights the particles using their cached log-likelihoods (no likelihood is computed),
+    //  3. resamples (stratified) if the ESS has fallen below _resampling_threshold times the
+    //     number of particles, and
+    //  4. moves every particle with _move_steps Chain::nextStep calls at heating power phi_t.
+    //
+    // The log marginal likelihood is estimated by the sum over iterations of the log of the
+    // weighted mean incremental weight.
+    //
+    // Particles are stored as Chain::saveCurrentState buffers. They are moved by one worker Chain
+    // per thread, each with its own model, Likelihood (hence BeagleLib instance) and Lot, the
+    // particles being split into contiguous blocks, one per worker. Initial particles are drawn
+    // from the prior by a chain at heating power 0 started from the template chain's state: each
+    // worker first runs _burnin_steps steps with tuning on, the tuned proposals are pooled and
+    // frozen, and every _init_steps-th state after that is kept.
+    class SMCSampler
+        {
+        public:
+                                                SMCSampler();
+                                                ~SMCSampler();
+
+            void                                clear();
+            void                                setChain(Chain::SharedPtr chain);
+            void                                setNumParticles(unsigned nparticles);
+            void                                setNumThreads(unsigned nthreads);
+            void                                setSeed(unsigned seed);
+            void                                setBurninSteps(unsigned nsteps);
+            void                                setInitSteps(unsigned nsteps);
+            void                                setMoveSteps(unsigned nsteps);
+            void                                setTargetCESS(double fraction);
+            void                                setResamplingThreshold(double fraction);
+
+            double                              run();
+
+            unsigned                            getNumParticles() const;
+            double                              getLogMarginalLikelihood() const;
+            const std::vector<double> &         getHeatingPowers() const;
+            const std::vector<double> &         getESS() const;
+            const std::vector<double> &         getLogWeights() const;
+            const std::vector<double> &         getLogLikelihoods() const;
+            std::vector<double>                 getNormalizedWeights() const;
+            void                                loadParticle(unsigned i, Chain & chain) const;
+
+        private:
+
+            void                                createWorkers();
+            void                                initParticles();
+            double                              chooseNextPower() const;
+            double                              calcCESS(double delta) const;
+            double                              reweight(double delta);
+            double                              calcESS() const;
+            void                                resample();
+            void                                move();
+            void                                adaptLambdas();
+            void                                poolLambdas();
+
+            Chain::SharedPtr                    _chain;             // template: data, model, starting state and updater settings
+            std::vector<Chain::SharedPtr>       _workers;
+            ThreadPool::SharedPtr               _pool;
+            Lot::SharedPtr                      _lot;               // for resampling
+
+            unsigned                            _nparticles;
+            unsigned                            _nthreads;
+            unsigned                            _seed;
+            unsigned                            _burnin_steps;      // per worker, before the first particle
+            unsigned                            _init_steps;        // thinning between initial particles
+            unsigned                            _move_steps;
+            double                              _target_cess;
+            double                              _resampling_threshold;
+
+            std::vector<std::string>            _particles;
+            std::vector<double>                 _log_weights;       // unnormalized
+            std::vector<double>                 _log_likelihoods;   // cached, one per particle
+            double                              _phi;
+            double                              _log_marginal_likelihood;
+            std::vector<double>                 _powers;            // phi at each iteration
+            std::vector<double>                 _ess;               // ESS after reweighting at each iteration
+
+        public:
+
+            typedef std::shared_ptr< SMCSampler > SharedPtr;
+        };
+
+inline SMCSampler::SMCSampler()
+    {
+    clear();
+    }
+
+inline SMCSampler::~SMCSampler()
+    {
+    }
+
+inline void SMCSampler::clear()
+    {
+    _chain.reset();
+    _workers.clear();
+    _pool.reset();
+    _lot.reset(new Lot());
+    _nparticles             = 100;
+    _nthreads               = 0;
+    _seed                   = 1;
+    _burnin_steps           = 1000;
+    _init_steps             = 50;
+    _move_steps             = 5;
+    _target_cess            = 0.9;
+    _resampling_threshold   = 0.5;
+    _particles.clear();
+    _log_weights.clear();
+    _log_likelihoods.clear();
+    _phi                    = 0.0;
+    _log_marginal_likelihood = 0.0;
+    _powers.clear();
+    _ess.clear();
+    }
+
+inline void SMCSampler::setChain(Chain::SharedPtr chain)
+    {
+    // The chain must have its likelihood (with data and model) and tree set. Its updater
+    // settings are copied to the workers; the chain itself is not modified.
+    _chain = chain;
+    _workers.clear();
+    }
+
+inline void SMCSampler::setNumParticles(unsigned nparticles)
+    {
+    if (nparticles < 2)
+        throw XStrom("SMC needs at least 2 particles");
+    _nparticles = nparticles;
+    }
+
+inline void SMCSampler::setNumThreads(unsigned nthreads)
+    {
+    // 0 means one thread per hardware thread; results depend on the number of threads because
+    // each worker has its own random number stream
+    _nthreads = nthreads;
+    _workers.clear();
+    _pool.reset();
+    }
+
+inline void SMCSampler::setSeed(unsigned seed)
+    {
+    _seed = seed;
+    _workers.clear();
+    }
+
+inline void SMCSampler::setBurninSteps(unsigned nsteps)
+    {
+    // The worker chains start at the template chain's state, which is usually far out in the
+    // tail of the prior, and their proposals start untuned
+    if (nsteps == 0)
+        throw XStrom("Number of burn-in steps must be positive");
+    _burnin_steps = nsteps;
+    }
+
+inline void SMCSampler::setInitSteps(unsigned nsteps)
+    {
+    if (nsteps == 0)
+        throw XStrom("Number of initialization steps must be positive");
+    _init_steps = nsteps;
+    }
+
+inline void SMCSampler::setMoveSteps(unsigned nsteps)
+    {
+    if (nsteps == 0)
+        throw XStrom("Number of MCMC steps per move must be positive");
+    _move_steps = nsteps;
+    }
+
+inline void SMCSampler::setTargetCESS(double fraction)
+    {
+    if (!(fraction > 0.0 && fraction < 1.0))
+        throw XStrom(boost::str(boost::format("Target conditional ESS must be between 0 and 1 (found %g)") % fraction));
+    _target_cess = fraction;
+    }
+
+inline void SMCSampler::setResamplingThreshold(double fraction)
+    {
+    if (!(fraction >= 0.0 && fraction <= 1.0))
+        throw XStrom(boost::str(boost::format("Resampling threshold must be between 0 and 1 (found %g)") % fraction));
+    _resampling_threshold = fraction;
+    }
+
+inline unsigned SMCSampler::getNumParticles() const
+    {
+    return _nparticles;
+    }
+
+inline double SMCSampler::getLogMarginalLikelihood() const
+    {
+    return _log_marginal_likelihood;
+    }
+
+inline const std::vector<double> & SMCSampler::getHeatingPowers() const
+    {
+    return _powers;
+    }
+
+inline const std::vector<double> & SMCSampler::getESS() const
+    {
+    return _ess;
+    }
+
+inline const std::vector<double> & SMCSampler::getLogWeights() const
+    {
+    return _log_weights;
+    }
+
+inline const std::vector<double> & SMCSampler::getLogLikelihoods() const
+    {
+    return _log_likelihoods;
+    }
+
+inline std::vector<double> SMCSampler::getNormalizedWeights() const
+    {
+    std::vector<double> w(_log_weights.size(), 0.0);
+    if (w.empty())
+        return w;
+    double log_total = logSumExp(_log_weights);
+    for (unsigned i = 0; i < w.size(); ++i)
+        w[i] = std::exp(_log_weights[i] - log_total);
+    return w;
+    }
+
+inline void SMCSampler::loadParticle(unsigned i, Chain & chain) const
+    {
+    // Puts particle i into chain (whose model and tree are overwritten), e.g. for output
+    if (i >= _particles.size())
+        throw XStrom(boost::str(boost::format("Particle %d requested but there are only %d") % i % _particles.size()));
+    const char * p = _particles[i].data();
+    chain.loadCurrentState(p, p + _particles[i].size());
+    }
+
+inline void SMCSampler::createWorkers()
+    {
+    // Workers are created and started on the calling thread so that BeagleLib instances are
+    // never created concurrently
+    if (!_chain || !_chain->getLikelihood() || !_chain->getTreeManip())
+        throw XStrom("SMCSampler needs a chain whose likelihood and tree have been set");
+
+    if (!_pool)
+        _pool.reset(new ThreadPool(_nthreads));
+    unsigned nworkers = std::min(_pool->getNumThreads(), _nparticles);
+
+    _workers.clear();
+    for (unsigned t = 0; t < nworkers; ++t)
+        {
+        Chain::SharedPtr worker = _chain->clone(_seed + 1 + t);
+        worker->setChainIndex(t);
+        worker->setHeatLikelihoodOnly(true);
+        worker->setReferenceDistribution(ReferenceDistribution::SharedPtr());
+        worker->setHeatingPower(0.0);
+        _workers.push_back(worker);
+        }
+    _lot->setSeed(_seed);
+    }
+
+inline void SMCSampler::initParticles()
+    {
+    // Each worker runs a chain targeting the prior (heating power 0 with only the likelihood
+    // heated). Updaters tune only during burn-in; the particles are then drawn with fixed
+    // proposals, _init_steps steps apart.
+    _particles.assign(_nparticles, std::string());
+    _log_likelihoods.assign(_nparticles, 0.0);
+    _log_weights.assign(_nparticles, 0.0);
+
+    unsigned nworkers = (unsigned)_workers.size();
+    _pool->parallelFor(nworkers, [&](unsigned t)
+        {
+        Chain & worker = *_workers[t];
+        worker.setHeatingPower(0.0);
+        worker.startTuning();
+        for (unsigned k = 0; k < _burnin_steps; ++k)
+            worker.nextStep(0);
+        worker.stopTuning();
+        });
+
+    // From here on all workers use the same, fixed proposals within an iteration
+    poolLambdas();
+
+    _pool->parallelFor(nworkers, [&](unsigned t)
+        {
+        Chain & worker = *_workers[t];
+        unsigned first = t*_nparticles/nworkers;
+        unsigned last = (t + 1)*_nparticles/nworkers;
+        for (unsigned i = first; i < last; ++i)
+            {
+            for (unsigned k = 0; k < _init_steps; ++k)
+                worker.nextStep(0);
+            worker.saveCurrentState(_particles[i]);
+            _log_likelihoods[i] = worker.getLogLikelihood();
+            }
+        });
+    }
+
+inline void SMCSampler::poolLambdas()
+    {
+    // Geometric mean of the workers' tuned proposal parameters
+    unsigned nworkers = (unsigned)_workers.size();
+    std::vector<double> lambdas(_workers[0]->getLambdas().size(), 0.0);
+    for (auto w : _workers)
+        {
+        std::vector<double> v = w->getLambdas();
+        for (unsigned j = 0; j < v.size(); ++j)
+            lambdas[j] += std::log(v[j])/nworkers;
+        }
+    for (auto & x : lambdas)
+        x = std::exp(x);
+    for (auto w : _workers)
+        w->setLambdas(lambdas);
+    }
+
+inline double SMCSampler::calcCESS(double delta) const
+    {
+    // Conditional ESS (Zhou, Johansen and Aston 2016) of the incremental weights
+    // exp(delta*lnL), as a fraction of the number of particles
+    std::vector<double> a(_nparticles);
+    std::vector<double> b(_nparticles);
+    for (unsigned i = 0; i < _nparticles; ++i)
+        {
+        a[i] = _log_weights[i] + delta*_log_likelihoods[i];
+        b[i] = _log_weights[i] + 2.0*delta*_log_likelihoods[i];
+        }
+    double log_w = logSumExp(_log_weights);
+    return std::exp(2.0*logSumExp(a) - log_w - logSumExp(b));
+    }
+
+inline double SMCSampler::chooseNextPower() const
+    {
+    double max_delta = 1.0 - _phi;
+    if (calcCESS(max_delta) >= _target_cess)
+        return 1.0;
+
+    // CESS decreases with delta, so bisect for the delta at which it equals the target
+    double lo = 0.0;
+    double hi = max_delta;
+    for (unsigned k = 0; k < 100 && hi - lo > 1.0e-12; ++k)
+        {
+        double mid = 0.5*(lo + hi);
+        if (calcCESS(mid) >= _target_cess)
+            lo = mid;
+        else
+            hi = mid;
+        }
+    return _phi + std::max(lo, 1.0e-12);
+    }
+
+inline double SMCSampler::reweight(double delta)
+    {
+    // Returns the log of the weighted mean incremental weight
+    double log_w = logSumExp(_log_weights);
+    for (unsigned i = 0; i < _nparticles; ++i)
+        _log_weights[i] += delta*_log_likelihoods[i];
+    return logSumExp(_log_weights) - log_w;
+    }
+
+inline double SMCSampler::calcESS() const
+    {
+    std::vector<double> twice(_log_weights.size());
+    for (unsigned i = 0; i < _log_weights.size(); ++i)
+        twice[i] = 2.0*_log_weights[i];
+    return std::exp(2.0*logSumExp(_log_weights) - logSumExp(twice));
+    }
+
+inline void SMCSampler::resample()
+    {
+    // Stratified resampling: one uniform in each of the intervals [i/n, (i + 1)/n)
+    std::vector<double> w = getNormalizedWeights();
+    std::vector<std::string> particles(_nparticles);
+    std::vector<double> log_likelihoods(_nparticles);
+    double cum = w[0];
+    unsigned j = 0;
+    for (unsigned i = 0; i < _nparticles; ++i)
+        {
+        double u = (i + _lot->uniform())/_nparticles;
+        while (u > cum && j + 1 < _nparticles)
+            cum += w[++j];
+        particles[i] = _particles[j];
+        log_likelihoods[i] = _log_likelihoods[j];
+        }
+    _particles.swap(particles);
+    _log_likelihoods.swap(log_likelihoods);
+    _log_weights.assign(_nparticles, 0.0);
+    }
+
+inline void SMCSampler::move()
+    {
+    unsigned nworkers = (unsigned)_workers.size();
+    _pool->parallelFor(nworkers, [&](unsigned t)
+        {
+        Chain & worker = *_workers[t];
+        worker.setHeatingPower(_phi);
+        worker.stopTuning();
+        unsigned first = t*_nparticles/nworkers;
+        unsigned last = (t + 1)*_nparticles/nworkers;
+        for (unsigned i = first; i < last; ++i)
+            {
+            const char * p = _particles[i].data();
+            worker.loadCurrentState(p, p + _particles[i].size());
+            for (unsigned k = 0; k < _move_steps; ++k)
+                worker.nextStep(0);
+            _particles[i].clear();
+            worker.saveCurrentState(_particles[i]);
+            _log_likelihoods[i] = worker.getLogLikelihood();
+            }
+        });
+    }
+
+inline void SMCSampler::adaptLambdas()
+    {
+    // Scales each updater's lambda according to its acceptance rate over all particles in the
+    // last move, so that the proposals follow the narrowing target from one iteration to the
+    // next while staying fixed within an iteration
+    std::vector<Updater::SharedPtr> updaters = _workers[0]->getUpdaters();
+    std::vector<double> lambdas = _workers[0]->getLambdas();
+    std::vector<double> accept_pct(lambdas.size(), 0.0);
+    for (auto w : _workers)
+        {
+        std::vector<double> v = w->getAcceptPercentages();
+        for (unsigned j = 0; j < v.size(); ++j)
+            accept_pct[j] += v[j]/_workers.size();
+        }
+    bool has_shape = (_workers[0]->getModel()->getGammaNCateg() > 1);
+    for (unsigned j = 0; j < lambdas.size(); ++j)
+        {
+        if (j == 0 && !has_shape)
+            continue;
+        double target = updaters[j]->getTargetAcceptanceRate();
+        lambdas[j] *= std::exp(2.0*(accept_pct[j]/100.0 - target));
+        lambdas[j] = std::min(lambdas[j], 1000.0);
+        }
+    for (auto w : _workers)
+        w->setLambdas(lambdas);
+    }
+
+inline double SMCSampler::run()
+    {
+    // Runs the sampler from the prior to the posterior and returns the log marginal likelihood
+    if (_workers.empty())
+        createWorkers();
+    _phi = 0.0;
+    _log_marginal_likelihood = 0.0;
+    _powers.clear();
+    _ess.clear();
+    initParticles();
+
+    while (_phi < 1.0)
+        {
+        double phi = chooseNextPower();
+        _log_marginal_likelihood += reweight(phi - _phi);
+        _phi = phi;
+        _powers.push_back(_phi);
+
+        double ess = calcESS();
+        _ess.push_back(ess);
+        if (ess < _resampling_threshold*_nparticles)
+            resample();
+
+        move();
+        adaptLambdas();
+        }
+
+    return _log_marginal_likelihood;
+    }
+
+    }
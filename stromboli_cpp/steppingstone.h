@@ -0,0 +1,270 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <boost/format.hpp>
+#include "chain.h"
+#include "reference_distribution.h"
+#include "thread_pool.h"
+#include "log_sum_exp.h"
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    // Stepping-stone estimate of the log marginal likelihood (Xie et al. 2011) using powers
+    // 0 = beta_0 < beta_1 < ... < beta_K = 1. For each k = 1, ..., K a chain targeting the power
+    // posterior at beta_{k-1} estimates
+    //
+    //      log r_k = log E[ exp((beta_k - beta_{k-1}) lnL) ]
+    //
+    // and the log marginal likelihood is the sum of the log r_k. The K chains are independent,
+    // so they run concurrently on a ThreadPool, each a Chain::clone of the template chain with its
+    // own random number stream. Each chain adds its samples to log r_k as it goes, using a
+    // running log-sum-exp, so no samples are stored.
+    //
+    // If a reference distribution is set, the generalized version (Fan et al. 2011) is used:
+    // chains target (likelihood x prior)^beta reference^(1 - beta), and lnL above is replaced by
+    // lnL + log prior - log reference. With a reference close to the posterior, far fewer
+    // stones are needed.
+    //
+    // By default the powers are quantiles of a Beta(alpha, 1) distribution, beta_k = (k/K)^(1/alpha),
+    // which puts most stones near 0 where the power posterior changes fastest.
+    class SteppingStone
+        {
+        public:
+                                                SteppingStone();
+                                                ~SteppingStone();
+
+            void                                clear();
+            void                                setChain(Chain::SharedPtr chain);
+            void                                setReferenceDistribution(ReferenceDistribution::SharedPtr reference);
+            void                                setNumStones(unsigned nstones);
+            void                                setBetaShape(double alpha);
+            void                                setPowers(const std::vector<double> & powers);
+            void                                setBurnin(unsigned niterations);
+            void                                setNumSamples(unsigned nsamples);
+            void                                setSampleFreq(unsigned freq);
+            void                                setNumThreads(unsigned nthreads);
+            void                                setSeed(unsigned seed);
+
+            double                              run();
+
+            std::vector<double>                 getPowers() const;
+            const std::vector<double> &         getLogRatios() const;
+            double                              getLogMarginalLikelihood() const;
+
+        private:
+
+            void                                runStone(unsigned k, Chain & chain);
+            double                              calcLogTerm(Chain & chain) const;
+
+            Chain::SharedPtr                    _chain;             // template: data, model, starting state and updater settings
+            ReferenceDistribution::SharedPtr    _reference;
+            ThreadPool::SharedPtr               _pool;
+
+            unsigned                            _nstones;
+            double                              _alpha;
+            std::vector<double>                 _powers;            // if empty, Beta(_alpha, 1) quantiles
+            unsigned                            _burnin;
+            unsigned                            _nsamples;
+            unsigned                            _sample_freq;
+            unsigned                            _nthreads;
+            unsigned                            _seed;
+
+            std::vector<double>                 _log_ratios;        // log r_k, k = 1, ..., K
+            double                              _log_marginal_likelihood;
+
+        public:
+
+            typedef std::shared_ptr< SteppingStone > SharedPtr;
+        };
+
+inline SteppingStone::SteppingStone()
+    {
+    clear();
+    }
+
+inline SteppingStone::~SteppingStone()
+    {
+    }
+
+inline void SteppingStone::clear()
+    {
+    _chain.reset();
+    _reference.reset();
+    _pool.reset();
+    _nstones                    = 16;
+    _alpha                      = 0.3;
+    _powers.clear();
+    _burnin                     = 1000;
+    _nsamples                   = 1000;
+    _sample_freq                = 1;
+    _nthreads                   = 0;
+    _seed                       = 1;
+    _log_ratios.clear();
+    _log_marginal_likelihood    = 0.0;
+    }
+
+inline void SteppingStone::setChain(Chain::SharedPtr chain)
+    {
+    // The chain must have its likelihood (with data and model) and tree set; it is not modified
+    _chain = chain;
+    }
+
+inline void SteppingStone::setReferenceDistribution(ReferenceDistribution::SharedPtr reference)
+    {
+    // Pass a null pointer to use the prior as the reference (ordinary stepping-stone)
+    if (reference && !reference->isFitted())
+        throw XStrom("Reference distribution must be fitted before use");
+    _reference = reference;
+    }
+
+inline void SteppingStone::setNumStones(unsigned nstones)
+    {
+    if (nstones == 0)
+        throw XStrom("Number of stepping stones must be positive");
+    _nstones = nstones;
+    _powers.clear();
+    }
+
+inline void SteppingStone::setBetaShape(double alpha)
+    {
+    if (!(alpha > 0.0))
+        throw XStrom(boost::str(boost::format("Beta shape for stepping-stone powers must be positive (found %g)") % alpha));
+    _alpha = alpha;
+    _powers.clear();
+    }
+
+inline void SteppingStone::setPowers(const std::vector<double> & powers)
+    {
+    // powers must start at 0, end at 1 and increase strictly; it sets the number of stones
+    if (powers.size() < 2 || powers.front() != 0.0 || powers.back() != 1.0)
+        throw XStrom("Stepping-stone powers must start at 0 and end at 1");
+    for (unsigned k = 1; k < powers.size(); ++k)
+        if (!(powers[k] > powers[k - 1]))
+            throw XStrom("Stepping-stone powers must be strictly increasing");
+    _powers = powers;
+    _nstones = (unsigned)powers.size() - 1;
+    }
+
+inline void SteppingStone::setBurnin(unsigned niterations)
+    {
+    _burnin = niterations;
+    }
+
+inline void SteppingStone::setNumSamples(unsigned nsamples)
+    {
+    if (nsamples == 0)
+        throw XStrom("Number of stepping-stone samples must be positive");
+    _nsamples = nsamples;
+    }
+
+inline void SteppingStone::setSampleFreq(unsigned freq)
+    {
+    if (freq == 0)
+        throw XStrom("Stepping-stone sample frequency must be positive");
+    _sample_freq = freq;
+    }
+
+inline void SteppingStone::setNumThreads(unsigned nthreads)
+    {
+    // 0 means one thread per stone, up to the number of hardware threads
+    _nthreads = nthreads;
+    _pool.reset();
+    }
+
+inline void SteppingStone::setSeed(unsigned seed)
+    {
+    _seed = seed;
+    }
+
+inline std::vector<double> SteppingStone::getPowers() const
+    {
+    if (!_powers.empty())
+        return _powers;
+    std::vector<double> powers(_nstones + 1);
+    for (unsigned k = 0; k <= _nstones; ++k)
+        powers[k] = std::pow((double)k/_nstones, 1.0/_alpha);
+    return powers;
+    }
+
+inline const std::vector<double> & SteppingStone::getLogRatios() const
+    {
+    return _log_ratios;
+    }
+
+inline double SteppingStone::getLogMarginalLikelihood() const
+    {
+    return _log_marginal_likelihood;
+    }
+
+inline double SteppingStone::calcLogTerm(Chain & chain) const
+    {
+    // The quantity whose (beta_k - beta_{k-1}) multiple is exponentiated and averaged
+    double lnL = chain.getLogLikelihood();
+    if (!_reference)
+        return lnL;
+    return lnL + chain.calcLogJointPrior() - _reference->calcLogDensity(*chain.getModel(), *chain.getTreeManip());
+    }
+
+inline void SteppingStone::runStone(unsigned k, Chain & chain)
+    {
+    // Chain targets beta_{k-1} and accumulates log r_k in _log_ratios[k - 1]
+    std::vector<double> powers = getPowers();
+    double delta = powers[k] - powers[k - 1];
+
+    chain.startTuning();
+    for (unsigned i = 1; i <= _burnin; ++i)
+        chain.nextStep(i);
+    chain.stopTuning();
+
+    std::vector<double> log_terms;
+    log_terms.reserve(_nsamples);
+    for (unsigned i = 1; i <= _nsamples*_sample_freq; ++i)
+        {
+        chain.nextStep(_burnin + i);
+        if (i % _sample_freq == 0)
+            log_terms.push_back(delta*calcLogTerm(chain));
+        }
+    _log_ratios[k - 1] = logSumExp(log_terms) - std::log((double)_nsamples);
+    }
+
+inline double SteppingStone::run()
+    {
+    // Runs the K chains and returns the log marginal likelihood
+    if (!_chain || !_chain->getLikelihood() || !_chain->getTreeManip())
+        throw XStrom("SteppingStone needs a chain whose likelihood and tree have been set");
+
+    std::vector<double> powers = getPowers();
+    std::vector<Chain::SharedPtr> chains;
+    for (unsigned k = 1; k <= _nstones; ++k)
+        {
+        Chain::SharedPtr c = _chain->clone(_seed + k);
+        c->setChainIndex(k - 1);
+        c->setReferenceDistribution(_reference);
+        c->setHeatLikelihoodOnly(!_reference);
+        c->setHeatingPower(powers[k - 1]);
+        chains.push_back(c);
+        }
+
+    if (!_pool)
+        {
+        unsigned nthreads = (_nthreads > 0 ? _nthreads : std::min(_nstones, ThreadPool::defaultNumThreads()));
+        _pool.reset(new ThreadPool(nthreads));
+        }
+
+    _log_ratios.assign(_nstones, 0.0);
+    _pool->parallelFor(_nstones, [&](unsigned j)
+        {
+        runStone(j + 1, *chains[j]);
+        });
+
+    _log_marginal_likelihood = 0.0;
+    for (auto r : _log_ratios)
+        _log_marginal_likelihood += r;
+    return _log_marginal_likelihood;
+    }
+
+    }
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <numeric>
+#include <boost/format.hpp>
+#include "likelihood.h"
+#include "data.h"
+#include "tree.h"
+#include "tree_manip.h"
+#include "model.h"
+#include "lot.h"
+#include "xstrom.h"
+
+namespace strom
+    {
+
+    // Estimates the log-likelihood of a large alignment from a random subsample of its sites,
+    // using the difference estimator with a reference-point control variate:
+    //
+    //      lnL(x) ~ lnL(r) + (N/m) sum_{s in S} [lnL_s(x) - lnL_s(r)]
+    //
+    // where r is a reference state at which the full likelihood lnL(r) was computed, S is a sample
+    // of m of the N sites drawn uniformly with replacement, and lnL_s is the log-likelihood of
+    // site s. The subsample is kept as its own Data object (sampled patterns with their number of
+    // draws as weights) and evaluated by a second Likelihood sharing the model of the full one,
+    // so an estimate costs about m/N of a full evaluation and benefits from the same partials
+    // caching.
+    //
+    // The reference point is fixed by setReferencePoint (or, failing that, at the first update)
+    // and copied, so it stays put while the chain moves. refresh, which beginUpdate calls every
+    // _refresh_interval updates, draws a new subsample independently of the chain's state and
+    // evaluates it at the stored reference. The first stage of delayed acceptance is then a fixed
+    // function of the current and proposed states for each subsample, so an Updater using this
+    // estimator remains exact. Moving the reference while sampling would break this; do it only
+    // at the end of burn-in, where the reference should be a typical posterior state.
+    class SubsampledLikelihood
+        {
+        public:
+                                        SubsampledLikelihood();
+
+            void                        clear();
+            void                        setLikelihood(Likelihood::SharedPtr likelihood);
+            void                        setLot(Lot::SharedPtr lot);
+            void                        setSubsampleSize(unsigned nsites);
+            void                        setRefreshInterval(unsigned nupdates);
+
+            Likelihood::SharedPtr       getLikelihood() const;
+            unsigned                    getSubsampleSize() const;
+            unsigned                    getNumSubsamplePatterns() const;
+
+            void                        setReferencePoint(Tree::SharedPtr t);
+            bool                        hasReferencePoint() const;
+            void                        refresh();
+            void                        beginUpdate(Tree::SharedPtr t);
+            double                      estimateLogLikelihood(Tree::SharedPtr t);
+
+            void                        recordScreening(bool passed);
+            unsigned long long          getNumScreened() const;
+            unsigned long long          getNumPassed() const;
+
+        private:
+
+            void                        drawSubsample();
+
+            Likelihood::SharedPtr       _likelihood;                // full likelihood
+            Likelihood::SharedPtr       _subsample_likelihood;
+            Likelihood::SharedPtr       _reference_likelihood;      // subsample under the reference model
+            TreeManip::SharedPtr        _reference_tree;            // copy of the reference tree
+            Data::SharedPtr             _subsample_data;
+            Lot::SharedPtr              _lot;
+            std::vector<double>         _cumulative_counts;         // of the full data's patterns
+            unsigned                    _subsample_size;
+            unsigned                    _refresh_interval;
+            unsigned                    _nupdates;                  // since last refresh
+            bool                        _refreshed;
+            double                      _scale;                     // N/m
+            double                      _ref_log_likelihood;        // lnL(r)
+            double                      _ref_subsample_log_likelihood;  // sum over S of lnL_s(r)
+            unsigned long long          _nscreened;
+            unsigned long long          _npassed;
+
+        public:
+
+            typedef std::shared_ptr< SubsampledLikelihood > SharedPtr;
+        };
+
+inline SubsampledLikelihood::SubsampledLikelihood()
+    {
+    clear();
+    }
+
+inline void SubsampledLikelihood::clear()
+    {
+    _likelihood.reset();
+    _subsample_likelihood.reset();
+    _reference_likelihood.reset();
+    _reference_tree.reset();
+    _subsample_data.reset();
+    _lot.reset(new Lot());
+    _cumulative_counts.clear();
+    _subsample_size                 = 1000;
+    _refresh_interval               = 100;
+    _nupdates                       = 0;
+    _refreshed                      = false;
+    _scale                          = 1.0;
+    _ref_log_likelihood             = 0.0;
+    _ref_subsample_log_likelihood   = 0.0;
+    _nscreened                      = 0;
+    _npassed                        = 0;
+    }
+
+inline void SubsampledLikelihood::setLikelihood(Likelihood::SharedPtr likelihood)
+    {
+    _likelihood = likelihood;
+    _reference_tree.reset();
+    _refreshed = false;
+    }
+
+inline void SubsampledLikelihood::setLot(Lot::SharedPtr lot)
+    {
+    _lot = lot;
+    }
+
+inline void SubsampledLikelihood::setSubsampleSize(unsigned nsites)
+    {
+    if (nsites == 0)
+        throw XStrom("Subsample size must be positive");
+    _subsample_size = nsites;
+    _refreshed = false;
+    }
+
+inline void SubsampledLikelihood::setRefreshInterval(unsigned nupdates)
+    {
+    if (nupdates == 0)
+        throw XStrom("Subsample refresh interval must be positive");
+    _refresh_interval = nupdates;
+    }
+
+inline Likelihood::SharedPtr SubsampledLikelihood::getLikelihood() const
+    {
+    return _likelihood;
+    }
+
+inline unsigned SubsampledLikelihood::getSubsampleSize() const
+    {
+    return _subsample_size;
+    }
+
+inline unsigned SubsampledLikelihood::getNumSubsamplePatterns() const
+    {
+    return (_subsample_data ? _subsample_data->getNumPatterns() : 0);
+    }
+
+inline void SubsampledLikelihood::drawSubsample()
+    {
+    // Sites are drawn uniformly, i.e. patterns with probability proportional to their counts
+    Data::SharedPtr data = _likelihood->getData();
+    if (!data)
+        throw XStrom("SubsampledLikelihood needs a likelihood whose data have been set");
+    const Data::pattern_counts_t & counts = data->getPatternCounts();
+    _cumulative_counts.resize(counts.size());
+    std::partial_sum(counts.begin(), counts.end(), _cumulative_counts.begin());
+    double nsites = _cumulative_counts.back();
+
+    std::map<unsigned, double> draws;
+    for (unsigned k = 0; k < _subsample_size; ++k)
+        {
+        double u = _lot->uniform()*nsites;
+        unsigned i = (unsigned)(std::upper_bound(_cumulative_counts.begin(), _cumulative_counts.end(), u) - _cumulative_counts.begin());
+        draws[std::min(i, (unsigned)counts.size() - 1)] += 1.0;
+        }
+
+    std::vector<unsigned> patterns;
+    Data::pattern_counts_t weights;
+    for (auto & d : draws)
+        {
+        patterns.push_back(d.first);
+        weights.push_back(d.second);
+        }
+    if (!_subsample_data)
+        _subsample_data.reset(new Data());
+    _subsample_data->setPatternSubset(*data, patterns, weights);
+    _scale = nsites/_subsample_size;
+    }
+
+inline void SubsampledLikelihood::setReferencePoint(Tree::SharedPtr t)
+    {
+    // t and the current model become the reference point; call while they are the chain's
+    // current state (e.g. at the end of burn-in), not while a proposal is pending
+    if (!_likelihood)
+        throw XStrom("must call setLikelihood before using SubsampledLikelihood");
+
+    std::string buffer;
+    TreeManip(t).saveBinary(buffer);
+    const char * p = buffer.data();
+    _reference_tree.reset(new TreeManip());
+    _reference_tree->loadBinary(p, p + buffer.size());
+
+    buffer.clear();
+    _likelihood->getModel()->saveState(buffer);
+    p = buffer.data();
+    Model::SharedPtr reference_model(new Model());
+    reference_model->loadState(p, p + buffer.size());
+    _reference_likelihood.reset(new Likelihood());
+    _reference_likelihood->setVerbose(false);
+    _reference_likelihood->setModel(reference_model);
+
+    _ref_log_likelihood = _likelihood->calcLogLikelihood(t);
+    refresh();
+    }
+
+inline bool SubsampledLikelihood::hasReferencePoint() const
+    {
+    return (bool)_reference_tree;
+    }
+
+inline void SubsampledLikelihood::refresh()
+    {
+    // New subsample, evaluated at the (unchanged) reference point
+    if (!_reference_tree)
+        throw XStrom("SubsampledLikelihood needs a reference point before it can be refreshed");
+    drawSubsample();
+
+    if (!_subsample_likelihood)
+        {
+        _subsample_likelihood.reset(new Likelihood());
+        _subsample_likelihood->setVerbose(false);
+        }
+    if (_subsample_likelihood->getModel() != _likelihood->getModel())
+        _subsample_likelihood->setModel(_likelihood->getModel());
+    _subsample_likelihood->setData(_subsample_data);
+    _reference_likelihood->setData(_subsample_data);
+
+    _ref_subsample_log_likelihood = _reference_likelihood->calcLogLikelihood(_reference_tree->getTree());
+    _nupdates = 0;
+    _refreshed = true;
+    }
+
+inline void SubsampledLikelihood::beginUpdate(Tree::SharedPtr t)
+    {
+    // Call at the start of each update, while the tree and model are in the current state
+    if (!_reference_tree)
+        setReferencePoint(t);
+    else if (!_refreshed || ++_nupdates >= _refresh_interval)
+        refresh();
+    }
+
+inline double SubsampledLikelihood::estimateLogLikelihood(Tree::SharedPtr t)
+    {
+    if (!_reference_tree)
+        setReferencePoint(t);
+    else if (!_refreshed)
+        refresh();
+    double sub_lnL = _subsample_likelihood->calcLogLikelihood(t);
+    return _ref_log_likelihood + _scale*(sub_lnL - _ref_subsample_log_likelihood);
+    }
+
+inline void SubsampledLikelihood::recordScreening(bool passed)
+    {
+    _nscreened++;
+    if (passed)
+        _npassed++;
+    }
+
+inline unsigned long long SubsampledLikelihood::getNumScreened() const
+    {
+    return _nscreened;
+    }
+
+inline unsigned long long SubsampledLikelihood::getNumPassed() const
+    {
+    return _npassed;
+    }
+
+    }
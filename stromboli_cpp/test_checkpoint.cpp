@@ -0,0 +1,167 @@
+//
+//  test_checkpoint.cpp
+//
+//  Stand-alone check of Chain::saveCheckpoint and Chain::loadCheckpoint. A chain is run on
+//  rbcL.nex from a random tree and checkpointed part way through, with and without the BeagleLib
+//  buffers; a fresh chain (whose Lot is seeded differently) restarted from the checkpoint must
+//  reproduce the original chain's log-likelihood, tree, tuning and subsequent trajectory. Files
+//  that are not checkpoints, or are truncated, must be rejected. Not part of the main target;
+//  build and run it with
+//
+//      make check
+//
+//  (see Makefile). Built with STROM_INSTRUMENT defined, e.g.
+//
+//      make check BUILD=build-instrument CXXFLAGS="-O2 -DSTROM_INSTRUMENT"
+//
+//  it also checks that a restart from a checkpoint that includes the BeagleLib buffers computes
+//  no partials or transition matrices for its first likelihood. Exits with status 1 if any check
+//  fails.
+//
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <boost/format.hpp>
+#include "node.h"
+#include "lot.h"
+#include "data.h"
+#include "model.h"
+#include "likelihood.h"
+#include "tree_manip.h"
+#include "chain.h"
+#include "xstrom.h"
+#include "test_support.h"
+
+using namespace strom;
+
+const double strom::Node::_smallest_edge_length = 1.0e-12;
+const double strom::Updater::_log_minus_infinity = -std::numeric_limits<double>::max();
+
+Chain::SharedPtr makeChain(Data::SharedPtr data, std::string newick, unsigned seed)
+    {
+    Likelihood::SharedPtr likelihood(new Likelihood());
+    likelihood->setData(data);
+    Model::SharedPtr model = likelihood->getModel();
+    model->setGammaNCateg(4);
+    model->setExchangeabilities(std::vector<double>(6, 1.0/6.0));
+
+    Lot::SharedPtr lot(new Lot());
+    lot->setSeed(seed);
+
+    Chain::SharedPtr chain(new Chain());
+    chain->setLikelihood(likelihood);
+    chain->setLot(lot);
+    chain->setTreeFromNewick(newick);
+    return chain;
+    }
+
+void checkRestart(Data::SharedPtr data, const std::string & newick, const std::string & filename, bool include_beagle_buffers)
+    {
+    std::string label = (include_beagle_buffers ? "restart with BeagleLib buffers" : "restart without BeagleLib buffers");
+    const unsigned nsteps = 200;
+    const unsigned checkpoint_step = 100;
+
+    Chain::SharedPtr original = makeChain(data, newick, 123);
+    original->start();
+    double lnL_at_checkpoint = 0.0;
+    std::string tree_at_checkpoint;
+    for (unsigned i = 1; i <= nsteps; ++i)
+        {
+        original->nextStep(i);
+        if (i == checkpoint_step)
+            {
+            original->stopTuning();
+            lnL_at_checkpoint = original->calcLogLikelihood();
+            tree_at_checkpoint = original->getTreeManip()->makeNewick(17);
+            original->saveCheckpoint(filename, i, include_beagle_buffers);
+            }
+        }
+
+    Chain::SharedPtr restarted = makeChain(data, newick, 999);
+    unsigned iteration = restarted->loadCheckpoint(filename);
+    check(iteration == checkpoint_step, boost::str(boost::format("%s: iteration %d restored, expected %d") % label % iteration % checkpoint_step));
+    check(restarted->getTreeManip()->makeNewick(17) == tree_at_checkpoint, label + ": tree differs at the checkpoint");
+
+#if defined(STROM_INSTRUMENT)
+    restarted->clearInstrumentation();
+#endif
+    double lnL = restarted->calcLogLikelihood();
+    check(std::fabs(lnL - lnL_at_checkpoint) < 1.0e-8, boost::str(boost::format("%s: recomputed log-likelihood %.10f differs from %.10f") % label % lnL % lnL_at_checkpoint));
+#if defined(STROM_INSTRUMENT)
+    if (include_beagle_buffers)
+        {
+        InstrumentationReport report;
+        restarted->getLikelihood()->appendInstrumentationReport(report);
+        for (auto & entry : report)
+            if (entry.name == "partialsOperations" || entry.name == "transitionMatrices")
+                check(entry.count == 0, boost::str(boost::format("%s: %d %s recomputed on restart") % label % entry.count % entry.name));
+        }
+#endif
+
+    for (unsigned i = iteration + 1; i <= nsteps; ++i)
+        restarted->nextStep(i);
+    check(restarted->getTreeManip()->makeNewick(17) == original->getTreeManip()->makeNewick(17), label + ": trajectory differs after the restart");
+    check(restarted->calcLogLikelihood() == original->calcLogLikelihood(), label + ": final log-likelihood differs after the restart");
+    check(restarted->getLambdas() == original->getLambdas(), label + ": tuning parameters differ after the restart");
+    std::remove(filename.c_str());
+    }
+
+void checkRejected(Data::SharedPtr data, const std::string & newick, const std::string & filename, const std::string & contents, const std::string & label)
+    {
+        {
+        std::ofstream outf(filename.c_str(), std::ios::out | std::ios::binary);
+        outf.write(contents.data(), contents.size());
+        }
+    bool rejected = false;
+    try
+        {
+        Chain::SharedPtr chain = makeChain(data, newick, 1);
+        chain->loadCheckpoint(filename);
+        }
+    catch (XStrom &)
+        {
+        rejected = true;
+        }
+    std::remove(filename.c_str());
+    check(rejected, label + " accepted as a checkpoint");
+    }
+
+int main(int argc, const char * argv[])
+    {
+    const std::string filename = "test_checkpoint.tmp";
+    try
+        {
+        Data::SharedPtr data(new Data());
+        data->getDataFromFile("rbcL.nex");
+        Lot::SharedPtr lot(new Lot());
+        lot->setSeed(1);
+        std::string newick = randomNewick(lot, data->getNumTaxa(), 0.1, false);
+
+        checkRestart(data, newick, filename, false);
+        checkRestart(data, newick, filename, true);
+
+        Chain::SharedPtr chain = makeChain(data, newick, 1);
+        chain->start();
+        chain->saveCheckpoint(filename, 1, true);
+        std::string contents;
+            {
+            std::ifstream inf(filename.c_str(), std::ios::in | std::ios::binary);
+            contents.assign(std::istreambuf_iterator<char>(inf), std::istreambuf_iterator<char>());
+            }
+        checkRejected(data, newick, filename, std::string(), "empty file");
+        checkRejected(data, newick, filename, "(1:0.1,2:0.1,(3:0.1,4:0.1):0.1);", "newick file");
+        checkRejected(data, newick, filename, contents.substr(0, contents.size()/2), "checkpoint truncated to half its length");
+        checkRejected(data, newick, filename, contents.substr(0, contents.size() - 1), "checkpoint missing its last byte");
+        }
+    catch (XStrom & x)
+        {
+        check(false, x.what());
+        }
+
+    return reportChecks("checkpoint");
+    }
@@ -0,0 +1,172 @@
+//
+//  test_coalescent.cpp
+//
+//  Stand-alone check of CoalescentPrior. The log density is compared with a direct evaluation
+//  (sort the node times, then integrate C(k,2)/N(t) interval by interval) for constant and
+//  skyline population sizes, both when all times are set at once and after long sequences of
+//  single-time changes through setNodeTime, including tied times and times on breakpoints. For
+//  two leaves the density must also be exactly that of the first coalescence and integrate to 1.
+//  Not part of the main target; build and run it with
+//
+//      make check
+//
+//  (see Makefile). Exits with status 1 if any check fails.
+//
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <boost/format.hpp>
+#include "lot.h"
+#include "coalescent.h"
+#include "xstrom.h"
+#include "test_support.h"
+
+using namespace strom;
+
+bool nearlyEqual(double a, double b)
+    {
+    return std::fabs(a - b) <= 1.0e-9*std::max(1.0, std::fabs(b));
+    }
+
+double populationSize(double t, const std::vector<double> & breakpoints, const std::vector<double> & sizes)
+    {
+    unsigned e = 0;
+    while (e < breakpoints.size() && t > breakpoints[e])
+        ++e;
+    return sizes[e];
+    }
+
+double directLogPrior(std::vector<double> times, const std::vector<double> & breakpoints, const std::vector<double> & sizes)
+    {
+    // Straight from the definition: k lineages coalesce at rate C(k,2)/N(t) between node times
+    std::sort(times.begin(), times.end());
+    double n = times.size() + 1.0;
+    double log_prior = 0.0;
+    double prev = 0.0;
+    for (unsigned j = 0; j < times.size(); ++j)
+        {
+        double k = n - j;
+        log_prior -= std::log(populationSize(times[j], breakpoints, sizes));
+        std::vector<double> ends(1, prev);
+        for (auto b : breakpoints)
+            if (b > prev && b < times[j])
+                ends.push_back(b);
+        ends.push_back(times[j]);
+        for (unsigned i = 0; i + 1 < ends.size(); ++i)
+            log_prior -= 0.5*k*(k - 1.0)*(ends[i + 1] - ends[i])/populationSize(0.5*(ends[i] + ends[i + 1]), breakpoints, sizes);
+        prev = times[j];
+        }
+    return log_prior;
+    }
+
+double randomTime(Lot::SharedPtr lot, const std::vector<double> & times, const std::vector<double> & breakpoints)
+    {
+    // Mostly continuous times, but sometimes one that ties with another node or a breakpoint
+    double u = lot->uniform();
+    if (u < 0.1 && !times.empty())
+        return times[lot->randint(0, (int)times.size() - 1)];
+    if (u < 0.2 && !breakpoints.empty())
+        return breakpoints[lot->randint(0, (int)breakpoints.size() - 1)];
+    return 5.0*lot->uniform();
+    }
+
+void checkAgainstDirect(Lot::SharedPtr lot, unsigned nleaves, const std::vector<double> & breakpoints, const std::vector<double> & sizes)
+    {
+    std::string label = boost::str(boost::format("%d leaves, %d epochs") % nleaves % sizes.size());
+    CoalescentPrior prior;
+    if (breakpoints.empty())
+        prior.setPopulationSize(sizes[0]);
+    else
+        prior.setSkyline(breakpoints, sizes);
+
+    std::vector<double> times;
+    for (unsigned i = 0; i + 1 < nleaves; ++i)
+        times.push_back(randomTime(lot, times, breakpoints));
+    prior.setNodeTimes(times);
+    check(prior.getNumLeaves() == nleaves, label + ": wrong number of leaves");
+    double log_prior = prior.calcLogPrior();
+    double expected = directLogPrior(times, breakpoints, sizes);
+    check(nearlyEqual(log_prior, expected), boost::str(boost::format("%s: log prior %.12g, direct evaluation %.12g") % label % log_prior % expected));
+
+    // Single-time changes must give the same density as setting all the times afresh
+    unsigned nbad = 0;
+    for (unsigned step = 0; step < 2000; ++step)
+        {
+        unsigned slot = (unsigned)lot->randint(0, (int)times.size() - 1);
+        times[slot] = randomTime(lot, times, breakpoints);
+        prior.setNodeTime(slot, times[slot]);
+        if (prior.getNodeTime(slot) != times[slot] || !nearlyEqual(prior.calcLogPrior(), directLogPrior(times, breakpoints, sizes)))
+            ++nbad;
+        }
+    check(nbad == 0, boost::str(boost::format("%s: %d of 2000 single-time changes give the wrong log prior") % label % nbad));
+
+    CoalescentPrior fresh;
+    fresh.setSkyline(breakpoints, sizes);
+    fresh.setNodeTimes(times);
+    check(nearlyEqual(prior.calcLogPrior(), fresh.calcLogPrior()), label + ": incremental and fresh log priors differ");
+    }
+
+void checkTwoLeaves()
+    {
+    // With two leaves the single node time is the first coalescence, with hazard 1/N(t)
+    std::vector<double> breakpoints = {0.5, 1.0, 2.5};
+    std::vector<double> sizes = {0.3, 2.0, 0.7, 1.5};
+    CoalescentPrior prior;
+    prior.setPopulationSize(2.0);
+    prior.setNodeTimes(std::vector<double>(1, 0.8));
+    check(nearlyEqual(prior.calcLogPrior(), -std::log(2.0) - 0.8/2.0), "two leaves, constant size: not the exponential density");
+
+    prior.setSkyline(breakpoints, sizes);
+    prior.setNodeTime(0, 1.7);
+    double expected = -std::log(0.7) - (0.5/0.3 + 0.5/2.0 + 0.7/0.7);
+    check(nearlyEqual(prior.calcLogPrior(), expected), "two leaves, skyline: wrong density");
+
+    // Midpoint rule on a fine grid out to where the remaining mass is negligible
+    const double upper = 60.0;
+    const unsigned nsteps = 600000;
+    double h = upper/nsteps;
+    double total = 0.0;
+    for (unsigned i = 0; i < nsteps; ++i)
+        {
+        prior.setNodeTime(0, (i + 0.5)*h);
+        total += std::exp(prior.calcLogPrior())*h;
+        }
+    check(std::fabs(total - 1.0) < 1.0e-6, boost::str(boost::format("two leaves, skyline: density integrates to %.9f") % total));
+    }
+
+int main(int argc, const char * argv[])
+    {
+    Lot::SharedPtr lot(new Lot());
+    lot->setSeed(1);
+    try
+        {
+        checkTwoLeaves();
+        for (unsigned nleaves : {2, 3, 5, 20, 200})
+            {
+            checkAgainstDirect(lot, nleaves, std::vector<double>(), std::vector<double>(1, 1.5));
+            checkAgainstDirect(lot, nleaves, {0.5, 1.0, 2.5}, {0.3, 2.0, 0.7, 1.5});
+            checkAgainstDirect(lot, nleaves, {4.0}, {1.0, 0.01});
+            }
+
+        bool rejected = false;
+        try
+            {
+            CoalescentPrior prior;
+            prior.setSkyline({1.0, 0.5}, {1.0, 1.0, 1.0});
+            }
+        catch (XStrom &)
+            {
+            rejected = true;
+            }
+        check(rejected, "decreasing skyline breakpoints accepted");
+        }
+    catch (XStrom & x)
+        {
+        check(false, x.what());
+        }
+
+    return reportChecks("coalescent");
+    }
@@ -0,0 +1,147 @@
+//
+//  test_newick.cpp
+//
+//  Stand-alone check of TreeManip::buildFromNewick and TreeManip::makeNewick. Hand-written
+//  descriptions (comments, quoted names, exponents, whitespace, rooted and unrooted) are parsed
+//  and checked against their known leaf count, tree length and splits; random trees are written,
+//  parsed and written again, which must reproduce both the description and the splits; and
+//  malformed descriptions must be rejected. Not part of the main target; build and run it with
+//
+//      make check
+//
+//  (see Makefile). Exits with status 1 if any check fails.
+//
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <set>
+#include <cmath>
+#include <boost/format.hpp>
+#include "lot.h"
+#include "tree_manip.h"
+#include "xstrom.h"
+#include "test_support.h"
+
+using namespace strom;
+
+const double strom::Node::_smallest_edge_length = 1.0e-12;
+
+struct NewickCase
+    {
+    std::string newick;
+    bool        rooted;
+    unsigned    nleaves;
+    double      tree_length;
+    };
+
+void checkRoundTrip(TreeManip & tm, const std::string & label)
+    {
+    // Writing, reading and writing again must reproduce the description and the splits
+    std::set<Split> before;
+    tm.storeSplits(before);
+    std::string newick = tm.makeNewick(8);
+
+    TreeManip copy;
+    copy.buildFromNewick(newick, tm.getTree()->isRooted(), false);
+    std::set<Split> after;
+    copy.storeSplits(after);
+    check(copy.makeNewick(8) == newick, label + ": makeNewick differs after reading it back");
+    check(before == after, label + ": splits differ after reading makeNewick back");
+    check(std::fabs(copy.calcTreeLength() - tm.calcTreeLength()) < 1.0e-7, label + ": tree length differs after reading makeNewick back");
+    }
+
+int main(int argc, const char * argv[])
+    {
+    std::vector<NewickCase> cases = {
+        {"(1:0.1,2:0.2,(3:0.3,4:0.4):0.5)", false, 4, 1.5},
+        {"(1:0.1,2:0.2,(3:0.3,4:0.4):0.5);", false, 4, 1.5},
+        {" ( 1 : 0.1 , 2 : 0.2 , ( 3 : 0.3 , 4 : 0.4 ) : 0.5 ) ; ", false, 4, 1.5},
+        {"(1:1e-1,2:2.0E-1,(3:0.03e1,4:4e-1):5e-1)", false, 4, 1.5},
+        {"[&U](1:0.1[&comment],2:0.2,(3:0.3,4:0.4)[x]:0.5)", false, 4, 1.5},
+        {"('1':0.1,'2':0.2,('3':0.3,'4':0.4):0.5)", false, 4, 1.5},
+        {"((1:0.1,2:0.2):0.05,(3:0.3,4:0.4):0.5)", true, 4, 1.55},
+        {"(((1:1,2:1):1,3:2):1,((4:1,5:1):1,6:2):1)", true, 6, 12.0},
+        {"(5:0.5,(1:0.1,4:0.4):0.7,(2:0.2,(3:0.3,6:0.6):0.8):0.9)", false, 6, 4.5}
+        };
+
+    for (auto & c : cases)
+        {
+        try
+            {
+            TreeManip tm;
+            tm.buildFromNewick(c.newick, c.rooted, false);
+            check(tm.getTree()->numLeaves() == c.nleaves, c.newick + ": wrong number of leaves");
+            // Allows for the root's edge, which is set to Node::_smallest_edge_length
+            check(std::fabs(tm.calcTreeLength() - c.tree_length) < 1.0e-9, c.newick + ": wrong tree length");
+            checkRoundTrip(tm, c.newick);
+            }
+        catch (XStrom & x)
+            {
+            check(false, c.newick + ": " + x.what());
+            }
+        }
+
+    // Same unrooted tree written in different orders and with different rootings
+    try
+        {
+        TreeManip a;
+        TreeManip b;
+        a.buildFromNewick("(1:0.1,2:0.2,(3:0.3,(4:0.4,5:0.5):0.6):0.7)", false, false);
+        b.buildFromNewick("((5:0.5,4:0.4):0.6,3:0.3,(2:0.2,1:0.1):0.7)", false, false);
+        std::set<Split> sa;
+        std::set<Split> sb;
+        a.storeSplits(sa);
+        b.storeSplits(sb);
+        check(sa == sb, "equivalent unrooted descriptions have different splits");
+        }
+    catch (XStrom & x)
+        {
+        check(false, std::string("equivalent unrooted descriptions: ") + x.what());
+        }
+
+    Lot::SharedPtr lot(new Lot());
+    lot->setSeed(1);
+    for (unsigned nleaves : {4, 5, 10, 50, 200})
+        {
+        for (unsigned rep = 0; rep < 10; ++rep)
+            {
+            try
+                {
+                TreeManip tm;
+                tm.buildFromNewick(randomNewick(lot, nleaves, 0.1, false), false, false);
+                checkRoundTrip(tm, boost::str(boost::format("random tree with %d leaves") % nleaves));
+                }
+            catch (XStrom & x)
+                {
+                check(false, boost::str(boost::format("random tree with %d leaves: %s") % nleaves % x.what()));
+                }
+            }
+        }
+
+    std::vector<std::string> malformed = {
+        "(1:0.1,2:0.2,(3:0.3,4:0.4):0.5",
+        "(1:0.1,2:0.2,(3:0.3,4:0.4):0.5))",
+        "(1:0.1,2:0.2,(3:0.3,4:0.4[:0.5)",
+        "(1:0.1,2:0.2,('3:0.3,4:0.4):0.5)",
+        "(1:0.1,,2:0.2,(3:0.3,4:0.4):0.5)",
+        "(1:0.1,2:0.2,(3:0.3):0.5,4:0.4)",
+        "(1:0.1,2:0.2,3:0.3,4:0.4)"
+        };
+    for (auto & newick : malformed)
+        {
+        bool rejected = false;
+        try
+            {
+            TreeManip tm;
+            tm.buildFromNewick(newick, false, false);
+            }
+        catch (XStrom &)
+            {
+            rejected = true;
+            }
+        check(rejected, newick + ": malformed description accepted");
+        }
+
+    return reportChecks("newick");
+    }
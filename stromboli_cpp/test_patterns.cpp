@@ -0,0 +1,477 @@
+//
+//  test_patterns.cpp
+//
+//  Stand-alone check of the packed alignment storage in Data. PackedMatrix must store and return
+//  every code without disturbing its neighbours; pattern compression must keep every column of
+//  the alignment exactly once, with the right count; IUPAC ambiguity codes read from FASTA must
+//  be kept exactly (and passed to BeagleLib as 4); the same alignment supplied to setData and
+//  read from a FASTA file must give identical patterns; and columns in which every taxon is
+//  missing must be dropped without changing the log-likelihood. Reordering the patterns by the
+//  leaves of a tree must sort them, keep track of where each came from and leave the
+//  log-likelihood unchanged. The per-node masks of patterns missing from every leaf below a node
+//  must match the leaves, and the log-likelihood computed with the kernels skipping those
+//  patterns must equal the one computed without masks. Not part of the main target; build and
+//  run it with
+//
+//      make check
+//
+//  (see Makefile). Exits with status 1 if any check fails.
+//
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+#include <boost/format.hpp>
+#include "lot.h"
+#include "data.h"
+#include "packed_matrix.h"
+#include "tree_manip.h"
+#include "likelihood.h"
+#include "missing_data_mask.h"
+#include "beagle_instance_pool.h"
+#include "xstrom.h"
+#include "test_support.h"
+
+using namespace strom;
+
+const double strom::Node::_smallest_edge_length = 1.0e-12;
+
+typedef std::map<std::vector<unsigned>, double> column_counts_t;
+
+column_counts_t countColumns(const Data & data)
+    {
+    // Packed code of every taxon for each pattern, with the pattern's count
+    column_counts_t columns;
+    const PackedMatrix & m = data.getPackedMatrix();
+    for (unsigned j = 0; j < data.getNumPatterns(); ++j)
+        {
+        std::vector<unsigned> column(data.getNumTaxa());
+        for (unsigned i = 0; i < column.size(); ++i)
+            column[i] = m.get(i, j);
+        columns[column] += data.getPatternCounts()[j];
+        }
+    return columns;
+    }
+
+void writeFasta(const std::string & filename, const Data::taxon_names_t & names, const std::vector<std::string> & sequences)
+    {
+    std::ofstream outf(filename.c_str());
+    for (unsigned t = 0; t < names.size(); ++t)
+        outf << ">" << names[t] << "\n" << sequences[t] << "\n";
+    }
+
+void checkPackedMatrix(Lot::SharedPtr lot)
+    {
+    // Column counts on either side of the word boundary
+    for (unsigned ncols : {1, 15, 16, 17, 37})
+        {
+        PackedMatrix m;
+        m.resize(5, ncols);
+        std::vector< std::vector<unsigned> > expected(5, std::vector<unsigned>(ncols));
+        for (unsigned i = 0; i < 5; ++i)
+            for (unsigned j = 0; j < ncols; ++j)
+                {
+                expected[i][j] = (unsigned)lot->randint(0, 15);
+                m.set(i, j, expected[i][j]);
+                }
+        bool same = true;
+        bool unpacked = true;
+        std::vector<int> states(ncols);
+        for (unsigned i = 0; i < 5; ++i)
+            {
+            m.unpackRow(i, &states[0]);
+            for (unsigned j = 0; j < ncols; ++j)
+                {
+                same = same && (m.get(i, j) == expected[i][j]);
+                unpacked = unpacked && (states[j] == PackedMatrix::codeToState(expected[i][j]));
+                }
+            }
+        check(same, boost::str(boost::format("PackedMatrix with %d columns does not return the codes stored") % ncols));
+        check(unpacked, boost::str(boost::format("PackedMatrix with %d columns unpacks the wrong states") % ncols));
+        }
+
+    for (int state = 0; state < 5; ++state)
+        check(PackedMatrix::codeToState(PackedMatrix::stateToCode(state)) == state, boost::str(boost::format("state %d does not survive packing") % state));
+    }
+
+void checkCompression(Lot::SharedPtr lot)
+    {
+    // Few taxa and a skewed choice of states, so that many columns are repeated
+    const unsigned ntaxa = 6;
+    const unsigned nsites = 1000;
+    Data::taxon_names_t names(ntaxa);
+    Data::data_matrix_t matrix(ntaxa, Data::pattern_t(nsites));
+    for (unsigned t = 0; t < ntaxa; ++t)
+        {
+        names[t] = boost::str(boost::format("taxon_%d") % (t + 1));
+        for (unsigned s = 0; s < nsites; ++s)
+            matrix[t][s] = (lot->uniform() < 0.7 ? 0 : lot->randint(1, 4));
+        }
+    Data data;
+    data.setData(names, matrix);
+
+    column_counts_t expected;
+    for (unsigned s = 0; s < nsites; ++s)
+        {
+        std::vector<unsigned> column(ntaxa);
+        for (unsigned t = 0; t < ntaxa; ++t)
+            column[t] = PackedMatrix::stateToCode(matrix[t][s]);
+        expected[column] += 1.0;
+        }
+    check(data.getSeqLen() == nsites, boost::str(boost::format("compressed alignment has %d sites, expected %d") % data.getSeqLen() % nsites));
+    check(data.getNumPatterns() == expected.size(), boost::str(boost::format("compressed alignment has %d patterns, expected %d") % data.getNumPatterns() % expected.size()));
+    check(countColumns(data) == expected, "compressed patterns or counts do not match the columns of the alignment");
+
+    Data::data_matrix_t expanded = data.getDataMatrix();
+    bool same = (expanded.size() == ntaxa);
+    std::vector<int> states;
+    for (unsigned t = 0; same && t < ntaxa; ++t)
+        {
+        data.getTipStates(t, states);
+        same = (states == expanded[t]);
+        }
+    check(same, "getTipStates and getDataMatrix disagree");
+
+    // The same alignment as a FASTA file must give exactly the same patterns, in the same order
+    const char * letters = "ACGTN";
+    std::vector<std::string> sequences(ntaxa);
+    for (unsigned t = 0; t < ntaxa; ++t)
+        for (unsigned s = 0; s < nsites; ++s)
+            sequences[t] += letters[matrix[t][s]];
+    std::string filename = "test_patterns.fa";
+    writeFasta(filename, names, sequences);
+    Data from_file;
+    from_file.getDataFromFile(filename);
+    std::remove(filename.c_str());
+    bool identical = (from_file.getNumPatterns() == data.getNumPatterns() && from_file.getPatternCounts() == data.getPatternCounts());
+    for (unsigned t = 0; identical && t < ntaxa; ++t)
+        for (unsigned j = 0; identical && j < data.getNumPatterns(); ++j)
+            identical = (from_file.getPackedMatrix().get(t, j) == data.getPackedMatrix().get(t, j));
+    check(identical, "FASTA file and setData give different patterns for the same alignment");
+    }
+
+void checkAmbiguityCodes()
+    {
+    // Columns: AAAA, CCCC, GGGG, TTTT, RYRM, NNAC, acgt, -?.A, ACGT, N-?A
+    Data::taxon_names_t names = {"t1", "t2", "t3", "t4"};
+    std::vector<std::string> sequences = {"ACGTRNa-AN", "ACGTYNc?C-", "ACGTRAg.G?", "ACGTMCtATA"};
+    std::string filename = "test_patterns.fa";
+    writeFasta(filename, names, sequences);
+    Data data;
+    data.getDataFromFile(filename);
+    std::remove(filename.c_str());
+
+    const unsigned A = 1, C = 2, G = 4, T = 8, N = PackedMatrix::missing_code;
+    column_counts_t expected;
+    expected[{A, A, A, A}] = 1.0;
+    expected[{C, C, C, C}] = 1.0;
+    expected[{G, G, G, G}] = 1.0;
+    expected[{T, T, T, T}] = 1.0;
+    expected[{A|G, C|T, A|G, A|C}] = 1.0;
+    expected[{N, N, A, C}] = 1.0;
+    expected[{A, C, G, T}] = 2.0;
+    expected[{N, N, N, A}] = 2.0;
+    check(data.getSeqLen() == 10, boost::str(boost::format("FASTA with ambiguity codes has %d sites, expected 10") % data.getSeqLen()));
+    check(countColumns(data) == expected, "ambiguity codes, case or gap symbols not packed as expected");
+
+    // BeagleLib sees every ambiguity code as completely unknown
+    bool all_ambiguous_as_4 = true;
+    std::vector<int> states;
+    for (unsigned t = 0; t < 4; ++t)
+        {
+        data.getTipStates(t, states);
+        for (unsigned j = 0; j < data.getNumPatterns(); ++j)
+            {
+            unsigned code = data.getPackedMatrix().get(t, j);
+            bool single = (code == A || code == C || code == G || code == T);
+            all_ambiguous_as_4 = all_ambiguous_as_4 && (single ? states[j] < 4 : states[j] == 4);
+            }
+        }
+    check(all_ambiguous_as_4, "ambiguity codes not passed to BeagleLib as state 4");
+    }
+
+Data::data_matrix_t randomMatrix(Lot::SharedPtr lot, unsigned ntaxa, unsigned nsites, double pmissing)
+    {
+    // Partial sequences: each taxon is missing for a random stretch as well as at random sites
+    Data::data_matrix_t matrix(ntaxa, Data::pattern_t(nsites));
+    for (unsigned t = 0; t < ntaxa; ++t)
+        {
+        unsigned first = (unsigned)lot->randint(0, nsites - 1);
+        unsigned last = std::min(nsites, first + nsites/4);
+        for (unsigned s = 0; s < nsites; ++s)
+            matrix[t][s] = ((s >= first && s < last) || lot->uniform() < pmissing ? 4 : lot->randint(0, 3));
+        }
+    return matrix;
+    }
+
+double logLikelihood(Data::SharedPtr data, TreeManip & tm)
+    {
+    Likelihood likelihood;
+    likelihood.setData(data);
+    likelihood.getModel()->setGammaNCateg(4);
+    likelihood.getModel()->setExchangeabilities(std::vector<double>(6, 1.0/6.0));
+    return likelihood.calcLogLikelihood(tm.getTree());
+    }
+
+void checkAllMissingColumns(Lot::SharedPtr lot)
+    {
+    const unsigned ntaxa = 10;
+    const unsigned nsites = 400;
+    Data::taxon_names_t names(ntaxa);
+    for (unsigned t = 0; t < ntaxa; ++t)
+        names[t] = boost::str(boost::format("taxon_%d") % (t + 1));
+    Data::data_matrix_t matrix = randomMatrix(lot, ntaxa, nsites, 0.3);
+    TreeManip tm;
+    tm.buildRandomTree(ntaxa, lot, 0.1);
+
+    Data::SharedPtr data(new Data());
+    data->setData(names, matrix);
+    unsigned ndropped = data->getNumAllMissingSites();
+    double lnL = logLikelihood(data, tm);
+
+    // Insert all-missing columns at random positions, including the first and last
+    const unsigned nextra = 25;
+    Data::data_matrix_t padded = matrix;
+    for (unsigned k = 0; k < nextra; ++k)
+        {
+        unsigned s = (k == 0 ? 0 : (k == 1 ? (unsigned)padded[0].size() : (unsigned)lot->randint(0, (int)padded[0].size())));
+        for (auto & row : padded)
+            row.insert(row.begin() + s, 4);
+        }
+    Data::SharedPtr padded_data(new Data());
+    padded_data->setData(names, padded);
+    check(padded_data->getNumAllMissingSites() == ndropped + nextra, boost::str(boost::format("%d all-missing sites reported, expected %d") % padded_data->getNumAllMissingSites() % (ndropped + nextra)));
+    check(padded_data->getSeqLen() == data->getSeqLen(), "all-missing columns counted in the sequence length");
+    check(countColumns(*padded_data) == countColumns(*data), "all-missing columns changed the patterns");
+    bool any_all_missing = false;
+    for (auto & c : countColumns(*padded_data))
+        any_all_missing = any_all_missing || (c.first == std::vector<unsigned>(ntaxa, PackedMatrix::missing_code));
+    check(!any_all_missing, "an all-missing pattern was kept");
+    double padded_lnL = logLikelihood(padded_data, tm);
+    check(padded_lnL == lnL, boost::str(boost::format("log-likelihood %.12f with all-missing columns differs from %.12f without") % padded_lnL % lnL));
+
+    // An alignment with nothing but missing data cannot be analysed
+    bool rejected = false;
+    try
+        {
+        Data empty;
+        empty.setData(names, Data::data_matrix_t(ntaxa, Data::pattern_t(10, 4)));
+        }
+    catch (XStrom &)
+        {
+        rejected = true;
+        }
+    check(rejected, "alignment in which every site is missing accepted");
+    }
+
+void checkReordering(Lot::SharedPtr lot)
+    {
+    const unsigned ntaxa = 12;
+    const unsigned nsites = 600;
+    Data::taxon_names_t names(ntaxa);
+    for (unsigned t = 0; t < ntaxa; ++t)
+        names[t] = boost::str(boost::format("taxon_%d") % (t + 1));
+    TreeManip tm;
+    tm.buildRandomTree(ntaxa, lot, 0.1);
+
+    Data::SharedPtr data(new Data());
+    data->setData(names, randomMatrix(lot, ntaxa, nsites, 0.1));
+    Data original(*data);
+    double lnL = logLikelihood(data, tm);
+
+    std::vector<unsigned> taxon_order;
+    tm.getLeafNumbersInPreorder(taxon_order);
+    for (unsigned pass = 0; pass < 2; ++pass)
+        {
+        // Second pass reorders the already reordered patterns, by the reverse order
+        std::string label = (pass == 0 ? "reordering by preorder" : "second reordering");
+        if (pass == 1)
+            std::reverse(taxon_order.begin(), taxon_order.end());
+        data->reorderPatterns(taxon_order);
+
+        const PackedMatrix & m = data->getPackedMatrix();
+        const std::vector<unsigned> & origins = data->getPatternOrigins();
+        bool sorted = true;
+        for (unsigned j = 1; j < data->getNumPatterns(); ++j)
+            {
+            std::vector<unsigned> a;
+            std::vector<unsigned> b;
+            for (auto t : taxon_order)
+                {
+                a.push_back(m.get(t, j - 1));
+                b.push_back(m.get(t, j));
+                }
+            sorted = sorted && !(b < a);
+            }
+        check(sorted, label + ": patterns are not sorted by the taxon order");
+
+        bool tracked = (origins.size() == original.getNumPatterns());
+        for (unsigned j = 0; tracked && j < origins.size(); ++j)
+            {
+            tracked = (data->getPatternCounts()[j] == original.getPatternCounts()[origins[j]]);
+            for (unsigned t = 0; tracked && t < ntaxa; ++t)
+                tracked = (m.get(t, j) == original.getPackedMatrix().get(t, origins[j]));
+            }
+        check(tracked, label + ": getPatternOrigins does not give each pattern's original position");
+
+        std::vector<double> values(origins.begin(), origins.end());
+        data->restorePatternOrder(values);
+        bool restored = true;
+        for (unsigned j = 0; j < values.size(); ++j)
+            restored = restored && (values[j] == j);
+        check(restored, label + ": restorePatternOrder does not undo the reordering");
+
+        // Same patterns summed in a different order
+        double reordered_lnL = logLikelihood(data, tm);
+        check(std::fabs(reordered_lnL - lnL) < 1.0e-9*std::fabs(lnL), boost::str(boost::format("%s: log-likelihood %.12f differs from %.12f") % label % reordered_lnL % lnL));
+        }
+
+    std::vector< std::vector<unsigned> > bad_orders = {std::vector<unsigned>(ntaxa - 1, 0), std::vector<unsigned>(ntaxa, 0), taxon_order};
+    bad_orders[2][0] = ntaxa;
+    for (auto & order : bad_orders)
+        {
+        bool rejected = false;
+        try
+            {
+            data->reorderPatterns(order);
+            }
+        catch (XStrom &)
+            {
+            rejected = true;
+            }
+        check(rejected, "taxon order that does not list each taxon once accepted");
+        }
+    }
+
+void leavesBelow(Node * nd, unsigned ntaxa, std::vector<unsigned> & leaves)
+    {
+    // A leaf is its own subtree, even the leaf that roots an unrooted tree
+    if ((unsigned)nd->getNumber() < ntaxa)
+        {
+        leaves.push_back(nd->getNumber());
+        return;
+        }
+    for (Node * child = nd->getLeftChild(); child; child = child->getRightSib())
+        leavesBelow(child, ntaxa, leaves);
+    }
+
+double unmaskedLogLikelihood(Data::SharedPtr data, TreeManip & tm)
+    {
+    Likelihood likelihood;
+    likelihood.useMissingDataMasks(false);
+    likelihood.setData(data);
+    likelihood.getModel()->setGammaNCateg(4);
+    likelihood.getModel()->setExchangeabilities(std::vector<double>(6, 1.0/6.0));
+    return likelihood.calcLogLikelihood(tm.getTree());
+    }
+
+void checkMissingDataMasks(Lot::SharedPtr lot)
+    {
+    // Long stretches of missing data, so that many patterns are missing from whole subtrees
+    const unsigned ntaxa = 16;
+    const unsigned nsites = 800;
+    Data::taxon_names_t names(ntaxa);
+    for (unsigned t = 0; t < ntaxa; ++t)
+        names[t] = boost::str(boost::format("taxon_%d") % (t + 1));
+    Data::SharedPtr data(new Data());
+    data->setData(names, randomMatrix(lot, ntaxa, nsites, 0.5));
+    const unsigned npatterns = data->getNumPatterns();
+    const PackedMatrix & m = data->getPackedMatrix();
+
+    MissingDataMask mask;
+    mask.setData(data);
+    check(mask.hasAnyMissing(), "missing data not found");
+
+    // One likelihood follows a series of trees, so that masks are replaced as the topology
+    // changes; each tree is also evaluated afresh without masks
+    Likelihood::SharedPtr masked(new Likelihood());
+    masked->setData(data);
+    masked->getModel()->setGammaNCateg(4);
+    masked->getModel()->setExchangeabilities(std::vector<double>(6, 1.0/6.0));
+    unsigned nmasked = 0;
+    TreeManip tm;
+    for (unsigned i = 0; i < 12; ++i)
+        {
+        bool rooted = (i % 3 == 2);
+        std::string label = boost::str(boost::format("tree %d (%s)") % i % (rooted ? "rooted" : "unrooted"));
+        tm.buildFromNewick(randomNewick(lot, ntaxa, 0.1, rooted), rooted, false);
+
+        mask.update(tm.getTree());
+        Node::PtrVector nodes;
+        tm.getNodesByNumber(nodes);
+        unsigned nwrong = 0;
+        for (Node * nd : nodes)
+            {
+            if (!nd)
+                continue;
+            std::vector<unsigned> leaves;
+            leavesBelow(nd, ntaxa, leaves);
+            for (unsigned j = 0; j < npatterns; ++j)
+                {
+                bool all_missing = true;
+                for (auto t : leaves)
+                    all_missing = all_missing && (m.get(t, j) == PackedMatrix::missing_code);
+                if (mask.isAllMissing(nd->getNumber(), j) != all_missing)
+                    ++nwrong;
+                if (all_missing && (unsigned)nd->getNumber() >= ntaxa)
+                    ++nmasked;
+                }
+            }
+        check(nwrong == 0, boost::str(boost::format("%s: %d node masks disagree with the leaves below the node") % label % nwrong));
+
+        for (double scaler : {1.0, 3.0})
+            {
+            // The second evaluation recomputes every partial with the masks already in place
+            tm.scaleAllEdgeLengths(scaler);
+            double lnL = masked->calcLogLikelihood(tm.getTree());
+            double expected = unmaskedLogLikelihood(data, tm);
+            check(std::fabs(lnL - expected) < 1.0e-10*std::fabs(expected), boost::str(boost::format("%s: log-likelihood %.12f with masks differs from %.12f without") % label % lnL % expected));
+            }
+        }
+    check(nmasked > 0, "no internal node is missing any pattern, so the masks were not exercised");
+
+    // Switching masks off must clear those already passed to BeagleLib
+    masked->useMissingDataMasks(false);
+    tm.buildFromNewick(randomNewick(lot, ntaxa, 0.1, false), false, false);
+    double lnL = masked->calcLogLikelihood(tm.getTree());
+    double expected = unmaskedLogLikelihood(data, tm);
+    check(std::fabs(lnL - expected) < 1.0e-10*std::fabs(expected), boost::str(boost::format("log-likelihood %.12f after switching masks off differs from %.12f") % lnL % expected));
+
+    // An instance returned to the pool must not pass its masks on to the next likelihood: the
+    // first evaluation below reuses the masked instance, the second gets a new one
+    masked->useMissingDataMasks(true);
+    tm.buildFromNewick(randomNewick(lot, ntaxa, 0.1, false), false, false);
+    masked->calcLogLikelihood(tm.getTree());
+    masked.reset();
+    tm.buildFromNewick(randomNewick(lot, ntaxa, 0.1, false), false, false);
+    double reused = unmaskedLogLikelihood(data, tm);
+    BeagleInstancePool::getPool().clear();
+    double fresh = unmaskedLogLikelihood(data, tm);
+    check(reused == fresh, boost::str(boost::format("log-likelihood %.12f from a reused instance differs from %.12f from a new one") % reused % fresh));
+    }
+
+int main(int argc, const char * argv[])
+    {
+    Lot::SharedPtr lot(new Lot());
+    lot->setSeed(1);
+    try
+        {
+        checkPackedMatrix(lot);
+        checkCompression(lot);
+        checkAmbiguityCodes();
+        checkAllMissingColumns(lot);
+        checkReordering(lot);
+        checkMissingDataMasks(lot);
+        }
+    catch (XStrom & x)
+        {
+        check(false, x.what());
+        }
+
+    return reportChecks("pattern");
+    }
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <boost/format.hpp>
+#include "lot.h"
+
+namespace strom
+    {
+
+    // Shared by the stand-alone test programs (see Makefile): check records a failure and carries
+    // on, and reportChecks prints the outcome and gives the program's exit status
+
+    inline unsigned & numFailedChecks()
+        {
+        static unsigned nfailures = 0;
+        return nfailures;
+        }
+
+    inline void check(bool ok, const std::string & what)
+        {
+        if (!ok)
+            {
+            std::cerr << "FAILED: " << what << std::endl;
+            ++numFailedChecks();
+            }
+        }
+
+    inline int reportChecks(const std::string & what)
+        {
+        unsigned nfailures = numFailedChecks();
+        if (nfailures > 0)
+            {
+            std::cerr << nfailures << " check(s) failed" << std::endl;
+            return 1;
+            }
+        std::cerr << "All " << what << " checks passed" << std::endl;
+        return 0;
+        }
+
+    inline std::string randomNewick(Lot::SharedPtr lot, unsigned nleaves, double mean_edge_length, bool rooted)
+        {
+        // Joins randomly chosen pairs of subtrees, leaves named 1..nleaves, exponential edge lengths
+        std::vector<std::string> subtrees;
+        for (unsigned i = 1; i <= nleaves; ++i)
+            subtrees.push_back(std::to_string(i));
+        unsigned nbasal = (rooted ? 2 : 3);
+        while (subtrees.size() > nbasal)
+            {
+            unsigned a = (unsigned)lot->randint(0, (int)subtrees.size() - 1);
+            std::string first = subtrees[a];
+            subtrees.erase(subtrees.begin() + a);
+            unsigned b = (unsigned)lot->randint(0, (int)subtrees.size() - 1);
+            subtrees[b] = boost::str(boost::format("(%s:%.8f,%s:%.8f)") % first % lot->gamma(1.0, mean_edge_length) % subtrees[b] % lot->gamma(1.0, mean_edge_length));
+            }
+        std::string newick = "(";
+        for (unsigned i = 0; i < subtrees.size(); ++i)
+            newick += boost::str(boost::format("%s%s:%.8f") % (i > 0 ? "," : "") % subtrees[i] % lot->gamma(1.0, mean_edge_length));
+        return newick + ")";
+        }
+    }
@@ -0,0 +1,113 @@
+//
+//  test_tip_tables.cpp
+//
+//  Stand-alone check of the tip tables in the 4-state BeagleLib CPU kernels. Partials for a
+//  cherry (two tips) and for a tip joined to an internal node are computed through the BeagleLib
+//  API, for pattern counts on either side of TIP_TABLE_MIN_PATTERNS and with tips that include
+//  the missing state, and compared with the products written out directly: a cherry's partial
+//  is a single product of two transition probabilities, so it must be bit-identical; a tip-inner
+//  partial involves a sum and is compared to within rounding. Not part of the main target; build
+//  and run it with
+//
+//      make check
+//
+//  (see Makefile). Exits with status 1 if any check fails.
+//
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <boost/format.hpp>
+#include "lot.h"
+#include "beagle.h"
+#include "test_support.h"
+
+using namespace strom;
+
+double transitionProbability(const std::vector<double> & matrix, unsigned categ, unsigned from, int to)
+    {
+    // The missing state (4) reads the padding column, which is set to 1
+    return (to == 4 ? 1.0 : matrix[categ*16 + from*4 + to]);
+    }
+
+void checkPartials(Lot::SharedPtr lot, unsigned npatterns, unsigned ncateg)
+    {
+    std::string label = boost::str(boost::format("%d patterns, %d categories") % npatterns % ncateg);
+
+    // Tips 0, 1 and 2; buffer 3 is the cherry (0,1) and buffer 4 joins tip 2 to the cherry
+    BeagleInstanceDetails details;
+    int instance = beagleCreateInstance(3, 2, 3, 4, (int)npatterns, 1, 3, (int)ncateg, 0, NULL, 0, BEAGLE_FLAG_PROCESSOR_CPU, BEAGLE_FLAG_PRECISION_DOUBLE, &details);
+    if (instance < 0)
+        {
+        check(false, boost::str(boost::format("%s: beagleCreateInstance failed with code %d") % label % instance));
+        return;
+        }
+
+    std::vector< std::vector<int> > states(3, std::vector<int>(npatterns));
+    for (unsigned t = 0; t < 3; ++t)
+        {
+        for (unsigned k = 0; k < npatterns; ++k)
+            states[t][k] = lot->randint(0, 4);
+        beagleSetTipStates(instance, (int)t, &states[t][0]);
+        }
+
+    std::vector< std::vector<double> > matrices(3, std::vector<double>(16*ncateg));
+    for (unsigned m = 0; m < 3; ++m)
+        {
+        for (auto & x : matrices[m])
+            x = lot->uniform();
+        beagleSetTransitionMatrix(instance, (int)m, &matrices[m][0], 1.0);
+        }
+
+    BeagleOperation operations[2] = {
+        {3, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 0, 0, 1, 1},
+        {4, BEAGLE_OP_NONE, BEAGLE_OP_NONE, 2, 2, 3, 0}
+        };
+    int code = beagleUpdatePartials(instance, operations, 2, BEAGLE_OP_NONE);
+    check(code == 0, boost::str(boost::format("%s: beagleUpdatePartials failed with code %d") % label % code));
+
+    std::vector<double> cherry(4*npatterns*ncateg);
+    std::vector<double> tip_inner(4*npatterns*ncateg);
+    beagleGetPartials(instance, 3, BEAGLE_OP_NONE, &cherry[0]);
+    beagleGetPartials(instance, 4, BEAGLE_OP_NONE, &tip_inner[0]);
+    beagleFinalizeInstance(instance);
+
+    unsigned cherry_mismatches = 0;
+    unsigned tip_inner_mismatches = 0;
+    for (unsigned l = 0; l < ncateg; ++l)
+        {
+        for (unsigned k = 0; k < npatterns; ++k)
+            {
+            const double * p = &cherry[(l*npatterns + k)*4];
+            const double * q = &tip_inner[(l*npatterns + k)*4];
+            for (unsigned i = 0; i < 4; ++i)
+                {
+                double expected = transitionProbability(matrices[0], l, i, states[0][k])*transitionProbability(matrices[1], l, i, states[1][k]);
+                if (p[i] != expected)
+                    ++cherry_mismatches;
+
+                double sum = 0.0;
+                for (unsigned j = 0; j < 4; ++j)
+                    sum += matrices[0][l*16 + i*4 + j]*p[j];
+                expected = transitionProbability(matrices[2], l, i, states[2][k])*sum;
+                if (std::fabs(q[i] - expected) > 1.0e-14*std::fabs(expected))
+                    ++tip_inner_mismatches;
+                }
+            }
+        }
+    check(cherry_mismatches == 0, boost::str(boost::format("%s: %d cherry partials not bit-identical to the direct products") % label % cherry_mismatches));
+    check(tip_inner_mismatches == 0, boost::str(boost::format("%s: %d tip-inner partials differ from the direct products") % label % tip_inner_mismatches));
+    }
+
+int main(int argc, const char * argv[])
+    {
+    Lot::SharedPtr lot(new Lot());
+    lot->setSeed(1);
+    for (unsigned npatterns : {1, 5, 31, 32, 33, 100, 1000})
+        for (unsigned ncateg : {1, 4})
+            checkPartials(lot, npatterns, ncateg);
+    beagleFinalize();
+
+    return reportChecks("tip table");
+    }
@@ -5,7 +5,9 @@
 #include "tree_summary.h"
 #include "tree.h"
 
-using boost::any_cast;
+// Resolved once when the data are set up, so that evaluate_log_likelihood does no
+// lookup or any_cast on each call.
+static AnyHandle<strom::Data::SharedPtr> sequences;
 
 Data data()
 {
@@ -15,6 +17,7 @@ Data data()
   
   Data data;
   data("sequences") = seq_data;
+  sequences = data.get_any_handle<strom::Data::SharedPtr>("sequences");
   return data;
   /*
   size_t n = 100;
@@ -37,7 +40,9 @@ double evaluate_log_likelihood(const Parameters &inputs, const Data &observed_da
   _tree_summary->readTreefile("/Users/Everitt/Dropbox/projects/stromboli_cpp/stromboli_cpp/rbcLjc.tre", 0);
   strom::Tree::SharedPtr tree = _tree_summary->getTree(0);
   
-  _likelihood->setData(any_cast<strom::Data::SharedPtr>(observed_data("sequences")));
+  if (!sequences.is_resolved())
+    sequences = observed_data.get_any_handle<strom::Data::SharedPtr>("sequences");
+  _likelihood->setData(*sequences);
   return _likelihood->calcLogLikelihood(tree);
   
   //double precision = inputs["tau"][0];
@@ -0,0 +1,152 @@
+//
+//  test_tree_output.cpp
+//
+//  Stand-alone check of the sample output path: TreeManip::saveBinary and TreeManip::loadBinary
+//  must reproduce trees exactly (node numbers, sibling order and edge lengths), including several
+//  trees packed into one buffer, and reject truncated buffers; AsyncWriter must write every
+//  record, in order, whether the producer runs ahead of the writer thread or leaves it idle.
+//  Not part of the main target; build and run it with
+//
+//      make check
+//
+//  (see Makefile). Exits with status 1 if any check fails.
+//
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <boost/format.hpp>
+#include "lot.h"
+#include "tree_manip.h"
+#include "async_writer.h"
+#include "xstrom.h"
+#include "test_support.h"
+
+using namespace strom;
+
+const double strom::Node::_smallest_edge_length = 1.0e-12;
+
+void checkBinaryRoundTrip(Lot::SharedPtr lot)
+    {
+    // Trees of several sizes, rooted and unrooted, saved one after another into a single buffer
+    std::vector<TreeManip::SharedPtr> trees;
+    for (unsigned nleaves : {4, 5, 17, 100})
+        {
+        for (bool rooted : {false, true})
+            {
+            TreeManip::SharedPtr tm(new TreeManip());
+            tm->buildFromNewick(randomNewick(lot, nleaves, 0.1, rooted), rooted, false);
+            trees.push_back(tm);
+            }
+        }
+
+    std::string buffer;
+    for (auto tm : trees)
+        tm->saveBinary(buffer);
+
+    const char * p = buffer.data();
+    const char * end = buffer.data() + buffer.size();
+    for (auto tm : trees)
+        {
+        std::string label = boost::str(boost::format("binary round trip of %s tree with %d leaves") % (tm->getTree()->isRooted() ? "rooted" : "unrooted") % tm->getTree()->numLeaves());
+        try
+            {
+            const char * begin = p;
+            TreeManip copy;
+            copy.loadBinary(p, end);
+            check(copy.getTree()->isRooted() == tm->getTree()->isRooted(), label + ": rootedness differs");
+            check(copy.makeNewick(17) == tm->makeNewick(17), label + ": tree differs");
+
+            // Saving the copy must give the same bytes, so node numbers and sibling order match too
+            std::string again;
+            copy.saveBinary(again);
+            check(again == std::string(begin, p), label + ": node numbers, parents or edge lengths differ");
+            }
+        catch (XStrom & x)
+            {
+            check(false, label + ": " + x.what());
+            return;
+            }
+        }
+    check(p == end, "binary round trip did not consume the whole buffer");
+
+    // A truncated description must be rejected rather than read past its end
+    std::string single;
+    trees[2]->saveBinary(single);
+    for (std::size_t n : {std::size_t(0), std::size_t(3), single.size()/2, single.size() - 1})
+        {
+        bool rejected = false;
+        try
+            {
+            const char * q = single.data();
+            TreeManip copy;
+            copy.loadBinary(q, single.data() + n);
+            }
+        catch (XStrom &)
+            {
+            rejected = true;
+            }
+        check(rejected, boost::str(boost::format("binary tree truncated to %d of %d bytes accepted") % n % single.size()));
+        }
+    }
+
+void checkAsyncWriter(const std::string & filename, unsigned nrecords, unsigned pause_every)
+    {
+    // The producer pauses every pause_every records so that the writer thread keeps going to
+    // sleep and has to be woken again
+    std::string label = boost::str(boost::format("AsyncWriter with %d records, pausing every %d") % nrecords % pause_every);
+        {
+        AsyncWriter writer;
+        writer.open(filename);
+        for (unsigned i = 0; i < nrecords; ++i)
+            {
+            std::string & record = writer.beginRecord();
+            record += std::to_string(i);
+            record += '\n';
+            writer.commitRecord();
+            if (pause_every > 0 && i % pause_every == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        writer.close();
+        }
+
+    std::ifstream inf(filename.c_str());
+    std::string line;
+    unsigned n = 0;
+    bool in_order = true;
+    while (std::getline(inf, line))
+        {
+        if (line != std::to_string(n))
+            in_order = false;
+        ++n;
+        }
+    inf.close();
+    std::remove(filename.c_str());
+    check(n == nrecords, boost::str(boost::format("%s: %d records written") % label % n));
+    check(in_order, label + ": records out of order or corrupted");
+    }
+
+int main(int argc, const char * argv[])
+    {
+    Lot::SharedPtr lot(new Lot());
+    lot->setSeed(1);
+    for (unsigned rep = 0; rep < 20; ++rep)
+        checkBinaryRoundTrip(lot);
+
+    try
+        {
+        checkAsyncWriter("test_tree_output.tmp", 200000, 0);
+        checkAsyncWriter("test_tree_output.tmp", 20000, 100);
+        checkAsyncWriter("test_tree_output.tmp", 2000, 1);
+        }
+    catch (XStrom & x)
+        {
+        check(false, std::string("AsyncWriter: ") + x.what());
+        }
+
+    return reportChecks("tree output");
+    }
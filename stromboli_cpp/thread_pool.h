@@ -0,0 +1,252 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <atomic>
+#include <deque>
+#include <future>
+
+namespace strom
+    {
+
+    class ThreadPool
+        {
+        public:
+                                        ThreadPool(unsigned nthreads = 0);
+                                        ~ThreadPool();
+
+            unsigned                    getNumThreads() const;
+            void                        parallelFor(unsigned n, const std::function<void(unsigned)> & f);
+
+            static unsigned             defaultNumThreads();
+
+        private:
+
+                                        ThreadPool(const ThreadPool &) = delete;
+            ThreadPool &                operator=(const ThreadPool &) = delete;
+
+            void                        workerLoop();
+            void                        runTasks(const std::function<void(unsigned)> * task, unsigned ntasks);
+
+            std::vector<std::thread>    _workers;
+            std::mutex                  _mutex;
+            std::condition_variable     _work_available;
+            std::condition_variable     _work_done;
+
+            // description of the parallelFor call currently being serviced
+            const std::function<void(unsigned)> * _task;
+            unsigned                    _ntasks;
+            std::atomic<unsigned>       _next_task;
+            unsigned                    _nbusy;
+            unsigned                    _generation;
+            bool                        _stopping;
+            std::exception_ptr          _exception;
+
+        public:
+
+            typedef std::shared_ptr< ThreadPool > SharedPtr;
+        };
+
+    // A single background thread that runs submitted jobs one at a time, in the order they were
+    // submitted, handing each result back through a future. Used to overlap one long computation
+    // (e.g. a likelihood evaluation) with work on the calling thread.
+    class TaskRunner
+        {
+        public:
+                                        TaskRunner();
+                                        ~TaskRunner();
+
+            std::future<double>         submit(std::function<double()> job);
+
+        private:
+
+                                        TaskRunner(const TaskRunner &) = delete;
+            TaskRunner &                operator=(const TaskRunner &) = delete;
+
+            void                        runnerLoop();
+
+            std::mutex                  _mutex;
+            std::condition_variable     _job_available;
+            std::deque< std::packaged_task<double()> > _jobs;
+            bool                        _stopping;
+            std::thread                 _runner;
+
+        public:
+
+            typedef std::shared_ptr< TaskRunner > SharedPtr;
+        };
+
+inline unsigned ThreadPool::defaultNumThreads()
+    {
+    unsigned n = std::thread::hardware_concurrency();
+    return (n > 0 ? n : 1);
+    }
+
+inline ThreadPool::ThreadPool(unsigned nthreads) : _task(0), _ntasks(0), _next_task(0), _nbusy(0), _generation(0), _stopping(false)
+    {
+    if (nthreads == 0)
+        nthreads = defaultNumThreads();
+
+    // The calling thread also works through tasks, so only nthreads - 1 helpers are needed
+    for (unsigned i = 1; i < nthreads; ++i)
+        _workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+
+inline ThreadPool::~ThreadPool()
+    {
+        {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        }
+    _work_available.notify_all();
+    for (auto & w : _workers)
+        w.join();
+    }
+
+inline unsigned ThreadPool::getNumThreads() const
+    {
+    return (unsigned)_workers.size() + 1;
+    }
+
+inline void ThreadPool::runTasks(const std::function<void(unsigned)> * task, unsigned ntasks)
+    {
+    // Claim task indices until none remain; the first exception thrown is kept
+    // and rethrown by parallelFor on the calling thread. task and ntasks are copies
+    // taken under _mutex, so later writes to _task and _ntasks cannot race with this
+    unsigned i;
+    while ((i = _next_task.fetch_add(1)) < ntasks)
+        {
+        try
+            {
+            (*task)(i);
+            }
+        catch(...)
+            {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_exception)
+                _exception = std::current_exception();
+            }
+        }
+    }
+
+inline void ThreadPool::workerLoop()
+    {
+    unsigned seen_generation = 0;
+    while (true)
+        {
+        const std::function<void(unsigned)> * task = 0;
+        unsigned ntasks = 0;
+            {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _work_available.wait(lock, [&]{return _stopping || _generation != seen_generation;});
+            if (_stopping)
+                return;
+            seen_generation = _generation;
+            task = _task;
+            ntasks = _ntasks;
+            ++_nbusy;
+            }
+
+        if (task)
+            {
+            runTasks(task, ntasks);
+            }
+
+            {
+            std::lock_guard<std::mutex> lock(_mutex);
+            --_nbusy;
+            }
+        _work_done.notify_all();
+        }
+    }
+
+inline void ThreadPool::parallelFor(unsigned n, const std::function<void(unsigned)> & f)
+    {
+    if (n == 0)
+        return;
+
+    if (_workers.empty() || n == 1)
+        {
+        for (unsigned i = 0; i < n; ++i)
+            f(i);
+        return;
+        }
+
+        {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _task = &f;
+        _ntasks = n;
+        _next_task = 0;
+        _exception = nullptr;
+        ++_generation;
+        }
+    _work_available.notify_all();
+
+    runTasks(&f, n);
+
+    std::exception_ptr e;
+        {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _work_done.wait(lock, [&]{return _nbusy == 0;});
+        _task = 0;
+        _ntasks = 0;
+        e = _exception;
+        _exception = nullptr;
+        }
+
+    if (e)
+        std::rethrow_exception(e);
+    }
+
+inline TaskRunner::TaskRunner() : _stopping(false)
+    {
+    _runner = std::thread(&TaskRunner::runnerLoop, this);
+    }
+
+inline TaskRunner::~TaskRunner()
+    {
+    // Jobs already submitted are finished before the thread exits
+        {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        }
+    _job_available.notify_one();
+    _runner.join();
+    }
+
+inline std::future<double> TaskRunner::submit(std::function<double()> job)
+    {
+    std::packaged_task<double()> task(std::move(job));
+    std::future<double> result = task.get_future();
+        {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(std::move(task));
+        }
+    _job_available.notify_one();
+    return result;
+    }
+
+inline void TaskRunner::runnerLoop()
+    {
+    while (true)
+        {
+        std::packaged_task<double()> task;
+            {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _job_available.wait(lock, [&]{return _stopping || !_jobs.empty();});
+            if (_jobs.empty())
+                return;
+            task = std::move(_jobs.front());
+            _jobs.pop_front();
+            }
+        // An exception thrown by the job is stored in the future
+        task();
+        }
+    }
+
+    }
@@ -10,6 +10,8 @@ namespace strom
     class TreeManip;
     class Likelihood;
     class Updater;
+    class Simulator;
+    class MissingDataMask;
 
     class Tree
         {
@@ -17,6 +19,8 @@ namespace strom
         friend class TreeManip;
         friend class Likelihood;
         friend class Updater;
+        friend class Simulator;
+        friend class MissingDataMask;
 
         public:
 
@@ -7,9 +7,13 @@
 #include <boost/format.hpp>
 #include <queue>
 #include <set>
-#include <regex>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <boost/range/adaptor/reversed.hpp>
 #include "tree.h"
+#include "lot.h"
+#include "serialization.h"
 #include "xstrom.h"
 
 namespace strom
@@ -26,11 +30,19 @@ namespace strom
             Tree::SharedPtr             getTree();
             double                      calcTreeLength() const;
             void                        scaleAllEdgeLengths(double scaler);
+            void                        calcNodeHeights(std::vector<double> & heights) const;
+            void                        getNodesByNumber(Node::PtrVector & nodes) const;
+            void                        getLeafNumbersInPreorder(std::vector<unsigned> & leaves) const;
             void                        createTestTree();
+            void                        buildRandomTree(unsigned nleaves, Lot::SharedPtr lot, double mean_edge_length);
             void                        clear();
 
             std::string                 makeNewick(unsigned precision) const;
-            void                        buildFromNewick(const std::string newick, bool rooted, bool allow_polytomies);
+            void                        appendNewick(std::string & newick, unsigned precision) const;
+            void                        saveBinary(std::string & buffer) const;
+            void                        loadBinary(const char * & p, const char * end);
+            void                        buildFromNewick(const std::string & newick, bool rooted, bool allow_polytomies);
+            void                        buildFromNewick(const char * newick_begin, const char * newick_end, bool rooted, bool allow_polytomies);
             void                        storeSplits(std::set<Split> & splitset);
             void                        rerootAt(int node_index);
 
@@ -42,13 +54,12 @@ namespace strom
             void                        refreshPreorder();
             void                        refreshLevelorder();
             void                        rerootHelper(Node * m, Node * t);
-            void                        extractNodeNumberFromName(Node * nd, std::set<unsigned> & used);
-            void                        extractEdgeLen(Node * nd, std::string edge_length_string);
-            unsigned                    countNewickLeaves(const std::string newick);
-            void                        stripOutNexusComments(std::string & newick);
             bool                        canHaveSibling(Node * nd, bool rooted, bool allow_polytomies);
+            void                        prepareTreeStorage(unsigned nleaves, bool rooted);
+            void                        setLeafNumber(Node * nd, const char * name_begin, const char * name_end);
 
             Tree::SharedPtr             _tree;
+            std::vector<bool>           _leaf_number_used;
 
         public:
 
@@ -107,6 +118,47 @@ inline void TreeManip::scaleAllEdgeLengths(double scaler)
         }
     }
 
+inline void TreeManip::calcNodeHeights(std::vector<double> & heights) const
+    {
+    // Height above the leaves (all at height 0) of every node, indexed by node number. An
+    // internal node's height is taken from its highest child so that small departures from
+    // ultrametricity cannot make an edge negative. The root node gets the height of its child.
+    if (!_tree->_is_rooted)
+        throw XStrom("Node heights are only defined for rooted trees");
+    heights.assign(_tree->_nodes.size(), 0.0);
+    for (auto nd : boost::adaptors::reverse(_tree->_preorder))
+        {
+        double h = heights[nd->_number] + nd->_edge_length;
+        double & parent_height = heights[nd->_parent->_number];
+        if (nd->_parent != _tree->_root && h > parent_height)
+            parent_height = h;
+        }
+    heights[_tree->_root->_number] = heights[_tree->_root->_left_child->_number];
+    }
+
+inline void TreeManip::getNodesByNumber(Node::PtrVector & nodes) const
+    {
+    nodes.assign(_tree->_nodes.size(), 0);
+    for (auto & nd : _tree->_nodes)
+        {
+        if (nd._number >= 0)
+            nodes[nd._number] = &nd;
+        }
+    }
+
+inline void TreeManip::getLeafNumbersInPreorder(std::vector<unsigned> & leaves) const
+    {
+    // Leaves of each clade are adjacent; in an unrooted tree the root (leaf 0) comes first
+    leaves.clear();
+    if (!_tree->_is_rooted)
+        leaves.push_back((unsigned)_tree->_root->_number);
+    for (auto nd : _tree->_preorder)
+        {
+        if (!nd->_left_child)
+            leaves.push_back((unsigned)nd->_number);
+        }
+    }
+
 inline void TreeManip::createTestTree()
     {
     clear();
@@ -198,134 +250,199 @@ inline void TreeManip::createTestTree()
     _tree->_levelorder.push_back(second_leaf);
 }
 
+inline void TreeManip::buildRandomTree(unsigned nleaves, Lot::SharedPtr lot, double mean_edge_length)
+    {
+    // Unrooted binary tree built by repeatedly joining two randomly chosen subtrees until three
+    // remain; edge lengths are drawn from an exponential distribution with the given mean
+    if (nleaves < 4)
+        throw XStrom("buildRandomTree requires at least 4 leaves");
+    assert(lot);
+
+    auto edgeLength = [&]()
+        {
+        double v = lot->gamma(1.0, mean_edge_length);
+        return (v < 1.0e-6 ? 1.0e-6 : v);
+        };
+
+    std::vector<std::string> subtrees(nleaves);
+    for (unsigned i = 0; i < nleaves; ++i)
+        appendUnsigned(subtrees[i], i + 1);
+
+    while (subtrees.size() > 3)
+        {
+        unsigned n = (unsigned)subtrees.size();
+        unsigned a = (unsigned)lot->randint(0, n - 1);
+        unsigned b = (unsigned)lot->randint(0, n - 2);
+        if (b >= a)
+            ++b;
+
+        std::string joined = "(";
+        joined += subtrees[a] + ":";
+        appendFixed(joined, edgeLength(), 8);
+        joined += "," + subtrees[b] + ":";
+        appendFixed(joined, edgeLength(), 8);
+        joined += ")";
+
+        // Replace a with the new subtree and remove b
+        subtrees[a].swap(joined);
+        subtrees[b].swap(subtrees.back());
+        subtrees.pop_back();
+        }
+
+    std::string newick = "(";
+    for (unsigned i = 0; i < 3; ++i)
+        {
+        newick += subtrees[i] + ":";
+        appendFixed(newick, edgeLength(), 8);
+        newick += (i < 2 ? "," : ")");
+        }
+
+    buildFromNewick(newick, false, false);
+    }
+
 inline std::string TreeManip::makeNewick(unsigned precision) const
 	{
     std::string newick;
-    const boost::format tip_node_format( boost::str(boost::format("%%d:%%.%df") % precision) );
-    const boost::format internal_node_format( boost::str(boost::format("):%%.%df") % precision) );
-    std::stack<Node *> node_stack;
+    appendNewick(newick, precision);
+    return newick;
+    }
+
+inline void TreeManip::appendNewick(std::string & newick, unsigned precision) const
+    {
+    // Appends the same description that makeNewick has always produced, formatting numbers
+    // directly into newick rather than through boost::format
+    std::vector<Node *> node_stack;
+    node_stack.reserve(_tree->_nleaves);
 
     Node * root_tip = (_tree->_is_rooted ? 0 : _tree->_root);
     for (auto nd : _tree->_preorder)
         {
         if (nd->_left_child)
             {
-            newick += "(";
-            node_stack.push(nd);
+            newick += '(';
+            node_stack.push_back(nd);
             if (root_tip)
                 {
-                newick += boost::str(boost::format(tip_node_format) % (root_tip->_number + 1) % nd->_edge_length);
-                newick += ",";
+                appendUnsigned(newick, root_tip->_number + 1);
+                newick += ':';
+                appendFixed(newick, nd->_edge_length, precision);
+                newick += ',';
                 root_tip = 0;
                 }
             }
         else
             {
-            newick += boost::str(boost::format(tip_node_format) % (nd->_number + 1) % nd->_edge_length);
+            appendUnsigned(newick, nd->_number + 1);
+            newick += ':';
+            appendFixed(newick, nd->_edge_length, precision);
             if (nd->_right_sib)
-                newick += ",";
+                newick += ',';
             else
                 {
-                Node * popped = (node_stack.empty() ? 0 : node_stack.top());
+                Node * popped = (node_stack.empty() ? 0 : node_stack.back());
                 while (popped && !popped->_right_sib)
                     {
-                    node_stack.pop();
+                    node_stack.pop_back();
                     if (node_stack.empty())
                         {
-                        newick += ")";
+                        newick += ')';
                         popped = 0;
                         }
                     else
                         {
-                        newick += boost::str(boost::format(internal_node_format) % popped->_edge_length);
-                        popped = node_stack.top();
+                        newick += "):";
+                        appendFixed(newick, popped->_edge_length, precision);
+                        popped = node_stack.back();
                         }
                     }
                 if (popped && popped->_right_sib)
                     {
-                    node_stack.pop();
-                    newick += boost::str(boost::format(internal_node_format) % popped->_edge_length);
-                    newick += ",";
+                    node_stack.pop_back();
+                    newick += "):";
+                    appendFixed(newick, popped->_edge_length, precision);
+                    newick += ',';
                     }
                 }
             }
         }
-
-    return newick;
     }
 
-inline void TreeManip::extractNodeNumberFromName(Node * nd, std::set<unsigned> & used)
+inline void TreeManip::saveBinary(std::string & buffer) const
     {
-    assert(nd);
-    bool success = true;
-    unsigned x = 0;
-    try
-        {
-        x = std::stoi(nd->_name);
-        }
-    catch(std::invalid_argument &)
+    // Layout: number of leaves, rooted flag, number of nodes, root node number, then for each
+    // node in preorder its number, the preorder index of its parent (-1 if the parent is the
+    // root) and its edge length. Internal node numbers are recreated by refreshPreorder.
+    assert(_tree);
+    appendBinary(buffer, (std::uint32_t)_tree->_nleaves);
+    appendBinary(buffer, (std::uint8_t)(_tree->_is_rooted ? 1 : 0));
+    appendBinary(buffer, (std::uint32_t)_tree->_nodes.size());
+    appendBinary(buffer, (std::int32_t)_tree->_root->_number);
+    appendBinary(buffer, (std::uint32_t)_tree->_preorder.size());
+
+    // Preorder index of each node is found via a scratch vector indexed by node number
+    std::vector<std::int32_t> preorder_index(_tree->_nodes.size(), -1);
+    std::int32_t i = 0;
+    for (auto nd : _tree->_preorder)
         {
-        // node name could not be converted to an integer value
-        success = false;
+        preorder_index[nd->_number] = i++;
+        std::int32_t parent = (nd->_parent == _tree->_root ? -1 : preorder_index[nd->_parent->_number]);
+        appendBinary(buffer, (std::int32_t)nd->_number);
+        appendBinary(buffer, parent);
+        appendBinary(buffer, nd->_edge_length);
         }
+    }
 
-    if (success)
+inline void TreeManip::loadBinary(const char * & p, const char * end)
+    {
+    std::uint32_t nleaves = 0;
+    std::uint8_t rooted = 0;
+    std::uint32_t nnodes = 0;
+    std::int32_t root_number = 0;
+    std::uint32_t npreorder = 0;
+    readBinary(p, end, nleaves);
+    readBinary(p, end, rooted);
+    readBinary(p, end, nnodes);
+    readBinary(p, end, root_number);
+    readBinary(p, end, npreorder);
+    if (nleaves < 2 || nnodes != 2*nleaves - (rooted ? 0 : 2) || npreorder + 1 != nnodes)
+        throw XStrom("Binary tree description is inconsistent");
+
+    prepareTreeStorage(nleaves, rooted != 0);
+
+    // Node 0 of the vector becomes the root; the others are filled in preorder, so appending each
+    // node as the rightmost child of its parent restores the original sibling order
+    Node * root = &_tree->_nodes[0];
+    root->_number = root_number;
+    _tree->_root = root;
+    for (std::uint32_t i = 0; i < npreorder; ++i)
         {
-        // conversion succeeded
-        // attempt to insert x into the set of node numbers altready used
-        std::pair<std::set<unsigned>::iterator, bool> insert_result = used.insert(x);
-        if (insert_result.second)
-            {
-            // insertion was made, so x has NOT already been used
-            nd->_number = x - 1;
-            }
+        std::int32_t number = 0;
+        std::int32_t parent_index = 0;
+        double edge_length = 0.0;
+        readBinary(p, end, number);
+        readBinary(p, end, parent_index);
+        readBinary(p, end, edge_length);
+        if (parent_index < -1 || parent_index >= (std::int32_t)i)
+            throw XStrom("Binary tree description is inconsistent");
+
+        Node * nd = &_tree->_nodes[i + 1];
+        Node * parent = (parent_index < 0 ? root : &_tree->_nodes[parent_index + 1]);
+        nd->_number = number;
+        nd->_edge_length = edge_length;
+        nd->_parent = parent;
+        if (!parent->_left_child)
+            parent->_left_child = nd;
         else
             {
-            // insertion was not made, so set already contained x
-            throw XStrom(boost::str(boost::format("leaf number %d used more than once") % x));
+            Node * sib = parent->_left_child;
+            while (sib->_right_sib)
+                sib = sib->_right_sib;
+            sib->_right_sib = nd;
             }
         }
-    else
-        throw XStrom(boost::str(boost::format("node name (%s) not interpretable as a positive integer") % nd->_name));
-    }
-
-inline void TreeManip::extractEdgeLen(Node * nd, std::string edge_length_string)
-    {
-    assert(nd);
-    bool success = true;
-    double d = 0.0;
-    try
-        {
-        d = std::stof(edge_length_string);
-        }
-    catch(std::invalid_argument &)
-        {
-        // edge_length_string could not be converted to a double value
-        success = false;
-        }
 
-    if (success)
-        {
-        // conversion succeeded
-        nd->_edge_length = (d < 0.0 ? 0.0 : d);
-        }
-    else
-        throw XStrom(boost::str(boost::format("%s is not interpretable as an edge length") % edge_length_string));
-
-    }
-
-inline unsigned TreeManip::countNewickLeaves(const std::string newick)
-    {
-    std::regex taxonexpr("[(,]\\s*(\\d+|\\S+?|['].+?['])\\s*(?=[,):])");
-    std::sregex_iterator m1(newick.begin(), newick.end(), taxonexpr);
-    std::sregex_iterator m2;
-    return (unsigned)std::distance(m1, m2);
-    }
-
-inline void TreeManip::stripOutNexusComments(std::string & newick)
-    {
-    std::regex commentexpr("\\[.*?\\]");
-    newick = std::regex_replace(newick, commentexpr, std::string(""));
+    refreshPreorder();
+    refreshLevelorder();
     }
 
 inline void TreeManip::refreshPreorder()
@@ -646,34 +763,87 @@ inline void TreeManip::rerootHelper(Node * m, Node * t)
         }
     }
 
-inline void TreeManip::buildFromNewick(const std::string newick, bool rooted, bool allow_polytomies)
+inline void TreeManip::prepareTreeStorage(unsigned nleaves, bool rooted)
     {
-    clear();
-    _tree.reset(new Tree());
+    // Reuse the existing tree (and the memory held by its nodes) unless someone else also holds it
+    if (!_tree || _tree.use_count() > 1)
+        _tree.reset(new Tree());
+
     _tree->_is_rooted = rooted;
+    _tree->_root = 0;
+    _tree->_nleaves = nleaves;
+    _tree->_preorder.clear();
+    _tree->_levelorder.clear();
 
-    std::set<unsigned> used; // used to ensure that two tips do not have the same number
-    unsigned curr_leaf = 0;
+    unsigned max_nodes = 2*nleaves - (rooted ? 0 : 2);
+    _tree->_nodes.resize(max_nodes);
+
+    // Assign all nodes a default node number that is negative to make it easy to tell if we've not set it
+    for (auto & nd : _tree->_nodes)
+        {
+        nd.clear();
+        nd._number = -1;
+        }
+
+    _leaf_number_used.assign(nleaves, false);
+    }
 
-    std::string commentless_newick = newick;
-    stripOutNexusComments(commentless_newick);
+inline void TreeManip::setLeafNumber(Node * nd, const char * name_begin, const char * name_end)
+    {
+    // Interpret the leading digits of the name as a 1-based leaf number (as std::stoi would)
+    const char * p = name_begin;
+    while (p < name_end && isspace((unsigned char)*p))
+        ++p;
+    if (p < name_end && *p == '+')
+        ++p;
+    unsigned x = 0;
+    const char * digits_begin = p;
+    while (p < name_end && isdigit((unsigned char)*p))
+        x = 10*x + (unsigned)(*p++ - '0');
+
+    if (p == digits_begin || x == 0)
+        throw XStrom(boost::str(boost::format("node name (%s) not interpretable as a positive integer") % std::string(name_begin, name_end)));
+    if (x > _tree->_nleaves)
+        throw XStrom(boost::str(boost::format("leaf number %d exceeds the number of leaves (%d)") % x % _tree->_nleaves));
+    if (_leaf_number_used[x - 1])
+        throw XStrom(boost::str(boost::format("leaf number %d used more than once") % x));
+
+    _leaf_number_used[x - 1] = true;
+    nd->_number = x - 1;
+    }
+
+inline void TreeManip::buildFromNewick(const std::string & newick, bool rooted, bool allow_polytomies)
+    {
+    buildFromNewick(newick.data(), newick.data() + newick.size(), rooted, allow_polytomies);
+    }
 
-    _tree->_nleaves = countNewickLeaves(commentless_newick);
-    if (_tree->_nleaves == 0)
+inline void TreeManip::buildFromNewick(const char * newick_begin, const char * newick_end, bool rooted, bool allow_polytomies)
+    {
+    // Single pass over the characters that builds the tree directly into the (reused) node vector.
+    // A prior scan counts the leaves, which is one more than the number of commas outside of
+    // comments and quoted names.
+    unsigned ncommas = 0;
+    for (const char * p = newick_begin; p < newick_end; ++p)
+        {
+        if (*p == ',')
+            ++ncommas;
+        else if (*p == '[' || *p == '\'')
+            {
+            const char * q = (const char *)std::memchr(p + 1, (*p == '[' ? ']' : '\''), newick_end - p - 1);
+            p = (q ? q : newick_end - 1);
+            }
+        }
+    if (ncommas == 0)
+        {
+        clear();
         throw XStrom("Expecting newick tree description to have at least 4 leaves");
-    unsigned max_nodes = 2*_tree->_nleaves - (_tree->_is_rooted ? 0 : 2);
-    _tree->_nodes.resize(max_nodes);
+        }
 
-    // Assign all nodes a default node number that is negative to make it easy to tell if we've not set it
-    // (leaves will replace this number with the number equivalent of their name, internal nodes will replace
-    // this number with a number higher than any leaf)
-    for (unsigned i = 0; i < max_nodes; ++i)
-        _tree->_nodes[i]._number = -1;
+    prepareTreeStorage(ncommas + 1, rooted);
 
     // This will point to the first tip node encountered so that we can reroot at this node before returning
     Node * first_tip = 0;
-
-    unsigned num_edge_lengths = 0;
+    unsigned curr_leaf = 0;
     unsigned curr_node_index = 0;
 
     try
@@ -707,102 +877,30 @@ inline void TreeManip::buildFromNewick(const std::string newick, bool rooted, bo
         unsigned Colon_Valid  = (Prev_Tok_RParen | Prev_Tok_Name);
         unsigned Name_Valid   = (Prev_Tok_RParen | Prev_Tok_LParen | Prev_Tok_Comma);
 
-        // Set to true while reading an edge length
-        bool inside_edge_length = false;
-        std::string edge_length_str;
-        unsigned edge_length_position = 0;
-
-        // Set to true while reading a node name surrounded by (single) quotes
-        bool inside_quoted_name = false;
-
-        // Set to true while reading a node name not surrounded by (single) quotes
-        bool inside_unquoted_name = false;
-
-        // Set to start of each node name and used in case of error
-        unsigned node_name_position = 0;
-
-        // loop through the characters in newick, building up tree as we go
-        unsigned position_in_string = 0;
-        for (auto ch : commentless_newick)
+        const char * p = newick_begin;
+        while (p < newick_end)
             {
-            position_in_string++;
+            char ch = *p;
+            unsigned position_in_string = (unsigned)(p - newick_begin) + 1;
 
-            if (inside_quoted_name)
+            if (isspace((unsigned char)ch))
                 {
-                if (ch == '\'')
-                    {
-                    inside_quoted_name = false;
-                    node_name_position = 0;
-                    if (!nd->_left_child)
-                        {
-                        extractNodeNumberFromName(nd, used);
-                        curr_leaf++;
-                        if (!first_tip)
-                            first_tip = nd;
-                        }
-                    previous = Prev_Tok_Name;
-                    }
-                else if (iswspace(ch))
-                    nd->_name += ' ';
-                else
-                    nd->_name += ch;
-
+                ++p;
                 continue;
                 }
-            else if (inside_unquoted_name)
-                {
-                if (ch == '(')
-                    throw XStrom(boost::str(boost::format("Unexpected left parenthesis inside node name at position %d in tree description") % node_name_position));
-
-                if (iswspace(ch) || ch == ':' || ch == ',' || ch == ')')
-                    {
-                    inside_unquoted_name = false;
-
-                    // Expect node name only after a left paren (child's name), a comma (sib's name) or a right paren (parent's name)
-                    if (!(previous & Name_Valid))
-                        throw XStrom(boost::str(boost::format("Unexpected node name (%s) at position %d in tree description") % nd->_name % node_name_position));
-
-                    if (!nd->_left_child)
-                        {
-                        extractNodeNumberFromName(nd, used);
-                        curr_leaf++;
-                        if (!first_tip)
-                            first_tip = nd;
-                        }
 
-                    previous = Prev_Tok_Name;
-                    }
-                else
-                    {
-                    nd->_name += ch;
-                    continue;
-                    }
-                }
-            else if (inside_edge_length)
+            switch(ch)
                 {
-                if (ch == ',' || ch == ')' || iswspace(ch))
+                case '[':
                     {
-                    inside_edge_length = false;
-                    edge_length_position = 0;
-                    extractEdgeLen(nd, edge_length_str);
-                    ++num_edge_lengths;
-                    previous = Prev_Tok_EdgeLen;
-                    }
-                else
-                    {
-                    bool valid = (ch =='e' || ch == 'E' || ch =='.' || ch == '-' || ch == '+' || isdigit(ch));
-                    if (!valid)
-                        throw XStrom(boost::str(boost::format("Invalid branch length character (%c) at position %d in tree description") % ch % position_in_string));
-                    edge_length_str += ch;
+                    // Skip over comment
+                    const char * q = (const char *)std::memchr(p, ']', newick_end - p);
+                    if (!q)
+                        throw XStrom(boost::str(boost::format("Unterminated comment starting at position %d in tree description") % position_in_string));
+                    p = q + 1;
                     continue;
                     }
-                }
 
-            if (iswspace(ch))
-                continue;
-
-            switch(ch)
-                {
                 case ';':
                     break;
 
@@ -836,7 +934,7 @@ inline void TreeManip::buildFromNewick(const std::string newick, bool rooted, bo
 
                     // Check for polytomies
                     if (!canHaveSibling(nd, rooted, allow_polytomies))
-                        throw XStrom(boost::str(boost::format("Polytomy found in the following tree description but polytomies prohibited:\n%s") % newick));
+                        throw XStrom(boost::str(boost::format("Polytomy found in the following tree description but polytomies prohibited:\n%s") % std::string(newick_begin, newick_end)));
 
                     // Create the sibling
                     curr_node_index++;
@@ -865,6 +963,7 @@ inline void TreeManip::buildFromNewick(const std::string newick, bool rooted, bo
                     break;
 
                 case '\'':
+                    {
                     // Encountered an apostrophe, which always indicates the start of a
                     // node name (but note that node names do not have to be quoted)
 
@@ -873,43 +972,94 @@ inline void TreeManip::buildFromNewick(const std::string newick, bool rooted, bo
                     if (!(previous & Name_Valid))
                         throw XStrom(boost::str(boost::format("Not expecting node name at position %d in tree description") % position_in_string));
 
-                    // Get the rest of the name
-                    nd->_name.clear();
+                    const char * name_begin = p + 1;
+                    const char * name_end = (const char *)std::memchr(name_begin, '\'', newick_end - name_begin);
+                    if (!name_end)
+                        throw XStrom(boost::str(boost::format("Expecting single quote to mark the end of node name at position %d in tree description") % position_in_string));
 
-                    inside_quoted_name = true;
-                    node_name_position = position_in_string;
-
-                    break;
+                    nd->_name.assign(name_begin, name_end);
+                    for (auto & c : nd->_name)
+                        if (isspace((unsigned char)c))
+                            c = ' ';
+                    if (!nd->_left_child)
+                        {
+                        setLeafNumber(nd, name_begin, name_end);
+                        curr_leaf++;
+                        if (!first_tip)
+                            first_tip = nd;
+                        }
+                    previous = Prev_Tok_Name;
+                    p = name_end + 1;
+                    continue;
+                    }
 
                 default:
-                    // Get here if ch is not one of ();:,'
+                    // Get here if ch is not one of ();:,'[
 
                     // Expecting either an edge length or an unquoted node name
                     if (previous == Prev_Tok_Colon)
                         {
                         // Edge length expected (e.g. "235", "0.12345", "1.7e-3")
-                        inside_edge_length = true;
-                        edge_length_position = position_in_string;
-                        edge_length_str = ch;
+                        const char * q = p;
+                        while (q < newick_end && (isdigit((unsigned char)*q) || *q == '.' || *q == 'e' || *q == 'E' || *q == '-' || *q == '+'))
+                            ++q;
+                        if (q == newick_end)
+                            throw XStrom(boost::str(boost::format("Tree description ended before end of edge length starting at position %d was found") % position_in_string));
+                        if (!(*q == ',' || *q == ')' || *q == '[' || *q == ';' || isspace((unsigned char)*q)))
+                            throw XStrom(boost::str(boost::format("Invalid branch length character (%c) at position %d in tree description") % *q % (unsigned)(q - newick_begin + 1)));
+
+                        // Copy into a null-terminated buffer on the stack so that strtod cannot
+                        // read beyond the end of the description
+                        char buffer[64];
+                        std::size_t len = (std::size_t)(q - p);
+                        char * endptr = buffer;
+                        double d = 0.0;
+                        if (len > 0 && len < sizeof(buffer))
+                            {
+                            std::memcpy(buffer, p, len);
+                            buffer[len] = '\0';
+                            d = std::strtod(buffer, &endptr);
+                            }
+                        if (endptr != buffer + len || len == 0)
+                            throw XStrom(boost::str(boost::format("%s is not interpretable as an edge length") % std::string(p, q)));
+                        nd->_edge_length = (d < 0.0 ? 0.0 : d);
+                        previous = Prev_Tok_EdgeLen;
+                        p = q;
                         }
                     else
                         {
-                        // Get the node name
-                        nd->_name = ch;
-
-                        inside_unquoted_name = true;
-                        node_name_position = position_in_string;
+                        // Expect node name only after a left paren (child's name), a comma (sib's name) or a right paren (parent's name)
+                        const char * q = p;
+                        while (q < newick_end && !(isspace((unsigned char)*q) || *q == ':' || *q == ',' || *q == ')' || *q == ';' || *q == '['))
+                            {
+                            if (*q == '(')
+                                throw XStrom(boost::str(boost::format("Unexpected left parenthesis inside node name at position %d in tree description") % position_in_string));
+                            ++q;
+                            }
+                        if (q == newick_end)
+                            throw XStrom(boost::str(boost::format("Tree description ended before end of node name starting at position %d was found") % position_in_string));
+                        if (!(previous & Name_Valid))
+                            throw XStrom(boost::str(boost::format("Unexpected node name (%s) at position %d in tree description") % std::string(p, q) % position_in_string));
+
+                        nd->_name.assign(p, q);
+                        if (!nd->_left_child)
+                            {
+                            setLeafNumber(nd, p, q);
+                            curr_leaf++;
+                            if (!first_tip)
+                                first_tip = nd;
+                            }
+                        previous = Prev_Tok_Name;
+                        p = q;
                         }
+                    continue;
 
                 }   // end of switch statement
-            }   // loop over characters in newick string
+            ++p;
+            }   // loop over characters in newick
 
-        if (inside_unquoted_name)
-            throw XStrom(boost::str(boost::format("Tree description ended before end of node name starting at position %d was found") % node_name_position));
-        if (inside_edge_length)
-            throw XStrom(boost::str(boost::format("Tree description ended before end of edge length starting at position %d was found") % edge_length_position));
-        if (inside_quoted_name)
-            throw XStrom(boost::str(boost::format("Expecting single quote to mark the end of node name at position %d in tree description") % node_name_position));
+        if (curr_leaf != _tree->_nleaves)
+            throw XStrom(boost::str(boost::format("Expecting %d named leaves in tree description but found %d") % _tree->_nleaves % curr_leaf));
 
         if (!_tree->_is_rooted)
             {
@@ -920,12 +1070,11 @@ inline void TreeManip::buildFromNewick(const std::string newick, bool rooted, bo
         refreshPreorder();
         refreshLevelorder();
         }
-    catch(XStrom x)
+    catch(XStrom & x)
         {
         clear();
         throw x;
         }
-
     }
 
 inline void TreeManip::storeSplits(std::set<Split> & splitset)
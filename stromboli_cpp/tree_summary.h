@@ -6,10 +6,14 @@
 #include <fstream>
 #include <cassert>
 #include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <boost/format.hpp>
 #include <boost/range/adaptor/reversed.hpp>
 #include "split.h"
 #include "tree_manip.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
 #include "xstrom.h"
 
 #include "nxsmultiformat.h"
@@ -28,18 +32,29 @@ namespace strom
             typedef std::vector<sorted_pair_t>          sorted_vect_t;  //POLPWK
 
             void                        readTreefile(const std::string filename, unsigned skip);
+            void                        readTreefileStreaming(const std::string filename, unsigned skip, unsigned nthreads = 0, unsigned batch_size = 10000);
             void                        showSummary() const;
             unsigned                    getNumStoredTrees() const;  //POLPWK
             void                        sortTrees(sorted_vect_t & sorted_trees) const; //POLPWK
+            Split::treemap_t &          getTreeIDMap(); //POLPWK
             Tree::SharedPtr             getTree(unsigned index);
             std::string                 getNewick(unsigned index);
             void                        clear();
 
         private:
 
+            typedef std::pair<std::size_t, std::size_t> extent_t;   // (offset, length) of a newick string in _mapped_treefile
+
+            void                        scanTreeStatements(unsigned skip);
+            void                        addSplitset(Split::treeid_t & splitset, unsigned tree_index);
+
             Split::treemap_t            _treeIDs;
             std::vector<std::string>    _newicks;
 
+            // used instead of _newicks when trees were read by readTreefileStreaming
+            MappedFile::SharedPtr       _mapped_treefile;
+            std::vector<extent_t>       _newick_extents;
+
         };
 
 inline TreeSummary::TreeSummary()
@@ -54,7 +69,7 @@ inline TreeSummary::~TreeSummary()
 
 inline unsigned TreeSummary::getNumStoredTrees() const  //POLPWK
     {
-    return (unsigned)_newicks.size();
+    return (unsigned)(_newicks.size() + _newick_extents.size());
     }
 
 inline void TreeSummary::sortTrees(sorted_vect_t & sorted_trees) const  //POLPWK
@@ -70,31 +85,64 @@ inline void TreeSummary::sortTrees(sorted_vect_t & sorted_trees) const  //POLPWK
     std::sort(sorted_trees.begin(), sorted_trees.end());
     }
 
+inline Split::treemap_t & TreeSummary::getTreeIDMap()  //POLPWK
+    {
+    // Maps each sampled topology to the indices of the stored trees having it
+    return _treeIDs;
+    }
+
 inline Tree::SharedPtr TreeSummary::getTree(unsigned index)
     {
-    if (index >= _newicks.size())
+    if (index >= getNumStoredTrees())
         throw XStrom("getTree called with index >= number of stored trees");
 
     TreeManip tm;
 
     // build the tree
-    tm.buildFromNewick(_newicks[index], false, false);
+    tm.buildFromNewick(getNewick(index), false, false);
 
     return tm.getTree();
     }
 
 inline std::string TreeSummary::getNewick(unsigned index)
     {
-    if (index >= _newicks.size())
+    if (index >= getNumStoredTrees())
         throw XStrom("getNewick called with index >= number of stored trees");
 
-        return _newicks[index];
+    if (!_newick_extents.empty())
+        {
+        const extent_t & e = _newick_extents[index];
+        return std::string(_mapped_treefile->begin() + e.first, e.second);
+        }
+
+    return _newicks[index];
     }
 
 inline void TreeSummary::clear()
     {
     _treeIDs.clear();
     _newicks.clear();
+    _newick_extents.clear();
+    _mapped_treefile.reset();
+    }
+
+inline void TreeSummary::addSplitset(Split::treeid_t & splitset, unsigned tree_index)
+    {
+    // iterator iter will point to the value corresponding to key splitset
+    // or to end (if splitset is not already a key in the map)
+    Split::treemap_t::iterator iter = _treeIDs.lower_bound(splitset);
+
+    if (iter == _treeIDs.end() || iter->first != splitset)
+        {
+        // splitset key not found in map, need to create an entry
+        std::vector<unsigned> v(1, tree_index);  // vector of length 1 with only element set to tree_index
+        _treeIDs.insert(iter, Split::treemap_t::value_type(std::move(splitset), v));
+        }
+    else
+        {
+        // splitset key was found in map, need to add this tree's index to vector
+        iter->second.push_back(tree_index);
+        }
     }
 
 inline void TreeSummary::readTreefile(const std::string filename, unsigned skip)
@@ -144,22 +192,7 @@ inline void TreeSummary::readTreefile(const std::string filename, unsigned skip)
                     // store set of splits
                     splitset.clear();
                     tm.storeSplits(splitset);
-
-                    // iterator iter will point to the value corresponding to key splitset
-                    // or to end (if splitset is not already a key in the map)
-                    Split::treemap_t::iterator iter = _treeIDs.lower_bound(splitset);
-
-                    if (iter == _treeIDs.end() || iter->first != splitset)
-                        {
-                        // splitset key not found in map, need to create an entry
-                        std::vector<unsigned> v(1, tree_index);  // vector of length 1 with only element set to tree_index
-                        _treeIDs.insert(iter, Split::treemap_t::value_type(splitset, v));
-                        }
-                    else
-                        {
-                        // splitset key was found in map, need to add this tree's index to vector
-                        iter->second.push_back(tree_index);
-                        }
+                    addSplitset(splitset, tree_index);
                     } // trees loop
                 } // if skip < ntrees
             } // TREES block loop
@@ -169,10 +202,202 @@ inline void TreeSummary::readTreefile(const std::string filename, unsigned skip)
     nexusReader.DeleteBlocksFromFactories();
     }
 
+inline void TreeSummary::readTreefileStreaming(const std::string filename, unsigned skip, unsigned nthreads, unsigned batch_size)
+    {
+    // Unlike readTreefile, this version never holds the parsed trees block in memory. The file is
+    // memory-mapped, tree statements are located by a light-weight scan (burn-in trees are skipped
+    // without being parsed), and only the offset and length of each retained newick description
+    // is stored. Split sets are then computed batch by batch on a pool of worker threads, so at
+    // most batch_size split sets exist at any one time beyond the unique topologies in _treeIDs.
+    // Leaf names must be the taxon numbers (as is always the case when a translate command is used).
+    clear();
+    _mapped_treefile.reset(new MappedFile(filename));
+    scanTreeStatements(skip);
+
+    if (batch_size == 0)
+        batch_size = 1;
+
+    ThreadPool pool(nthreads);
+    unsigned nchunks = pool.getNumThreads();
+    unsigned ntrees = (unsigned)_newick_extents.size();
+    std::vector<Split::treeid_t> splitsets;
+    for (unsigned first = 0; first < ntrees; first += batch_size)
+        {
+        unsigned n = std::min(batch_size, ntrees - first);
+        splitsets.assign(n, Split::treeid_t());
+
+        // Each chunk of the batch gets its own TreeManip so that node storage is reused within a chunk
+        unsigned chunk_size = (n + nchunks - 1)/nchunks;
+        pool.parallelFor((n + chunk_size - 1)/chunk_size, [&](unsigned c)
+            {
+            TreeManip tm;
+            unsigned last = std::min(n, (c + 1)*chunk_size);
+            for (unsigned i = c*chunk_size; i < last; ++i)
+                {
+                const extent_t & e = _newick_extents[first + i];
+                const char * newick_begin = _mapped_treefile->begin() + e.first;
+                tm.buildFromNewick(newick_begin, newick_begin + e.second, false, false);
+                tm.storeSplits(splitsets[i]);
+                }
+            });
+
+        // Merge in tree order so that the tree index lists come out sorted, as in readTreefile
+        for (unsigned i = 0; i < n; ++i)
+            addSplitset(splitsets[i], first + i);
+        }
+    }
+
+inline void TreeSummary::scanTreeStatements(unsigned skip)
+    {
+    const char * const file_begin = _mapped_treefile->begin();
+    const char * const file_end   = _mapped_treefile->end();
+    const char * p = file_begin;
+
+    // Advances p past whitespace and (non-nested) square-bracket comments
+    auto skipWhitespaceAndComments = [&]()
+        {
+        while (p < file_end)
+            {
+            if (isspace((unsigned char)*p))
+                ++p;
+            else if (*p == '[')
+                {
+                const char * q = (const char *)std::memchr(p, ']', file_end - p);
+                if (!q)
+                    throw XStrom(boost::str(boost::format("Unterminated comment in file \"%s\"") % _mapped_treefile->getFileName()));
+                p = q + 1;
+                }
+            else
+                break;
+            }
+        };
+
+    // Returns the next NEXUS word, treating each punctuation character as a word of its own
+    auto nextWord = [&]()
+        {
+        skipWhitespaceAndComments();
+        std::string word;
+        if (p == file_end)
+            return word;
+        if (*p == '\'')
+            {
+            for (++p; p < file_end; ++p)
+                {
+                if (*p == '\'')
+                    {
+                    if (p + 1 < file_end && p[1] == '\'')
+                        ++p;    // doubled single quote stands for a single quote
+                    else
+                        {
+                        ++p;
+                        break;
+                        }
+                    }
+                word += *p;
+                }
+            return word;
+            }
+        if (*p == ';' || *p == ',' || *p == '=')
+            {
+            word = *p++;
+            return word;
+            }
+        while (p < file_end && !isspace((unsigned char)*p) && *p != ';' && *p != ',' && *p != '=' && *p != '[' && *p != '\'')
+            word += (char)tolower((unsigned char)*p++);
+        return word;
+        };
+
+    // Moves p just beyond the semicolon that ends the current command, honouring quotes and comments
+    auto skipToEndOfCommand = [&]()
+        {
+        while (p < file_end)
+            {
+            char ch = *p;
+            if (ch == '[' || isspace((unsigned char)ch))
+                skipWhitespaceAndComments();
+            else if (ch == '\'')
+                {
+                for (++p; p < file_end && *p != '\''; ++p)
+                    ;
+                ++p;
+                }
+            else if (ch == ';')
+                {
+                ++p;
+                return;
+                }
+            else
+                ++p;
+            }
+        };
+
+    bool in_trees_block = false;
+    unsigned tree_number = 0;
+    std::string word = nextWord();
+    if (word == "#nexus")
+        word = nextWord();
+    while (!word.empty())
+        {
+        if (word == "begin")
+            {
+            in_trees_block = (nextWord() == "trees");
+            tree_number = 0;
+            skipToEndOfCommand();
+            }
+        else if (word == "end" || word == "endblock")
+            {
+            in_trees_block = false;
+            skipToEndOfCommand();
+            }
+        else if (in_trees_block && (word == "tree" || word == "utree"))
+            {
+            if (tree_number++ < skip)
+                skipToEndOfCommand();
+            else
+                {
+                // Tree name (possibly quoted) followed by an equals sign
+                nextWord();
+                if (nextWord() != "=")
+                    throw XStrom(boost::str(boost::format("Expecting '=' after name of tree %d in file \"%s\"") % tree_number % _mapped_treefile->getFileName()));
+                skipWhitespaceAndComments();
+                const char * newick_begin = p;
+                skipToEndOfCommand();
+                const char * newick_end = p - 1;
+                _newick_extents.push_back(extent_t(newick_begin - file_begin, newick_end - newick_begin));
+                }
+            }
+        else if (in_trees_block && word == "translate")
+            {
+            // Leaf names in the newick descriptions are used directly as taxon numbers, so
+            // the translate keys must simply be 1, 2, ... in order
+            unsigned expected = 1;
+            while (true)
+                {
+                std::string key = nextWord();
+                if (key.empty() || key == ";")
+                    break;
+                if (key != std::to_string(expected))
+                    throw XStrom(boost::str(boost::format("readTreefileStreaming requires translate keys to be 1, 2, ... in order but found \"%s\" where %d was expected") % key % expected));
+                ++expected;
+                nextWord();
+                std::string sep = nextWord();
+                if (sep == ";")
+                    break;
+                if (sep != ",")
+                    throw XStrom(boost::str(boost::format("Expecting comma in translate command but found \"%s\"") % sep));
+                }
+            }
+        else if (word != ";")
+            skipToEndOfCommand();
+
+        word = nextWord();
+        }
+    }
+
 inline void TreeSummary::showSummary() const
     {
     // Produce some output to show that it works
-    std::cout << boost::str(boost::format("\nRead %d trees from file") % _newicks.size()) << std::endl;
+    std::cout << boost::str(boost::format("\nRead %d trees from file") % getNumStoredTrees()) << std::endl;
 
     // Show all unique topologies with a list of the trees that have that topology
     // Also create a map that can be used to sort topologies by their sample frequency
@@ -19,7 +19,7 @@ namespace strom
             virtual double                      calcLogPrior() const;
             double                              calcLogTopologyPrior() const;
 
-        private:
+        protected:
 
             virtual void                        revert();
             virtual void                        proposeNewState();
@@ -5,6 +5,10 @@
 #include "lot.h"
 #include "xstrom.h"
 #include "likelihood.h"
+#include "subsampled_likelihood.h"
+#include "reference_distribution.h"
+#include "serialization.h"
+#include "instrumentation.h"
 
 namespace strom
 {
@@ -20,21 +24,32 @@ namespace strom
             virtual                 ~Updater();
 
             void                    setLikelihood(typename Likelihood::SharedPtr likelihood);
+            void                    setSubsampledLikelihood(SubsampledLikelihood::SharedPtr subsampled);
             void                    setTreeManip(typename TreeManip::SharedPtr treemanip);
             void                    setLot(Lot::SharedPtr lot);
             void                    setLambda(double lambda);
             void                    setHeatingPower(double p);
+            void                    setHeatLikelihoodOnly(bool on);
+            void                    setAsyncLikelihood(bool on);
+            void                    setReferenceDistribution(ReferenceDistribution::SharedPtr reference);
             void                    setTuning(bool on);
             void                    setTargetAcceptanceRate(double target);
             void                    setPriorParameters(const std::vector<double> & c);
 
             TreeManip::SharedPtr    getTreeManip() const;
             double                  getLambda() const;
+            double                  getTargetAcceptanceRate() const;
             double                  getAcceptPct() const;
             std::string             getUpdaterName() const;
 
             virtual void            clear();
 
+            void                    clearInstrumentation();
+            void                    appendInstrumentationReport(InstrumentationReport & report) const;
+
+            virtual void            saveState(std::string & buffer) const;
+            virtual void            loadState(const char * & p, const char * end);
+
             virtual double          calcLogPrior() const = 0;
             double                  calcEdgeLengthPrior() const;
             double                  calcLogLikelihood() const;
@@ -45,6 +60,9 @@ namespace strom
             virtual void            reset();
             virtual void            tune(bool accepted);
 
+            double                  calcLogReferenceDensity() const;
+            double                  calcLogHeatedDensity(double log_likelihood, double log_prior, double log_reference) const;
+
             virtual void            revert() = 0;
             virtual void            proposeNewState() = 0;
             virtual void            pullCurrentStateFromModel() = 0;
@@ -52,6 +70,7 @@ namespace strom
 
             Lot::SharedPtr          _lot;
             Likelihood::SharedPtr   _likelihood;
+            SubsampledLikelihood::SharedPtr _subsampled_likelihood;
             TreeManip::SharedPtr    _tree_manipulator;
             std::string             _name;
             double                  _lambda;
@@ -63,11 +82,21 @@ namespace strom
             std::vector<double>     _prior_parameters;
 
             double                  _heating_power;
+            bool                    _heat_likelihood_only;
+            bool                    _async_likelihood;
+            ReferenceDistribution::SharedPtr _reference;
+
+            enum {_phase_pull, _phase_propose, _phase_push, _phase_likelihood, _phase_prior, _phase_revert, _phase_subsample};
+            Instrumentation         _instrumentation;
 
             static const double     _log_minus_infinity;
+
+        public:
+
+            typedef std::shared_ptr< Updater > SharedPtr;
         };
 
-inline Updater::Updater()
+inline Updater::Updater() : _instrumentation({"pull", "propose", "push", "likelihood", "prior", "revert", "subsample"})
     {
     //std::cout << "Updater constructor called" << std::endl;
     clear();
@@ -87,10 +116,24 @@ inline void Updater::clear()
     _naccepts               = 0;
     _nattempts              = 0;
     _heating_power          = 1.0;
+    _heat_likelihood_only   = false;
+    _async_likelihood       = false;
+    _reference.reset();
     _prior_parameters.clear();
+    _instrumentation.clear();
     reset();
     }
 
+inline void Updater::clearInstrumentation()
+    {
+    _instrumentation.clear();
+    }
+
+inline void Updater::appendInstrumentationReport(InstrumentationReport & report) const
+    {
+    _instrumentation.appendReport(report, _name);
+    }
+
 inline void Updater::reset()
     {
     _log_hastings_ratio = 0.0;
@@ -101,6 +144,13 @@ inline void Updater::setLikelihood(typename Likelihood::SharedPtr likelihood)
     _likelihood = likelihood;
     }
 
+inline void Updater::setSubsampledLikelihood(SubsampledLikelihood::SharedPtr subsampled)
+    {
+    // If set, update uses delayed acceptance: proposals are first screened using the subsample
+    // estimate and only those that pass are evaluated with the full likelihood
+    _subsampled_likelihood = subsampled;
+    }
+
 inline void Updater::setTreeManip(typename TreeManip::SharedPtr treemanip)
     {
     _tree_manipulator = treemanip;
@@ -121,6 +171,45 @@ inline void Updater::setHeatingPower(double p)
     _heating_power = p;
     }
 
+inline void Updater::setHeatLikelihoodOnly(bool on)
+    {
+    // If on, the heating power is applied to the likelihood alone, so that a power of 0 targets
+    // the prior (as needed for tempering from prior to posterior); otherwise it is applied to
+    // the likelihood times the prior
+    _heat_likelihood_only = on;
+    }
+
+inline void Updater::setAsyncLikelihood(bool on)
+    {
+    // If on, update starts the likelihood of the proposed state on the likelihood's background
+    // thread and computes the prior and reference densities while it runs. Only worthwhile if
+    // there is a spare core; the chain visits exactly the same states either way.
+    _async_likelihood = on;
+    }
+
+inline void Updater::setReferenceDistribution(ReferenceDistribution::SharedPtr reference)
+    {
+    // If set, the updater targets (likelihood x prior)^p reference^(1 - p), where p is the
+    // heating power, as in generalized stepping-stone sampling
+    _reference = reference;
+    }
+
+inline double Updater::calcLogReferenceDensity() const
+    {
+    if (!_reference)
+        return 0.0;
+    return _reference->calcLogDensity(*_likelihood->getModel(), *_tree_manipulator);
+    }
+
+inline double Updater::calcLogHeatedDensity(double log_likelihood, double log_prior, double log_reference) const
+    {
+    if (_reference)
+        return _heating_power*(log_likelihood + log_prior) + (1.0 - _heating_power)*log_reference;
+    if (_heat_likelihood_only)
+        return _heating_power*log_likelihood + log_prior;
+    return _heating_power*(log_likelihood + log_prior);
+    }
+
 inline void Updater::setLambda(double lambda)
     {
     _lambda = lambda;
@@ -133,6 +222,36 @@ void Updater::setTuning(bool do_tune)
     _nattempts = 0;
     }
 
+inline void Updater::saveState(std::string & buffer) const
+    {
+    // Tuning state only; the parameter values themselves live in the model and tree
+    appendBinaryString(buffer, _name);
+    appendBinary(buffer, _lambda);
+    appendBinary(buffer, (std::uint32_t)_naccepts);
+    appendBinary(buffer, (std::uint32_t)_nattempts);
+    appendBinary(buffer, (std::uint8_t)(_tuning ? 1 : 0));
+    appendBinary(buffer, _heating_power);
+    }
+
+inline void Updater::loadState(const char * & p, const char * end)
+    {
+    std::string name;
+    std::uint32_t naccepts = 0;
+    std::uint32_t nattempts = 0;
+    std::uint8_t tuning = 0;
+    readBinaryString(p, end, name);
+    if (name != _name)
+        throw XStrom(boost::str(boost::format("Expecting saved state for updater \"%s\" but found \"%s\"") % _name % name));
+    readBinary(p, end, _lambda);
+    readBinary(p, end, naccepts);
+    readBinary(p, end, nattempts);
+    readBinary(p, end, tuning);
+    readBinary(p, end, _heating_power);
+    _naccepts = naccepts;
+    _nattempts = nattempts;
+    _tuning = (tuning != 0);
+    }
+
 inline void Updater::tune(bool accepted)
     {
     _nattempts++;
@@ -166,6 +285,11 @@ inline double Updater::getLambda() const
     return _lambda;
     }
 
+inline double Updater::getTargetAcceptanceRate() const
+    {
+    return _target_acceptance;
+    }
+
 inline double Updater::getAcceptPct() const
     {
     return (_nattempts == 0 ? 0.0 : (100.0*_naccepts/_nattempts));
@@ -184,28 +308,100 @@ inline double Updater::calcLogLikelihood() const
 inline double Updater::update(double prev_lnL)
     {
     // Copy current state from model into _curr_point.
-    pullCurrentStateFromModel();
+        {
+        STROM_TIME(_instrumentation, _phase_pull);
+        pullCurrentStateFromModel();
+        }
+
+    double prev_log_prior = 0.0;
+    double prev_log_reference = 0.0;
+        {
+        STROM_TIME(_instrumentation, _phase_prior);
+        prev_log_prior = calcLogPrior();
+        prev_log_reference = calcLogReferenceDensity();
+        }
 
-    double prev_log_prior      = calcLogPrior();
+    // Subsample estimate for the current state, needed by the first stage of delayed acceptance
+    double prev_estimate = 0.0;
+    if (_subsampled_likelihood)
+        {
+        STROM_TIME(_instrumentation, _phase_subsample);
+        _subsampled_likelihood->beginUpdate(_tree_manipulator->getTree());
+        prev_estimate = _subsampled_likelihood->estimateLogLikelihood(_tree_manipulator->getTree());
+        }
 
     // Set model to proposed state and calculate _log_hastings_ratio
-    proposeNewState();
-    pushCurrentStateToModel();
+        {
+        STROM_TIME(_instrumentation, _phase_propose);
+        proposeNewState();
+        }
+        {
+        STROM_TIME(_instrumentation, _phase_push);
+        pushCurrentStateToModel();
+        }
+
+    // Proposed likelihood computed in the background while the priors are computed here. The
+    // tree and model are only read until it is collected; if the prior rules the proposal out,
+    // the result is discarded, but it must still be waited for before revert changes anything.
+    std::future<double> pending;
+    if (_async_likelihood && !_subsampled_likelihood)
+        pending = _likelihood->calcLogLikelihoodAsync(_tree_manipulator->getTree());
 
-    double log_likelihood = calcLogLikelihood();
-    double log_prior = calcLogPrior();
-    bool accept = true;
-    if (log_prior > _log_minus_infinity)
+    double log_prior = 0.0;
+    double log_reference = 0.0;
         {
+        STROM_TIME(_instrumentation, _phase_prior);
+        log_prior = calcLogPrior();
+        log_reference = calcLogReferenceDensity();
+        }
+    double log_likelihood = prev_lnL;
+    bool accept = (log_prior > _log_minus_infinity);
+    if (accept && _subsampled_likelihood)
+        {
+        // Delayed acceptance (Christen and Fox 2005). The first stage is an ordinary
+        // Metropolis-Hastings test using the estimate in place of the likelihood; the second
+        // stage corrects for the estimate's error, so the chain still targets the exact posterior.
+        double estimate = 0.0;
+            {
+            STROM_TIME(_instrumentation, _phase_subsample);
+            estimate = _subsampled_likelihood->estimateLogLikelihood(_tree_manipulator->getTree());
+            }
         double log_diff = _log_hastings_ratio;
-        log_diff += _heating_power*((log_likelihood + log_prior) - (prev_lnL + prev_log_prior));
+        log_diff += calcLogHeatedDensity(estimate, log_prior, log_reference) - calcLogHeatedDensity(prev_estimate, prev_log_prior, prev_log_reference);
+        if (_lot->logUniform() > log_diff)
+            accept = false;
+        _subsampled_likelihood->recordScreening(accept);
 
+        if (accept)
+            {
+                {
+                STROM_TIME(_instrumentation, _phase_likelihood);
+                log_likelihood = calcLogLikelihood();
+                }
+            log_diff = _heating_power*((log_likelihood - prev_lnL) - (estimate - prev_estimate));
+            if (_lot->logUniform() > log_diff)
+                accept = false;
+            }
+        }
+    else if (accept)
+        {
         double logu = _lot->logUniform();
+            {
+            STROM_TIME(_instrumentation, _phase_likelihood);
+            log_likelihood = (pending.valid() ? pending.get() : calcLogLikelihood());
+            }
+        double log_diff = _log_hastings_ratio;
+        log_diff += calcLogHeatedDensity(log_likelihood, log_prior, log_reference) - calcLogHeatedDensity(prev_lnL, prev_log_prior, prev_log_reference);
+
         if (logu > log_diff)
             accept = false;
         }
-    else
-        accept = false;
+
+    if (pending.valid())
+        {
+        STROM_TIME(_instrumentation, _phase_likelihood);
+        pending.wait();
+        }
 
     if (accept)
         {
@@ -213,8 +409,14 @@ inline double Updater::update(double prev_lnL)
         }
     else
         {
-        revert();
-        pushCurrentStateToModel();
+            {
+            STROM_TIME(_instrumentation, _phase_revert);
+            revert();
+            }
+            {
+            STROM_TIME(_instrumentation, _phase_push);
+            pushCurrentStateToModel();
+            }
         log_likelihood = prev_lnL;
         }
 
@@ -186,12 +186,12 @@ inline double inf_function(const Parameters &inputs)
 
 inline double annealing_power(const Parameters &inputs)
 {
-  return inputs["power"][0];
+  return inputs.get_double("power");
 }
 
 inline double annealing_one_minus_power(const Parameters &inputs)
 {
-  return 1.0 - inputs["power"][0];
+  return 1.0 - inputs.get_double("power");
 }
 
 inline arma::mat get_sigma_points(const arma::colvec &posterior_mean,